@@ -0,0 +1,71 @@
+/*
+ * ecp_fast.h
+ *
+ * Faster mbedTLS ECC for the handshakes, without changing mbedTLS's sources:
+ *
+ * - Comb tables of the base points in flash. mbedTLS multiplies a point
+ *   with a comb of 2^(w-1) of its multiples, which it computes first: d (w-1)
+ *   doublings, d = bits / w, before the d doublings and additions of the
+ *   multiplication itself. With MBEDTLS_ECP_FIXED_POINT_OPTIM, the table of
+ *   the base point G, with a window one larger, is kept on the heap as long
+ *   as the group (grp->T). But a handshake loads its groups afresh (the
+ *   ECDHE parameters, the keys of the certificates), so each one would
+ *   compute it again, for its ECDHE key and each ECDSA verification.
+ *   ecp_tables.c has them, generated on the host by
+ *   host_sim/Src/host_ecp_tables.c for the curves and window of
+ *   mbedtls_config.h.
+ * - X25519 (x25519.c) for the Curve25519 group, instead of mbedTLS's
+ *   generic ladder. mbedTLS 2.16 only has it for ECDH, not in TLS, whose
+ *   point format for it came with 2.23 (as did static tables, in 2.24).
+ *
+ * mbedTLS 2.16 has no hook for either with MBEDTLS_ECP_RESTARTABLE (the ALT
+ * interfaces exclude it), so the link wraps mbedtls_ecp_mul_restartable and
+ * mbedtls_ecp_muladd_restartable (-Wl,--wrap=...), the entry points of the
+ * other modules (ECDH, ECDSA) into ecp.c: for the length of each call, a
+ * group without a table gets the flash one as its grp->T, and the Curve25519
+ * group goes to x25519. The table is never left in the group, whose
+ * mbedtls_ecp_group_free would free it.
+ *
+ * The table must have the window mbedTLS picks for the base point: the
+ * smaller of MBEDTLS_ECP_WINDOW_SIZE and 5 (6 from 384 bits), which
+ * ecp_tables.c checks. The window also applies to the other points, whose
+ * tables mbedTLS computes on the heap for each multiplication.
+ *
+ * With ECP_FAST_BENCH, ecp_fast_bench times the ECDHE key generation of each
+ * curve with the flash table, and with mbedTLS's own table at the first
+ * multiplication and after, and X25519 against mbedTLS's ladder.
+ */
+
+#ifndef INC_ECP_FAST_H_
+#define INC_ECP_FAST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mbedtls/ecp.h"
+
+#ifndef ECP_FAST_BENCH_RUNS
+#define ECP_FAST_BENCH_RUNS 4 //key generations timed per case
+#endif
+
+struct ecp_fast_table
+{
+  mbedtls_ecp_group_id id; //MBEDTLS_ECP_DP_NONE ends the list
+  unsigned char size; //points, T_size
+  const mbedtls_ecp_point *T;
+};
+
+extern const struct ecp_fast_table ecp_fast_tables[]; //ecp_tables.c
+
+struct ecp_fast_stats
+{
+  uint32_t flash; //multiplications of a base point on a flash table
+  uint32_t x25519;
+  uint32_t other; //multiplications left to mbedTLS
+};
+
+void ecp_fast_enable(int on);
+void ecp_fast_get_stats(struct ecp_fast_stats *stats);
+void ecp_fast_bench(void);
+
+#endif /* INC_ECP_FAST_H_ */
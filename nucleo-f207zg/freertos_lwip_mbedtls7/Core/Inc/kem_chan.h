@@ -0,0 +1,104 @@
+/*
+ * kem_chan.h
+ *
+ * A secure channel for the time protocol, much lighter than TLS for a few
+ * bytes a second: one round trip to go_tstamp_srv -kem, where a Kyber768
+ * encapsulation to the server's static public key replaces the certificate,
+ * the ECDHE and the signature, then ChaCha20-Poly1305 records
+ * (MBEDTLS_CHACHAPOLY_C). The handshake messages have a fixed length for
+ * their type, on TCP:
+ *
+ *   client  FULL    type, nonce[16], Kyber ciphertext[1088]
+ *           RESUME  type, nonce[16], ticket[64]
+ *           KEY_REQ type: asks for the server's public key
+ *   server  ACCEPT  type, nonce[16], a record holding the next ticket
+ *           RETRY   type: the ticket did not open, send FULL
+ *           KEY     type, public key[1184], the answer to KEY_REQ
+ *   record  plaintext length[2], ciphertext, tag[16]
+ *
+ * Both sides derive the keys with HKDF-SHA-256 from the shared secret of the
+ * KEM, salted with both nonces: the client's key, the server's, and the
+ * secret of the next ticket. Only the holder of the private key can
+ * decapsulate, so the ticket record of ACCEPT, which the client
+ * authenticates, proves the server; the client is not authenticated, like
+ * the TLS sessions. Each direction has its own key, and the nonce of a
+ * record is its number in that direction, not sent: a record costs its
+ * length and tag, 18 bytes (29 for TLS 1.2 with AES-GCM).
+ *
+ * The ticket is the secret and an expiry, sealed with a key that only the
+ * server has. RESUME offers it and skips the KEM, as a TLS 1.2 ticket does
+ * the ECDHE: the keys then come from its secret and the new nonces, without
+ * forward secrecy for the resumed connection.
+ *
+ * With KEM_CHAN_SERVER, the server side too, for host_tlsbench.c: the
+ * board only runs the client (kem_client.c).
+ */
+
+#ifndef INC_KEM_CHAN_H_
+#define INC_KEM_CHAN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mbedtls/chachapoly.h"
+#include "kyber_fused.h"
+
+#define KEM_CHAN_NONCE 16 //of each side's hello
+#define KEM_CHAN_SECRET 32 //bytes of a key or secret
+#define KEM_CHAN_TAG 16
+#define KEM_CHAN_HDR 2 //record: plaintext length, big endian
+#define KEM_CHAN_OVERHEAD (KEM_CHAN_HDR + KEM_CHAN_TAG)
+#define KEM_CHAN_TICKET 64 //nonce[12], then secret[32] and expiry[4] sealed, tag[16]
+#define KEM_CHAN_TICKET_LIFETIME 86400 //s
+#ifndef KEM_CHAN_RECORD_MAX
+#define KEM_CHAN_RECORD_MAX 256 //plaintext per record: a v1 packet, or a few v2 frames
+#endif
+
+#define KEM_CHAN_FULL 1 //message types
+#define KEM_CHAN_RESUME 2
+#define KEM_CHAN_KEY_REQ 3
+#define KEM_CHAN_ACCEPT 4
+#define KEM_CHAN_RETRY 5
+#define KEM_CHAN_KEY 6
+
+#define KEM_CHAN_FULL_LEN (1 + KEM_CHAN_NONCE + KYBER_CIPHERTEXTBYTES)
+#define KEM_CHAN_RESUME_LEN (1 + KEM_CHAN_NONCE + KEM_CHAN_TICKET)
+#define KEM_CHAN_ACCEPT_LEN (1 + KEM_CHAN_NONCE + KEM_CHAN_OVERHEAD + KEM_CHAN_TICKET)
+#define KEM_CHAN_KEY_LEN (1 + KYBER_PUBLICKEYBYTES)
+#define KEM_CHAN_RECORD_LEN(hdr) ((size_t)((hdr)[0] << 8 | (hdr)[1]) + KEM_CHAN_OVERHEAD) //whole record, from its header
+
+#define KEM_CHAN_ERR_MSG -0x7F00 //malformed or unexpected message
+#define KEM_CHAN_ERR_RETRY -0x7F02 //kem_chan_accept: the server declined the ticket, send a full hello
+
+struct kem_chan_ticket //the client's, for the next connections
+{
+  uint8_t valid;
+  uint8_t secret[KEM_CHAN_SECRET];
+  uint8_t ticket[KEM_CHAN_TICKET];
+};
+
+struct kem_chan
+{
+  mbedtls_chachapoly_context tx; //this side's key...
+  mbedtls_chachapoly_context rx; //...and the other's
+  uint64_t tx_seq; //records sealed...
+  uint64_t rx_seq; //...and opened
+  uint8_t nonce[KEM_CHAN_NONCE]; //the client's hello
+  uint8_t secret[KEM_CHAN_SECRET]; //of the KEM or the ticket, until the keys are derived
+  uint8_t resumed;
+};
+
+void kem_chan_init(struct kem_chan *ch);
+void kem_chan_free(struct kem_chan *ch);
+size_t kem_chan_msg_len(uint8_t type);
+int kem_chan_hello(struct kem_chan *ch, const uint8_t *pk, const struct kem_chan_ticket *ticket, uint8_t *out,
+                   size_t *olen);
+int kem_chan_accept(struct kem_chan *ch, const uint8_t *in, size_t len, struct kem_chan_ticket *ticket);
+int kem_chan_seal(struct kem_chan *ch, const uint8_t *in, size_t len, uint8_t *out);
+int kem_chan_open(struct kem_chan *ch, const uint8_t *rec, size_t len, uint8_t *out);
+#ifdef KEM_CHAN_SERVER
+int kem_chan_server_hello(struct kem_chan *ch, const uint8_t *sk, const uint8_t *ticket_key, uint32_t now,
+                          const uint8_t *in, size_t len, uint8_t *out, size_t *olen);
+#endif
+
+#endif /* INC_KEM_CHAN_H_ */
@@ -0,0 +1,35 @@
+/*
+ * kem_client.h
+ *
+ * Time client over kem_chan.c: one connection to go_tstamp_srv -kem, in a
+ * task of its own with a blocking netconn. The task gets the server's
+ * Kyber768 public key (KEY_REQ, or KEM_CLIENT_SERVER_PK pinned at build
+ * time), opens the channel, resuming with the ticket of the last one when
+ * it has one, and sends a protocol v2 REQ every KEM_CLIENT_PERIOD_MS in a
+ * record. A connection that fails is opened again after
+ * KEM_CLIENT_RETRY_MS. Every KEM_CLIENT_REPORT_MS, a [KEM] report gives the
+ * handshakes, full and resumed, as tls_client.c's [TLS] report does, and
+ * the RAM of the channel.
+ * With KEM_CLIENT_ENABLE defined, main.c starts StartKemClientTask.
+ */
+
+#ifndef INC_KEM_CLIENT_H_
+#define INC_KEM_CLIENT_H_
+
+#define KEM_SERVER_IP1 192 //server ip address
+#define KEM_SERVER_IP2 168
+#define KEM_SERVER_IP3 15
+#define KEM_SERVER_IP4 13
+#define KEM_SERVER_PORT 5446 //go_tstamp_srv -kem :5446
+#define KEM_CLIENT_PERIOD_MS 1000 //request interval
+#define KEM_CLIENT_TIMEOUT_MS 5000 //for each answer of the server
+#define KEM_CLIENT_RETRY_MS 2000 //delay before connecting again
+#define KEM_CLIENT_REPORT_MS 10000 //[KEM] report period
+#ifndef KEM_CLIENT_STACK
+#define KEM_CLIENT_STACK 4608 //words: crypto_kem_enc takes about 13.7 kB
+#endif
+//#include "kem_server_pk.h" /* Include this (written by go_tstamp_srv -kempub kem_server_pk.h) to pin the server's key */
+
+void StartKemClientTask(void const *argument);
+
+#endif /* INC_KEM_CLIENT_H_ */
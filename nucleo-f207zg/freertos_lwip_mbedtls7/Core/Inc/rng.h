@@ -0,0 +1,69 @@
+/*
+ * rng.h
+ *
+ * One random number service for every task, instead of an entropy context
+ * and a CTR_DRBG in each task that needs randomness (about 1 kB and a
+ * seeding each), or one pair shared without a lock. RNG_SHARDS CTR_DRBGs are
+ * seeded from one entropy context, the hardware RNG, and each one is behind
+ * its own mutex (MBEDTLS_THREADING_C, threading_alt.c).
+ *
+ * rng_random, an mbedTLS f_rng (its p_rng is not used), takes the calling
+ * task's shard, or the next free one if another task holds it, and waits
+ * only when all of them are held. The F207 has one core: shards do not run
+ * in parallel, but a task preempted while generating (by a tick, or a task
+ * of higher priority) then holds up no other. rng_randombytes is the same,
+ * for the randombytes callback of the Kyber KEM (crypto_kem_keypair,
+ * crypto_kem_enc), which has no error path.
+ *
+ * The stats give, per shard, the calls served, their bytes, the calls it
+ * took over from a held shard, and the calls that waited for it.
+ *
+ * With RNG_STRESS_ENABLE, rng_stress starts RNG_STRESS_TASKS tasks that call
+ * rng_random for RNG_STRESS_MS, waits for them, then reports the rate, the
+ * contention and the stack they used.
+ */
+
+#ifndef INC_RNG_H_
+#define INC_RNG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef RNG_SHARDS
+#define RNG_SHARDS 2 //CTR_DRBGs, about 330 B each
+#endif
+#ifndef RNG_STRESS_TASKS
+#define RNG_STRESS_TASKS 4 //tasks of the stress test
+#endif
+#ifndef RNG_STRESS_MS
+#define RNG_STRESS_MS 5000
+#endif
+#ifndef RNG_STRESS_LEN
+#define RNG_STRESS_LEN 64 //bytes per call: a Kyber keypair's seeds
+#endif
+#ifndef RNG_STRESS_STACK
+#define RNG_STRESS_STACK 2048 //words, as the TLS task: a reseed runs the entropy's SHA-512 and the DRBG's df
+#endif
+
+struct rng_shard_stats
+{
+  uint32_t calls; //served
+  uint32_t bytes;
+  uint32_t moved; //calls whose own shard was held
+  uint32_t waits; //calls that waited, all shards held
+  uint32_t failed;
+};
+
+struct rng_stats
+{
+  uint32_t seed_ms; //of all the shards
+  struct rng_shard_stats shard[RNG_SHARDS];
+};
+
+int rng_init(void);
+int rng_random(void *p_rng, unsigned char *output, size_t len);
+void rng_randombytes(uint8_t *out, size_t n_bytes);
+void rng_get_stats(struct rng_stats *stats);
+void rng_stress(void);
+
+#endif /* INC_RNG_H_ */
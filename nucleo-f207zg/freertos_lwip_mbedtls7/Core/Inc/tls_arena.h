@@ -0,0 +1,108 @@
+/*
+ * tls_arena.h
+ *
+ * mbedTLS heap in a static arena, instead of newlib's malloc: pools of
+ * fixed-size blocks, one per size class, each a free list, so that an
+ * allocation takes the first block of the smallest class that fits and has
+ * one left, and a free puts it back, both in constant time and without
+ * fragmentation. The classes and their block counts come from the
+ * allocations of a handshake (ECDHE-ECDSA-AES128-GCM on P-256): thousands of
+ * MPI limbs of 32 to 128 bytes, a few hundred-byte structures, a certificate,
+ * and the record buffers; with MBEDTLS_ECP_WINDOW_SIZE 4 (ecp_fast.h), the
+ * comb of 8 points of the server's ECDHE key and of its certificate's key,
+ * each multiplied in turn. Most of it is freed when the handshake ends; an
+ * open session keeps its context, transform and session, and (with
+ * TLS_MUX_SHRINK) record buffers of TLS_MUX_IN_LEN and TLS_MUX_OUT_LEN. The
+ * arena holds TLS_ARENA_SESSIONS open sessions' worth of blocks, plus
+ * TLS_MUX_HANDSHAKES handshakes' worth, plus those of the shared state; a
+ * session that does not fit fails its allocation, cleanly, instead of taking
+ * the heap of another task.
+ *
+ * Each block remembers its owner: the tls_mux session whose mbedTLS call
+ * allocated it (tls_arena_owner, set by tls_mux.c around those calls), or
+ * TLS_ARENA_SHARED for everything else (configuration, CA, DRBG, saved
+ * session). The stats give, per owner, the bytes in use, their peak and the
+ * allocations that failed, and per class the blocks in use, their peak and
+ * the allocations that spilled into a larger class.
+ *
+ * The lists are taken under taskENTER_CRITICAL, a few instructions long:
+ * any task can allocate and free.
+ */
+
+#ifndef INC_TLS_ARENA_H_
+#define INC_TLS_ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tls_mux.h"
+
+#ifndef TLS_ARENA_SESSIONS
+#define TLS_ARENA_SESSIONS TLS_MUX_SESSIONS //open sessions the arena is sized for: about 9 kB each, plus 24 kB per handshake, with 4/2 kB records shrunk to 2/1 kB
+#endif
+#define TLS_ARENA_HANDSHAKES TLS_MUX_HANDSHAKES
+#define TLS_ARENA_SHARED TLS_MUX_SESSIONS //owner of the allocations made outside a session
+#define TLS_ARENA_OWNERS (TLS_MUX_SESSIONS + 1)
+
+/* Size classes: X(name, block size, blocks per open session, more blocks per
+ * handshake, shared blocks). TLS_ARENA_IN/OUT_LEN are the record buffers,
+ * MBEDTLS_SSL_IN/OUT_BUFFER_LEN, which only handshakes hold with
+ * TLS_MUX_SHRINK, and TLS_ARENA_IN/OUT_S_LEN those of TLS_MUX_IN/OUT_LEN. */
+#define TLS_ARENA_CLASS_TABLE(X) \
+  X(16,    16,                  2,                10,               8)  \
+  X(32,    32,                  2,                72,               32) \
+  X(64,    64,                  1,                8,                16) \
+  X(128,   128,                 1,                47,               8)  \
+  X(256,   256,                 1,                4,                4)  \
+  X(512,   512,                 7,                2,                2)  \
+  X(1K,    1024,                1,                3,                2)  \
+  X(3K,    3072,                0,                1,                0)  \
+  X(IN,    TLS_ARENA_IN_LEN,    !TLS_MUX_SHRINK,  !!TLS_MUX_SHRINK, 0)  \
+  X(OUT,   TLS_ARENA_OUT_LEN,   !TLS_MUX_SHRINK,  !!TLS_MUX_SHRINK, 0)  \
+  X(IN_S,  TLS_ARENA_IN_S_LEN,  !!TLS_MUX_SHRINK, 0,                0)  \
+  X(OUT_S, TLS_ARENA_OUT_S_LEN, !!TLS_MUX_SHRINK, 0,                0)
+
+#define TLS_ARENA_ENUM(name, len, per_session, per_handshake, shared) TLS_ARENA_C_##name,
+enum
+{
+  TLS_ARENA_CLASS_TABLE(TLS_ARENA_ENUM)
+  TLS_ARENA_CLASSES
+};
+#undef TLS_ARENA_ENUM
+
+struct tls_arena_class_stats
+{
+  uint32_t size; //of a block
+  uint16_t count; //blocks in the pool
+  uint16_t used; //in use now...
+  uint16_t peak; //...and at most
+  uint32_t spills; //allocations given a block of another class, this one being used up
+};
+
+struct tls_arena_owner_stats
+{
+  uint32_t used; //bytes of the blocks in use
+  uint32_t peak; //since the session was opened
+  uint32_t failed; //allocations refused
+};
+
+struct tls_arena_stats
+{
+  uint32_t size; //bytes of the arena
+  uint32_t used; //of its blocks in use...
+  uint32_t peak; //...and at most
+  uint32_t allocs; //allocations served
+  uint32_t failed; //and refused: too large, or no block left
+  uint32_t session_peak; //largest peak of a session since reset
+  struct tls_arena_class_stats cls[TLS_ARENA_CLASSES];
+  struct tls_arena_owner_stats owner[TLS_ARENA_OWNERS];
+};
+
+void tls_arena_init(void);
+void *tls_arena_calloc(size_t n, size_t size);
+void tls_arena_free(void *ptr);
+int tls_arena_owner(int owner);
+void tls_arena_open(int owner);
+void tls_arena_get_stats(struct tls_arena_stats *stats);
+
+#endif /* INC_TLS_ARENA_H_ */
@@ -0,0 +1,51 @@
+/*
+ * tls_client.h
+ *
+ * Time client over TLS: TLS_CLIENT_SESSIONS sessions to go_tstamp_srv -tls,
+ * all served by one task through tls_mux.c. Each session sends a protocol
+ * v2 REQ every TLS_CLIENT_PERIOD_MS and reads its RESP; a session that
+ * closes is opened again after TLS_CLIENT_RETRY_MS. The task prints a [TLS]
+ * report with the handshake times and the mbedTLS heap per session.
+ * With TLS_CLIENT_BULK_KB defined, one more session echoes that much data
+ * through go_tstamp_srv -tlsecho, in TLS_CLIENT_BULK_REC byte records
+ * (tls_alloc/tls_send, tls_recv_zc), then reports the rate and the bytes
+ * copied per record; again every TLS_CLIENT_REPORT_MS.
+ * With TLS_CLIENT_RESUME, the sessions resume the last full handshake's
+ * session, kept in flash by tls_store.c across resets, and the report
+ * compares full and resumed handshakes.
+ * With TLS_CLIENT_ENABLE defined, main.c starts StartTlsClientTask.
+ * tls_client_config sets up the sessions' configuration, which
+ * host_sim/Src/host_tlsbench.c benchmarks against a host server.
+ */
+
+#ifndef INC_TLS_CLIENT_H_
+#define INC_TLS_CLIENT_H_
+
+#include "tls_mux.h"
+
+//#define TLS_CLIENT_BULK_KB 256 /* Define this to measure bulk throughput as well */
+#ifndef TLS_CLIENT_RESUME
+#define TLS_CLIENT_RESUME 1 //resume the session saved in flash; 0: full handshakes only
+#endif
+#define TLS_CLIENT_BULK_REC 1024 //plaintext per record, at most TLS_MUX_ZC_TX_MAX for tls_alloc
+#ifdef TLS_CLIENT_BULK_KB
+#define TLS_CLIENT_SESSIONS (TLS_MUX_SESSIONS - 1) //sessions kept open, the bulk test takes one more
+#else
+#define TLS_CLIENT_SESSIONS TLS_MUX_SESSIONS //sessions kept open
+#endif
+#define TLS_SERVER_IP1 192 //server ip address
+#define TLS_SERVER_IP2 168
+#define TLS_SERVER_IP3 15
+#define TLS_SERVER_IP4 13
+#define TLS_SERVER_PORT 5443 //go_tstamp_srv -tls :5443
+#define TLS_SERVER_ECHO_PORT 5444 //go_tstamp_srv -tlsecho :5444
+#define TLS_CLIENT_HOSTNAME "go_tstamp_srv" //name in the server certificate
+#define TLS_CLIENT_PERIOD_MS 1000 //request interval of each session
+#define TLS_CLIENT_RETRY_MS 2000 //delay before opening a closed session again
+#define TLS_CLIENT_REPORT_MS 10000 //[TLS] report period
+//#define TLS_CLIENT_CA_PEM "-----BEGIN CERTIFICATE-----\r\n...\r\n" /* Define this to verify the server certificate */
+
+int tls_client_config(mbedtls_ssl_config *config);
+void StartTlsClientTask(void const *argument);
+
+#endif /* INC_TLS_CLIENT_H_ */
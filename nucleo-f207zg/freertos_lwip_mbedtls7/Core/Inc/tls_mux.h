@@ -0,0 +1,200 @@
+/*
+ * tls_mux.h
+ *
+ * Many TLS client sessions served by one task, instead of one blocking task
+ * (and stack) per session. Each session is a TCP netconn created with an
+ * event callback, and an mbedTLS context whose BIO (mbedtls_ssl_set_bio)
+ * never blocks: it reads only what lwIP already queued and writes only what
+ * fits in the send buffer, and returns WANT_READ/WANT_WRITE otherwise. The
+ * callback, run by tcpip_thread, flags the session and wakes the task with
+ * its notification bit; the task then advances that session only, one
+ * handshake step at a time in turn with the other ready sessions.
+ *
+ * Everything runs in the task calling tls_mux_run: tls_open, tls_read,
+ * tls_write and tls_close are called from there, typically from the event
+ * callback of a session or between two tls_mux_run calls.
+ *
+ * With TLS_MUX_ZEROCOPY and an AES-GCM cipher suite, application data
+ * records skip mbedTLS's record buffers: tls_recv_zc decrypts a received
+ * record in place in its pbufs and returns the plaintext from there, and
+ * tls_alloc/tls_send encrypt in place in a pbuf that TCP sends by reference
+ * (NETCONN_NOCOPY), freed once acknowledged. Other records (alerts, records
+ * over TLS_MUX_ZC_RECORD_MAX) go through mbedTLS, copied, as do tls_read
+ * and tls_write, which can be mixed with the zero-copy calls.
+ *
+ * With MBEDTLS_ECP_RESTARTABLE, the ECC of a handshake (ECDHE, the server's
+ * ECDSA signature and certificate chain) is also cut into steps of at most
+ * TLS_MUX_ECP_OPS operations: mbedTLS returns CRYPTO_IN_PROGRESS, and the
+ * task yields to tcpip_thread and the other tasks of its priority before
+ * resuming it. The stats give the longest step, and the delay of a probe
+ * posted to tcpip_thread during handshakes, i.e. how late an ACK can be.
+ *
+ * A session given a saved one with tls_set_session, right after tls_open,
+ * offers it to the server (session ID or ticket); if the server agrees, the
+ * handshake is abbreviated, without certificate or ECDHE, and s->resumed is
+ * set. The stats count the full and the resumed handshakes apart, with their
+ * time, the CPU cycles of their steps (what they cost in energy) and the
+ * bytes they exchanged.
+ *
+ * With TLS_MUX_ARENA, mbedTLS allocates from the static pools of
+ * tls_arena.c, and each session's allocations are charged to it: the arena
+ * stats give its heap, its peak and its failed allocations.
+ *
+ * A handshake needs mbedTLS's full record buffers (MBEDTLS_SSL_IN/
+ * OUT_CONTENT_LEN) and most of its heap; an open session much less. So at
+ * most TLS_MUX_HANDSHAKES sessions handshake at a time: tls_open queues the
+ * others (TLS_S_QUEUED, no connection and no mbedTLS state yet) and they
+ * start as the handshakes end. With TLS_MUX_SHRINK, a session then moves to
+ * record buffers of TLS_MUX_IN_LEN and TLS_MUX_OUT_LEN bytes of plaintext.
+ * The client asks the server for records of at most TLS_MUX_IN_LEN (RFC 6066
+ * max_fragment_length); one that ignores it and sends a larger record, which
+ * the zero-copy path does not take, ends the session with
+ * MBEDTLS_ERR_SSL_INVALID_RECORD instead of overflowing the buffer. tls_write
+ * writes at most TLS_MUX_OUT_LEN bytes per record.
+ */
+
+#ifndef INC_TLS_MUX_H_
+#define INC_TLS_MUX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lwip/api.h"
+#include "mbedtls/ssl.h"
+
+#ifndef TLS_MUX_SESSIONS
+#define TLS_MUX_SESSIONS 4 //sessions of the task, at most 32 (one notification bit each); lwIP needs as many netconns and TCP pcbs
+#endif
+#define TLS_MUX_HANDSHAKE_MS 20000 //connect and handshake time limit
+#define TLS_MUX_TICK_MS 100 //wake-up period without events, for the time limits
+#ifndef TLS_MUX_ECP_OPS
+#define TLS_MUX_ECP_OPS 200 //ECC budget of a handshake step (mbedtls_ecp_set_max_ops), with MBEDTLS_ECP_RESTARTABLE; 0: no limit
+#endif
+#ifndef TLS_MUX_ZEROCOPY
+#define TLS_MUX_ZEROCOPY 1 //in-place record path of tls_recv_zc and tls_send, needs LWIP_TCPIP_CORE_LOCKING
+#endif
+#define TLS_MUX_ZC_RECORD_MAX 4096 //larger records are left to mbedTLS: their pbufs would tie up the pool
+#define TLS_MUX_ZC_TX_MAX 1024 //plaintext of a tls_alloc record (lwIP heap, MEM_SIZE)
+#define TLS_MUX_ZC_TXQ 2 //records sent by reference per session, until acknowledged
+#define TLS_MUX_DRAIN_MS 2000 //tls_close waits this long for them
+#ifndef TLS_MUX_ARENA
+#define TLS_MUX_ARENA 1 //mbedTLS heap in tls_arena.c, needs MBEDTLS_PLATFORM_MEMORY; 0: newlib's calloc
+#endif
+#ifndef TLS_MUX_HANDSHAKES
+#define TLS_MUX_HANDSHAKES 1 //handshakes at a time, the other sessions opened wait for their turn
+#endif
+#ifndef TLS_MUX_SHRINK
+#define TLS_MUX_SHRINK 1 //smaller record buffers after the handshake
+#endif
+#ifndef TLS_MUX_IN_LEN
+#define TLS_MUX_IN_LEN 2048 //plaintext of a record received after the handshake: 512, 1024, 2048 or 4096 for max_fragment_length
+#endif
+#ifndef TLS_MUX_OUT_LEN
+#define TLS_MUX_OUT_LEN 1024 //and sent
+#endif
+
+enum tls_event
+{
+  TLS_EV_OPEN, //handshake done, the session can write
+  TLS_EV_READ, //data may be readable: tls_read until it returns MBEDTLS_ERR_SSL_WANT_READ
+  TLS_EV_WRITE, //a tls_write that returned MBEDTLS_ERR_SSL_WANT_WRITE can be repeated
+  TLS_EV_CLOSED //failed or closed by the server: already free, only err and arg are left
+};
+
+struct tls_session;
+
+typedef void (*tls_event_fn)(struct tls_session *s, enum tls_event ev, void *arg);
+
+struct tls_session
+{
+  struct netconn *conn; //NULL while free or queued
+  mbedtls_ssl_context ssl;
+  ip_addr_t addr; //of tls_open, for a queued session
+  u16_t port;
+  const char *hostname;
+  const mbedtls_ssl_session *offer; //of tls_set_session, for a queued session
+  struct pbuf *rx; //received (a chain), not consumed yet...
+  u16_t rx_off; //...from here
+  volatile s16_t rx_queued; //receive messages lwIP queued in the netconn (its RCVPLUS - RCVMINUS)
+  volatile u8_t failed; //netconn error event
+  u8_t state;
+  u8_t want_write; //tls_write waits for TLS_EV_WRITE
+  uint32_t opened; //tick the session started connecting
+  uint16_t steps; //handshake steps run
+  u8_t resumed; //the server resumed the session of tls_set_session
+  u8_t shrunk; //the record buffers are TLS_MUX_IN_LEN and TLS_MUX_OUT_LEN ones
+  uint32_t hs_cycles; //CPU time of the handshake steps
+  uint32_t hs_tx; //handshake bytes sent and received
+  uint32_t hs_rx;
+  int err; //why it closed: mbedTLS error, lwIP err_t, or 0 if by the server
+  tls_event_fn fn;
+  void *arg;
+#if TLS_MUX_ZEROCOPY
+  u8_t zc; //the cipher suite allows the zero-copy record path
+  u16_t zc_left; //plaintext of the record decrypted in place, not returned yet
+  u16_t zc_done; //bytes of rx returned by tls_recv_zc, dropped on the next call
+  struct pbuf *txq[TLS_MUX_ZC_TXQ]; //encrypted records sent by reference, oldest first
+  u32_t tx_end[TLS_MUX_ZC_TXQ]; //TCP sequence number after each one written
+  u8_t tx_n; //records queued...
+  u8_t tx_written; //...of which TCP has
+  u16_t tx_off; //bytes written of the next one
+#endif
+};
+
+struct tls_hs_stats
+{
+  uint32_t count; //handshakes done
+  uint32_t ms_sum; //their time, from the connect
+  uint32_t kcycles_sum; //CPU time of their steps, thousands of cycles
+  uint32_t tx_bytes; //TLS bytes sent and received
+  uint32_t rx_bytes;
+};
+
+struct tls_mux_stats
+{
+  uint32_t opened; //tls_open calls that got a session
+  uint32_t queued; //of which waited for another handshake to end
+  uint32_t shrunk; //sessions moved to smaller record buffers
+  uint32_t oversized; //records larger than those, refused
+  uint32_t established; //handshakes done
+  uint32_t failed; //connects and handshakes that failed or timed out
+  uint32_t closed; //sessions that ended after their handshake
+  uint32_t hs_ms_max; //handshake time, from the connect (not the wait in the queue)
+  uint32_t hs_ms_sum;
+  uint32_t hs_ms_first; //the first full handshake since the start, time and CPU
+  uint32_t hs_kcycles_first;
+  uint32_t steps; //handshake steps run
+  struct tls_hs_stats full; //handshakes done, full...
+  struct tls_hs_stats resumed; //...and abbreviated
+  uint32_t ecp_pauses; //of which cut short by TLS_MUX_ECP_OPS
+  uint32_t step_us_max; //longest handshake step: how long the task kept the CPU
+  uint32_t probes; //tcpip_thread latency probes, posted during handshakes
+  uint32_t probe_us_max; //their delay
+  uint32_t probe_us_sum;
+  uint32_t wakeups; //times the task woke up with events
+  uint32_t rx_records; //application data records, after the handshakes
+  uint32_t tx_records;
+  uint32_t rx_bytes; //their plaintext
+  uint32_t tx_bytes;
+  uint32_t rx_zc; //records that took the zero-copy path
+  uint32_t tx_zc;
+  uint32_t copied; //bytes copied on the way: by the BIO, by mbedTLS to and from the application, by the in-place path
+  size_t mem_used; //mbedTLS heap in use (with MBEDTLS_PLATFORM_MEMORY), arena blocks with TLS_MUX_ARENA
+  size_t mem_peak;
+};
+
+void tls_mux_init(const mbedtls_ssl_config *conf);
+struct tls_session *tls_open(const ip_addr_t *addr, u16_t port, const char *hostname, tls_event_fn fn, void *arg);
+int tls_set_session(struct tls_session *s, const mbedtls_ssl_session *session);
+int tls_get_session(struct tls_session *s, mbedtls_ssl_session *session);
+int tls_read(struct tls_session *s, void *buf, size_t len);
+int tls_write(struct tls_session *s, const void *buf, size_t len);
+int tls_recv_zc(struct tls_session *s, const uint8_t **data);
+uint8_t *tls_alloc(struct tls_session *s, size_t len);
+int tls_send(struct tls_session *s, size_t len);
+void tls_close(struct tls_session *s);
+void tls_mux_run(uint32_t ms);
+int tls_mux_count(void);
+void tls_mux_get_stats(struct tls_mux_stats *stats);
+
+#endif /* INC_TLS_MUX_H_ */
@@ -0,0 +1,45 @@
+/*
+ * tls_store.h
+ *
+ * The client's TLS session (master secret, session ID, ticket) kept in a
+ * flash sector, so that the sessions opened after a reset resume it with an
+ * abbreviated handshake (no certificate, no ECDHE) instead of a full one.
+ * The sector is a log: each tls_store_save appends a record (header, the
+ * session's fields and ticket, CRC-32), tls_store_load returns the last
+ * valid one, and the sector is erased only when the next record does not
+ * fit. A save programs a few hundred bytes, and the sector wears once every
+ * TLS_STORE_SIZE / record saves instead of once per save.
+ *
+ * The master secret is stored as is: anyone who reads the flash can decrypt
+ * the sessions that resume it. Called from one task only (tls_client.c).
+ */
+
+#ifndef INC_TLS_STORE_H_
+#define INC_TLS_STORE_H_
+
+#include <stdint.h>
+
+#include "main.h"
+#include "mbedtls/ssl.h"
+
+#ifndef TLS_STORE_SECTOR
+#define TLS_STORE_SECTOR FLASH_SECTOR_11 //last 128 KB sector of the F207ZG: keep it out of the image (FLASH length in the .ld)
+#define TLS_STORE_ADDR 0x080E0000UL
+#define TLS_STORE_SIZE (128 * 1024)
+#endif
+#define TLS_STORE_TICKET_MAX 512 //a larger ticket is not stored, the session ID still is
+
+struct tls_store_stats
+{
+  uint32_t saves; //records written...
+  uint32_t erases; //...and sector erases since reset
+  uint32_t used; //bytes of the sector in use
+  uint32_t save_us_max; //longest save, without the erase
+  uint32_t erase_us_max; //the CPU stalls while flash is erased or programmed
+};
+
+int tls_store_load(mbedtls_ssl_session *session);
+int tls_store_save(const mbedtls_ssl_session *session);
+void tls_store_get_stats(struct tls_store_stats *stats);
+
+#endif /* INC_TLS_STORE_H_ */
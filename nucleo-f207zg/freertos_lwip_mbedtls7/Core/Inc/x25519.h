@@ -0,0 +1,29 @@
+/*
+ * x25519.h
+ *
+ * X25519 (RFC 7748) on 32-bit limbs: field elements of ten signed limbs of
+ * 26 and 25 bits (radix 2^25.5), multiplied with 32x32->64 bit products
+ * (SMULL/SMLAL on the Cortex-M3) and reduced by 19 on the fly, instead of
+ * mbedTLS's generic bignum, whose every multiplication goes through
+ * mbedtls_mpi_mul_mpi, its allocations and a separate reduction. The ladder
+ * swaps in constant time; given an f_rng, it also randomizes the projective
+ * coordinates of its input point, as mbedTLS does, since the Cortex-M3's
+ * long multiplications end early on small operands.
+ *
+ * ecp_fast.c runs the multiplications of mbedTLS's Curve25519 group here.
+ */
+
+#ifndef INC_X25519_H_
+#define INC_X25519_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define X25519_LEN 32 //scalar, point and result, little endian
+
+extern const uint8_t x25519_base[X25519_LEN]; //u = 9
+
+int x25519(uint8_t out[X25519_LEN], const uint8_t scalar[X25519_LEN], const uint8_t point[X25519_LEN],
+           int (*f_rng)(void *, unsigned char *, size_t), void *p_rng);
+
+#endif /* INC_X25519_H_ */
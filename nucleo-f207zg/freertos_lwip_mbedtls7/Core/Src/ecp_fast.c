@@ -0,0 +1,340 @@
+/*
+ * ecp_fast.c
+ *
+ * See ecp_fast.h. ecp_mul_comb multiplies a point equal to G (by value, as
+ * here) with grp->T when it is set, and only reads the X and Y of its
+ * points; it frees a table only when it is not the group's. The flash table
+ * is therefore cast to the group's table for the call, then taken back. A
+ * paused call (MBEDTLS_ERR_ECP_IN_PROGRESS) keeps its own table in the
+ * restart context, never the group's: the next call installs it again.
+ *
+ * The Curve25519 group is checked as mbedtls_ecp_mul_restartable does it
+ * (a scalar of mbedTLS's key generation, a point of at most 32 bytes), then
+ * scalar and point are converted to the little-endian strings of x25519. A
+ * coordinate of more than 255 bits stays with mbedTLS, which reduces it
+ * where RFC 7748 masks its top bit. mbedTLS's ladder is not restartable
+ * either, and fails on a point of small order (no inverse of Z = 0): x25519
+ * returns 0 there, which fails the same way.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "main.h"
+#include "mbedtls/ecdh.h"
+#include "mbedtls/platform_util.h"
+#include "cycles.h"
+#include "ecp_fast.h"
+#include "x25519.h"
+#include "rng.h"
+
+static int on = 1;
+static struct ecp_fast_stats stats;
+
+int __real_mbedtls_ecp_mul_restartable(mbedtls_ecp_group *grp, mbedtls_ecp_point *R, const mbedtls_mpi *m,
+                                       const mbedtls_ecp_point *P, int (*f_rng)(void *, unsigned char *, size_t),
+                                       void *p_rng, mbedtls_ecp_restart_ctx *rs_ctx);
+int __real_mbedtls_ecp_muladd_restartable(mbedtls_ecp_group *grp, mbedtls_ecp_point *R, const mbedtls_mpi *m,
+                                          const mbedtls_ecp_point *P, const mbedtls_mpi *n, const mbedtls_ecp_point *Q,
+                                          mbedtls_ecp_restart_ctx *rs_ctx);
+
+void ecp_fast_enable(int enable)
+{
+  on = enable;
+}
+
+void ecp_fast_get_stats(struct ecp_fast_stats *st)
+{
+  taskENTER_CRITICAL();
+  *st = stats;
+  taskEXIT_CRITICAL();
+}
+
+/* window of ecp_mul_comb for the base point of nbits */
+static unsigned ecp_fast_window(size_t nbits)
+{
+  unsigned w = (nbits >= 384 ? 5 : 4) + 1;
+
+  if (MBEDTLS_ECP_WINDOW_SIZE < 6 && w > MBEDTLS_ECP_WINDOW_SIZE)
+  {
+    w = MBEDTLS_ECP_WINDOW_SIZE;
+  }
+  return w;
+}
+
+/* P is the base point, as ecp_mul_comb compares it */
+static int ecp_fast_is_g(const mbedtls_ecp_group *grp, const mbedtls_ecp_point *P)
+{
+  return mbedtls_mpi_cmp_mpi(&P->Y, &grp->G.Y) == 0 && mbedtls_mpi_cmp_mpi(&P->X, &grp->G.X) == 0;
+}
+
+/*
+ * ecp_fast_install
+ * set the flash table of the group as its grp->T, if it has none: 1 if it
+ * did, to be taken back by ecp_fast_remove
+ */
+static int ecp_fast_install(mbedtls_ecp_group *grp)
+{
+  const struct ecp_fast_table *t;
+
+  if (!on || grp->T != NULL)
+  {
+    return 0;
+  }
+  for (t = ecp_fast_tables; t->id != MBEDTLS_ECP_DP_NONE; t++)
+  {
+    if (t->id == grp->id)
+    {
+      if (t->size != 1U << (ecp_fast_window(grp->nbits) - 1))
+      {
+        return 0; //another window than the one it was made for: mbedTLS would read past it
+      }
+      grp->T = (mbedtls_ecp_point *)t->T; //only read
+      grp->T_size = t->size;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void ecp_fast_remove(mbedtls_ecp_group *grp)
+{
+  grp->T = NULL;
+  grp->T_size = 0;
+}
+
+/* big-endian bignum to the little-endian string of x25519 */
+static int ecp_fast_write_le(const mbedtls_mpi *X, uint8_t out[X25519_LEN])
+{
+  uint8_t t;
+  int i, ret;
+
+  ret = mbedtls_mpi_write_binary(X, out, X25519_LEN);
+  for (i = 0; i < X25519_LEN / 2; i++)
+  {
+    t = out[i];
+    out[i] = out[X25519_LEN - 1 - i];
+    out[X25519_LEN - 1 - i] = t;
+  }
+  return ret;
+}
+
+/*
+ * ecp_fast_x25519
+ * R = m * P on Curve25519, with x25519: 0, or an mbedTLS error
+ */
+static int ecp_fast_x25519(mbedtls_ecp_group *grp, mbedtls_ecp_point *R, const mbedtls_mpi *m,
+                           const mbedtls_ecp_point *P, int (*f_rng)(void *, unsigned char *, size_t), void *p_rng)
+{
+  uint8_t k[X25519_LEN], u[X25519_LEN], out[X25519_LEN], zero = 0;
+  int i, ret;
+
+  if ((ret = mbedtls_ecp_check_privkey(grp, m)) != 0 || (ret = mbedtls_ecp_check_pubkey(grp, P)) != 0)
+  {
+    return ret;
+  }
+  if ((ret = ecp_fast_write_le(m, k)) != 0 || (ret = ecp_fast_write_le(&P->X, u)) != 0)
+  {
+    goto cleanup;
+  }
+  if ((ret = x25519(out, k, u, f_rng, p_rng)) != 0)
+  {
+    goto cleanup;
+  }
+  for (i = 0; i < X25519_LEN; i++)
+  {
+    zero |= out[i];
+  }
+  if (zero == 0)
+  {
+    ret = MBEDTLS_ERR_ECP_BAD_INPUT_DATA; //point of small order
+    goto cleanup;
+  }
+  for (i = 0; i < X25519_LEN / 2; i++)
+  {
+    zero = out[i];
+    out[i] = out[X25519_LEN - 1 - i];
+    out[X25519_LEN - 1 - i] = zero;
+  }
+  if ((ret = mbedtls_mpi_read_binary(&R->X, out, X25519_LEN)) == 0)
+  {
+    ret = mbedtls_mpi_lset(&R->Z, 1);
+  }
+  mbedtls_mpi_free(&R->Y); //as mbedTLS's ladder leaves it
+
+cleanup:
+  mbedtls_platform_zeroize(k, sizeof(k));
+  mbedtls_platform_zeroize(out, sizeof(out));
+  return ret;
+}
+
+/*
+ * __wrap_mbedtls_ecp_mul_restartable
+ * R = m * P, with the flash table when P is the base point, with x25519 on
+ * Curve25519
+ */
+int __wrap_mbedtls_ecp_mul_restartable(mbedtls_ecp_group *grp, mbedtls_ecp_point *R, const mbedtls_mpi *m,
+                                       const mbedtls_ecp_point *P, int (*f_rng)(void *, unsigned char *, size_t),
+                                       void *p_rng, mbedtls_ecp_restart_ctx *rs_ctx)
+{
+  int ret, flash;
+
+  if (on && grp->id == MBEDTLS_ECP_DP_CURVE25519 && mbedtls_mpi_bitlen(&P->X) <= 255)
+  {
+    ret = ecp_fast_x25519(grp, R, m, P, f_rng, p_rng);
+    stats.x25519++;
+    return ret;
+  }
+
+  flash = ecp_fast_install(grp);
+  ret = __real_mbedtls_ecp_mul_restartable(grp, R, m, P, f_rng, p_rng, rs_ctx);
+  if (flash)
+  {
+    ecp_fast_remove(grp);
+  }
+  if (ret != MBEDTLS_ERR_ECP_IN_PROGRESS) //once per multiplication
+  {
+    if (flash && ecp_fast_is_g(grp, P))
+    {
+      stats.flash++;
+    }
+    else
+    {
+      stats.other++;
+    }
+  }
+  return ret;
+}
+
+/*
+ * __wrap_mbedtls_ecp_muladd_restartable
+ * R = m * P + n * Q (an ECDSA verification: P is the base point), with the
+ * flash table
+ */
+int __wrap_mbedtls_ecp_muladd_restartable(mbedtls_ecp_group *grp, mbedtls_ecp_point *R, const mbedtls_mpi *m,
+                                          const mbedtls_ecp_point *P, const mbedtls_mpi *n, const mbedtls_ecp_point *Q,
+                                          mbedtls_ecp_restart_ctx *rs_ctx)
+{
+  int ret, flash = ecp_fast_install(grp);
+
+  ret = __real_mbedtls_ecp_muladd_restartable(grp, R, m, P, n, Q, rs_ctx);
+  if (flash)
+  {
+    ecp_fast_remove(grp);
+  }
+  if (ret != MBEDTLS_ERR_ECP_IN_PROGRESS)
+  {
+    if (flash && ecp_fast_is_g(grp, P))
+    {
+      stats.flash++;
+    }
+    else
+    {
+      stats.other++;
+    }
+    stats.other++; //n * Q
+  }
+  return ret;
+}
+
+#ifdef ECP_FAST_BENCH
+/* bytes of a table: its points and their limbs */
+static uint32_t ecp_fast_table_bytes(const mbedtls_ecp_point *T, size_t size, int with_z)
+{
+  uint32_t bytes = size * sizeof(mbedtls_ecp_point);
+  size_t i;
+
+  for (i = 0; i < size; i++)
+  {
+    bytes += (T[i].X.n + T[i].Y.n + (with_z ? T[i].Z.n : 0)) * sizeof(mbedtls_mpi_uint);
+  }
+  return bytes;
+}
+
+/*
+ * ecp_fast_keygen
+ * cycles of n ECDHE key generations on grp, averaged: 0 if one failed
+ */
+static uint32_t ecp_fast_keygen(mbedtls_ecp_group *grp, int n)
+{
+  mbedtls_mpi d;
+  mbedtls_ecp_point Q;
+  uint32_t start, cycles = 0;
+  int i, ret = 0;
+
+  mbedtls_mpi_init(&d);
+  mbedtls_ecp_point_init(&Q);
+  for (i = 0; i < n && ret == 0; i++)
+  {
+    start = DWT->CYCCNT;
+    ret = mbedtls_ecdh_gen_public(grp, &d, &Q, rng_random, NULL);
+    cycles += DWT->CYCCNT - start;
+  }
+  mbedtls_ecp_point_free(&Q);
+  mbedtls_mpi_free(&d);
+  return ret == 0 ? cycles / n : 0;
+}
+
+/*
+ * ecp_fast_bench
+ * the key generation of each curve with a flash table, with mbedTLS's own
+ * table (at its first multiplication, which computes it, and after), and
+ * X25519 with mbedTLS's ladder and with x25519.c
+ */
+void ecp_fast_bench(void)
+{
+  const struct ecp_fast_table *t;
+  const mbedtls_ecp_curve_info *info;
+  mbedtls_ecp_group grp;
+  struct ecp_fast_stats saved = stats; //the report's counts are the handshakes'
+  uint32_t first, ram, flash, heap;
+  int was = on;
+
+  cycles_enable();
+
+  for (t = ecp_fast_tables; t->id != MBEDTLS_ECP_DP_NONE; t++)
+  {
+    info = mbedtls_ecp_curve_info_from_grp_id(t->id);
+    mbedtls_ecp_group_init(&grp);
+    on = 0;
+    if (mbedtls_ecp_group_load(&grp, t->id) != 0)
+    {
+      mbedtls_ecp_group_free(&grp);
+      continue;
+    }
+    first = ecp_fast_keygen(&grp, 1);
+    heap = grp.T != NULL ? ecp_fast_table_bytes(grp.T, grp.T_size, 1) : 0;
+    ram = ecp_fast_keygen(&grp, ECP_FAST_BENCH_RUNS);
+    mbedtls_ecp_group_free(&grp);
+
+    mbedtls_ecp_group_init(&grp);
+    on = 1;
+    mbedtls_ecp_group_load(&grp, t->id);
+    flash = ecp_fast_keygen(&grp, ECP_FAST_BENCH_RUNS);
+    mbedtls_ecp_group_free(&grp);
+
+    printf("[ECP] %s keygen: flash table %lu kcycles (%lu B of flash), RAM table %lu kcycles first, %lu after (%lu B of heap per group)\r\n",
+           info != NULL ? info->name : "?", (unsigned long)(flash / 1000),
+           (unsigned long)ecp_fast_table_bytes(t->T, t->size, 0), (unsigned long)(first / 1000),
+           (unsigned long)(ram / 1000), (unsigned long)heap);
+  }
+
+#if defined(MBEDTLS_ECP_DP_CURVE25519_ENABLED)
+  mbedtls_ecp_group_init(&grp);
+  if (mbedtls_ecp_group_load(&grp, MBEDTLS_ECP_DP_CURVE25519) == 0)
+  {
+    on = 0;
+    ram = ecp_fast_keygen(&grp, ECP_FAST_BENCH_RUNS);
+    on = 1;
+    flash = ecp_fast_keygen(&grp, ECP_FAST_BENCH_RUNS);
+    printf("[ECP] x25519 keygen: mbedTLS %lu kcycles, x25519.c %lu kcycles\r\n", (unsigned long)(ram / 1000),
+           (unsigned long)(flash / 1000));
+  }
+  mbedtls_ecp_group_free(&grp);
+#endif
+  on = was;
+  stats = saved;
+}
+#endif
@@ -0,0 +1,130 @@
+/*
+ * ecp_tables.c
+ *
+ * Comb tables of the base points, for ecp_fast.c: generated by
+ * host_sim/Src/host_ecp_tables.c for MBEDTLS_ECP_WINDOW_SIZE 4, do not edit.
+ */
+
+#include "mbedtls/ecp.h"
+#include "ecp_fast.h"
+
+#if MBEDTLS_ECP_WINDOW_SIZE != 4 || MBEDTLS_ECP_FIXED_POINT_OPTIM != 1
+#error "ecp_tables.c was generated for another window, or for no fixed-point tables: run host_ecp_tables again"
+#endif
+
+#if defined(MBEDTLS_HAVE_INT32)
+#define W(lo, hi) (lo), (hi)
+#else
+#define W(lo, hi) ((mbedtls_mpi_uint)(hi) << 32 | (lo))
+#endif
+#define LIMBS(bits) (((bits) + 63) / 64 * 8 / sizeof(mbedtls_mpi_uint))
+#define MPI(a, i, bits) {1, LIMBS(bits), (mbedtls_mpi_uint *)(a) + (i) * LIMBS(bits)}
+#define POINT(a, i, bits) {MPI(a, 2 * (i), bits), MPI(a, 2 * (i) + 1, bits), {1, 1, (mbedtls_mpi_uint *)ecp_one}}
+
+static const mbedtls_mpi_uint ecp_one[] = {1}; //Z of every point
+
+#if defined(MBEDTLS_ECP_DP_SECP384R1_ENABLED)
+/* secp384r1: w = 4, d = 96 */
+static const mbedtls_mpi_uint secp384r1_T[] = {
+    /* 0 */
+    W(0x72760ab7, 0x3a545e38), W(0xbf55296c, 0x5502f25d), W(0x82542a38, 0x59f741e0), W(0x8ba79b98, 0x6e1d3b62),
+    W(0xf320ad74, 0x8eb1c71e), W(0xbe8b0537, 0xaa87ca22),
+    W(0x90ea0e5f, 0x7a431d7c), W(0x1d7e819d, 0x0a60b1ce), W(0xb5f0b8c0, 0xe9da3113), W(0x289a147c, 0xf8f41dbd),
+    W(0x9292dc29, 0x5d9e98bf), W(0x96262c6f, 0x3617de4a),
+    /* 1 */
+    W(0xeb09a0e5, 0x264e5246), W(0x32cdf03c, 0xf8f4be11), W(0x5faefa4f, 0xda9d5483), W(0x17a31b22, 0xbbbc4fd0),
+    W(0x86f06145, 0xc3decd0c), W(0x0a5f2cab, 0x528ef167),
+    W(0xc14f0dd6, 0x8a1e9858), W(0x09cb7524, 0x550538a8), W(0xc87fed22, 0xbd60cab4), W(0x631d058d, 0xf8b76fdd),
+    W(0x1a1dcf14, 0x5803eaa1), W(0x7bccf56c, 0x7b9b1fbe),
+    /* 2 */
+    W(0xaa133909, 0x30991560), W(0xc6cb0017, 0x9097dbb1), W(0xb860fae6, 0xd37de424), W(0x70b375dd, 0x9bb183b2),
+    W(0xcd6ce3a3, 0x567a6233), W(0x0fdc3088, 0xaab8bb9f),
+    W(0x600ad5a6, 0x16c5b981), W(0xd62faa44, 0xebdf73f2), W(0xc9747bf3, 0x6d955bb3), W(0x15eb04ac, 0xf6005fc8),
+    W(0x282050b5, 0xf0af01d1), W(0x314f6d28, 0x48942f81),
+    /* 3 */
+    W(0x0e758344, 0x300ae2e6), W(0x371a2ca5, 0x451c707a), W(0x5052dd32, 0x25651d10), W(0x4862b954, 0xbf88de7f),
+    W(0x0381ef13, 0xfafce26e), W(0x960e090e, 0xdc916c17),
+    W(0x026b0889, 0xed17cc44), W(0x9b42441b, 0x95c01ff1), W(0xcc160697, 0x40896478), W(0x0ba04a35, 0x52d154b8),
+    W(0x701c2952, 0xb3d92ea4), W(0xd69eca0a, 0x266e8a40),
+    /* 4 */
+    W(0x708d4cee, 0x8d104d24), W(0x819cf043, 0x197d6958), W(0xf0712210, 0x47fc87fa), W(0x5c201558, 0x103df785),
+    W(0x611ef638, 0x30b0a9e8), W(0xfdfebfec, 0x00b19ac8),
+    W(0xd201e03e, 0xd40e8d6f), W(0x2228ff5f, 0xbb7c969c), W(0x636164c5, 0x68810282), W(0xe754220d, 0xcdbb3cd2),
+    W(0xe9f6edc4, 0x1418fe25), W(0x9ee36031, 0xa72f9105),
+    /* 5 */
+    W(0x85651f82, 0x044c0dd2), W(0x785d3ef7, 0x325c51e7), W(0x88e95532, 0xb83a1861), W(0x522c2931, 0x539f94ad),
+    W(0x8980f137, 0x15274e5b), W(0xdf0f66d7, 0x9fd7b010),
+    W(0x4064e4c0, 0xe4a7b94a), W(0x25d7d211, 0xd44eba45), W(0xbe8a04e3, 0x0a806b54), W(0x149033de, 0x929226bd),
+    W(0xc9739246, 0x795f6fa3), W(0xb9260225, 0x321aa9a3),
+    /* 6 */
+    W(0x5f863bbd, 0x10b05658), W(0xb483283d, 0xe92cdc5a), W(0xdc7c421d, 0xebb31209), W(0x6d01a5a8, 0x3afcbd79),
+    W(0xa08b6a51, 0xe2b067ca), W(0xe8cb7aeb, 0x026e0dc2),
+    W(0x02dde18a, 0xd8c35029), W(0xd8c6cf36, 0x64c15fac), W(0x10781e45, 0x17ea2701), W(0x1f3443d8, 0xd68d1ffc),
+    W(0x8c7461a5, 0x4be25637), W(0xd8ef24e1, 0xae8866ba),
+    /* 7 */
+    W(0xc62666de, 0x89109a0e), W(0x7ffcd01e, 0xc8c12e75), W(0xc48b5ab0, 0xa8206169), W(0xf983ac6c, 0x4bc2fdcf),
+    W(0x55977d23, 0x59cfca71), W(0x5766c96a, 0x1264cb33),
+    W(0x2e014b4b, 0x6b691381), W(0xe4483ec5, 0x31d28707), W(0xffb19758, 0xcbf7190c), W(0x65a5f248, 0xb66717a0),
+    W(0xc53b4f69, 0xd94ad8fa), W(0xa1a1a376, 0x119ebeee),
+};
+static const mbedtls_ecp_point secp384r1_points[] = {
+    POINT(secp384r1_T, 0, 384),
+    POINT(secp384r1_T, 1, 384),
+    POINT(secp384r1_T, 2, 384),
+    POINT(secp384r1_T, 3, 384),
+    POINT(secp384r1_T, 4, 384),
+    POINT(secp384r1_T, 5, 384),
+    POINT(secp384r1_T, 6, 384),
+    POINT(secp384r1_T, 7, 384),
+};
+#endif
+
+#if defined(MBEDTLS_ECP_DP_SECP256R1_ENABLED)
+/* secp256r1: w = 4, d = 64 */
+static const mbedtls_mpi_uint secp256r1_T[] = {
+    /* 0 */
+    W(0xd898c296, 0xf4a13945), W(0x2deb33a0, 0x77037d81), W(0x63a440f2, 0xf8bce6e5), W(0xe12c4247, 0x6b17d1f2),
+    W(0x37bf51f5, 0xcbb64068), W(0x6b315ece, 0x2bce3357), W(0x7c0f9e16, 0x8ee7eb4a), W(0xfe1a7f9b, 0x4fe342e2),
+    /* 1 */
+    W(0x097992af, 0x93391ce2), W(0x0d35f1fa, 0xe96c98fd), W(0x95e02789, 0xb257c0de), W(0x89d6726f, 0x300a4bbc),
+    W(0xc08127a0, 0xaa54a291), W(0xa9d806a5, 0x5bb1eead), W(0xff1e3c6f, 0x7f1ddb25), W(0xd09b4644, 0x72aac7e0),
+    /* 2 */
+    W(0x2a1d367f, 0x13949c93), W(0x1a0a11b7, 0xef7fbd2b), W(0xb91dfc60, 0xddc6068b), W(0x8a9c72ff, 0xef951932),
+    W(0x7376d8a8, 0x196035a7), W(0x95ca1740, 0x23183b08), W(0x022c219c, 0xc1ee9807), W(0x7dbb2c9b, 0x611e9fc3),
+    /* 3 */
+    W(0xfc5cde01, 0xe48ecaff), W(0x0d715f26, 0x7ccd84e7), W(0xf43e4391, 0xa2e8f483), W(0xb21141ea, 0xeb5d7745),
+    W(0x731a3479, 0xcac917e2), W(0x2844b645, 0x85f22cfe), W(0x58006cee, 0x0990e6a1), W(0xdbecc17b, 0xeafd72eb),
+    /* 4 */
+    W(0x677c8a3e, 0x2df48c04), W(0x0203a56b, 0x74e02f08), W(0xb8c7fedb, 0x31855f7d), W(0x72c9ddad, 0x4e769e76),
+    W(0xb824bbb0, 0xa4c36165), W(0x3b9122a5, 0xfb9ae16f), W(0x06947281, 0x1ec00572), W(0xde830663, 0x42b99082),
+    /* 5 */
+    W(0xc31a3573, 0x7f991ed2), W(0xd54fb496, 0x5b82dd5b), W(0x812ffcae, 0x595c5220), W(0x716b1287, 0x0c88bc4d),
+    W(0x5f48aca8, 0x3a57bf63), W(0xdf2564f3, 0x7c8181f4), W(0x9c04e6aa, 0x18d1b5b3), W(0xf3901dc6, 0xdd5ddea3),
+    /* 6 */
+    W(0xa2582e7f, 0xd36b4789), W(0x4ec39c28, 0x0d1a1014), W(0xedbad7a0, 0x663c62c3), W(0x6f461db9, 0x4052bf4b),
+    W(0x188d25eb, 0x235a27c3), W(0x99bfcc5b, 0xe724f339), W(0x71d70cc8, 0x862be6bd), W(0x90b0fc61, 0xfecf4d51),
+    /* 7 */
+    W(0x0d1d78e5, 0x9615b511), W(0x25c4744b, 0x66b0de32), W(0x6aaf363a, 0x0a4a46fb), W(0x84f7a21c, 0xb48e26b4),
+    W(0x21a01b2d, 0x06ebb0f6), W(0x8b7b0f98, 0xc004e404), W(0xfed6f668, 0x64131bcd), W(0x4d4d3dab, 0xfac01540),
+};
+static const mbedtls_ecp_point secp256r1_points[] = {
+    POINT(secp256r1_T, 0, 256),
+    POINT(secp256r1_T, 1, 256),
+    POINT(secp256r1_T, 2, 256),
+    POINT(secp256r1_T, 3, 256),
+    POINT(secp256r1_T, 4, 256),
+    POINT(secp256r1_T, 5, 256),
+    POINT(secp256r1_T, 6, 256),
+    POINT(secp256r1_T, 7, 256),
+};
+#endif
+
+const struct ecp_fast_table ecp_fast_tables[] = {
+#if defined(MBEDTLS_ECP_DP_SECP384R1_ENABLED)
+    {MBEDTLS_ECP_DP_SECP384R1, 8, secp384r1_points},
+#endif
+#if defined(MBEDTLS_ECP_DP_SECP256R1_ENABLED)
+    {MBEDTLS_ECP_DP_SECP256R1, 8, secp256r1_points},
+#endif
+    {MBEDTLS_ECP_DP_NONE, 0, NULL},
+};
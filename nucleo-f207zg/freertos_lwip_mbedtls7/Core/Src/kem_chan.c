@@ -0,0 +1,377 @@
+/*
+ * kem_chan.c
+ *
+ * See kem_chan.h. HKDF-SHA-256 (salt: the client's nonce, then the
+ * server's; info "kem_chan v1") gives 96 bytes: the key of the client's
+ * records, the server's, and the secret of the next ticket. The nonce of a
+ * record is 4 zero bytes and its number, big endian: each direction has its
+ * own key, so the numbers of the two directions may meet. The header of a
+ * record is its additional data, which the tag covers.
+ *
+ * crypto_kem_enc takes about 13.7 kB of stack on the calling task
+ * (crypto_kem_dec, on the server, 17.8 kB).
+ */
+
+#include <string.h>
+
+#include "mbedtls/hkdf.h"
+#include "mbedtls/platform_util.h"
+#include "kem_chan.h"
+#include "rng.h"
+
+#define KEM_CHAN_AEAD_NONCE 12
+#define KEM_CHAN_TICKET_BODY (KEM_CHAN_SECRET + 4) //secret, expiry
+
+static const unsigned char kem_chan_info[] = "kem_chan v1";
+
+/*
+ * kem_chan_nonce
+ * the AEAD nonce of record seq
+ */
+static void kem_chan_nonce(uint64_t seq, uint8_t *nonce)
+{
+  int i;
+
+  memset(nonce, 0, 4);
+  for (i = 11; i >= 4; i--)
+  {
+    nonce[i] = (uint8_t)seq;
+    seq >>= 8;
+  }
+}
+
+/*
+ * kem_chan_keys
+ * derive the keys from ch->secret and the nonces, for the server's side or
+ * the client's, and the secret of the next ticket; ch->secret is cleared
+ */
+static int kem_chan_keys(struct kem_chan *ch, const uint8_t *nonce_s, int server, uint8_t *next)
+{
+  uint8_t salt[2 * KEM_CHAN_NONCE], okm[3 * KEM_CHAN_SECRET];
+  int ret;
+
+  memcpy(salt, ch->nonce, KEM_CHAN_NONCE);
+  memcpy(salt + KEM_CHAN_NONCE, nonce_s, KEM_CHAN_NONCE);
+  ret = mbedtls_hkdf(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), salt, sizeof(salt), ch->secret,
+                     KEM_CHAN_SECRET, kem_chan_info, sizeof(kem_chan_info) - 1, okm, sizeof(okm));
+  if (ret == 0)
+  {
+    ret = mbedtls_chachapoly_setkey(&ch->tx, server ? okm + KEM_CHAN_SECRET : okm);
+  }
+  if (ret == 0)
+  {
+    ret = mbedtls_chachapoly_setkey(&ch->rx, server ? okm : okm + KEM_CHAN_SECRET);
+  }
+  memcpy(next, okm + 2 * KEM_CHAN_SECRET, KEM_CHAN_SECRET);
+  mbedtls_platform_zeroize(okm, sizeof(okm));
+  mbedtls_platform_zeroize(ch->secret, sizeof(ch->secret));
+  ch->tx_seq = 0;
+  ch->rx_seq = 0;
+  return ret;
+}
+
+/*
+ * kem_chan_init
+ */
+void kem_chan_init(struct kem_chan *ch)
+{
+  memset(ch, 0, sizeof(*ch));
+  mbedtls_chachapoly_init(&ch->tx);
+  mbedtls_chachapoly_init(&ch->rx);
+}
+
+/*
+ * kem_chan_free
+ * the keys too
+ */
+void kem_chan_free(struct kem_chan *ch)
+{
+  mbedtls_chachapoly_free(&ch->tx);
+  mbedtls_chachapoly_free(&ch->rx);
+  mbedtls_platform_zeroize(ch, sizeof(*ch));
+}
+
+/*
+ * kem_chan_msg_len
+ * length of a handshake message from its type, the first byte; 0 for an
+ * unknown type
+ */
+size_t kem_chan_msg_len(uint8_t type)
+{
+  switch (type)
+  {
+    case KEM_CHAN_FULL:
+      return KEM_CHAN_FULL_LEN;
+    case KEM_CHAN_RESUME:
+      return KEM_CHAN_RESUME_LEN;
+    case KEM_CHAN_KEY_REQ:
+    case KEM_CHAN_RETRY:
+      return 1;
+    case KEM_CHAN_ACCEPT:
+      return KEM_CHAN_ACCEPT_LEN;
+    case KEM_CHAN_KEY:
+      return KEM_CHAN_KEY_LEN;
+    default:
+      return 0;
+  }
+}
+
+/*
+ * kem_chan_hello
+ * the client's hello into out: RESUME with a valid ticket, else FULL,
+ * encapsulating to the server's public key pk
+ */
+int kem_chan_hello(struct kem_chan *ch, const uint8_t *pk, const struct kem_chan_ticket *ticket, uint8_t *out,
+                   size_t *olen)
+{
+  int ret;
+
+  ret = rng_random(NULL, ch->nonce, KEM_CHAN_NONCE);
+  if (ret != 0)
+  {
+    return ret;
+  }
+  memcpy(out + 1, ch->nonce, KEM_CHAN_NONCE);
+  if (ticket != NULL && ticket->valid)
+  {
+    out[0] = KEM_CHAN_RESUME;
+    memcpy(out + 1 + KEM_CHAN_NONCE, ticket->ticket, KEM_CHAN_TICKET);
+    memcpy(ch->secret, ticket->secret, KEM_CHAN_SECRET);
+    ch->resumed = 1;
+    *olen = KEM_CHAN_RESUME_LEN;
+    return 0;
+  }
+  out[0] = KEM_CHAN_FULL;
+  ret = crypto_kem_enc(out + 1 + KEM_CHAN_NONCE, ch->secret, pk, rng_randombytes);
+  ch->resumed = 0;
+  *olen = KEM_CHAN_FULL_LEN;
+  return ret;
+}
+
+/*
+ * kem_chan_accept
+ * the server's answer to the hello: the keys, and the next ticket into
+ * ticket. KEM_CHAN_ERR_RETRY if it declined the ticket, which is then
+ * invalid: send a full hello. A ticket record that does not open
+ * (MBEDTLS_ERR_CHACHAPOLY_AUTH_FAILED) is a server without the private key
+ */
+int kem_chan_accept(struct kem_chan *ch, const uint8_t *in, size_t len, struct kem_chan_ticket *ticket)
+{
+  uint8_t next[KEM_CHAN_SECRET];
+  int ret;
+
+  if (len == 1 && in[0] == KEM_CHAN_RETRY && ch->resumed)
+  {
+    ticket->valid = 0;
+    return KEM_CHAN_ERR_RETRY;
+  }
+  if (len != KEM_CHAN_ACCEPT_LEN || in[0] != KEM_CHAN_ACCEPT)
+  {
+    return KEM_CHAN_ERR_MSG;
+  }
+  ret = kem_chan_keys(ch, in + 1, 0, next);
+  if (ret == 0)
+  {
+    ret = kem_chan_open(ch, in + 1 + KEM_CHAN_NONCE, KEM_CHAN_OVERHEAD + KEM_CHAN_TICKET, ticket->ticket);
+  }
+  if (ret == KEM_CHAN_TICKET)
+  {
+    memcpy(ticket->secret, next, KEM_CHAN_SECRET);
+    ticket->valid = 1;
+    ret = 0;
+  }
+  else
+  {
+    ticket->valid = 0;
+    ret = ret < 0 ? ret : KEM_CHAN_ERR_MSG;
+  }
+  mbedtls_platform_zeroize(next, sizeof(next));
+  return ret;
+}
+
+/*
+ * kem_chan_seal
+ * a record of len bytes into out, which takes len + KEM_CHAN_OVERHEAD:
+ * that length, or an error
+ */
+int kem_chan_seal(struct kem_chan *ch, const uint8_t *in, size_t len, uint8_t *out)
+{
+  uint8_t nonce[KEM_CHAN_AEAD_NONCE];
+  int ret;
+
+  if (len > KEM_CHAN_RECORD_MAX)
+  {
+    return KEM_CHAN_ERR_MSG;
+  }
+  out[0] = (uint8_t)(len >> 8);
+  out[1] = (uint8_t)len;
+  kem_chan_nonce(ch->tx_seq++, nonce);
+  ret = mbedtls_chachapoly_encrypt_and_tag(&ch->tx, len, nonce, out, KEM_CHAN_HDR, in, out + KEM_CHAN_HDR,
+                                           out + KEM_CHAN_HDR + len);
+  return ret != 0 ? ret : (int)(len + KEM_CHAN_OVERHEAD);
+}
+
+/*
+ * kem_chan_open
+ * the plaintext of a whole record (len bytes, KEM_CHAN_RECORD_LEN of its
+ * header) into out: its length, or an error
+ */
+int kem_chan_open(struct kem_chan *ch, const uint8_t *rec, size_t len, uint8_t *out)
+{
+  uint8_t nonce[KEM_CHAN_AEAD_NONCE];
+  size_t plen;
+  int ret;
+
+  if (len < KEM_CHAN_OVERHEAD || KEM_CHAN_RECORD_LEN(rec) != len)
+  {
+    return KEM_CHAN_ERR_MSG;
+  }
+  plen = len - KEM_CHAN_OVERHEAD;
+  if (plen > KEM_CHAN_RECORD_MAX)
+  {
+    return KEM_CHAN_ERR_MSG;
+  }
+  kem_chan_nonce(ch->rx_seq, nonce);
+  ret = mbedtls_chachapoly_auth_decrypt(&ch->rx, plen, nonce, rec, KEM_CHAN_HDR, rec + len - KEM_CHAN_TAG,
+                                        rec + KEM_CHAN_HDR, out);
+  if (ret != 0)
+  {
+    return ret;
+  }
+  ch->rx_seq++;
+  return (int)plen;
+}
+
+#ifdef KEM_CHAN_SERVER
+/*
+ * kem_chan_ticket_seal
+ * secret and expiry, under the ticket key
+ */
+static int kem_chan_ticket_seal(const uint8_t *ticket_key, const uint8_t *secret, uint32_t expiry, uint8_t *ticket)
+{
+  mbedtls_chachapoly_context ctx;
+  uint8_t body[KEM_CHAN_TICKET_BODY];
+  int ret;
+
+  ret = rng_random(NULL, ticket, KEM_CHAN_AEAD_NONCE);
+  if (ret != 0)
+  {
+    return ret;
+  }
+  memcpy(body, secret, KEM_CHAN_SECRET);
+  body[KEM_CHAN_SECRET] = (uint8_t)expiry;
+  body[KEM_CHAN_SECRET + 1] = (uint8_t)(expiry >> 8);
+  body[KEM_CHAN_SECRET + 2] = (uint8_t)(expiry >> 16);
+  body[KEM_CHAN_SECRET + 3] = (uint8_t)(expiry >> 24);
+  mbedtls_chachapoly_init(&ctx);
+  ret = mbedtls_chachapoly_setkey(&ctx, ticket_key);
+  if (ret == 0)
+  {
+    ret = mbedtls_chachapoly_encrypt_and_tag(&ctx, sizeof(body), ticket, NULL, 0, body,
+                                             ticket + KEM_CHAN_AEAD_NONCE,
+                                             ticket + KEM_CHAN_AEAD_NONCE + sizeof(body));
+  }
+  mbedtls_chachapoly_free(&ctx);
+  mbedtls_platform_zeroize(body, sizeof(body));
+  return ret;
+}
+
+/*
+ * kem_chan_ticket_open
+ * the secret of a ticket sealed under the ticket key and not expired at now
+ */
+static int kem_chan_ticket_open(const uint8_t *ticket_key, const uint8_t *ticket, uint32_t now, uint8_t *secret)
+{
+  mbedtls_chachapoly_context ctx;
+  uint8_t body[KEM_CHAN_TICKET_BODY];
+  uint32_t expiry;
+  int ret;
+
+  mbedtls_chachapoly_init(&ctx);
+  ret = mbedtls_chachapoly_setkey(&ctx, ticket_key);
+  if (ret == 0)
+  {
+    ret = mbedtls_chachapoly_auth_decrypt(&ctx, sizeof(body), ticket, NULL, 0,
+                                          ticket + KEM_CHAN_AEAD_NONCE + sizeof(body), ticket + KEM_CHAN_AEAD_NONCE,
+                                          body);
+  }
+  mbedtls_chachapoly_free(&ctx);
+  if (ret == 0)
+  {
+    expiry = (uint32_t)body[KEM_CHAN_SECRET] | (uint32_t)body[KEM_CHAN_SECRET + 1] << 8 |
+             (uint32_t)body[KEM_CHAN_SECRET + 2] << 16 | (uint32_t)body[KEM_CHAN_SECRET + 3] << 24;
+    if ((int32_t)(expiry - now) > 0)
+    {
+      memcpy(secret, body, KEM_CHAN_SECRET);
+    }
+    else
+    {
+      ret = KEM_CHAN_ERR_RETRY;
+    }
+  }
+  mbedtls_platform_zeroize(body, sizeof(body));
+  return ret;
+}
+
+/*
+ * kem_chan_server_hello
+ * the server's answer to the client's hello into out, with the private key
+ * sk and the ticket key, at now (s). KEM_CHAN_ERR_RETRY with RETRY in out
+ * for a ticket that does not open or has expired: send it, and expect a
+ * full hello. KEY_REQ is left to the caller, which has the public key
+ */
+int kem_chan_server_hello(struct kem_chan *ch, const uint8_t *sk, const uint8_t *ticket_key, uint32_t now,
+                          const uint8_t *in, size_t len, uint8_t *out, size_t *olen)
+{
+  uint8_t next[KEM_CHAN_SECRET], ticket[KEM_CHAN_TICKET];
+  int ret;
+
+  if (len == 0 || len != kem_chan_msg_len(in[0]) || (in[0] != KEM_CHAN_FULL && in[0] != KEM_CHAN_RESUME))
+  {
+    return KEM_CHAN_ERR_MSG;
+  }
+  memcpy(ch->nonce, in + 1, KEM_CHAN_NONCE);
+  if (in[0] == KEM_CHAN_RESUME)
+  {
+    ret = kem_chan_ticket_open(ticket_key, in + 1 + KEM_CHAN_NONCE, now, ch->secret);
+    if (ret != 0)
+    {
+      out[0] = KEM_CHAN_RETRY;
+      *olen = 1;
+      return KEM_CHAN_ERR_RETRY;
+    }
+    ch->resumed = 1;
+  }
+  else
+  {
+    ret = crypto_kem_dec(ch->secret, in + 1 + KEM_CHAN_NONCE, sk); //a forged ciphertext gives a random secret
+    if (ret != 0)
+    {
+      return ret;
+    }
+    ch->resumed = 0;
+  }
+
+  out[0] = KEM_CHAN_ACCEPT;
+  ret = rng_random(NULL, out + 1, KEM_CHAN_NONCE);
+  if (ret == 0)
+  {
+    ret = kem_chan_keys(ch, out + 1, 1, next);
+  }
+  if (ret == 0)
+  {
+    ret = kem_chan_ticket_seal(ticket_key, next, now + KEM_CHAN_TICKET_LIFETIME, ticket);
+  }
+  if (ret == 0)
+  {
+    ret = kem_chan_seal(ch, ticket, KEM_CHAN_TICKET, out + 1 + KEM_CHAN_NONCE);
+  }
+  mbedtls_platform_zeroize(next, sizeof(next));
+  if (ret < 0)
+  {
+    return ret;
+  }
+  *olen = KEM_CHAN_ACCEPT_LEN;
+  return 0;
+}
+#endif
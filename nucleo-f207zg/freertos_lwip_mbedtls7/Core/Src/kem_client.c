@@ -0,0 +1,454 @@
+/*
+ * kem_client.c
+ *
+ * See kem_client.h. The task blocks in netconn_recv, with a timeout
+ * (LWIP_SO_RCVTIMEO), and runs at osPriorityBelowNormal: crypto_kem_enc is
+ * one call of about a million cycles, which tcpip_thread and the TLS task
+ * preempt. Its stack takes most of that call's 13.7 kB, once per
+ * connection; the channel itself is struct kem_chan, the two ChaCha20-Poly1305
+ * contexts, in static RAM.
+ *
+ * The handshake time runs from the connect to the ACCEPT opened, as
+ * tls_mux.c's does; the cycles are those of kem_chan_hello and
+ * kem_chan_accept, where the CPU time of the handshake is, and the bytes
+ * are the messages on the wire. Fetching the server's key (KEY_REQ), once
+ * per start, is left out.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "cmsis_os.h"
+#include "lwip/api.h"
+#include "lwip/ip_addr.h"
+#include "main.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/sha256.h"
+#include "cycles.h"
+#include "kem_chan.h"
+#include "kem_client.h"
+#ifdef METRICS_ENABLE
+#include "metrics.h"
+#endif
+
+#define TP2_MAGIC 0xAF
+#define TP2_VERSION 2
+#define TP2_HDR 8 //magic, version << 4 | type, len, flags, seq[4] (see lwip_bare tcp_client.h)
+#define TP2_BODY_MAX 16
+#define TP2_REQ 0
+#define TP2_RESP 1
+
+struct kem_hs_stats
+{
+  uint32_t count; //handshakes done
+  uint32_t ms_sum; //their time, from the connect
+  uint32_t kcycles_sum; //CPU time of kem_chan_hello and kem_chan_accept, thousands of cycles
+  uint32_t tx_bytes; //handshake bytes sent and received
+  uint32_t rx_bytes;
+};
+
+static struct netconn *conn;
+static struct netbuf *rx_buf; //received, not all read yet...
+static u16_t rx_off; //...from this offset
+static uint32_t tx_bytes, rx_bytes; //of the connection
+static struct kem_chan ch;
+static struct kem_chan_ticket ticket; //of the last handshake, for the next one
+#ifdef KEM_CLIENT_SERVER_PK
+static const uint8_t pk[KYBER_PUBLICKEYBYTES] = KEM_CLIENT_SERVER_PK; //pinned, in flash
+#else
+static uint8_t pk[KYBER_PUBLICKEYBYTES]; //asked of the server...
+static uint8_t pk_valid; //...once, and trusted from then on
+#endif
+static uint8_t msg[KEM_CHAN_KEY_LEN]; //handshake messages, both ways
+static uint8_t rec[KEM_CHAN_OVERHEAD + TP2_HDR + TP2_BODY_MAX];
+static uint8_t frame[TP2_HDR + TP2_BODY_MAX];
+static struct kem_hs_stats full, resumed;
+static uint32_t responses, errors, closes, declined;
+static uint32_t lat_max, lat_sum; //request to response, ms
+#ifdef METRICS_ENABLE
+static struct metrics_op op_handshake = METRICS_OP_INIT("kem.handshake");
+#endif
+
+/*
+ * kem_client_send
+ */
+static int kem_client_send(const uint8_t *buf, size_t len)
+{
+  if (netconn_write(conn, buf, len, NETCONN_COPY) != ERR_OK)
+  {
+    return MBEDTLS_ERR_NET_SEND_FAILED;
+  }
+  tx_bytes += len;
+  return 0;
+}
+
+/*
+ * kem_client_recv
+ * exactly len bytes, whatever the netbuf boundaries; what is left of a
+ * netbuf is kept for the next call
+ */
+static int kem_client_recv(uint8_t *buf, size_t len)
+{
+  u16_t n;
+  err_t err;
+
+  while (len > 0)
+  {
+    if (rx_buf == NULL)
+    {
+      err = netconn_recv(conn, &rx_buf);
+      if (err != ERR_OK)
+      {
+        rx_buf = NULL;
+        return err == ERR_CLSD ? MBEDTLS_ERR_NET_CONN_RESET : MBEDTLS_ERR_NET_RECV_FAILED; //closed, reset or ERR_TIMEOUT
+      }
+      rx_off = 0;
+    }
+    n = netbuf_copy_partial(rx_buf, buf, len, rx_off);
+    buf += n;
+    len -= n;
+    rx_off += n;
+    rx_bytes += n;
+    if (rx_off >= netbuf_len(rx_buf))
+    {
+      netbuf_delete(rx_buf);
+      rx_buf = NULL;
+    }
+  }
+  return 0;
+}
+
+/*
+ * kem_client_recv_msg
+ * a handshake message into msg: its length, or an error
+ */
+static int kem_client_recv_msg(void)
+{
+  size_t len;
+  int ret;
+
+  ret = kem_client_recv(msg, 1);
+  if (ret != 0)
+  {
+    return ret;
+  }
+  len = kem_chan_msg_len(msg[0]);
+  if (len == 0 || len > sizeof(msg))
+  {
+    return KEM_CHAN_ERR_MSG;
+  }
+  ret = kem_client_recv(msg + 1, len - 1);
+  return ret != 0 ? ret : (int)len;
+}
+
+/*
+ * kem_client_fingerprint
+ * print the SHA-256 of the server's public key, as go_tstamp_srv logs it
+ */
+static void kem_client_fingerprint(const char *how)
+{
+  unsigned char sum[32];
+  int i;
+
+  if (mbedtls_sha256_ret(pk, sizeof(pk), sum, 0) != 0)
+  {
+    return;
+  }
+  printf("[KEM] %s server key SHA-256 ", how);
+  for (i = 0; i < 32; i++)
+  {
+    printf("%02x", sum[i]);
+  }
+  printf("\r\n");
+}
+
+/*
+ * kem_client_key
+ * the server's public key, asked on the first connection
+ */
+static int kem_client_key(void)
+{
+#ifndef KEM_CLIENT_SERVER_PK
+  int ret;
+
+  if (pk_valid)
+  {
+    return 0;
+  }
+  msg[0] = KEM_CHAN_KEY_REQ;
+  ret = kem_client_send(msg, 1);
+  if (ret == 0)
+  {
+    ret = kem_client_recv_msg();
+  }
+  if (ret < 0)
+  {
+    return ret;
+  }
+  if (msg[0] != KEM_CHAN_KEY)
+  {
+    return KEM_CHAN_ERR_MSG;
+  }
+  memcpy(pk, msg + 1, sizeof(pk));
+  pk_valid = 1;
+  kem_client_fingerprint("received");
+#endif
+  return 0;
+}
+
+/*
+ * kem_client_handshake
+ * hello and accept, again with a full hello if the server declines the
+ * ticket; accounted from start, the tick of the connect
+ */
+static int kem_client_handshake(uint32_t start)
+{
+  struct kem_hs_stats *hs;
+  uint32_t cycles = 0, c0, tx0, rx0, ms;
+  size_t len;
+  int ret;
+
+  ret = kem_client_key();
+  if (ret != 0)
+  {
+    return ret;
+  }
+  tx0 = tx_bytes;
+  rx0 = rx_bytes;
+  do
+  {
+    c0 = DWT->CYCCNT;
+    ret = kem_chan_hello(&ch, pk, &ticket, msg, &len);
+    cycles += DWT->CYCCNT - c0;
+    if (ret == 0)
+    {
+      ret = kem_client_send(msg, len);
+    }
+    if (ret == 0)
+    {
+      ret = kem_client_recv_msg();
+    }
+    if (ret > 0)
+    {
+      c0 = DWT->CYCCNT;
+      ret = kem_chan_accept(&ch, msg, ret, &ticket);
+      cycles += DWT->CYCCNT - c0;
+    }
+    if (ret == KEM_CHAN_ERR_RETRY)
+    {
+      declined++; //the ticket is invalid now: a full hello
+    }
+  } while (ret == KEM_CHAN_ERR_RETRY);
+  if (ret != 0)
+  {
+    return ret;
+  }
+
+  ms = osKernelSysTick() - start;
+  hs = ch.resumed ? &resumed : &full;
+  hs->count++;
+  hs->ms_sum += ms;
+  hs->kcycles_sum += cycles / 1000;
+  hs->tx_bytes += tx_bytes - tx0;
+  hs->rx_bytes += rx_bytes - rx0;
+#ifdef METRICS_ENABLE
+  metrics_op_record(&op_handshake, ms * 1000, 1);
+#endif
+  return 0;
+}
+
+/*
+ * kem_client_request
+ * one v2 REQ in a record, and its RESP
+ */
+static int kem_client_request(uint32_t seq)
+{
+  uint32_t sent = osKernelSysTick(), ms;
+  size_t len;
+  int ret;
+
+  memset(frame, 0, TP2_HDR);
+  frame[0] = TP2_MAGIC;
+  frame[1] = (TP2_VERSION << 4) | TP2_REQ;
+  frame[4] = seq;
+  frame[5] = seq >> 8;
+  frame[6] = seq >> 16;
+  frame[7] = seq >> 24;
+  ret = kem_chan_seal(&ch, frame, TP2_HDR, rec);
+  if (ret > 0)
+  {
+    ret = kem_client_send(rec, ret);
+  }
+  if (ret == 0)
+  {
+    ret = kem_client_recv(rec, KEM_CHAN_HDR);
+  }
+  if (ret != 0)
+  {
+    return ret;
+  }
+  len = KEM_CHAN_RECORD_LEN(rec);
+  if (len > sizeof(rec))
+  {
+    return KEM_CHAN_ERR_MSG;
+  }
+  ret = kem_client_recv(rec + KEM_CHAN_HDR, len - KEM_CHAN_HDR);
+  if (ret == 0)
+  {
+    ret = kem_chan_open(&ch, rec, len, frame);
+  }
+  if (ret < 0)
+  {
+    return ret;
+  }
+
+  if (ret < TP2_HDR || frame[0] != TP2_MAGIC || frame[1] != ((TP2_VERSION << 4) | TP2_RESP) ||
+      ret != TP2_HDR + frame[2] || frame[4] != (uint8_t)seq || frame[5] != (uint8_t)(seq >> 8) ||
+      frame[6] != (uint8_t)(seq >> 16) || frame[7] != (uint8_t)(seq >> 24))
+  {
+    errors++;
+    return 0;
+  }
+  ms = osKernelSysTick() - sent;
+  responses++;
+  lat_sum += ms;
+  if (ms > lat_max)
+  {
+    lat_max = ms;
+  }
+  return 0;
+}
+
+/*
+ * kem_client_close
+ */
+static void kem_client_close(void)
+{
+  if (rx_buf != NULL)
+  {
+    netbuf_delete(rx_buf);
+    rx_buf = NULL;
+  }
+  if (conn != NULL)
+  {
+    netconn_close(conn);
+    netconn_delete(conn);
+    conn = NULL;
+  }
+  kem_chan_free(&ch);
+}
+
+/*
+ * kem_client_report_hs
+ * averages of the full or resumed handshakes
+ */
+static void kem_client_report_hs(const char *name, const struct kem_hs_stats *hs)
+{
+  uint32_t n = hs->count ? hs->count : 1;
+
+  printf("[KEM] %lu %s handshakes, avg %lu ms, %lu kcycles, %lu B sent, %lu B received\r\n", (unsigned long)hs->count,
+         name, (unsigned long)(hs->ms_sum / n), (unsigned long)(hs->kcycles_sum / n), (unsigned long)(hs->tx_bytes / n),
+         (unsigned long)(hs->rx_bytes / n));
+}
+
+/*
+ * kem_client_report
+ * handshakes, responses, and the RAM of the channel: its state, and the
+ * task's stack peak
+ */
+static void kem_client_report(void)
+{
+  unsigned long stack = 0;
+#if configUSE_TRACE_FACILITY
+  TaskStatus_t ts;
+
+  vTaskGetInfo(NULL, &ts, pdTRUE, eInvalid);
+  stack = (unsigned long)(KEM_CLIENT_STACK - ts.usStackHighWaterMark) * sizeof(StackType_t);
+#endif
+
+  kem_client_report_hs("full", &full);
+  kem_client_report_hs("resumed", &resumed);
+  printf("[KEM] %lu responses, %lu errors, %lu closes, %lu tickets declined, latency avg/max %lu/%lu ms, %lu B of state, stack peak %lu B\r\n",
+         (unsigned long)responses, (unsigned long)errors, (unsigned long)closes, (unsigned long)declined,
+         (unsigned long)(responses ? lat_sum / responses : 0), (unsigned long)lat_max,
+         (unsigned long)(sizeof(ch) + sizeof(ticket)), stack);
+}
+
+/*
+ * StartKemClientTask
+ * connect, open the channel and send the requests, again after a failure
+ */
+void StartKemClientTask(void const *argument)
+{
+  ip_addr_t addr;
+  uint32_t start, due, report, seq = 0;
+  int ret;
+
+  (void)argument;
+
+  cycles_enable();
+#ifdef METRICS_ENABLE
+  metrics_op_add(&op_handshake);
+#endif
+#ifdef KEM_CLIENT_SERVER_PK
+  kem_client_fingerprint("pinned");
+#endif
+  IP4_ADDR(&addr, KEM_SERVER_IP1, KEM_SERVER_IP2, KEM_SERVER_IP3, KEM_SERVER_IP4);
+  report = osKernelSysTick() + KEM_CLIENT_REPORT_MS;
+
+  for (;;)
+  {
+    kem_chan_init(&ch);
+    start = osKernelSysTick();
+    conn = netconn_new(NETCONN_TCP);
+    if (conn == NULL)
+    {
+      ret = MBEDTLS_ERR_NET_SOCKET_FAILED;
+    }
+    else
+    {
+      netconn_set_recvtimeout(conn, KEM_CLIENT_TIMEOUT_MS); //a silent server must not block the task
+      ret = netconn_connect(conn, &addr, KEM_SERVER_PORT) == ERR_OK ? 0 : MBEDTLS_ERR_NET_CONNECT_FAILED;
+    }
+    if (ret == 0)
+    {
+      ret = kem_client_handshake(start);
+      if (ret != 0)
+      {
+        printf("[KEM] handshake failed: -0x%04x\r\n", (unsigned int)-ret);
+#ifdef METRICS_ENABLE
+        metrics_op_record(&op_handshake, 0, 0);
+#endif
+      }
+    }
+
+    due = osKernelSysTick();
+    while (ret == 0)
+    {
+      if ((int32_t)(osKernelSysTick() - due) < 0)
+      {
+        osDelay(due - osKernelSysTick());
+      }
+      due += KEM_CLIENT_PERIOD_MS;
+      ret = kem_client_request(seq++);
+      if (ret != 0)
+      {
+        printf("[KEM] connection failed: -0x%04x\r\n", (unsigned int)-ret);
+      }
+      if ((int32_t)(osKernelSysTick() - report) >= 0)
+      {
+        kem_client_report();
+        report = osKernelSysTick() + KEM_CLIENT_REPORT_MS;
+      }
+    }
+
+    kem_client_close();
+    closes++;
+    osDelay(KEM_CLIENT_RETRY_MS);
+    if ((int32_t)(osKernelSysTick() - report) >= 0)
+    {
+      kem_client_report();
+      report = osKernelSysTick() + KEM_CLIENT_REPORT_MS;
+    }
+  }
+}
@@ -23,8 +23,21 @@
 
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
-#include "mbedtls/entropy.h"
-#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/threading.h"
+#include "ecp_fast.h"
+#include "rng.h"
+#ifdef UARTLOG_ENABLE
+#include "uartlog.h"
+#endif
+#ifdef METRICS_ENABLE
+#include "metrics.h"
+#endif
+#ifdef TLS_CLIENT_ENABLE
+#include "tls_client.h"
+#endif
+#ifdef KEM_CLIENT_ENABLE
+#include "kem_client.h"
+#endif
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -51,7 +64,17 @@ PCD_HandleTypeDef hpcd_USB_OTG_FS;
 
 osThreadId defaultTaskHandle;
 /* USER CODE BEGIN PV */
-
+#ifdef METRICS_ENABLE
+osThreadId metricsTaskHandle;  //metrics server task handle
+static struct metrics_op op_seed = METRICS_OP_INIT("drbg.seed");
+static struct metrics_op op_random = METRICS_OP_INIT("drbg.random"); //32 bytes
+#endif
+#ifdef TLS_CLIENT_ENABLE
+osThreadId tlsClientTaskHandle;  //TLS sessions task handle
+#endif
+#ifdef KEM_CLIENT_ENABLE
+osThreadId kemClientTaskHandle;  //Kyber channel task handle
+#endif
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
@@ -69,8 +92,12 @@ void StartDefaultTask(void const * argument);
 /* Private user code ---------------------------------------------------------*/
 /* USER CODE BEGIN 0 */
 int __io_putchar(int ch){
+#ifdef UARTLOG_ENABLE
+  return uartlog_putc(ch);	// queued, drained by USART3 TX DMA
+#else
   HAL_UART_Transmit(&huart3, (uint8_t *)&ch, 1, 0xFFFF);
   return ch;
+#endif
 }
 /* USER CODE END 0 */
 
@@ -106,7 +133,13 @@ int main(void)
   MX_USB_OTG_FS_PCD_Init();
   MX_RNG_Init();
   /* USER CODE BEGIN 2 */
-
+#ifdef UARTLOG_ENABLE
+  // HSO: non-blocking printf, see uartlog.h
+  if (uartlog_init(&huart3) != 0) {
+    static const char msg[] = "uartlog: USART3 TX DMA not configured\r\n";
+    HAL_UART_Transmit(&huart3, (uint8_t *)msg, sizeof(msg) - 1, 0xFFFF);
+  }
+#endif
   /* USER CODE END 2 */
 
   /* USER CODE BEGIN RTOS_MUTEX */
@@ -341,8 +374,14 @@ static void MX_GPIO_Init(void)
 void rand_bytes_wrapper(int (*f_rng)(void *, unsigned char *, size_t), void *p_rng) {
   int ret;
   uint8_t rand_bytes[32];
+#ifdef METRICS_ENABLE
+  uint32_t start = metrics_op_start();
+#endif
 
   ret = f_rng(p_rng, (unsigned char *)rand_bytes, 32);
+#ifdef METRICS_ENABLE
+  metrics_op_end(&op_random, start, ret == 0);
+#endif
 
   if (ret != 0) {
 	printf("RNG failed\r\n");
@@ -374,20 +413,42 @@ void StartDefaultTask(void const * argument)
 
   /* USER CODE BEGIN 5 */
   int ret;
-  mbedtls_entropy_context entropy;
-  mbedtls_ctr_drbg_context ctr_drbg;
-
-  mbedtls_ctr_drbg_init(&ctr_drbg);
-  mbedtls_entropy_init(&entropy);
-
-  ret = mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy, (const unsigned char *) "GEN_RAND_BYTES", 14);
+#ifdef METRICS_ENABLE
+  uint32_t start;
+
+  metrics_op_add(&op_seed);
+  metrics_op_add(&op_random);
+  osThreadDef(metricsTask, StartMetricsTask, osPriorityBelowNormal, 0, 2 * configMINIMAL_STACK_SIZE);
+  metricsTaskHandle = osThreadCreate(osThread(metricsTask), NULL); //run metrics server task
+  start = metrics_op_start();
+#endif
+
+  threading_alt_init(); //before any mbedTLS context: they create their mutexes
+  ret = rng_init(); //the CTR_DRBGs every task draws from
+#ifdef METRICS_ENABLE
+  metrics_op_end(&op_seed, start, ret == 0);
+#endif
   if (ret != 0) {
-	printf("Failed in mbedtls_ctr_drbg_seed: %d\n\r", ret);
+	printf("Failed in rng_init: %d\n\r", ret);
   }
+#ifdef ECP_FAST_BENCH
+  ecp_fast_bench(); //before the TLS task starts its handshakes
+#endif
+#ifdef RNG_STRESS_ENABLE
+  rng_stress();
+#endif
+#ifdef TLS_CLIENT_ENABLE
+  osThreadDef(tlsClientTask, StartTlsClientTask, osPriorityNormal, 0, 2048); //one stack for all the sessions, started once the RNG is seeded
+  tlsClientTaskHandle = osThreadCreate(osThread(tlsClientTask), NULL); //run TLS client task
+#endif
+#ifdef KEM_CLIENT_ENABLE
+  osThreadDef(kemClientTask, StartKemClientTask, osPriorityBelowNormal, 0, KEM_CLIENT_STACK); //below tcpip_thread: crypto_kem_enc is one long call
+  kemClientTaskHandle = osThreadCreate(osThread(kemClientTask), NULL); //run Kyber channel client task
+#endif
   /* Infinite loop */
   for(;;)
   {
-    rand_bytes_wrapper(mbedtls_ctr_drbg_random, &ctr_drbg);
+    rand_bytes_wrapper(rng_random, NULL);
     HAL_GPIO_TogglePin(LD1_GPIO_Port, LD1_Pin);
     osDelay(1000);
   }
@@ -0,0 +1,274 @@
+/*
+ * rng.c
+ *
+ * See rng.h. A shard is a CTR_DRBG; its own mutex (ctx->mutex, the one
+ * mbedtls_ctr_drbg_random takes) guards it, and rng_random takes that mutex
+ * itself, to try the shards in turn without waiting (threading_alt_trylock),
+ * then calls mbedtls_ctr_drbg_random_with_add, which does not lock. The
+ * shard stats are updated under the shard's mutex. The shards reseed from
+ * the entropy context, which has its own mutex.
+ *
+ * A task's shard comes from its handle, a TCB address, through a
+ * multiplicative hash: the same task keeps the same shard.
+ *
+ * The stress test runs half its tasks flat out at normal priority, and the
+ * other half above it, one call per tick: these preempt the first ones, at
+ * times while they hold a shard, as the TLS task would preempt a bulk
+ * consumer of randomness. The flat out ones reach the reseed interval, so
+ * each task has the stack of an mbedTLS task, and the caller of rng_stress
+ * prints the report on its own.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "cmsis_os.h"
+#include "main.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/threading.h"
+#include "rng.h"
+
+#if !defined(MBEDTLS_THREADING_C) || !defined(MBEDTLS_THREADING_ALT)
+#error "rng.c shares its CTR_DRBGs between tasks: it needs MBEDTLS_THREADING_C and MBEDTLS_THREADING_ALT"
+#endif
+
+struct rng_shard
+{
+  mbedtls_ctr_drbg_context drbg;
+  struct rng_shard_stats st;
+};
+
+static mbedtls_entropy_context entropy;
+static struct rng_shard shards[RNG_SHARDS];
+static uint32_t seed_ms;
+
+/*
+ * rng_init
+ * seed the shards; after threading_alt_init and before any rng_random: 0,
+ * or an mbedTLS error
+ */
+int rng_init(void)
+{
+  unsigned char pers[] = "RNG_SHARD_0";
+  uint32_t start = osKernelSysTick();
+  int i, ret = 0;
+
+  mbedtls_entropy_init(&entropy);
+  for (i = 0; i < RNG_SHARDS; i++)
+  {
+    mbedtls_ctr_drbg_init(&shards[i].drbg);
+  }
+  for (i = 0; i < RNG_SHARDS && ret == 0; i++)
+  {
+    pers[sizeof(pers) - 2] = '0' + i % 10; //different streams, should two seeds ever match
+    ret = mbedtls_ctr_drbg_seed(&shards[i].drbg, mbedtls_entropy_func, &entropy, pers, sizeof(pers) - 1);
+  }
+  seed_ms = osKernelSysTick() - start;
+  return ret;
+}
+
+/* shard of the calling task */
+static int rng_shard_of(void)
+{
+  uint32_t h = (uint32_t)((uintptr_t)xTaskGetCurrentTaskHandle() >> 3); //TCBs are 8-byte aligned
+
+  return (int)((h * 2654435761u) >> 16) % RNG_SHARDS;
+}
+
+/*
+ * rng_random
+ * mbedTLS f_rng: len random bytes at output, from the calling task's shard
+ * or another one that is free: 0, or an mbedTLS error
+ */
+int rng_random(void *p_rng, unsigned char *output, size_t len)
+{
+  struct rng_shard *sh = NULL;
+  size_t n;
+  int own = rng_shard_of(), i, ret;
+
+  (void)p_rng;
+
+  for (i = 0; i < RNG_SHARDS; i++)
+  {
+    sh = &shards[(own + i) % RNG_SHARDS];
+    if (threading_alt_trylock(&sh->drbg.mutex) == 0)
+    {
+      break;
+    }
+  }
+  if (i == RNG_SHARDS) //all held: wait for this task's
+  {
+    sh = &shards[own];
+    ret = mbedtls_mutex_lock(&sh->drbg.mutex);
+    if (ret != 0)
+    {
+      return ret;
+    }
+    sh->st.waits++;
+  }
+  else
+  {
+    sh->st.moved += i > 0;
+  }
+
+  ret = 0;
+  sh->st.calls++;
+  while (len > 0 && ret == 0) //in requests of at most MBEDTLS_CTR_DRBG_MAX_REQUEST
+  {
+    n = len < MBEDTLS_CTR_DRBG_MAX_REQUEST ? len : MBEDTLS_CTR_DRBG_MAX_REQUEST;
+    ret = mbedtls_ctr_drbg_random_with_add(&sh->drbg, output, n, NULL, 0);
+    sh->st.bytes += ret == 0 ? n : 0;
+    output += n;
+    len -= n;
+  }
+  sh->st.failed += ret != 0;
+  mbedtls_mutex_unlock(&sh->drbg.mutex);
+  return ret;
+}
+
+/*
+ * rng_randombytes
+ * the Kyber KEM's f_rng: n_bytes random bytes at out, or Error_Handler, as
+ * mbedtls_hardware_poll does when the RNG fails
+ */
+void rng_randombytes(uint8_t *out, size_t n_bytes)
+{
+  if (rng_random(NULL, out, n_bytes) != 0)
+  {
+    Error_Handler();
+  }
+}
+
+void rng_get_stats(struct rng_stats *st)
+{
+  int i;
+
+  taskENTER_CRITICAL();
+  st->seed_ms = seed_ms;
+  for (i = 0; i < RNG_SHARDS; i++)
+  {
+    st->shard[i] = shards[i].st;
+  }
+  taskEXIT_CRITICAL();
+}
+
+#ifdef RNG_STRESS_ENABLE
+static uint32_t stress_calls[RNG_STRESS_TASKS]; //per task
+static struct rng_stats stress_before;
+static struct threading_alt_stats stress_mutex_before;
+static uint32_t stress_stack[RNG_STRESS_TASKS]; //per task, peak in bytes
+static uint32_t stress_start;
+static volatile int stress_left; //tasks still running
+static TaskHandle_t stress_caller; //notified by the last one
+
+/*
+ * rng_stress_report
+ * what the stress tasks got, from the stats deltas
+ */
+static void rng_stress_report(void)
+{
+  struct rng_stats st;
+  struct threading_alt_stats ts;
+  uint32_t ms = osKernelSysTick() - stress_start, calls = 0, bytes = 0, moved = 0, waits = 0, stack = 0;
+  int i;
+
+  rng_get_stats(&st);
+  threading_alt_get_stats(&ts);
+  for (i = 0; i < RNG_SHARDS; i++)
+  {
+    calls += st.shard[i].calls - stress_before.shard[i].calls;
+    bytes += st.shard[i].bytes - stress_before.shard[i].bytes;
+    moved += st.shard[i].moved - stress_before.shard[i].moved;
+    waits += st.shard[i].waits - stress_before.shard[i].waits;
+  }
+  printf("[RNG] stress %d tasks, %d shards, %d B calls: %lu calls in %lu ms, %lu kB/s, %lu moved, %lu waited, %lu mutex waits\r\n",
+         RNG_STRESS_TASKS, RNG_SHARDS, RNG_STRESS_LEN, (unsigned long)calls, (unsigned long)ms,
+         (unsigned long)(ms ? bytes / ms : 0), (unsigned long)moved, (unsigned long)waits,
+         (unsigned long)(ts.waits - stress_mutex_before.waits));
+  printf("[RNG] shards calls/moved/waits:");
+  for (i = 0; i < RNG_SHARDS; i++)
+  {
+    printf(" %d: %lu/%lu/%lu", i, (unsigned long)(st.shard[i].calls - stress_before.shard[i].calls),
+           (unsigned long)(st.shard[i].moved - stress_before.shard[i].moved),
+           (unsigned long)(st.shard[i].waits - stress_before.shard[i].waits));
+  }
+  printf("\r\n[RNG] tasks calls (even: flat out, odd: one per tick, above normal):");
+  for (i = 0; i < RNG_STRESS_TASKS; i++)
+  {
+    printf(" %d: %lu", i, (unsigned long)stress_calls[i]);
+    if (stress_stack[i] > stack)
+    {
+      stack = stress_stack[i];
+    }
+  }
+  printf(", stack peak %lu B of %lu\r\n", (unsigned long)stack,
+         (unsigned long)(RNG_STRESS_STACK * sizeof(StackType_t)));
+}
+
+static void rng_stress_task(void const *argument)
+{
+  int i = (int)(intptr_t)argument;
+  uint8_t buf[RNG_STRESS_LEN];
+#if configUSE_TRACE_FACILITY
+  TaskStatus_t ts;
+#endif
+
+  while (osKernelSysTick() - stress_start < RNG_STRESS_MS)
+  {
+    if (rng_random(NULL, buf, sizeof(buf)) == 0)
+    {
+      stress_calls[i]++;
+    }
+    if (i & 1)
+    {
+      osDelay(1);
+    }
+  }
+
+#if configUSE_TRACE_FACILITY
+  vTaskGetInfo(NULL, &ts, pdTRUE, eInvalid);
+  stress_stack[i] = (uint32_t)(RNG_STRESS_STACK - ts.usStackHighWaterMark) * sizeof(StackType_t);
+#endif
+  taskENTER_CRITICAL();
+  if (--stress_left == 0)
+  {
+    xTaskNotifyGive(stress_caller);
+  }
+  taskEXIT_CRITICAL();
+  osThreadTerminate(NULL);
+}
+
+/*
+ * rng_stress
+ * start the stress tasks, wait for the last one to end, and report
+ */
+void rng_stress(void)
+{
+  int i;
+
+  osThreadDef(rngStress, rng_stress_task, osPriorityNormal, 0, RNG_STRESS_STACK);
+  osThreadDef(rngStressHigh, rng_stress_task, osPriorityAboveNormal, 0, RNG_STRESS_STACK);
+  stress_caller = xTaskGetCurrentTaskHandle();
+  rng_get_stats(&stress_before);
+  threading_alt_get_stats(&stress_mutex_before);
+  stress_start = osKernelSysTick();
+  stress_left = RNG_STRESS_TASKS;
+  for (i = 0; i < RNG_STRESS_TASKS; i++)
+  {
+    if (osThreadCreate(i & 1 ? osThread(rngStressHigh) : osThread(rngStress), (void *)(intptr_t)i) == NULL)
+    {
+      taskENTER_CRITICAL();
+      stress_left--;
+      taskEXIT_CRITICAL();
+    }
+  }
+  while (stress_left > 0)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  }
+  rng_stress_report();
+}
+#endif
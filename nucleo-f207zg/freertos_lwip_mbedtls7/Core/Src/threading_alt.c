@@ -0,0 +1,169 @@
+/*
+ * threading_alt.c
+ *
+ * See threading_alt.h. threading_alt_init hands the four functions to
+ * mbedTLS; it runs before any mbedTLS context is initialized, since
+ * mbedtls_entropy_init and mbedtls_ctr_drbg_init create their mutexes.
+ *
+ * A lock first tries the mutex without waiting, to count the waits, then
+ * blocks for good: mbedTLS holds its mutexes for one call at most. The
+ * mutexes have priority inheritance on both RTOSes. Before the scheduler
+ * starts there is a single thread of execution, and locks are no-ops.
+ */
+
+#include <string.h>
+
+#include "mbedtls/mbedtls_config.h"
+
+#if defined(MBEDTLS_THREADING_C) && defined(MBEDTLS_THREADING_ALT)
+
+#include "mbedtls/threading.h"
+#ifndef THREADING_ALT_THREADX
+#include "task.h"
+#endif
+
+static struct threading_alt_stats stats;
+
+#ifdef THREADING_ALT_THREADX
+#define THREADING_ENTER() UINT level = tx_interrupt_control(TX_INT_DISABLE)
+#define THREADING_EXIT() tx_interrupt_control(level)
+#define THREADING_RUNNING() (tx_thread_identify() != TX_NULL)
+#else
+#define THREADING_ENTER() taskENTER_CRITICAL()
+#define THREADING_EXIT() taskEXIT_CRITICAL()
+#define THREADING_RUNNING() (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED)
+#endif
+
+static void threading_mutex_init(mbedtls_threading_mutex_t *mutex)
+{
+  memset(mutex, 0, sizeof(*mutex));
+#ifdef THREADING_ALT_THREADX
+  mutex->valid = tx_mutex_create(&mutex->mutex, "mbedtls", TX_INHERIT) == TX_SUCCESS;
+#else
+  mutex->mutex = xSemaphoreCreateMutex();
+  mutex->valid = mutex->mutex != NULL;
+#endif
+  THREADING_ENTER();
+  stats.mutexes += mutex->valid;
+  stats.failed += !mutex->valid;
+  THREADING_EXIT();
+}
+
+static void threading_mutex_free(mbedtls_threading_mutex_t *mutex)
+{
+  if (!mutex->valid)
+  {
+    return;
+  }
+#ifdef THREADING_ALT_THREADX
+  tx_mutex_delete(&mutex->mutex);
+#else
+  vSemaphoreDelete(mutex->mutex);
+#endif
+  mutex->valid = 0;
+  THREADING_ENTER();
+  stats.mutexes--;
+  THREADING_EXIT();
+}
+
+/*
+ * threading_take
+ * take mutex, waiting (wait != 0) or not: 1 if taken
+ */
+static int threading_take(mbedtls_threading_mutex_t *mutex, int wait)
+{
+#ifdef THREADING_ALT_THREADX
+  return tx_mutex_get(&mutex->mutex, wait ? TX_WAIT_FOREVER : TX_NO_WAIT) == TX_SUCCESS;
+#else
+  return xSemaphoreTake(mutex->mutex, wait ? portMAX_DELAY : 0) == pdTRUE;
+#endif
+}
+
+/* count a lock of mutex, taken after waiting or not */
+static void threading_count(mbedtls_threading_mutex_t *mutex, int waited)
+{
+  mutex->locks++; //under the mutex
+  mutex->waits += waited;
+  THREADING_ENTER();
+  stats.locks++;
+  stats.waits += waited;
+  THREADING_EXIT();
+}
+
+static int threading_mutex_lock(mbedtls_threading_mutex_t *mutex)
+{
+  int waited;
+
+  if (!mutex->valid)
+  {
+    return MBEDTLS_ERR_THREADING_BAD_INPUT_DATA;
+  }
+  if (!THREADING_RUNNING())
+  {
+    return 0;
+  }
+  waited = !threading_take(mutex, 0);
+  if (waited && !threading_take(mutex, 1))
+  {
+    return MBEDTLS_ERR_THREADING_MUTEX_ERROR;
+  }
+  threading_count(mutex, waited);
+  return 0;
+}
+
+static int threading_mutex_unlock(mbedtls_threading_mutex_t *mutex)
+{
+  if (!mutex->valid)
+  {
+    return MBEDTLS_ERR_THREADING_BAD_INPUT_DATA;
+  }
+  if (!THREADING_RUNNING())
+  {
+    return 0;
+  }
+#ifdef THREADING_ALT_THREADX
+  return tx_mutex_put(&mutex->mutex) == TX_SUCCESS ? 0 : MBEDTLS_ERR_THREADING_MUTEX_ERROR;
+#else
+  return xSemaphoreGive(mutex->mutex) == pdTRUE ? 0 : MBEDTLS_ERR_THREADING_MUTEX_ERROR;
+#endif
+}
+
+/*
+ * threading_alt_init
+ * mbedTLS's mutexes on the RTOS's; before any other mbedTLS call
+ */
+void threading_alt_init(void)
+{
+  mbedtls_threading_set_alt(threading_mutex_init, threading_mutex_free, threading_mutex_lock, threading_mutex_unlock);
+}
+
+/*
+ * threading_alt_trylock
+ * take mutex if no task holds it: 0, or MBEDTLS_ERR_THREADING_MUTEX_ERROR.
+ * mbedtls_mutex_unlock releases it.
+ */
+int threading_alt_trylock(mbedtls_threading_mutex_t *mutex)
+{
+  if (!mutex->valid)
+  {
+    return MBEDTLS_ERR_THREADING_BAD_INPUT_DATA;
+  }
+  if (THREADING_RUNNING())
+  {
+    if (!threading_take(mutex, 0))
+    {
+      return MBEDTLS_ERR_THREADING_MUTEX_ERROR;
+    }
+    threading_count(mutex, 0);
+  }
+  return 0;
+}
+
+void threading_alt_get_stats(struct threading_alt_stats *st)
+{
+  THREADING_ENTER();
+  *st = stats;
+  THREADING_EXIT();
+}
+
+#endif /* MBEDTLS_THREADING_C && MBEDTLS_THREADING_ALT */
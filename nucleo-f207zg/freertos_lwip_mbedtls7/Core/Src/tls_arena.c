@@ -0,0 +1,227 @@
+/*
+ * tls_arena.c
+ *
+ * See tls_arena.h. A pool is a static array of blocks; a free block holds
+ * the address of the next free one, so that the free list costs no RAM, and
+ * a byte per block, aside, holds its owner. A block carries no header: free
+ * finds its class from the pool its address falls in, which keeps the
+ * 8-byte alignment mbedTLS expects and the small classes small. The lookups
+ * loop over the classes, a bound known at compile time.
+ */
+
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "mbedtls/ssl_internal.h"
+#include "tls_arena.h"
+
+#define TLS_ARENA_ALIGN(len) (((len) + 7) & ~7)
+#define TLS_ARENA_IN_LEN TLS_ARENA_ALIGN(MBEDTLS_SSL_IN_BUFFER_LEN)
+#define TLS_ARENA_OUT_LEN TLS_ARENA_ALIGN(MBEDTLS_SSL_OUT_BUFFER_LEN)
+#define TLS_ARENA_IN_S_LEN TLS_ARENA_ALIGN(MBEDTLS_SSL_IN_BUFFER_LEN - MBEDTLS_SSL_IN_CONTENT_LEN + TLS_MUX_IN_LEN)
+#define TLS_ARENA_OUT_S_LEN TLS_ARENA_ALIGN(MBEDTLS_SSL_OUT_BUFFER_LEN - MBEDTLS_SSL_OUT_CONTENT_LEN + TLS_MUX_OUT_LEN)
+#define TLS_ARENA_COUNT(per_session, per_handshake, shared) \
+  ((per_session) * TLS_ARENA_SESSIONS + (per_handshake) * TLS_ARENA_HANDSHAKES + (shared))
+#define TLS_ARENA_ARRAY(count) ((count) > 0 ? (count) : 1) //no zero-length array for an empty class
+
+struct tls_arena_class
+{
+  uint8_t *base; //the pool
+  uint8_t *owner; //of each block
+  void *free; //first free block
+};
+
+#define TLS_ARENA_POOL(name, len, per_session, per_handshake, shared) \
+  static uint64_t pool_##name[TLS_ARENA_ARRAY((len) / 8 * TLS_ARENA_COUNT(per_session, per_handshake, shared))]; \
+  static uint8_t owner_##name[TLS_ARENA_ARRAY(TLS_ARENA_COUNT(per_session, per_handshake, shared))];
+TLS_ARENA_CLASS_TABLE(TLS_ARENA_POOL)
+#undef TLS_ARENA_POOL
+
+#define TLS_ARENA_DESC(name, len, per_session, per_handshake, shared) {(uint8_t *)pool_##name, owner_##name, NULL},
+static struct tls_arena_class classes[TLS_ARENA_CLASSES] = {TLS_ARENA_CLASS_TABLE(TLS_ARENA_DESC)};
+#undef TLS_ARENA_DESC
+
+static struct tls_arena_stats stats;
+static int cur_owner = TLS_ARENA_SHARED; //owner of the allocations of...
+static TaskHandle_t owner_task; //...this task
+
+/*
+ * tls_arena_init
+ * chain the blocks of every pool; before the first allocation
+ */
+void tls_arena_init(void)
+{
+  struct tls_arena_class *c;
+  uint32_t i;
+  int k = 0;
+
+#define TLS_ARENA_SIZE(name, len, per_session, per_handshake, shared) \
+  stats.cls[k].size = (len); \
+  stats.cls[k].count = TLS_ARENA_COUNT(per_session, per_handshake, shared); \
+  k++;
+  TLS_ARENA_CLASS_TABLE(TLS_ARENA_SIZE)
+#undef TLS_ARENA_SIZE
+
+  for (k = 0; k < TLS_ARENA_CLASSES; k++)
+  {
+    c = &classes[k];
+    c->free = NULL;
+    for (i = stats.cls[k].count; i-- > 0;) //the first block at the head
+    {
+      *(void **)(c->base + i * stats.cls[k].size) = c->free;
+      c->free = c->base + i * stats.cls[k].size;
+    }
+    stats.size += stats.cls[k].size * stats.cls[k].count;
+  }
+}
+
+/*
+ * tls_arena_calloc
+ * mbedTLS's calloc: a zeroed block of the smallest class that fits and has
+ * one left, charged to the current owner. NULL if none. The classes are
+ * not sorted: the record buffers' sizes depend on the configuration.
+ */
+void *tls_arena_calloc(size_t n, size_t size)
+{
+  struct tls_arena_owner_stats *o;
+  struct tls_arena_class_stats *cs;
+  size_t len = n * size;
+  uint8_t *p = NULL;
+  int i, k, fit, owner;
+
+  if (size != 0 && len / size != n)
+  {
+    return NULL;
+  }
+
+  taskENTER_CRITICAL();
+  owner = cur_owner != TLS_ARENA_SHARED && xTaskGetCurrentTaskHandle() == owner_task ? cur_owner : TLS_ARENA_SHARED;
+  o = &stats.owner[owner];
+  fit = k = TLS_ARENA_CLASSES;
+  for (i = 0; i < TLS_ARENA_CLASSES; i++)
+  {
+    if (stats.cls[i].size < len || stats.cls[i].count == 0)
+    {
+      continue;
+    }
+    if (fit == TLS_ARENA_CLASSES || stats.cls[i].size < stats.cls[fit].size)
+    {
+      fit = i;
+    }
+    if (classes[i].free != NULL && (k == TLS_ARENA_CLASSES || stats.cls[i].size < stats.cls[k].size))
+    {
+      k = i;
+    }
+  }
+  if (k == TLS_ARENA_CLASSES)
+  {
+    o->failed++;
+    stats.failed++;
+    taskEXIT_CRITICAL();
+    return NULL;
+  }
+  cs = &stats.cls[k];
+  p = classes[k].free;
+  classes[k].free = *(void **)p;
+  classes[k].owner[(p - classes[k].base) / cs->size] = owner;
+  stats.cls[fit].spills += stats.cls[k].size != stats.cls[fit].size;
+  if (++cs->used > cs->peak)
+  {
+    cs->peak = cs->used;
+  }
+  stats.allocs++;
+  stats.used += cs->size;
+  if (stats.used > stats.peak)
+  {
+    stats.peak = stats.used;
+  }
+  o->used += cs->size;
+  if (o->used > o->peak)
+  {
+    o->peak = o->used;
+    if (owner != TLS_ARENA_SHARED && o->peak > stats.session_peak)
+    {
+      stats.session_peak = o->peak;
+    }
+  }
+  taskEXIT_CRITICAL();
+
+  memset(p, 0, cs->size < len ? cs->size : len);
+  return p;
+}
+
+/*
+ * tls_arena_free
+ * mbedTLS's free: the block back to the head of its pool's list, and off
+ * its owner's bytes
+ */
+void tls_arena_free(void *ptr)
+{
+  struct tls_arena_class_stats *cs;
+  uint8_t *p = ptr;
+  uint32_t i;
+  int k;
+
+  if (ptr == NULL)
+  {
+    return;
+  }
+  for (k = 0; k < TLS_ARENA_CLASSES; k++)
+  {
+    cs = &stats.cls[k];
+    if (p >= classes[k].base && p < classes[k].base + cs->size * cs->count)
+    {
+      break;
+    }
+  }
+  if (k == TLS_ARENA_CLASSES)
+  {
+    return; //not from the arena
+  }
+  i = (p - classes[k].base) / cs->size;
+
+  taskENTER_CRITICAL();
+  *(void **)p = classes[k].free;
+  classes[k].free = p;
+  cs->used--;
+  stats.used -= cs->size;
+  stats.owner[classes[k].owner[i]].used -= cs->size;
+  taskEXIT_CRITICAL();
+}
+
+/*
+ * tls_arena_owner
+ * charge the calling task's next allocations to owner (a session, or
+ * TLS_ARENA_SHARED); returns the previous owner, to restore
+ */
+int tls_arena_owner(int owner)
+{
+  int prev;
+
+  taskENTER_CRITICAL();
+  prev = cur_owner;
+  cur_owner = owner;
+  owner_task = xTaskGetCurrentTaskHandle();
+  taskEXIT_CRITICAL();
+  return prev;
+}
+
+/*
+ * tls_arena_open
+ * a new session takes owner: its peak and failures start over
+ */
+void tls_arena_open(int owner)
+{
+  taskENTER_CRITICAL();
+  stats.owner[owner].peak = stats.owner[owner].used;
+  stats.owner[owner].failed = 0;
+  taskEXIT_CRITICAL();
+}
+
+void tls_arena_get_stats(struct tls_arena_stats *st)
+{
+  taskENTER_CRITICAL();
+  *st = stats;
+  taskEXIT_CRITICAL();
+}
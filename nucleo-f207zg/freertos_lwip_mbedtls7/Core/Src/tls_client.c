@@ -0,0 +1,623 @@
+/*
+ * tls_client.c
+ *
+ * See tls_client.h. Each session has a struct tls_client, the argument of
+ * its event callback: requests are written from the task loop when due,
+ * responses are reassembled in rx from whatever tls_read returns.
+ *
+ * Every session, the bulk one too, is offered the saved session when it is
+ * opened. A full handshake replaces it, in RAM and in flash: the server
+ * declined to resume it, or there was none.
+ *
+ * The bulk test writes a counter pattern (byte i of the stream is i & 0xFF)
+ * straight into tls_alloc's record, or into bulk_buf for tls_write when the
+ * zero-copy path is off, and checks it where tls_recv_zc returns it.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "cmsis_os.h"
+#include "lwip/ip_addr.h"
+#include "mbedtls/sha256.h"
+#include "mbedtls/x509_crt.h"
+#include "ecp_fast.h"
+#include "rng.h"
+#include "tls_arena.h"
+#include "tls_client.h"
+#include "tls_store.h"
+
+#define TP2_MAGIC 0xAF
+#define TP2_VERSION 2
+#define TP2_HDR 8 //magic, version << 4 | type, len, flags, seq[4] (see lwip_bare tcp_client.h)
+#define TP2_BODY_MAX 16
+#define TP2_REQ 0
+#define TP2_RESP 1
+
+#define TLS_CLIENT_LOOP_MS 100 //tls_mux_run slice between two request checks
+
+#if TLS_MUX_IN_LEN == 512 //max_fragment_length asked of the server: the records that fit the shrunk buffer
+#define TLS_CLIENT_MFL MBEDTLS_SSL_MAX_FRAG_LEN_512
+#elif TLS_MUX_IN_LEN == 1024
+#define TLS_CLIENT_MFL MBEDTLS_SSL_MAX_FRAG_LEN_1024
+#elif TLS_MUX_IN_LEN == 2048
+#define TLS_CLIENT_MFL MBEDTLS_SSL_MAX_FRAG_LEN_2048
+#elif TLS_MUX_IN_LEN == 4096
+#define TLS_CLIENT_MFL MBEDTLS_SSL_MAX_FRAG_LEN_4096
+#else
+#define TLS_CLIENT_MFL MBEDTLS_SSL_MAX_FRAG_LEN_NONE
+#endif
+
+struct tls_client
+{
+  struct tls_session *s; //NULL while closed
+  uint8_t open; //handshake done
+  uint8_t tx_pending; //request waiting for TLS_EV_WRITE
+  uint8_t tx[TP2_HDR];
+  uint8_t rx[TP2_HDR + TP2_BODY_MAX];
+  uint8_t rx_len;
+  uint32_t seq; //sequence number of the next request
+  uint32_t sent; //tick of the request in flight, 0 if none
+  uint32_t due; //tick of the next request, or of the next tls_open
+};
+
+static struct tls_client clients[TLS_CLIENT_SESSIONS];
+static mbedtls_ssl_config conf;
+#ifdef TLS_CLIENT_CA_PEM
+static mbedtls_x509_crt ca;
+#endif
+#if TLS_CLIENT_RESUME
+static mbedtls_ssl_session session; //offered by tls_open...
+static uint8_t session_valid; //...once there is one
+#endif
+static uint32_t responses, errors, closes;
+static uint32_t lat_max, lat_sum; //request to response, ms
+
+#ifdef TLS_CLIENT_BULK_KB
+#define TLS_CLIENT_BULK_LEN ((uint32_t)TLS_CLIENT_BULK_KB * 1024)
+
+static struct
+{
+  struct tls_session *s; //NULL while closed
+  uint32_t tx; //bytes sent...
+  uint32_t rx; //...and received back
+  uint32_t bad; //received bytes that differ from the pattern
+  uint32_t start; //tick of TLS_EV_OPEN
+  uint32_t due; //tick of the next tls_open
+  struct tls_mux_stats st; //at TLS_EV_OPEN
+} bulk;
+static uint8_t bulk_buf[TLS_CLIENT_BULK_REC];
+#endif
+
+/*
+ * tls_client_fingerprint
+ * print the SHA-256 of the server certificate, as go_tstamp_srv logs it
+ */
+static void tls_client_fingerprint(struct tls_session *s)
+{
+  const mbedtls_x509_crt *crt = mbedtls_ssl_get_peer_cert(&s->ssl);
+  unsigned char sum[32];
+  int i;
+
+  if (s->resumed)
+  {
+    printf("[TLS] %s, session resumed\r\n", mbedtls_ssl_get_ciphersuite(&s->ssl));
+    return;
+  }
+  if (crt == NULL || mbedtls_sha256_ret(crt->raw.p, crt->raw.len, sum, 0) != 0)
+  {
+    return;
+  }
+  printf("[TLS] %s, server certificate SHA-256 ", mbedtls_ssl_get_ciphersuite(&s->ssl));
+  for (i = 0; i < 32; i++)
+  {
+    printf("%02x", sum[i]);
+  }
+  printf("\r\n");
+}
+
+/*
+ * tls_client_open
+ * tls_open to the server, offering the saved session
+ */
+static struct tls_session *tls_client_open(const ip_addr_t *addr, u16_t port, tls_event_fn fn, void *arg)
+{
+  struct tls_session *s = tls_open(addr, port, TLS_CLIENT_HOSTNAME, fn, arg);
+
+#if TLS_CLIENT_RESUME
+  if (s != NULL && session_valid)
+  {
+    tls_set_session(s, &session);
+  }
+#endif
+  return s;
+}
+
+/*
+ * tls_client_keep
+ * after a full handshake, save its session for the next ones
+ */
+static void tls_client_keep(struct tls_session *s)
+{
+#if TLS_CLIENT_RESUME
+  if (s->resumed || tls_get_session(s, &session) != 0)
+  {
+    return;
+  }
+  session_valid = 1;
+  if (tls_store_save(&session) != 0)
+  {
+    printf("[TLS] session not saved: flash error\r\n");
+  }
+#else
+  (void)s;
+#endif
+}
+
+/*
+ * tls_client_send
+ * write the request of c, or leave it for TLS_EV_WRITE
+ */
+static void tls_client_send(struct tls_client *c)
+{
+  int ret = tls_write(c->s, c->tx, sizeof(c->tx));
+
+  c->tx_pending = ret == MBEDTLS_ERR_SSL_WANT_WRITE;
+}
+
+/*
+ * tls_client_recv
+ * read what is there, and check the responses completed
+ */
+static void tls_client_recv(struct tls_client *c)
+{
+  uint32_t ms;
+  int ret, need;
+
+  while (1)
+  {
+    need = c->rx_len < TP2_HDR ? TP2_HDR : TP2_HDR + c->rx[2];
+    ret = tls_read(c->s, c->rx + c->rx_len, need - c->rx_len);
+    if (ret <= 0)
+    {
+      return; //WANT_READ, or the session is closing
+    }
+    c->rx_len += ret;
+
+    if (c->rx_len == TP2_HDR &&
+        (c->rx[0] != TP2_MAGIC || c->rx[1] != ((TP2_VERSION << 4) | TP2_RESP) || c->rx[2] > TP2_BODY_MAX))
+    {
+      errors++;
+      tls_close(c->s); //out of sync
+      c->s = NULL;
+      c->due = osKernelSysTick() + TLS_CLIENT_RETRY_MS;
+      return;
+    }
+    if (c->rx_len < TP2_HDR || c->rx_len < TP2_HDR + c->rx[2])
+    {
+      continue;
+    }
+
+    if (c->sent != 0 && memcmp(c->rx + 4, c->tx + 4, 4) == 0)
+    {
+      ms = osKernelSysTick() - c->sent;
+      responses++;
+      lat_sum += ms;
+      if (ms > lat_max)
+      {
+        lat_max = ms;
+      }
+      c->sent = 0;
+    }
+    else
+    {
+      errors++; //not the sequence number in flight
+    }
+    c->rx_len = 0;
+  }
+}
+
+/*
+ * tls_client_event
+ * session events, from tls_mux_run
+ */
+static void tls_client_event(struct tls_session *s, enum tls_event ev, void *arg)
+{
+  struct tls_client *c = arg;
+
+  switch (ev)
+  {
+    case TLS_EV_OPEN:
+      c->open = 1;
+      c->due = osKernelSysTick();
+      tls_client_keep(s);
+      if (c == clients)
+      {
+        tls_client_fingerprint(s);
+      }
+      break;
+    case TLS_EV_READ:
+      tls_client_recv(c);
+      break;
+    case TLS_EV_WRITE:
+      if (c->tx_pending)
+      {
+        tls_client_send(c);
+      }
+      break;
+    case TLS_EV_CLOSED:
+      if (s->err != 0)
+      {
+        printf("[TLS] session %d %s: -0x%04x\r\n", (int)(c - clients), c->open ? "failed" : "handshake failed",
+               (unsigned int)-s->err);
+      }
+      closes++;
+      c->s = NULL;
+      c->due = osKernelSysTick() + TLS_CLIENT_RETRY_MS;
+      break;
+  }
+}
+
+#ifdef TLS_CLIENT_BULK_KB
+/*
+ * tls_client_bulk_send
+ * send the pattern until the send buffer or the record queue is full
+ */
+static void tls_client_bulk_send(void)
+{
+  uint32_t len, i;
+  uint8_t *p;
+  int ret;
+
+  while (bulk.tx < TLS_CLIENT_BULK_LEN)
+  {
+    len = TLS_CLIENT_BULK_LEN - bulk.tx;
+    if (len > TLS_CLIENT_BULK_REC)
+    {
+      len = TLS_CLIENT_BULK_REC;
+    }
+    p = tls_alloc(bulk.s, len);
+    if (p == NULL && bulk.s->want_write)
+    {
+      return; //TLS_EV_WRITE
+    }
+    for (i = 0; i < len; i++)
+    {
+      (p != NULL ? p : bulk_buf)[i] = bulk.tx + i;
+    }
+    ret = p != NULL ? tls_send(bulk.s, len) : tls_write(bulk.s, bulk_buf, len);
+    if (ret <= 0)
+    {
+      return; //WANT_WRITE, the same call on TLS_EV_WRITE, or the session is closing
+    }
+    bulk.tx += ret;
+  }
+}
+
+/*
+ * tls_client_bulk_report
+ * rate and copies of the run, from the tls_mux_stats deltas
+ */
+static void tls_client_bulk_report(void)
+{
+  struct tls_mux_stats st;
+  uint32_t ms = osKernelSysTick() - bulk.start, rec;
+
+  tls_mux_get_stats(&st);
+  rec = st.rx_records - bulk.st.rx_records + st.tx_records - bulk.st.tx_records;
+  printf("[TLS] bulk %lu kB echoed in %lu ms, %lu kB/s each way, %lu bad bytes\r\n", (unsigned long)TLS_CLIENT_BULK_KB,
+         (unsigned long)ms, (unsigned long)(ms ? TLS_CLIENT_BULK_KB * 1000UL / ms : 0), (unsigned long)bulk.bad);
+  printf("[TLS] bulk records %lu sent (%lu zero-copy), %lu received (%lu zero-copy), %lu B copied per record\r\n",
+         (unsigned long)(st.tx_records - bulk.st.tx_records), (unsigned long)(st.tx_zc - bulk.st.tx_zc),
+         (unsigned long)(st.rx_records - bulk.st.rx_records), (unsigned long)(st.rx_zc - bulk.st.rx_zc),
+         (unsigned long)(rec ? (st.copied - bulk.st.copied) / rec : 0));
+}
+
+/*
+ * tls_client_bulk_recv
+ * check what came back; once all of it did, report and close
+ */
+static void tls_client_bulk_recv(void)
+{
+  const uint8_t *data;
+  int ret, i;
+
+  while ((ret = tls_recv_zc(bulk.s, &data)) > 0)
+  {
+    for (i = 0; i < ret; i++)
+    {
+      bulk.bad += data[i] != (uint8_t)(bulk.rx + i);
+    }
+    bulk.rx += ret;
+  }
+  if (bulk.rx >= TLS_CLIENT_BULK_LEN)
+  {
+    tls_client_bulk_report();
+    tls_close(bulk.s);
+    bulk.s = NULL;
+    bulk.due = osKernelSysTick() + TLS_CLIENT_REPORT_MS;
+  }
+}
+
+/*
+ * tls_client_bulk_event
+ * events of the bulk session, from tls_mux_run
+ */
+static void tls_client_bulk_event(struct tls_session *s, enum tls_event ev, void *arg)
+{
+  (void)arg;
+
+  switch (ev)
+  {
+    case TLS_EV_OPEN:
+      tls_client_fingerprint(s);
+      tls_client_keep(s);
+      bulk.start = osKernelSysTick();
+      tls_mux_get_stats(&bulk.st);
+      tls_client_bulk_send();
+      break;
+    case TLS_EV_READ:
+      tls_client_bulk_recv();
+      break;
+    case TLS_EV_WRITE:
+      tls_client_bulk_send();
+      break;
+    case TLS_EV_CLOSED:
+      printf("[TLS] bulk session closed after %lu/%lu bytes: -0x%04x\r\n", (unsigned long)bulk.rx,
+             (unsigned long)TLS_CLIENT_BULK_LEN, (unsigned int)-s->err);
+      closes++;
+      bulk.s = NULL;
+      bulk.due = osKernelSysTick() + TLS_CLIENT_RETRY_MS;
+      break;
+  }
+}
+#endif
+
+/*
+ * tls_client_config
+ * TLS 1.2 client configuration, on the shared RNG: the sessions', and
+ * host_tlsbench.c's
+ */
+int tls_client_config(mbedtls_ssl_config *config)
+{
+  int ret;
+
+  mbedtls_ssl_config_init(config);
+
+  ret = mbedtls_ssl_config_defaults(config, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                    MBEDTLS_SSL_PRESET_DEFAULT);
+  if (ret != 0)
+  {
+    return ret;
+  }
+  mbedtls_ssl_conf_rng(config, rng_random, NULL); //seeded by StartDefaultTask
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH) && TLS_MUX_SHRINK
+  ret = mbedtls_ssl_conf_max_frag_len(config, TLS_CLIENT_MFL);
+  if (ret != 0)
+  {
+    return ret;
+  }
+#endif
+
+#ifdef TLS_CLIENT_CA_PEM
+  mbedtls_x509_crt_init(&ca);
+  ret = mbedtls_x509_crt_parse(&ca, (const unsigned char *)TLS_CLIENT_CA_PEM, sizeof(TLS_CLIENT_CA_PEM));
+  if (ret != 0)
+  {
+    return ret;
+  }
+  mbedtls_ssl_conf_ca_chain(config, &ca, NULL);
+  mbedtls_ssl_conf_authmode(config, MBEDTLS_SSL_VERIFY_REQUIRED);
+#else
+  mbedtls_ssl_conf_authmode(config, MBEDTLS_SSL_VERIFY_NONE); //the server's certificate is made at start: check its fingerprint instead
+#endif
+  return 0;
+}
+
+/*
+ * tls_client_setup
+ * configuration shared by the sessions, and the saved session
+ */
+static int tls_client_setup(void)
+{
+  int ret;
+
+  ret = tls_client_config(&conf);
+  if (ret != 0)
+  {
+    return ret;
+  }
+#if TLS_CLIENT_RESUME
+  mbedtls_ssl_session_init(&session);
+  session_valid = tls_store_load(&session) == 0;
+  printf("[TLS] %s\r\n", session_valid ? "session loaded from flash" : "no session in flash");
+#endif
+  return 0;
+}
+
+/*
+ * tls_client_report_hs
+ * averages of the full or resumed handshakes
+ */
+static void tls_client_report_hs(const char *name, const struct tls_hs_stats *hs)
+{
+  uint32_t n = hs->count ? hs->count : 1;
+
+  printf("[TLS] %lu %s handshakes, avg %lu ms, %lu kcycles, %lu B sent, %lu B received\r\n", (unsigned long)hs->count,
+         name, (unsigned long)(hs->ms_sum / n), (unsigned long)(hs->kcycles_sum / n), (unsigned long)(hs->tx_bytes / n),
+         (unsigned long)(hs->rx_bytes / n));
+}
+
+#if TLS_MUX_ARENA
+/*
+ * tls_client_report_arena
+ * the arena, its owners (bytes in use, peak, failed allocations) and its
+ * classes (blocks in use, peak, count, spills)
+ */
+static void tls_client_report_arena(void)
+{
+  struct tls_arena_stats as;
+  int i;
+
+  tls_arena_get_stats(&as);
+  printf("[TLS] arena %lu/%lu B used, peak %lu B, %lu allocations, %lu failed, session peak %lu B\r\n",
+         (unsigned long)as.used, (unsigned long)as.size, (unsigned long)as.peak, (unsigned long)as.allocs,
+         (unsigned long)as.failed, (unsigned long)as.session_peak);
+  printf("[TLS] arena owners B/peak/failed:");
+  for (i = 0; i < TLS_ARENA_OWNERS; i++)
+  {
+    if (i == TLS_ARENA_SHARED)
+    {
+      printf(" shared:");
+    }
+    else
+    {
+      printf(" %d:", i);
+    }
+    printf(" %lu/%lu/%lu", (unsigned long)as.owner[i].used, (unsigned long)as.owner[i].peak,
+           (unsigned long)as.owner[i].failed);
+  }
+  printf("\r\n[TLS] arena classes blocks/peak/count+spills:");
+  for (i = 0; i < TLS_ARENA_CLASSES; i++)
+  {
+    printf(" %lu %u/%u/%u+%lu", (unsigned long)as.cls[i].size, as.cls[i].used, as.cls[i].peak, as.cls[i].count,
+           (unsigned long)as.cls[i].spills);
+  }
+  printf("\r\n");
+}
+#endif
+
+/*
+ * tls_client_report
+ * sessions, handshakes, responses and the mbedTLS heap per session
+ */
+static void tls_client_report(size_t mem_base)
+{
+  struct tls_mux_stats st;
+  struct ecp_fast_stats es;
+#if TLS_CLIENT_RESUME
+  struct tls_store_stats ss;
+#endif
+  int open = tls_mux_count();
+
+  tls_mux_get_stats(&st);
+  ecp_fast_get_stats(&es);
+  printf("[TLS] %d/%d sessions, %lu handshakes (%lu failed), handshake avg/max %lu/%lu ms, %lu steps each, %lu wakeups\r\n",
+         open, TLS_CLIENT_SESSIONS, (unsigned long)st.established, (unsigned long)st.failed,
+         (unsigned long)(st.established ? st.hs_ms_sum / st.established : 0), (unsigned long)st.hs_ms_max,
+         (unsigned long)(st.established ? st.steps / st.established : 0), (unsigned long)st.wakeups);
+  printf("[TLS] handshake step max %lu us, %lu ECC pauses each, tcpip_thread latency avg/max %lu/%lu us (%lu probes)\r\n",
+         (unsigned long)st.step_us_max, (unsigned long)(st.established ? st.ecp_pauses / st.established : 0),
+         (unsigned long)(st.probes ? st.probe_us_sum / st.probes : 0), (unsigned long)st.probe_us_max,
+         (unsigned long)st.probes);
+  tls_client_report_hs("full", &st.full);
+  tls_client_report_hs("resumed", &st.resumed);
+  printf("[TLS] first handshake %lu ms, %lu kcycles; ECC %lu base point multiplications on flash tables, %lu X25519, %lu other\r\n",
+         (unsigned long)st.hs_ms_first, (unsigned long)st.hs_kcycles_first, (unsigned long)es.flash,
+         (unsigned long)es.x25519, (unsigned long)es.other);
+  printf("[TLS] %lu sessions opened, %lu queued for a handshake, %lu shrunk to %u/%u B records, %lu oversized records\r\n",
+         (unsigned long)st.opened, (unsigned long)st.queued, (unsigned long)st.shrunk, TLS_MUX_IN_LEN, TLS_MUX_OUT_LEN,
+         (unsigned long)st.oversized);
+#if TLS_CLIENT_RESUME
+  tls_store_get_stats(&ss);
+  printf("[TLS] session store %lu saves, %lu erases, %lu/%lu B used, save max %lu us, erase max %lu us\r\n",
+         (unsigned long)ss.saves, (unsigned long)ss.erases, (unsigned long)ss.used, (unsigned long)TLS_STORE_SIZE,
+         (unsigned long)ss.save_us_max, (unsigned long)ss.erase_us_max);
+#endif
+  printf("[TLS] %lu responses, %lu errors, %lu closes, latency avg/max %lu/%lu ms, heap %lu B per session (peak %lu B), %lu B of state each\r\n",
+         (unsigned long)responses, (unsigned long)errors, (unsigned long)closes,
+         (unsigned long)(responses ? lat_sum / responses : 0), (unsigned long)lat_max,
+         (unsigned long)(open ? (st.mem_used - mem_base) / open : 0), (unsigned long)(st.mem_peak - mem_base),
+         (unsigned long)sizeof(struct tls_session));
+#if TLS_MUX_ARENA
+  tls_client_report_arena();
+#endif
+}
+
+/*
+ * StartTlsClientTask
+ * open the sessions and serve them, sending the requests when due
+ */
+void StartTlsClientTask(void const *argument)
+{
+  struct tls_mux_stats st;
+  struct tls_client *c;
+  ip_addr_t addr;
+  uint32_t now, report;
+  size_t mem_base;
+  int ret;
+
+  (void)argument;
+
+  tls_mux_init(&conf); //first, so that the setup allocations are counted
+  ret = tls_client_setup();
+  if (ret != 0)
+  {
+    printf("[TLS] setup failed: -0x%04x\r\n", (unsigned int)-ret);
+    osThreadTerminate(NULL);
+    return;
+  }
+  tls_mux_get_stats(&st);
+  mem_base = st.mem_used; //configuration, CA, DRBG
+
+  IP4_ADDR(&addr, TLS_SERVER_IP1, TLS_SERVER_IP2, TLS_SERVER_IP3, TLS_SERVER_IP4);
+  report = osKernelSysTick() + TLS_CLIENT_REPORT_MS;
+
+  for (;;)
+  {
+    now = osKernelSysTick();
+#ifdef TLS_CLIENT_BULK_KB
+    if (bulk.s == NULL && (int32_t)(now - bulk.due) >= 0)
+    {
+      bulk.tx = 0;
+      bulk.rx = 0;
+      bulk.bad = 0;
+      bulk.s = tls_client_open(&addr, TLS_SERVER_ECHO_PORT, tls_client_bulk_event, NULL);
+      if (bulk.s == NULL)
+      {
+        bulk.due = now + TLS_CLIENT_RETRY_MS;
+      }
+    }
+#endif
+    for (c = clients; c < clients + TLS_CLIENT_SESSIONS; c++)
+    {
+      if (c->s == NULL)
+      {
+        if ((int32_t)(now - c->due) >= 0)
+        {
+          c->open = 0;
+          c->tx_pending = 0;
+          c->rx_len = 0;
+          c->sent = 0;
+          c->s = tls_client_open(&addr, TLS_SERVER_PORT, tls_client_event, c);
+          if (c->s == NULL)
+          {
+            c->due = now + TLS_CLIENT_RETRY_MS;
+          }
+        }
+      }
+      else if (c->open && c->sent == 0 && (int32_t)(now - c->due) >= 0)
+      {
+        memset(c->tx, 0, sizeof(c->tx));
+        c->tx[0] = TP2_MAGIC;
+        c->tx[1] = (TP2_VERSION << 4) | TP2_REQ;
+        c->tx[4] = c->seq;
+        c->tx[5] = c->seq >> 8;
+        c->tx[6] = c->seq >> 16;
+        c->tx[7] = c->seq >> 24;
+        c->seq++;
+        c->sent = now != 0 ? now : 1;
+        c->due = now + TLS_CLIENT_PERIOD_MS;
+        tls_client_send(c);
+      }
+    }
+
+    if ((int32_t)(now - report) >= 0)
+    {
+      tls_client_report(mem_base);
+      report = now + TLS_CLIENT_REPORT_MS;
+    }
+
+    tls_mux_run(TLS_CLIENT_LOOP_MS);
+  }
+}
@@ -0,0 +1,1501 @@
+/*
+ * tls_mux.c
+ *
+ * See tls_mux.h. lwIP 2.0.3 netconns have no non-blocking receive, so the
+ * session counts the messages waiting in its receive mailbox from the
+ * RCVPLUS/RCVMINUS events, as the socket layer does for select(), and only
+ * calls netconn_recv_tcp_pbuf when one is there. Sends use
+ * netconn_write_partly with NETCONN_DONTBLOCK, and the connect is
+ * non-blocking (netconn_set_nonblocking): its end is a SENDPLUS or ERROR
+ * event. The pbufs received are kept, chained, and handed to mbedTLS in
+ * the pieces it asks for (a record header, then its body).
+ *
+ * The zero-copy path reuses the keys, fixed IVs and record counters of
+ * mbedTLS's transform (ssl_internal.h), so that both paths can follow each
+ * other on a session. A received AES-GCM record is decrypted where it lies
+ * with mbedtls_gcm_update, whole blocks in place in each pbuf; a block
+ * split between two pbufs goes through a 16-byte buffer. A sent record is
+ * encrypted in a PBUF_RAM pbuf and written without NETCONN_COPY: TCP points
+ * to it until the peer acknowledges it (pcb->lastack past the end of the
+ * record, read under the core lock), then it is freed. A session that ends
+ * before that aborts its connection, so that no segment outlives the pbuf.
+ *
+ * A handshake step cut short by the ECC budget returns CRYPTO_IN_PROGRESS,
+ * and the session is flagged ready for the next pass, which starts with
+ * taskYIELD instead of a blocking wait. The task also yields after every
+ * handshake step, so that tcpip_thread waits for one step at most, and not
+ * for one per session. The latency probe is a tcpip_callback stamped with the
+ * cycle counter, one at a time, posted before a pass that steps a handshake.
+ *
+ * mbedTLS decides on resumption when it reads the ServerHello, and keeps it
+ * in ssl->handshake->resume (ssl_internal.h), which the handshake's last
+ * step frees: the flag is copied to the session after every step. The
+ * handshake's bytes are counted by the BIO.
+ *
+ * With MBEDTLS_PLATFORM_MEMORY, mbedTLS allocates from tls_arena.c, or
+ * through a wrapper of calloc/free that counts the bytes in use. The arena
+ * charges a block to the session whose mbedTLS call allocated it: the
+ * mbedTLS calls on a session that can allocate (setup, handshake steps,
+ * reads and writes) are made with the session as the arena's owner, and
+ * tls_get_session's copy, which outlives the session, is shared.
+ *
+ * mbedTLS 2.16 sizes its record buffers at compile time (the variable
+ * buffers of MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH came with 2.23), so the
+ * session swaps them itself once the handshake is over: it allocates the
+ * smaller ones, copies what precedes the record's plaintext (the counter,
+ * header and explicit IV of the current transform), moves mbedTLS's
+ * pointers by the same offsets, and frees the large ones. mbedTLS still
+ * reads a record as long as MBEDTLS_SSL_IN_CONTENT_LEN into in_hdr, so the
+ * BIO refuses to write past the end of the small buffer, and
+ * mbedtls_ssl_free, which zeroizes the buffers at their compile-time length,
+ * finds them already freed.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "cmsis_os.h"
+#include "lwip/tcp.h"
+#include "lwip/tcpip.h"
+#include "main.h"
+#include "mbedtls/ecp.h"
+#include "mbedtls/gcm.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/platform.h"
+#include "mbedtls/platform_util.h"
+#include "mbedtls/ssl_internal.h"
+#include "cycles.h"
+#include "tls_arena.h"
+#include "tls_mux.h"
+#ifdef METRICS_ENABLE
+#include "metrics.h"
+#endif
+
+enum
+{
+  TLS_S_FREE,
+  TLS_S_QUEUED, //opened, waits for a handshake to end
+  TLS_S_CONNECT,
+  TLS_S_HANDSHAKE,
+  TLS_S_OPEN,
+  TLS_S_CLOSING, //ended by tls_read/tls_write, TLS_EV_CLOSED on the next pass
+  TLS_S_DRAIN //closed by tls_close, its records still to be acknowledged
+};
+
+#if TLS_MUX_ARENA && !defined(MBEDTLS_PLATFORM_MEMORY)
+#error "TLS_MUX_ARENA needs MBEDTLS_PLATFORM_MEMORY"
+#endif
+#if TLS_MUX_SHRINK && (TLS_MUX_IN_LEN > MBEDTLS_SSL_IN_CONTENT_LEN || TLS_MUX_OUT_LEN > MBEDTLS_SSL_OUT_CONTENT_LEN)
+#error "TLS_MUX_IN_LEN and TLS_MUX_OUT_LEN shrink MBEDTLS_SSL_IN/OUT_CONTENT_LEN"
+#endif
+#if TLS_MUX_ZEROCOPY && !LWIP_TCPIP_CORE_LOCKING
+#error "TLS_MUX_ZEROCOPY reads the TCP sequence numbers under LOCK_TCPIP_CORE"
+#endif
+
+#define TLS_REC_HDR 5 //type, version, length
+#define TLS_GCM_EXPLICIT 8 //explicit part of the nonce, the record counter
+#define TLS_GCM_TAG 16
+#define TLS_COPY_MAX 512 //tls_recv_zc buffer, for the records left to mbedTLS
+#define TLS_IN_LEN (MBEDTLS_SSL_IN_BUFFER_LEN - MBEDTLS_SSL_IN_CONTENT_LEN + TLS_MUX_IN_LEN) //record buffers after the handshake
+#define TLS_OUT_LEN (MBEDTLS_SSL_OUT_BUFFER_LEN - MBEDTLS_SSL_OUT_CONTENT_LEN + TLS_MUX_OUT_LEN)
+
+static struct tls_session sessions[TLS_MUX_SESSIONS];
+static const mbedtls_ssl_config *ssl_conf;
+static TaskHandle_t mux_task;
+static uint32_t ready; //sessions to step on the next pass without an event
+static struct tls_mux_stats stats;
+static volatile uint8_t probe_pending; //a probe is queued to tcpip_thread...
+static uint32_t probe_start; //...since this cycle count
+#ifdef METRICS_ENABLE
+static struct metrics_op op_handshake = METRICS_OP_INIT("tls.handshake");
+static struct metrics_op op_step = METRICS_OP_INIT("tls.handshake_step");
+static struct metrics_op op_probe = METRICS_OP_INIT("tls.tcpip_latency");
+#endif
+
+static uint8_t rx_copy[TLS_COPY_MAX];
+
+#define TLS_BIT(s) (1UL << ((s) - sessions))
+
+#if defined(MBEDTLS_PLATFORM_MEMORY) && !TLS_MUX_ARENA
+#define TLS_MEM_HDR 8 //size of the block, keeps the 8-byte alignment
+
+static void *tls_mem_calloc(size_t n, size_t size)
+{
+  size_t len = n * size;
+  uint8_t *p;
+
+  if (size != 0 && len / size != n)
+  {
+    return NULL;
+  }
+  p = calloc(1, len + TLS_MEM_HDR);
+  if (p == NULL)
+  {
+    return NULL;
+  }
+  *(size_t *)p = len;
+
+  taskENTER_CRITICAL();
+  stats.mem_used += len;
+  if (stats.mem_used > stats.mem_peak)
+  {
+    stats.mem_peak = stats.mem_used;
+  }
+  taskEXIT_CRITICAL();
+  return p + TLS_MEM_HDR;
+}
+
+static void tls_mem_free(void *ptr)
+{
+  uint8_t *p = (uint8_t *)ptr - TLS_MEM_HDR;
+
+  if (ptr == NULL)
+  {
+    return;
+  }
+  taskENTER_CRITICAL();
+  stats.mem_used -= *(size_t *)p;
+  taskEXIT_CRITICAL();
+  free(p);
+}
+#endif
+
+/*
+ * tls_owner
+ * charge the task's next mbedTLS allocations to session owner (or
+ * TLS_ARENA_SHARED); returns the previous owner, to restore
+ */
+static int tls_owner(int owner)
+{
+#if TLS_MUX_ARENA
+  return tls_arena_owner(owner);
+#else
+  (void)owner;
+  return 0;
+#endif
+}
+
+/*
+ * tls_event
+ * netconn callback, mostly run by tcpip_thread: note the event and wake the
+ * task. RCVMINUS and SENDMINUS come from the task's own calls.
+ */
+static void tls_event(struct netconn *conn, enum netconn_evt evt, u16_t len)
+{
+  struct tls_session *s;
+  SYS_ARCH_DECL_PROTECT(lev);
+
+  LWIP_UNUSED_ARG(len);
+
+  for (s = sessions; s < sessions + TLS_MUX_SESSIONS && s->conn != conn; s++)
+  {
+  }
+  if (s == sessions + TLS_MUX_SESSIONS) //closed, these are the events of netconn_delete
+  {
+    return;
+  }
+
+  switch (evt)
+  {
+    case NETCONN_EVT_RCVPLUS:
+      SYS_ARCH_PROTECT(lev);
+      s->rx_queued++;
+      SYS_ARCH_UNPROTECT(lev);
+      break;
+    case NETCONN_EVT_RCVMINUS:
+      SYS_ARCH_PROTECT(lev);
+      s->rx_queued--;
+      SYS_ARCH_UNPROTECT(lev);
+      return;
+    case NETCONN_EVT_ERROR:
+      s->failed = 1;
+      break;
+    case NETCONN_EVT_SENDPLUS: //connected, or send buffer space again
+      break;
+    default:
+      return;
+  }
+  xTaskNotify(mux_task, TLS_BIT(s), eSetBits);
+}
+
+/*
+ * tls_bio_send
+ * queue what fits in the send buffer, copied
+ */
+static int tls_bio_send(void *ctx, const unsigned char *buf, size_t len)
+{
+  struct tls_session *s = ctx;
+  size_t written = 0;
+  err_t err;
+
+  if (s->failed)
+  {
+    return MBEDTLS_ERR_NET_CONN_RESET;
+  }
+
+  err = netconn_write_partly(s->conn, buf, len, NETCONN_COPY | NETCONN_DONTBLOCK, &written);
+  if (err == ERR_WOULDBLOCK || (err == ERR_OK && written == 0)) //SENDPLUS when there is room again
+  {
+    return MBEDTLS_ERR_SSL_WANT_WRITE;
+  }
+  if (err != ERR_OK)
+  {
+    return MBEDTLS_ERR_NET_SEND_FAILED;
+  }
+  if (s->state == TLS_S_OPEN)
+  {
+    stats.copied += written;
+  }
+  else
+  {
+    s->hs_tx += written;
+  }
+  return (int)written;
+}
+
+static u16_t tls_rx_held(const struct tls_session *s)
+{
+  return s->rx != NULL ? s->rx->tot_len - s->rx_off : 0;
+}
+
+/*
+ * tls_rx_drop
+ * consume n bytes of rx, freeing the pbufs passed
+ */
+static void tls_rx_drop(struct tls_session *s, u32_t n)
+{
+  struct pbuf *q;
+
+  n += s->rx_off;
+  while (s->rx != NULL && n >= s->rx->len)
+  {
+    n -= s->rx->len;
+    q = s->rx->next;
+    s->rx->next = NULL; //free the first pbuf only, the chain holds no reference to the rest
+    s->rx->tot_len = s->rx->len;
+    pbuf_free(s->rx);
+    s->rx = q;
+  }
+  s->rx_off = s->rx != NULL ? n : 0;
+}
+
+/*
+ * tls_rx_pull
+ * chain what lwIP queued to rx, until need bytes are held; never blocks
+ */
+static int tls_rx_pull(struct tls_session *s, u16_t need)
+{
+  struct pbuf *p;
+  err_t err;
+
+  while (tls_rx_held(s) < need && s->rx_queued > 0)
+  {
+    err = netconn_recv_tcp_pbuf(s->conn, &p);
+    if (err != ERR_OK)
+    {
+      return err == ERR_CLSD ? MBEDTLS_ERR_SSL_CONN_EOF : MBEDTLS_ERR_NET_RECV_FAILED;
+    }
+    if (s->rx == NULL)
+    {
+      s->rx = p;
+      s->rx_off = 0;
+    }
+    else
+    {
+      pbuf_cat(s->rx, p);
+    }
+  }
+  return 0;
+}
+
+/*
+ * tls_bio_recv
+ * copy from the pbufs received, fetching more only if lwIP has queued
+ * them, so that netconn_recv never blocks
+ */
+static int tls_bio_recv(void *ctx, unsigned char *buf, size_t len)
+{
+  struct tls_session *s = ctx;
+  u16_t n;
+  int ret;
+
+  ret = tls_rx_pull(s, 1);
+  if (ret == MBEDTLS_ERR_SSL_CONN_EOF)
+  {
+    return 0; //closed by the server
+  }
+  if (ret != 0)
+  {
+    return ret;
+  }
+  if (s->rx == NULL)
+  {
+    return s->failed ? MBEDTLS_ERR_NET_CONN_RESET : MBEDTLS_ERR_SSL_WANT_READ;
+  }
+  if (s->shrunk && buf + len > s->ssl.in_buf + TLS_IN_LEN)
+  {
+    stats.oversized++;
+    return MBEDTLS_ERR_SSL_INVALID_RECORD; //a record larger than TLS_MUX_IN_LEN
+  }
+
+  n = pbuf_copy_partial(s->rx, buf, len > 0xFFFF ? 0xFFFF : (u16_t)len, s->rx_off);
+  tls_rx_drop(s, n);
+  if (s->state == TLS_S_OPEN)
+  {
+    stats.copied += n;
+  }
+  else
+  {
+    s->hs_rx += n;
+  }
+  return n;
+}
+
+/*
+ * tls_fail
+ * end the session after an error of a tls_* call, TLS_EV_CLOSED follows
+ */
+static int tls_fail(struct tls_session *s, int ret)
+{
+  s->err = ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY ? 0 : ret;
+  s->state = TLS_S_CLOSING;
+  ready |= TLS_BIT(s);
+  return ret;
+}
+
+#if TLS_MUX_ZEROCOPY
+/*
+ * tls_zc_setup
+ * after the handshake: can the records bypass mbedTLS (TLS 1.2, AES-GCM)?
+ */
+static void tls_zc_setup(struct tls_session *s)
+{
+  const mbedtls_ssl_transform *in = s->ssl.transform_in, *out = s->ssl.transform_out;
+
+  s->zc = s->ssl.minor_ver == MBEDTLS_SSL_MINOR_VERSION_3 && in != NULL && out != NULL &&
+          mbedtls_cipher_get_cipher_mode(&in->cipher_ctx_dec) == MBEDTLS_MODE_GCM &&
+          mbedtls_cipher_get_cipher_mode(&out->cipher_ctx_enc) == MBEDTLS_MODE_GCM &&
+          in->ivlen == 12 && in->fixed_ivlen == 4 && out->ivlen == 12 && out->fixed_ivlen == 4;
+}
+
+/* record counter + 1, as mbedTLS does after each record */
+static int tls_ctr_inc(unsigned char *ctr)
+{
+  int i;
+
+  for (i = 7; i >= 0 && ++ctr[i] == 0; i--)
+  {
+  }
+  return i < 0 ? MBEDTLS_ERR_SSL_COUNTER_WRAPPING : 0;
+}
+
+/*
+ * tls_zc_decrypt
+ * decrypt and authenticate in place the record at rx_off, whose body
+ * (nonce, ciphertext, tag) is len bytes; the plaintext is used only if
+ * the tag matches
+ */
+static int tls_zc_decrypt(struct tls_session *s, u16_t len)
+{
+  const mbedtls_ssl_transform *t = s->ssl.transform_in;
+  mbedtls_gcm_context *gcm = t->cipher_ctx_dec.cipher_ctx;
+  unsigned char iv[12], add[13], tag[TLS_GCM_TAG], blk[16], *at[16], *p;
+  u16_t left = len - TLS_GCM_EXPLICIT - TLS_GCM_TAG, off, n, carry = 0, i;
+  struct pbuf *q = s->rx;
+  unsigned char diff = 0;
+  int ret;
+
+  memcpy(iv, t->iv_dec, 4);
+  pbuf_copy_partial(s->rx, iv + 4, TLS_GCM_EXPLICIT, s->rx_off + TLS_REC_HDR);
+  pbuf_copy_partial(s->rx, tag, TLS_GCM_TAG, s->rx_off + TLS_REC_HDR + TLS_GCM_EXPLICIT + left);
+  memcpy(add, s->ssl.in_ctr, 8);
+  add[8] = MBEDTLS_SSL_MSG_APPLICATION_DATA;
+  add[9] = s->ssl.major_ver;
+  add[10] = s->ssl.minor_ver;
+  add[11] = left >> 8;
+  add[12] = left & 0xFF;
+
+  ret = mbedtls_gcm_starts(gcm, MBEDTLS_GCM_DECRYPT, iv, sizeof(iv), add, sizeof(add));
+  if (ret != 0)
+  {
+    return ret;
+  }
+
+  for (off = s->rx_off + TLS_REC_HDR + TLS_GCM_EXPLICIT; off >= q->len; q = q->next) //first pbuf of the ciphertext
+  {
+    off -= q->len;
+  }
+  while (left > 0)
+  {
+    p = (unsigned char *)q->payload + off;
+    n = q->len - off < left ? q->len - off : left;
+    if (carry == 0 && (n >= 16 || n == left))
+    {
+      if (n < left)
+      {
+        n &= ~15; //whole blocks, the last call only may be shorter
+      }
+      ret = mbedtls_gcm_update(gcm, n, p, p);
+    }
+    else //a block across pbufs: through blk, byte by byte
+    {
+      ret = 0;
+      n = 1;
+      at[carry] = p;
+      blk[carry++] = *p;
+      if (carry == 16 || left == 1)
+      {
+        ret = mbedtls_gcm_update(gcm, carry, blk, blk);
+        for (i = 0; i < carry; i++)
+        {
+          *at[i] = blk[i];
+        }
+        stats.copied += 2 * carry;
+        carry = 0;
+      }
+    }
+    if (ret != 0)
+    {
+      return ret;
+    }
+    left -= n;
+    off += n;
+    if (off == q->len)
+    {
+      q = q->next;
+      off = 0;
+    }
+  }
+
+  ret = mbedtls_gcm_finish(gcm, blk, TLS_GCM_TAG);
+  if (ret != 0)
+  {
+    return ret;
+  }
+  for (i = 0; i < TLS_GCM_TAG; i++) //constant time
+  {
+    diff |= blk[i] ^ tag[i];
+  }
+  if (diff != 0)
+  {
+    return MBEDTLS_ERR_SSL_INVALID_MAC;
+  }
+  return tls_ctr_inc(s->ssl.in_ctr);
+}
+
+/*
+ * tls_zc_flush
+ * write the queued records to TCP by reference and free those the peer
+ * acknowledged; an lwIP error if the connection failed
+ */
+static err_t tls_zc_flush(struct tls_session *s)
+{
+  struct tcp_pcb *pcb;
+  struct pbuf *p;
+  size_t written;
+  u32_t ack = 0;
+  err_t err;
+  u8_t i, n;
+
+  while (s->tx_written < s->tx_n && s->ssl.out_left == 0) //not in the middle of an mbedTLS record
+  {
+    p = s->txq[s->tx_written];
+    err = netconn_write_partly(s->conn, (u8_t *)p->payload + s->tx_off, p->len - s->tx_off, NETCONN_DONTBLOCK,
+                               &written);
+    if (err == ERR_WOULDBLOCK)
+    {
+      break;
+    }
+    if (err != ERR_OK)
+    {
+      return err;
+    }
+    s->tx_off += written;
+    if (s->tx_off < p->len)
+    {
+      break; //send buffer full, SENDPLUS follows
+    }
+    LOCK_TCPIP_CORE();
+    pcb = s->conn->pcb.tcp;
+    s->tx_end[s->tx_written] = pcb != NULL ? pcb->snd_lbb : 0;
+    UNLOCK_TCPIP_CORE();
+    s->tx_written++;
+    s->tx_off = 0;
+  }
+
+  LOCK_TCPIP_CORE();
+  pcb = s->conn->pcb.tcp; //NULL once lwIP dropped the connection, and its segments
+  if (pcb != NULL)
+  {
+    ack = pcb->lastack;
+  }
+  UNLOCK_TCPIP_CORE();
+  for (n = 0; n < s->tx_written && (pcb == NULL || (s32_t)(ack - s->tx_end[n]) >= 0); n++)
+  {
+    pbuf_free(s->txq[n]);
+  }
+  if (n > 0)
+  {
+    for (i = n; i < TLS_MUX_ZC_TXQ; i++) //the rest, and tls_alloc's pbuf, to the front
+    {
+      s->txq[i - n] = s->txq[i];
+      s->tx_end[i - n] = s->tx_end[i];
+    }
+    for (i = TLS_MUX_ZC_TXQ - n; i < TLS_MUX_ZC_TXQ; i++)
+    {
+      s->txq[i] = NULL;
+    }
+    s->tx_n -= n;
+    s->tx_written -= n;
+  }
+  return ERR_OK;
+}
+
+/*
+ * tls_zc_free
+ * free the records, aborting the connection if TCP still points to some
+ */
+static void tls_zc_free(struct tls_session *s)
+{
+  int i;
+
+  if ((s->tx_written > 0 || s->tx_off > 0) && s->conn != NULL)
+  {
+    LOCK_TCPIP_CORE();
+    if (s->conn->pcb.tcp != NULL)
+    {
+      tcp_abort(s->conn->pcb.tcp); //frees its segments
+    }
+    UNLOCK_TCPIP_CORE();
+  }
+  for (i = 0; i < TLS_MUX_ZC_TXQ; i++)
+  {
+    if (s->txq[i] != NULL)
+    {
+      pbuf_free(s->txq[i]);
+      s->txq[i] = NULL;
+    }
+  }
+  s->tx_n = 0;
+  s->tx_written = 0;
+  s->tx_off = 0;
+  s->zc_left = 0;
+  s->zc_done = 0;
+}
+#endif
+
+#if TLS_MUX_SHRINK
+/*
+ * tls_shrink
+ * after the handshake: move the session to record buffers of TLS_MUX_IN_LEN
+ * and TLS_MUX_OUT_LEN, unless mbedTLS holds part of a record; the large
+ * ones are then free for the next handshake
+ */
+static void tls_shrink(struct tls_session *s)
+{
+  mbedtls_ssl_context *ssl = &s->ssl;
+  unsigned char *in, *out;
+  int owner;
+
+  if (ssl->in_left > 0 || ssl->in_offt != NULL || ssl->out_left > 0)
+  {
+    return;
+  }
+  owner = tls_owner(s - sessions);
+  in = mbedtls_calloc(1, TLS_IN_LEN);
+  out = mbedtls_calloc(1, TLS_OUT_LEN);
+  tls_owner(owner);
+  if (in == NULL || out == NULL)
+  {
+    mbedtls_free(in);
+    mbedtls_free(out);
+    return; //keeps the large ones
+  }
+
+  memcpy(in, ssl->in_buf, ssl->in_msg - ssl->in_buf);
+  ssl->in_ctr = in + (ssl->in_ctr - ssl->in_buf);
+  ssl->in_hdr = in + (ssl->in_hdr - ssl->in_buf);
+  ssl->in_len = in + (ssl->in_len - ssl->in_buf);
+  ssl->in_iv = in + (ssl->in_iv - ssl->in_buf);
+  ssl->in_msg = in + (ssl->in_msg - ssl->in_buf);
+  mbedtls_platform_zeroize(ssl->in_buf, MBEDTLS_SSL_IN_BUFFER_LEN);
+  mbedtls_free(ssl->in_buf);
+  ssl->in_buf = in;
+
+  memcpy(out, ssl->out_buf, ssl->out_msg - ssl->out_buf);
+  ssl->out_ctr = out + (ssl->out_ctr - ssl->out_buf);
+  ssl->out_hdr = out + (ssl->out_hdr - ssl->out_buf);
+  ssl->out_len = out + (ssl->out_len - ssl->out_buf);
+  ssl->out_iv = out + (ssl->out_iv - ssl->out_buf);
+  ssl->out_msg = out + (ssl->out_msg - ssl->out_buf);
+  mbedtls_platform_zeroize(ssl->out_buf, MBEDTLS_SSL_OUT_BUFFER_LEN);
+  mbedtls_free(ssl->out_buf);
+  ssl->out_buf = out;
+
+  s->shrunk = 1;
+  stats.shrunk++;
+}
+#endif
+
+/*
+ * tls_release
+ * free the session's resources and its slot
+ */
+static void tls_release(struct tls_session *s)
+{
+  struct netconn *conn = s->conn;
+
+#if TLS_MUX_ZEROCOPY
+  tls_zc_free(s);
+#endif
+  if (s->rx != NULL)
+  {
+    pbuf_free(s->rx);
+    s->rx = NULL;
+  }
+  if (s->shrunk) //before mbedtls_ssl_free, which would zeroize them at their full length
+  {
+    mbedtls_platform_zeroize(s->ssl.in_buf, TLS_IN_LEN);
+    mbedtls_free(s->ssl.in_buf);
+    s->ssl.in_buf = NULL;
+    mbedtls_platform_zeroize(s->ssl.out_buf, TLS_OUT_LEN);
+    mbedtls_free(s->ssl.out_buf);
+    s->ssl.out_buf = NULL;
+  }
+  mbedtls_ssl_free(&s->ssl);
+  s->state = TLS_S_FREE;
+  s->conn = NULL; //the events of netconn_delete find no session
+  ready &= ~TLS_BIT(s);
+  if (conn != NULL)
+  {
+    netconn_delete(conn); //close and free
+  }
+}
+
+/*
+ * tls_end
+ * release a session the server closed or that failed, and tell its owner
+ */
+static void tls_end(struct tls_session *s, int err)
+{
+  if (s->state == TLS_S_CONNECT || s->state == TLS_S_HANDSHAKE)
+  {
+    stats.failed++;
+#ifdef METRICS_ENABLE
+    metrics_op_record(&op_handshake, 0, 0);
+#endif
+  }
+  else
+  {
+    stats.closed++;
+  }
+  s->err = err;
+  tls_release(s);
+  s->fn(s, TLS_EV_CLOSED, s->arg);
+}
+
+/*
+ * tls_handshake
+ * one handshake step, then the other ready sessions get theirs
+ */
+static void tls_handshake(struct tls_session *s)
+{
+  struct tls_hs_stats *hs;
+  uint32_t ms, us, cycles, start = DWT->CYCCNT;
+  int ret, owner = tls_owner(s - sessions);
+
+  ret = mbedtls_ssl_handshake_step(&s->ssl);
+  tls_owner(owner);
+  cycles = DWT->CYCCNT - start;
+  us = cycles / (SystemCoreClock / 1000000);
+  s->hs_cycles += cycles;
+  if (s->ssl.handshake != NULL)
+  {
+    s->resumed = s->ssl.handshake->resume != 0;
+  }
+  s->steps++;
+  stats.steps++;
+  if (us > stats.step_us_max)
+  {
+    stats.step_us_max = us;
+  }
+#ifdef METRICS_ENABLE
+  metrics_op_record(&op_step, us, 1);
+#endif
+  taskYIELD();
+
+  if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE)
+  {
+    return; //next event
+  }
+  if (ret == MBEDTLS_ERR_SSL_CRYPTO_IN_PROGRESS)
+  {
+    stats.ecp_pauses++;
+    ready |= TLS_BIT(s); //resumed on the next pass
+    return;
+  }
+  if (ret != 0)
+  {
+    tls_end(s, ret);
+    return;
+  }
+  if (s->ssl.state != MBEDTLS_SSL_HANDSHAKE_OVER)
+  {
+    ready |= TLS_BIT(s);
+    return;
+  }
+
+  ms = osKernelSysTick() - s->opened;
+  s->state = TLS_S_OPEN;
+#if TLS_MUX_SHRINK
+  tls_shrink(s);
+#endif
+#if TLS_MUX_ZEROCOPY
+  tls_zc_setup(s);
+#endif
+  stats.established++;
+  stats.hs_ms_sum += ms;
+  if (ms > stats.hs_ms_max)
+  {
+    stats.hs_ms_max = ms;
+  }
+  hs = s->resumed ? &stats.resumed : &stats.full;
+  if (hs == &stats.full && hs->count == 0)
+  {
+    stats.hs_ms_first = ms;
+    stats.hs_kcycles_first = s->hs_cycles / 1000;
+  }
+  hs->count++;
+  hs->ms_sum += ms;
+  hs->kcycles_sum += s->hs_cycles / 1000;
+  hs->tx_bytes += s->hs_tx;
+  hs->rx_bytes += s->hs_rx;
+#ifdef METRICS_ENABLE
+  metrics_op_record(&op_handshake, ms * 1000, 1);
+#endif
+  ready |= TLS_BIT(s); //the first data may have come with the last flight
+  s->fn(s, TLS_EV_OPEN, s->arg);
+}
+
+#if TLS_MUX_ZEROCOPY
+/*
+ * tls_drain
+ * a closed session waits for its records to be acknowledged, then sends
+ * close_notify; released early if it fails or after TLS_MUX_DRAIN_MS
+ */
+static void tls_drain(struct tls_session *s)
+{
+  if (!s->failed && tls_zc_flush(s) == ERR_OK && s->tx_n > 0 && osKernelSysTick() - s->opened < TLS_MUX_DRAIN_MS)
+  {
+    return;
+  }
+  if (!s->failed && s->tx_n == 0)
+  {
+    mbedtls_ssl_close_notify(&s->ssl);
+  }
+  tls_release(s);
+}
+#endif
+
+/*
+ * tls_step
+ * advance a session that had an event, or asked for another pass
+ */
+static void tls_step(struct tls_session *s)
+{
+  switch (s->state)
+  {
+    case TLS_S_CONNECT:
+      if (s->failed)
+      {
+        tls_end(s, netconn_err(s->conn));
+        return;
+      }
+      if (s->conn->state == NETCONN_CONNECT)
+      {
+        return;
+      }
+      s->state = TLS_S_HANDSHAKE;
+      /* fall through */
+    case TLS_S_HANDSHAKE:
+      tls_handshake(s);
+      return;
+    case TLS_S_OPEN:
+#if TLS_MUX_ZEROCOPY
+      if (s->tx_n > 0 && tls_zc_flush(s) != ERR_OK)
+      {
+        tls_end(s, MBEDTLS_ERR_NET_SEND_FAILED);
+        return;
+      }
+      if (s->want_write && s->tx_n < TLS_MUX_ZC_TXQ)
+#else
+      if (s->want_write)
+#endif
+      {
+        s->want_write = 0;
+        s->fn(s, TLS_EV_WRITE, s->arg);
+        if (s->state != TLS_S_OPEN)
+        {
+          break;
+        }
+      }
+      if (s->rx != NULL || s->rx_queued > 0 || mbedtls_ssl_get_bytes_avail(&s->ssl) > 0)
+      {
+        s->fn(s, TLS_EV_READ, s->arg);
+      }
+      else if (s->failed)
+      {
+        tls_end(s, netconn_err(s->conn));
+        return;
+      }
+      break;
+#if TLS_MUX_ZEROCOPY
+    case TLS_S_DRAIN:
+      tls_drain(s);
+      return;
+#endif
+    default:
+      break;
+  }
+
+  if (s->state == TLS_S_CLOSING)
+  {
+    tls_end(s, s->err);
+  }
+}
+
+/*
+ * tls_probe
+ * run by tcpip_thread: how long the probe waited in its mailbox
+ */
+static void tls_probe(void *arg)
+{
+  uint32_t us = (DWT->CYCCNT - probe_start) / (SystemCoreClock / 1000000);
+
+  LWIP_UNUSED_ARG(arg);
+
+  taskENTER_CRITICAL();
+  stats.probes++;
+  stats.probe_us_sum += us;
+  if (us > stats.probe_us_max)
+  {
+    stats.probe_us_max = us;
+  }
+  taskEXIT_CRITICAL();
+#ifdef METRICS_ENABLE
+  metrics_op_record(&op_probe, us, 1);
+#endif
+  probe_pending = 0;
+}
+
+/*
+ * tls_mux_init
+ * serve sessions with conf from the calling task, which then runs
+ * tls_mux_run
+ */
+void tls_mux_init(const mbedtls_ssl_config *conf)
+{
+  ssl_conf = conf;
+  mux_task = xTaskGetCurrentTaskHandle();
+#if TLS_MUX_ARENA
+  tls_arena_init();
+  mbedtls_platform_set_calloc_free(tls_arena_calloc, tls_arena_free);
+#elif defined(MBEDTLS_PLATFORM_MEMORY)
+  mbedtls_platform_set_calloc_free(tls_mem_calloc, tls_mem_free);
+#endif
+#if defined(MBEDTLS_ECP_RESTARTABLE)
+  mbedtls_ecp_set_max_ops(TLS_MUX_ECP_OPS); //global, but only restartable calls (the handshakes here) heed it
+#endif
+  cycles_enable();
+#ifdef METRICS_ENABLE
+  metrics_op_add(&op_handshake);
+  metrics_op_add(&op_step);
+  metrics_op_add(&op_probe);
+#endif
+}
+
+/*
+ * tls_handshakes
+ * sessions connecting or in their handshake
+ */
+static int tls_handshakes(void)
+{
+  int n = 0, i;
+
+  for (i = 0; i < TLS_MUX_SESSIONS; i++)
+  {
+    n += sessions[i].state == TLS_S_CONNECT || sessions[i].state == TLS_S_HANDSHAKE;
+  }
+  return n;
+}
+
+/*
+ * tls_start
+ * set up the mbedTLS context of a session opened and start connecting: 0,
+ * or an mbedTLS or lwIP error, the session then to release
+ */
+static int tls_start(struct tls_session *s)
+{
+  err_t err;
+  int ret, owner;
+
+  s->state = TLS_S_CONNECT;
+  s->opened = osKernelSysTick();
+#if TLS_MUX_ARENA
+  tls_arena_open(s - sessions);
+#endif
+  owner = tls_owner(s - sessions);
+  ret = mbedtls_ssl_setup(&s->ssl, ssl_conf);
+  if (ret == 0 && s->hostname != NULL)
+  {
+    ret = mbedtls_ssl_set_hostname(&s->ssl, s->hostname);
+  }
+  if (ret == 0 && s->offer != NULL)
+  {
+    ret = mbedtls_ssl_set_session(&s->ssl, s->offer); //a copy of the ticket
+  }
+  tls_owner(owner);
+  if (ret != 0)
+  {
+    return ret;
+  }
+  mbedtls_ssl_set_bio(&s->ssl, s, tls_bio_send, tls_bio_recv, NULL);
+
+  s->conn = netconn_new_with_callback(NETCONN_TCP, tls_event); //set before any event
+  if (s->conn == NULL)
+  {
+    return ERR_MEM;
+  }
+#if LWIP_TCPIP_CORE_LOCKING
+  LOCK_TCPIP_CORE();
+  tcp_nagle_disable(s->conn->pcb.tcp); //handshake messages are written one by one
+  UNLOCK_TCPIP_CORE();
+#endif
+  netconn_set_nonblocking(s->conn, 1);
+
+  err = netconn_connect(s->conn, &s->addr, s->port);
+  if (err != ERR_INPROGRESS && err != ERR_OK)
+  {
+    return err;
+  }
+  return 0;
+}
+
+/*
+ * tls_open
+ * start connecting to addr:port, or queue the session if
+ * TLS_MUX_HANDSHAKES are under way; hostname (SNI and certificate name) may
+ * be NULL, and is kept by reference until the session starts. fn gets the
+ * session's events. NULL if no session is free, or out of memory.
+ */
+struct tls_session *tls_open(const ip_addr_t *addr, u16_t port, const char *hostname, tls_event_fn fn, void *arg)
+{
+  struct tls_session *s;
+
+  for (s = sessions; s < sessions + TLS_MUX_SESSIONS && s->state != TLS_S_FREE; s++)
+  {
+  }
+  if (s == sessions + TLS_MUX_SESSIONS)
+  {
+    return NULL;
+  }
+
+  memset(s, 0, sizeof(*s));
+  mbedtls_ssl_init(&s->ssl);
+  ip_addr_copy(s->addr, *addr);
+  s->port = port;
+  s->hostname = hostname;
+  s->fn = fn;
+  s->arg = arg;
+
+  if (tls_handshakes() >= TLS_MUX_HANDSHAKES)
+  {
+    s->state = TLS_S_QUEUED; //started by tls_mux_run
+    stats.queued++;
+  }
+  else if (tls_start(s) != 0)
+  {
+    tls_release(s);
+    return NULL;
+  }
+  stats.opened++;
+  return s;
+}
+
+/*
+ * tls_set_session
+ * offer session (e.g. from tls_get_session or tls_store_load) to the
+ * server, right after tls_open: 0, or an mbedTLS error. A queued session
+ * keeps it by reference, and copies it when it starts.
+ */
+int tls_set_session(struct tls_session *s, const mbedtls_ssl_session *session)
+{
+  int ret, owner;
+
+  if (s->state == TLS_S_QUEUED)
+  {
+    s->offer = session;
+    return 0;
+  }
+  if (s->state != TLS_S_CONNECT)
+  {
+    return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+  }
+  owner = tls_owner(s - sessions);
+  ret = mbedtls_ssl_set_session(&s->ssl, session); //a copy of the ticket
+  tls_owner(owner);
+  return ret;
+}
+
+/*
+ * tls_get_session
+ * copy the session of an open session into session (initialized), to
+ * resume it later: 0, or an mbedTLS error. The peer certificate is left
+ * out, which saves its heap.
+ */
+int tls_get_session(struct tls_session *s, mbedtls_ssl_session *session)
+{
+  int ret, owner;
+
+  if (s->state != TLS_S_OPEN)
+  {
+    return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+  }
+  mbedtls_ssl_session_free(session);
+  owner = tls_owner(TLS_ARENA_SHARED);
+  ret = mbedtls_ssl_get_session(&s->ssl, session);
+  tls_owner(owner);
+#if defined(MBEDTLS_X509_CRT_PARSE_C)
+  if (session->peer_cert != NULL)
+  {
+    mbedtls_x509_crt_free(session->peer_cert);
+    mbedtls_free(session->peer_cert);
+    session->peer_cert = NULL;
+  }
+#endif
+  return ret;
+}
+
+/*
+ * tls_read
+ * application data: bytes read, MBEDTLS_ERR_SSL_WANT_READ if there is no
+ * more for now. Anything else means the session is over, TLS_EV_CLOSED
+ * follows.
+ */
+int tls_read(struct tls_session *s, void *buf, size_t len)
+{
+  size_t avail;
+  int ret, owner;
+
+  if (s->state != TLS_S_OPEN)
+  {
+    return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+  }
+#if TLS_MUX_ZEROCOPY
+  if (s->zc_left > 0)
+  {
+    return MBEDTLS_ERR_SSL_BAD_INPUT_DATA; //tls_recv_zc has not returned all of its record
+  }
+  tls_rx_drop(s, s->zc_done);
+  s->zc_done = 0;
+#endif
+
+  avail = mbedtls_ssl_get_bytes_avail(&s->ssl);
+  owner = tls_owner(s - sessions);
+  ret = mbedtls_ssl_read(&s->ssl, buf, len); //may read a NewSessionTicket
+  tls_owner(owner);
+  if (ret > 0)
+  {
+    stats.rx_records += avail == 0; //a new record
+    stats.rx_bytes += ret;
+    stats.copied += ret;
+    return ret;
+  }
+  if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE)
+  {
+    return ret;
+  }
+  return tls_fail(s, ret);
+}
+
+/*
+ * tls_write
+ * encrypt and queue up to len bytes (one record, of at most TLS_MUX_OUT_LEN
+ * once the buffers are shrunk): bytes written, or
+ * MBEDTLS_ERR_SSL_WANT_WRITE, after which the same call is repeated on
+ * TLS_EV_WRITE (mbedTLS holds the record). Other errors end the session.
+ */
+int tls_write(struct tls_session *s, const void *buf, size_t len)
+{
+  int ret, owner;
+
+  if (s->state != TLS_S_OPEN)
+  {
+    return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+  }
+
+#if TLS_MUX_ZEROCOPY
+  if (s->tx_written < s->tx_n)
+  {
+    s->want_write = 1; //after the records of tls_send
+    return MBEDTLS_ERR_SSL_WANT_WRITE;
+  }
+#endif
+
+  if (s->shrunk && len > TLS_MUX_OUT_LEN)
+  {
+    len = TLS_MUX_OUT_LEN;
+  }
+  owner = tls_owner(s - sessions);
+  ret = mbedtls_ssl_write(&s->ssl, buf, len);
+  tls_owner(owner);
+  if (ret > 0)
+  {
+    stats.tx_records++;
+    stats.tx_bytes += ret;
+    stats.copied += ret;
+  }
+  else if (ret == MBEDTLS_ERR_SSL_WANT_WRITE)
+  {
+    s->want_write = 1;
+  }
+  else if (ret < 0 && ret != MBEDTLS_ERR_SSL_WANT_READ)
+  {
+    tls_fail(s, ret);
+  }
+  return ret;
+}
+
+/*
+ * tls_recv_zc
+ * application data in place: bytes at *data, valid until the next call on
+ * the session, or MBEDTLS_ERR_SSL_WANT_READ if there is no more for now.
+ * Records the zero-copy path cannot take are read by tls_read into a
+ * static buffer. Other errors end the session, as for tls_read.
+ */
+int tls_recv_zc(struct tls_session *s, const uint8_t **data)
+{
+  int ret;
+#if TLS_MUX_ZEROCOPY
+  u16_t len, n;
+
+  if (s->state != TLS_S_OPEN)
+  {
+    return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+  }
+  tls_rx_drop(s, s->zc_done);
+  s->zc_done = 0;
+
+  if (s->zc_left == 0)
+  {
+    if (!s->zc || s->ssl.in_left > 0 || mbedtls_ssl_get_bytes_avail(&s->ssl) > 0)
+    {
+      goto copy; //mbedTLS is in the middle of a record
+    }
+    ret = tls_rx_pull(s, TLS_REC_HDR);
+    if (ret != 0)
+    {
+      return tls_fail(s, ret);
+    }
+    if (tls_rx_held(s) < TLS_REC_HDR)
+    {
+      goto more;
+    }
+    len = pbuf_get_at(s->rx, s->rx_off + 3) << 8 | pbuf_get_at(s->rx, s->rx_off + 4);
+    if (pbuf_get_at(s->rx, s->rx_off) != MBEDTLS_SSL_MSG_APPLICATION_DATA ||
+        pbuf_get_at(s->rx, s->rx_off + 1) != s->ssl.major_ver ||
+        pbuf_get_at(s->rx, s->rx_off + 2) != s->ssl.minor_ver || len > TLS_MUX_ZC_RECORD_MAX ||
+        len <= TLS_GCM_EXPLICIT + TLS_GCM_TAG)
+    {
+      goto copy; //alerts, handshake messages, empty and oversized records, errors: all mbedTLS's
+    }
+    ret = tls_rx_pull(s, TLS_REC_HDR + len);
+    if (ret != 0)
+    {
+      return tls_fail(s, ret);
+    }
+    if (tls_rx_held(s) < TLS_REC_HDR + len)
+    {
+      goto more;
+    }
+
+    ret = tls_zc_decrypt(s, len);
+    if (ret != 0)
+    {
+      return tls_fail(s, ret);
+    }
+    tls_rx_drop(s, TLS_REC_HDR + TLS_GCM_EXPLICIT);
+    s->zc_left = len - TLS_GCM_EXPLICIT - TLS_GCM_TAG;
+    stats.rx_records++;
+    stats.rx_zc++;
+    stats.rx_bytes += s->zc_left;
+  }
+
+  n = s->rx->len - s->rx_off; //the plaintext in this pbuf
+  if (n > s->zc_left)
+  {
+    n = s->zc_left;
+  }
+  *data = (const uint8_t *)s->rx->payload + s->rx_off;
+  s->zc_left -= n;
+  s->zc_done = s->zc_left > 0 ? n : n + TLS_GCM_TAG;
+  return n;
+
+more:
+  return s->failed ? tls_fail(s, MBEDTLS_ERR_NET_CONN_RESET) : MBEDTLS_ERR_SSL_WANT_READ;
+
+copy:
+#endif
+  ret = tls_read(s, rx_copy, sizeof(rx_copy));
+  if (ret > 0)
+  {
+    *data = rx_copy;
+  }
+  return ret;
+}
+
+/*
+ * tls_alloc
+ * room for len bytes of application data, to fill then send with tls_send
+ * (a new call replaces it). NULL with s->want_write set: the session has
+ * TLS_MUX_ZC_TXQ records in flight, call again on TLS_EV_WRITE. NULL
+ * otherwise: the zero-copy path is not available, use tls_write.
+ */
+uint8_t *tls_alloc(struct tls_session *s, size_t len)
+{
+#if TLS_MUX_ZEROCOPY
+  struct pbuf *p;
+
+  if (s->state != TLS_S_OPEN || !s->zc || len == 0 || len > TLS_MUX_ZC_TX_MAX)
+  {
+    return NULL;
+  }
+  if (s->tx_n == TLS_MUX_ZC_TXQ || s->ssl.out_left > 0)
+  {
+    s->want_write = 1;
+    return NULL;
+  }
+
+  if (s->txq[s->tx_n] != NULL)
+  {
+    pbuf_free(s->txq[s->tx_n]);
+  }
+  p = pbuf_alloc(PBUF_RAW, TLS_REC_HDR + TLS_GCM_EXPLICIT + len + TLS_GCM_TAG, PBUF_RAM); //one piece
+  s->txq[s->tx_n] = p;
+  if (p == NULL)
+  {
+    return NULL;
+  }
+  return (uint8_t *)p->payload + TLS_REC_HDR + TLS_GCM_EXPLICIT;
+#else
+  (void)s;
+  (void)len;
+  return NULL;
+#endif
+}
+
+/*
+ * tls_send
+ * encrypt in place the first len bytes filled after tls_alloc, and send
+ * them as one record. len, or an error that ends the session.
+ */
+int tls_send(struct tls_session *s, size_t len)
+{
+#if TLS_MUX_ZEROCOPY
+  mbedtls_ssl_transform *t = s->ssl.transform_out;
+  unsigned char iv[12], add[13], *rec;
+  struct pbuf *p;
+  size_t olen;
+  int ret;
+
+  p = s->state == TLS_S_OPEN && s->tx_n < TLS_MUX_ZC_TXQ ? s->txq[s->tx_n] : NULL;
+  if (p == NULL || len == 0 || TLS_REC_HDR + TLS_GCM_EXPLICIT + len + TLS_GCM_TAG > p->len)
+  {
+    return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+  }
+  pbuf_realloc(p, TLS_REC_HDR + TLS_GCM_EXPLICIT + len + TLS_GCM_TAG);
+
+  rec = p->payload;
+  rec[0] = MBEDTLS_SSL_MSG_APPLICATION_DATA;
+  rec[1] = s->ssl.major_ver;
+  rec[2] = s->ssl.minor_ver;
+  rec[3] = (len + TLS_GCM_EXPLICIT + TLS_GCM_TAG) >> 8;
+  rec[4] = (len + TLS_GCM_EXPLICIT + TLS_GCM_TAG) & 0xFF;
+  memcpy(rec + TLS_REC_HDR, s->ssl.out_ctr, TLS_GCM_EXPLICIT); //the nonce mbedTLS would use
+  memcpy(iv, t->iv_enc, 4);
+  memcpy(iv + 4, s->ssl.out_ctr, 8);
+  memcpy(add, s->ssl.out_ctr, 8);
+  memcpy(add + 8, rec, 3);
+  add[11] = len >> 8;
+  add[12] = len & 0xFF;
+
+  rec += TLS_REC_HDR + TLS_GCM_EXPLICIT;
+  ret = mbedtls_cipher_auth_encrypt(&t->cipher_ctx_enc, iv, sizeof(iv), add, sizeof(add), rec, len, rec, &olen,
+                                    rec + len, TLS_GCM_TAG);
+  if (ret == 0)
+  {
+    ret = tls_ctr_inc(s->ssl.out_ctr);
+  }
+  if (ret != 0)
+  {
+    return tls_fail(s, ret);
+  }
+  s->tx_n++;
+  stats.tx_records++;
+  stats.tx_zc++;
+  stats.tx_bytes += len;
+
+  if (tls_zc_flush(s) != ERR_OK)
+  {
+    return tls_fail(s, MBEDTLS_ERR_NET_SEND_FAILED);
+  }
+  return (int)len;
+#else
+  (void)s;
+  (void)len;
+  return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+#endif
+}
+
+/*
+ * tls_close
+ * send close_notify if it fits and free the session, without TLS_EV_CLOSED.
+ * Records of tls_send not acknowledged yet are given TLS_MUX_DRAIN_MS first.
+ */
+void tls_close(struct tls_session *s)
+{
+  if (s->state == TLS_S_FREE || s->state == TLS_S_DRAIN)
+  {
+    return;
+  }
+  if (s->state == TLS_S_OPEN)
+  {
+    stats.closed++;
+#if TLS_MUX_ZEROCOPY
+    if (s->tx_n < TLS_MUX_ZC_TXQ && s->txq[s->tx_n] != NULL)
+    {
+      pbuf_free(s->txq[s->tx_n]); //tls_alloc without tls_send
+      s->txq[s->tx_n] = NULL;
+    }
+    if (s->tx_n > 0)
+    {
+      s->state = TLS_S_DRAIN;
+      s->opened = osKernelSysTick();
+      ready |= TLS_BIT(s);
+      return;
+    }
+#endif
+    mbedtls_ssl_close_notify(&s->ssl); //best effort, never waits
+  }
+  tls_release(s);
+}
+
+/*
+ * tls_mux_run
+ * serve the sessions' events for ms (osWaitForever: for good)
+ */
+void tls_mux_run(uint32_t ms)
+{
+  struct tls_session *s;
+  uint32_t start = osKernelSysTick(), now = start, events, wait;
+  int ret;
+
+  while (ms == osWaitForever || now - start < ms)
+  {
+    wait = TLS_MUX_TICK_MS;
+    if (ms != osWaitForever && ms - (now - start) < wait)
+    {
+      wait = ms - (now - start);
+    }
+
+    if (ready != 0)
+    {
+      taskYIELD(); //no wait: tcpip_thread and the tasks of this priority run first
+    }
+    events = 0;
+    if (xTaskNotifyWait(0, UINT32_MAX, &events, ready != 0 ? 0 : pdMS_TO_TICKS(wait)) == pdTRUE)
+    {
+      stats.wakeups++;
+    }
+    events |= ready;
+    ready = 0;
+
+    for (s = sessions; s < sessions + TLS_MUX_SESSIONS; s++)
+    {
+      if (s->state == TLS_S_HANDSHAKE && (events & TLS_BIT(s)) && !probe_pending)
+      {
+        probe_pending = 1;
+        probe_start = DWT->CYCCNT;
+        if (tcpip_callback_with_block(tls_probe, NULL, 0) != ERR_OK)
+        {
+          probe_pending = 0;
+        }
+        break;
+      }
+    }
+
+    now = osKernelSysTick();
+    for (s = sessions; s < sessions + TLS_MUX_SESSIONS; s++)
+    {
+      if (s->state != TLS_S_FREE && (events & TLS_BIT(s)))
+      {
+        tls_step(s);
+      }
+#if TLS_MUX_ZEROCOPY
+      else if (s->tx_n > 0)
+      {
+        tls_step(s); //acknowledgements without an event: SENDPLUS comes only above the send buffer's low-water mark
+      }
+#endif
+      if ((s->state == TLS_S_CONNECT || s->state == TLS_S_HANDSHAKE) && now - s->opened >= TLS_MUX_HANDSHAKE_MS)
+      {
+        tls_end(s, MBEDTLS_ERR_SSL_TIMEOUT);
+      }
+    }
+
+    for (s = sessions; s < sessions + TLS_MUX_SESSIONS; s++) //the queued sessions, as handshakes end
+    {
+      if (s->state == TLS_S_QUEUED && tls_handshakes() < TLS_MUX_HANDSHAKES)
+      {
+        ret = tls_start(s);
+        if (ret != 0)
+        {
+          tls_end(s, ret);
+        }
+      }
+    }
+  }
+}
+
+/*
+ * tls_mux_count
+ * sessions in use
+ */
+int tls_mux_count(void)
+{
+  int n = 0, i;
+
+  for (i = 0; i < TLS_MUX_SESSIONS; i++)
+  {
+    n += sessions[i].state != TLS_S_FREE;
+  }
+  return n;
+}
+
+void tls_mux_get_stats(struct tls_mux_stats *st)
+{
+#if TLS_MUX_ARENA
+  struct tls_arena_stats as;
+#endif
+
+  taskENTER_CRITICAL();
+  *st = stats;
+  taskEXIT_CRITICAL();
+#if TLS_MUX_ARENA
+  tls_arena_get_stats(&as);
+  st->mem_used = as.used;
+  st->mem_peak = as.peak;
+#endif
+}
@@ -0,0 +1,267 @@
+/*
+ * tls_store.c
+ *
+ * See tls_store.h. mbedTLS 2.16 cannot serialize a session
+ * (mbedtls_ssl_session_save came with 2.19), so a record holds the fields
+ * of mbedtls_ssl_session that a client needs to resume it, as struct
+ * tls_store_rec, followed by the ticket. The peer certificate is left out:
+ * a resumed session has none (mbedtls_ssl_get_peer_cert returns NULL), but
+ * it keeps the result of the certificate's verification.
+ *
+ * A record is programmed one word at a time, from its end, so that the
+ * magic word of its header is written last: a reset in the middle of a save
+ * leaves words without a header, where the scan stops. The next save finds
+ * them not erased and erases the sector first, as it does when the sector
+ * is full. The CPU stalls while flash is programmed or erased, since it
+ * runs from the same flash: about 1 ms for a record, and a second or two
+ * for an erase of the 128 KB sector.
+ */
+
+#include <string.h>
+
+#include "mbedtls/platform.h"
+#include "cycles.h"
+#include "tls_store.h"
+
+#define TLS_STORE_MAGIC 0x53534C54UL //"TLSS"
+#define TLS_STORE_LEN(body) ((sizeof(struct tls_store_hdr) + (body) + 3) & ~3UL) //bytes of a record in the sector
+
+struct tls_store_hdr
+{
+  uint32_t magic; //programmed last
+  uint32_t len; //of the body: struct tls_store_rec and the ticket
+  uint32_t crc; //CRC-32 of the body
+};
+
+struct tls_store_rec
+{
+  uint16_t ciphersuite;
+  uint8_t compression;
+  uint8_t id_len;
+  uint8_t id[32];
+  uint8_t master[48];
+  uint32_t verify_result;
+  uint32_t ticket_lifetime;
+  uint32_t ticket_len; //0 without a ticket
+};
+
+static uint32_t store_end; //offset of the first free word...
+static uint8_t scanned; //...known
+static struct tls_store_stats stats;
+static uint32_t rec_buf[(sizeof(struct tls_store_hdr) + sizeof(struct tls_store_rec) + TLS_STORE_TICKET_MAX + 3) / 4];
+
+/*
+ * tls_store_crc
+ * CRC-32 (IEEE 802.3), bit by bit: records are small and saved seldom
+ */
+static uint32_t tls_store_crc(const uint8_t *p, uint32_t len)
+{
+  uint32_t crc = 0xFFFFFFFFUL;
+  int k;
+
+  while (len-- > 0)
+  {
+    crc ^= *p++;
+    for (k = 0; k < 8; k++)
+    {
+      crc = (crc >> 1) ^ (0xEDB88320UL & -(crc & 1));
+    }
+  }
+  return ~crc;
+}
+
+/*
+ * tls_store_scan
+ * walk the records up to the first free word: the offset of the last
+ * valid one, or -1
+ */
+static int32_t tls_store_scan(void)
+{
+  const struct tls_store_hdr *h;
+  uint32_t off = 0;
+  int32_t last = -1;
+
+  while (off + sizeof(*h) <= TLS_STORE_SIZE)
+  {
+    h = (const struct tls_store_hdr *)(TLS_STORE_ADDR + off);
+    if (h->magic != TLS_STORE_MAGIC || h->len < sizeof(struct tls_store_rec) ||
+        h->len > TLS_STORE_SIZE - off - sizeof(*h))
+    {
+      break; //erased, or what a reset left of a save
+    }
+    if (tls_store_crc((const uint8_t *)(h + 1), h->len) == h->crc)
+    {
+      last = off;
+    }
+    off += TLS_STORE_LEN(h->len);
+  }
+  store_end = off;
+  stats.used = off;
+  scanned = 1;
+  return last;
+}
+
+/*
+ * tls_store_blank
+ * are the len bytes from off still erased?
+ */
+static int tls_store_blank(uint32_t off, uint32_t len)
+{
+  const uint32_t *p = (const uint32_t *)(TLS_STORE_ADDR + off);
+  uint32_t i;
+
+  for (i = 0; i < len / 4; i++)
+  {
+    if (p[i] != 0xFFFFFFFFUL)
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * tls_store_erase
+ * erase the sector, flash unlocked
+ */
+static HAL_StatusTypeDef tls_store_erase(void)
+{
+  FLASH_EraseInitTypeDef erase = {0};
+  uint32_t sector_error, us, start = DWT->CYCCNT;
+  HAL_StatusTypeDef st;
+
+  erase.TypeErase = FLASH_TYPEERASE_SECTORS;
+  erase.Sector = TLS_STORE_SECTOR;
+  erase.NbSectors = 1;
+  erase.VoltageRange = FLASH_VOLTAGE_RANGE_3; //2.7 to 3.6 V: word programming
+  st = HAL_FLASHEx_Erase(&erase, &sector_error);
+
+  us = (DWT->CYCCNT - start) / (SystemCoreClock / 1000000);
+  if (us > stats.erase_us_max)
+  {
+    stats.erase_us_max = us;
+  }
+  stats.erases++;
+  store_end = 0;
+  stats.used = 0;
+  return st;
+}
+
+/*
+ * tls_store_load
+ * the session last saved, into session (initialized, without a ticket). 0,
+ * or -1 if no valid record is stored.
+ */
+int tls_store_load(mbedtls_ssl_session *session)
+{
+  const struct tls_store_hdr *h;
+  const struct tls_store_rec *r;
+  int32_t last = tls_store_scan();
+
+  if (last < 0)
+  {
+    return -1;
+  }
+  h = (const struct tls_store_hdr *)(TLS_STORE_ADDR + last);
+  r = (const struct tls_store_rec *)(h + 1);
+  if (r->id_len > sizeof(r->id) || r->ticket_len != h->len - sizeof(*r))
+  {
+    return -1;
+  }
+
+  session->ciphersuite = r->ciphersuite;
+  session->compression = r->compression;
+  session->id_len = r->id_len;
+  memcpy(session->id, r->id, sizeof(r->id));
+  memcpy(session->master, r->master, sizeof(r->master));
+  session->verify_result = r->verify_result;
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+  if (r->ticket_len > 0)
+  {
+    session->ticket = mbedtls_calloc(1, r->ticket_len);
+    if (session->ticket == NULL)
+    {
+      return -1;
+    }
+    memcpy(session->ticket, r + 1, r->ticket_len);
+    session->ticket_len = r->ticket_len;
+    session->ticket_lifetime = r->ticket_lifetime;
+  }
+#endif
+  return 0;
+}
+
+/*
+ * tls_store_save
+ * append session to the log, erasing the sector first if it does not fit.
+ * 0, or -1 if flash could not be programmed.
+ */
+int tls_store_save(const mbedtls_ssl_session *session)
+{
+  struct tls_store_hdr *h = (struct tls_store_hdr *)rec_buf;
+  struct tls_store_rec *r = (struct tls_store_rec *)(h + 1);
+  uint32_t len = sizeof(*r), total, us, start, i;
+  HAL_StatusTypeDef st = HAL_OK;
+
+  cycles_enable();
+  if (!scanned)
+  {
+    tls_store_scan();
+  }
+
+  memset(rec_buf, 0, sizeof(rec_buf));
+  r->ciphersuite = session->ciphersuite;
+  r->compression = session->compression;
+  r->id_len = session->id_len;
+  memcpy(r->id, session->id, sizeof(r->id));
+  memcpy(r->master, session->master, sizeof(r->master));
+  r->verify_result = session->verify_result;
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+  if (session->ticket != NULL && session->ticket_len <= TLS_STORE_TICKET_MAX)
+  {
+    memcpy(r + 1, session->ticket, session->ticket_len);
+    r->ticket_len = session->ticket_len;
+    r->ticket_lifetime = session->ticket_lifetime;
+    len += session->ticket_len;
+  }
+#endif
+  h->magic = TLS_STORE_MAGIC;
+  h->len = len;
+  h->crc = tls_store_crc((const uint8_t *)r, len);
+  total = TLS_STORE_LEN(len);
+
+  HAL_FLASH_Unlock();
+  if (store_end + total > TLS_STORE_SIZE || !tls_store_blank(store_end, total))
+  {
+    st = tls_store_erase();
+  }
+  start = DWT->CYCCNT;
+  for (i = total / 4; i-- > 0 && st == HAL_OK;) //from the end: the magic word last
+  {
+    st = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, TLS_STORE_ADDR + store_end + 4 * i, rec_buf[i]);
+  }
+  HAL_FLASH_Lock();
+  __HAL_FLASH_DATA_CACHE_DISABLE(); //the ART data cache may hold the words as they were
+  __HAL_FLASH_DATA_CACHE_RESET();
+  __HAL_FLASH_DATA_CACHE_ENABLE();
+
+  us = (DWT->CYCCNT - start) / (SystemCoreClock / 1000000);
+  if (us > stats.save_us_max)
+  {
+    stats.save_us_max = us;
+  }
+  if (st != HAL_OK || memcmp((const void *)(TLS_STORE_ADDR + store_end), rec_buf, total) != 0)
+  {
+    scanned = 0; //scan again before the next save
+    return -1;
+  }
+  store_end += total;
+  stats.used = store_end;
+  stats.saves++;
+  return 0;
+}
+
+void tls_store_get_stats(struct tls_store_stats *st)
+{
+  *st = stats;
+}
@@ -0,0 +1,347 @@
+/*
+ * x25519.c
+ *
+ * See x25519.h. The field arithmetic follows the 32-bit "ref10" one of
+ * SUPERCOP: an element is f0 + f1 2^26 + f2 2^51 + ... + f9 2^230, limbs of
+ * 26 bits (even) and 25 bits (odd), signed. Additions and subtractions do
+ * not carry; multiplications take the sum or difference of two carried
+ * elements at most (|limb| < 1.1 * 2^26), which keeps 19 * limb in 32 bits
+ * and the sums of products in 64 bits, and return carried elements.
+ */
+
+#include <string.h>
+
+#include "mbedtls/platform_util.h"
+#include "x25519.h"
+
+typedef int32_t fe[10];
+
+#define M(a, b) ((int64_t)(a) * (b))
+
+const uint8_t x25519_base[X25519_LEN] = {9};
+
+static const uint8_t fe_off[10] = {0, 26, 51, 77, 102, 128, 153, 179, 204, 230}; //bit of each limb
+
+#define FE_BITS(i) ((i) & 1 ? 25 : 26)
+
+/*
+ * fe_frombytes
+ * h = s, 255 bits little endian (the top bit is ignored, RFC 7748)
+ */
+static void fe_frombytes(fe h, const uint8_t s[X25519_LEN])
+{
+  uint64_t w;
+  int i, k, at;
+
+  for (i = 0; i < 10; i++)
+  {
+    at = fe_off[i] / 8;
+    w = 0;
+    for (k = 4; k >= 0; k--)
+    {
+      if (at + k < X25519_LEN)
+      {
+        w = w << 8 | s[at + k];
+      }
+    }
+    h[i] = (int32_t)((w >> (fe_off[i] % 8)) & ((1u << FE_BITS(i)) - 1));
+  }
+}
+
+/*
+ * fe_tobytes
+ * s = h mod p, fully reduced, little endian; h carried
+ */
+static void fe_tobytes(uint8_t s[X25519_LEN], const fe h)
+{
+  int32_t t[10], q, c;
+  uint64_t acc = 0;
+  int i, bits = 0, n = 0;
+
+  memcpy(t, h, sizeof(t));
+  q = (19 * t[9] + ((int32_t)1 << 24)) >> 25; //q = floor(h / p), 0 or 1
+  for (i = 0; i < 10; i++)
+  {
+    q = (t[i] + q) >> FE_BITS(i);
+  }
+  t[0] += 19 * q; //h - p q = h + 19 q - 2^255 q, the 2^255 q dropped with the last carry
+  for (i = 0; i < 9; i++)
+  {
+    c = t[i] >> FE_BITS(i);
+    t[i + 1] += c;
+    t[i] -= c * ((int32_t)1 << FE_BITS(i));
+  }
+  t[9] &= ((int32_t)1 << 25) - 1;
+
+  for (i = 0; i < 10; i++)
+  {
+    acc |= (uint64_t)(uint32_t)t[i] << bits;
+    bits += FE_BITS(i);
+    while (bits >= 8)
+    {
+      s[n++] = (uint8_t)acc;
+      acc >>= 8;
+      bits -= 8;
+    }
+  }
+  s[n] = (uint8_t)acc; //the last 7 bits
+  mbedtls_platform_zeroize(t, sizeof(t));
+}
+
+/*
+ * fe_carry
+ * h = t, carried: |h0| <= 2^25, |h1| <= 2^24, ...
+ */
+static void fe_carry(fe h, int64_t t[10])
+{
+  static const uint8_t order[12] = {0, 4, 1, 5, 2, 6, 3, 7, 4, 8, 9, 0}; //two chains, interleaved
+  int64_t c;
+  int i, k, b;
+
+  for (k = 0; k < 12; k++)
+  {
+    i = order[k];
+    b = FE_BITS(i);
+    c = (t[i] + ((int64_t)1 << (b - 1))) >> b;
+    t[i] -= c * ((int64_t)1 << b);
+    if (i == 9)
+    {
+      t[0] += c * 19; //2^255 = 19 mod p
+    }
+    else
+    {
+      t[i + 1] += c;
+    }
+  }
+  for (i = 0; i < 10; i++)
+  {
+    h[i] = (int32_t)t[i];
+  }
+}
+
+static void fe_add(fe h, const fe f, const fe g)
+{
+  int i;
+
+  for (i = 0; i < 10; i++)
+  {
+    h[i] = f[i] + g[i];
+  }
+}
+
+static void fe_sub(fe h, const fe f, const fe g)
+{
+  int i;
+
+  for (i = 0; i < 10; i++)
+  {
+    h[i] = f[i] - g[i];
+  }
+}
+
+/* swap f and g if b, in constant time */
+static void fe_cswap(fe f, fe g, uint32_t b)
+{
+  int32_t mask = -(int32_t)b, x;
+  int i;
+
+  for (i = 0; i < 10; i++)
+  {
+    x = mask & (f[i] ^ g[i]);
+    f[i] ^= x;
+    g[i] ^= x;
+  }
+}
+
+/*
+ * fe_mul
+ * h = f g; h may be f or g
+ */
+static void fe_mul(fe h, const fe f, const fe g)
+{
+  int32_t f0 = f[0], f1 = f[1], f2 = f[2], f3 = f[3], f4 = f[4], f5 = f[5], f6 = f[6], f7 = f[7], f8 = f[8], f9 = f[9];
+  int32_t g0 = g[0], g1 = g[1], g2 = g[2], g3 = g[3], g4 = g[4], g5 = g[5], g6 = g[6], g7 = g[7], g8 = g[8], g9 = g[9];
+  int32_t f1_2 = 2 * f1, f3_2 = 2 * f3, f5_2 = 2 * f5, f7_2 = 2 * f7, f9_2 = 2 * f9; //odd limbs times odd limbs: 2^51 = 2 * 2^25 * 2^25...
+  int32_t g1_19 = 19 * g1, g2_19 = 19 * g2, g3_19 = 19 * g3, g4_19 = 19 * g4, g5_19 = 19 * g5; //...and past 2^255, times 19
+  int32_t g6_19 = 19 * g6, g7_19 = 19 * g7, g8_19 = 19 * g8, g9_19 = 19 * g9;
+  int64_t t[10];
+
+  t[0] = M(f0, g0) + M(f1_2, g9_19) + M(f2, g8_19) + M(f3_2, g7_19) + M(f4, g6_19) + M(f5_2, g5_19) + M(f6, g4_19) +
+         M(f7_2, g3_19) + M(f8, g2_19) + M(f9_2, g1_19);
+  t[1] = M(f0, g1) + M(f1, g0) + M(f2, g9_19) + M(f3, g8_19) + M(f4, g7_19) + M(f5, g6_19) + M(f6, g5_19) +
+         M(f7, g4_19) + M(f8, g3_19) + M(f9, g2_19);
+  t[2] = M(f0, g2) + M(f1_2, g1) + M(f2, g0) + M(f3_2, g9_19) + M(f4, g8_19) + M(f5_2, g7_19) + M(f6, g6_19) +
+         M(f7_2, g5_19) + M(f8, g4_19) + M(f9_2, g3_19);
+  t[3] = M(f0, g3) + M(f1, g2) + M(f2, g1) + M(f3, g0) + M(f4, g9_19) + M(f5, g8_19) + M(f6, g7_19) + M(f7, g6_19) +
+         M(f8, g5_19) + M(f9, g4_19);
+  t[4] = M(f0, g4) + M(f1_2, g3) + M(f2, g2) + M(f3_2, g1) + M(f4, g0) + M(f5_2, g9_19) + M(f6, g8_19) +
+         M(f7_2, g7_19) + M(f8, g6_19) + M(f9_2, g5_19);
+  t[5] = M(f0, g5) + M(f1, g4) + M(f2, g3) + M(f3, g2) + M(f4, g1) + M(f5, g0) + M(f6, g9_19) + M(f7, g8_19) +
+         M(f8, g7_19) + M(f9, g6_19);
+  t[6] = M(f0, g6) + M(f1_2, g5) + M(f2, g4) + M(f3_2, g3) + M(f4, g2) + M(f5_2, g1) + M(f6, g0) + M(f7_2, g9_19) +
+         M(f8, g8_19) + M(f9_2, g7_19);
+  t[7] = M(f0, g7) + M(f1, g6) + M(f2, g5) + M(f3, g4) + M(f4, g3) + M(f5, g2) + M(f6, g1) + M(f7, g0) +
+         M(f8, g9_19) + M(f9, g8_19);
+  t[8] = M(f0, g8) + M(f1_2, g7) + M(f2, g6) + M(f3_2, g5) + M(f4, g4) + M(f5_2, g3) + M(f6, g2) + M(f7_2, g1) +
+         M(f8, g0) + M(f9_2, g9_19);
+  t[9] = M(f0, g9) + M(f1, g8) + M(f2, g7) + M(f3, g6) + M(f4, g5) + M(f5, g4) + M(f6, g3) + M(f7, g2) + M(f8, g1) +
+         M(f9, g0);
+  fe_carry(h, t);
+}
+
+/*
+ * fe_sq
+ * h = f^2, the products of fe_mul paired; h may be f
+ */
+static void fe_sq(fe h, const fe f)
+{
+  int32_t f0 = f[0], f1 = f[1], f2 = f[2], f3 = f[3], f4 = f[4], f5 = f[5], f6 = f[6], f7 = f[7], f8 = f[8], f9 = f[9];
+  int32_t f0_2 = 2 * f0, f1_2 = 2 * f1, f2_2 = 2 * f2, f3_2 = 2 * f3, f4_2 = 2 * f4, f5_2 = 2 * f5, f6_2 = 2 * f6;
+  int32_t f7_2 = 2 * f7, f8_2 = 2 * f8, f9_2 = 2 * f9;
+  int32_t f1_4 = 4 * f1, f3_4 = 4 * f3, f5_4 = 4 * f5, f7_4 = 4 * f7;
+  int32_t f5_19 = 19 * f5, f6_19 = 19 * f6, f7_19 = 19 * f7, f8_19 = 19 * f8, f9_19 = 19 * f9;
+  int64_t t[10];
+
+  t[0] = M(f0, f0) + M(f1_4, f9_19) + M(f2_2, f8_19) + M(f3_4, f7_19) + M(f4_2, f6_19) + M(f5_2, f5_19);
+  t[1] = M(f0_2, f1) + M(f2_2, f9_19) + M(f3_2, f8_19) + M(f4_2, f7_19) + M(f5_2, f6_19);
+  t[2] = M(f0_2, f2) + M(f1_2, f1) + M(f3_4, f9_19) + M(f4_2, f8_19) + M(f5_4, f7_19) + M(f6, f6_19);
+  t[3] = M(f0_2, f3) + M(f1_2, f2) + M(f4_2, f9_19) + M(f5_2, f8_19) + M(f6_2, f7_19);
+  t[4] = M(f0_2, f4) + M(f1_4, f3) + M(f2, f2) + M(f5_4, f9_19) + M(f6_2, f8_19) + M(f7_2, f7_19);
+  t[5] = M(f0_2, f5) + M(f1_2, f4) + M(f2_2, f3) + M(f6_2, f9_19) + M(f7_2, f8_19);
+  t[6] = M(f0_2, f6) + M(f1_4, f5) + M(f2_2, f4) + M(f3_2, f3) + M(f7_4, f9_19) + M(f8, f8_19);
+  t[7] = M(f0_2, f7) + M(f1_2, f6) + M(f2_2, f5) + M(f3_2, f4) + M(f8_2, f9_19);
+  t[8] = M(f0_2, f8) + M(f1_4, f7) + M(f2_2, f6) + M(f3_4, f5) + M(f4, f4) + M(f9_2, f9_19);
+  t[9] = M(f0_2, f9) + M(f1_2, f8) + M(f2_2, f7) + M(f3_2, f6) + M(f4_2, f5);
+  fe_carry(h, t);
+}
+
+/* h = f^(2^n) */
+static void fe_sqn(fe h, const fe f, int n)
+{
+  fe_sq(h, f);
+  while (--n > 0)
+  {
+    fe_sq(h, h);
+  }
+}
+
+/* h = 121665 f, (A - 2) / 4 for Curve25519's A = 486662 */
+static void fe_mul121665(fe h, const fe f)
+{
+  int64_t t[10];
+  int i;
+
+  for (i = 0; i < 10; i++)
+  {
+    t[i] = M(f[i], 121665);
+  }
+  fe_carry(h, t);
+}
+
+/*
+ * fe_invert
+ * h = z^(p - 2) = 1 / z, p - 2 = 2^255 - 21: 254 squarings, 11 multiplications
+ */
+static void fe_invert(fe h, const fe z)
+{
+  fe t0, t1, t2, t3;
+
+  fe_sq(t0, z); //2
+  fe_sqn(t1, t0, 2); //8
+  fe_mul(t1, z, t1); //9
+  fe_mul(t0, t0, t1); //11
+  fe_sq(t2, t0); //22
+  fe_mul(t1, t1, t2); //2^5 - 1
+  fe_sqn(t2, t1, 5);
+  fe_mul(t1, t2, t1); //2^10 - 1
+  fe_sqn(t2, t1, 10);
+  fe_mul(t2, t2, t1); //2^20 - 1
+  fe_sqn(t3, t2, 20);
+  fe_mul(t2, t3, t2); //2^40 - 1
+  fe_sqn(t2, t2, 10);
+  fe_mul(t1, t2, t1); //2^50 - 1
+  fe_sqn(t2, t1, 50);
+  fe_mul(t2, t2, t1); //2^100 - 1
+  fe_sqn(t3, t2, 100);
+  fe_mul(t2, t3, t2); //2^200 - 1
+  fe_sqn(t2, t2, 50);
+  fe_mul(t1, t2, t1); //2^250 - 1
+  fe_sqn(t1, t1, 5); //2^255 - 32
+  fe_mul(h, t1, t0); //2^255 - 21
+}
+
+/*
+ * x25519
+ * out = X25519(scalar, point), the Montgomery ladder of RFC 7748 section 5;
+ * out may be point. 0, or the error of f_rng.
+ */
+int x25519(uint8_t out[X25519_LEN], const uint8_t scalar[X25519_LEN], const uint8_t point[X25519_LEN],
+           int (*f_rng)(void *, unsigned char *, size_t), void *p_rng)
+{
+  struct
+  {
+    uint8_t k[X25519_LEN];
+    uint8_t r[X25519_LEN];
+    fe x1, x2, z2, x3, z3, a, aa, b, bb, e, c, d, da, cb;
+  } v; //one block, to zeroize
+  uint32_t swap = 0, bit;
+  int t, ret = 0;
+
+  memset(&v, 0, sizeof(v));
+  memcpy(v.k, scalar, X25519_LEN);
+  v.k[0] &= 248; //clamped: a multiple of the cofactor 8...
+  v.k[31] &= 127;
+  v.k[31] |= 64; //...with bit 254 set
+  fe_frombytes(v.x1, point);
+  v.x2[0] = 1; //(x2 : z2) = (1 : 0), the point at infinity
+  memcpy(v.x3, v.x1, sizeof(fe)); //(x3 : z3) = (x1 : 1)
+  v.z3[0] = 1;
+  if (f_rng != NULL) //(x3 : z3) = (x1 r : r)
+  {
+    ret = f_rng(p_rng, v.r, sizeof(v.r));
+    fe_frombytes(v.z3, v.r);
+    fe_mul(v.x3, v.x1, v.z3);
+    if (ret != 0)
+    {
+      mbedtls_platform_zeroize(&v, sizeof(v));
+      return ret;
+    }
+  }
+
+  for (t = 254; t >= 0; t--)
+  {
+    bit = v.k[t >> 3] >> (t & 7) & 1;
+    swap ^= bit;
+    fe_cswap(v.x2, v.x3, swap);
+    fe_cswap(v.z2, v.z3, swap);
+    swap = bit;
+
+    fe_add(v.a, v.x2, v.z2);
+    fe_sub(v.b, v.x2, v.z2);
+    fe_add(v.c, v.x3, v.z3);
+    fe_sub(v.d, v.x3, v.z3);
+    fe_sq(v.aa, v.a);
+    fe_sq(v.bb, v.b);
+    fe_mul(v.da, v.d, v.a);
+    fe_mul(v.cb, v.c, v.b);
+    fe_sub(v.e, v.aa, v.bb);
+
+    fe_add(v.x3, v.da, v.cb);
+    fe_sq(v.x3, v.x3);
+    fe_sub(v.z3, v.da, v.cb);
+    fe_sq(v.z3, v.z3);
+    fe_mul(v.z3, v.z3, v.x1);
+    fe_mul(v.x2, v.aa, v.bb);
+    fe_mul121665(v.z2, v.e);
+    fe_add(v.z2, v.z2, v.aa);
+    fe_mul(v.z2, v.z2, v.e);
+  }
+  fe_cswap(v.x2, v.x3, swap);
+  fe_cswap(v.z2, v.z3, swap);
+
+  fe_invert(v.z2, v.z2);
+  fe_mul(v.x2, v.x2, v.z2);
+  fe_tobytes(out, v.x2);
+  mbedtls_platform_zeroize(&v, sizeof(v));
+  return 0;
+}
@@ -95,8 +95,14 @@
 #define RECV_BUFSIZE_DEFAULT 2000000000
 /*----- Value in opt.h for LWIP_USE_EXTERNAL_MBEDTLS: 0 -----*/
 #define LWIP_USE_EXTERNAL_MBEDTLS 1
-/*----- Value in opt.h for LWIP_STATS: 1 -----*/
-#define LWIP_STATS 0
+/*----- Value in opt.h for MIB2_STATS: 0 -----*/
+#define MIB2_STATS 1
+/*----- Value in opt.h for MEMP_NUM_NETCONN: 4 -----*/
+#define MEMP_NUM_NETCONN 8
+/*----- Value in opt.h for MEMP_NUM_TCP_PCB: 5 -----*/
+#define MEMP_NUM_TCP_PCB 8
+/*----- Value in opt.h for MEM_SIZE: 1600 -----*/
+#define MEM_SIZE 10240
 /*----- Value in opt.h for CHECKSUM_GEN_IP: 1 -----*/
 #define CHECKSUM_GEN_IP 0
 /*----- Value in opt.h for CHECKSUM_GEN_UDP: 1 -----*/
@@ -119,7 +125,7 @@
 #define CHECKSUM_CHECK_ICMP6 0
 /*-----------------------------------------------------------------------------*/
 /* USER CODE BEGIN 1 */
-
+#define LWIP_SO_RCVTIMEO 1 //a silent server must not block kem_client.c
 /* USER CODE END 1 */
 
 #ifdef __cplusplus
@@ -0,0 +1,49 @@
+/*
+ * threading_alt.h
+ *
+ * mbedTLS mutexes (MBEDTLS_THREADING_ALT) on FreeRTOS mutexes, or on ThreadX
+ * ones with THREADING_ALT_THREADX, see threading_alt.c. mbedtls/threading.h
+ * includes it: it sits next to mbedtls_config.h.
+ *
+ * Each mutex counts the times it was taken and, of those, the times it was
+ * held by another task, so that the contexts shared between tasks (entropy,
+ * CTR_DRBG) show how often they made one wait.
+ */
+
+#ifndef MBEDTLS_THREADING_ALT_H
+#define MBEDTLS_THREADING_ALT_H
+
+#include <stdint.h>
+
+#ifdef THREADING_ALT_THREADX
+#include "tx_api.h"
+#else
+#include "FreeRTOS.h"
+#include "semphr.h"
+#endif
+
+typedef struct
+{
+#ifdef THREADING_ALT_THREADX
+  TX_MUTEX mutex;
+#else
+  SemaphoreHandle_t mutex;
+#endif
+  uint8_t valid; //created, not freed
+  uint32_t locks; //times taken...
+  uint32_t waits; //...of which another task held it
+} mbedtls_threading_mutex_t;
+
+struct threading_alt_stats
+{
+  uint32_t mutexes; //in use
+  uint32_t failed; //creations, out of RTOS memory
+  uint32_t locks; //of all the mutexes
+  uint32_t waits;
+};
+
+void threading_alt_init(void);
+int threading_alt_trylock(mbedtls_threading_mutex_t *mutex);
+void threading_alt_get_stats(struct threading_alt_stats *stats);
+
+#endif /* MBEDTLS_THREADING_ALT_H */
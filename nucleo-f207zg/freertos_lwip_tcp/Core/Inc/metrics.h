@@ -0,0 +1,54 @@
+/*
+ * metrics.h
+ *
+ * Device metrics over TCP: every connection to METRICS_PORT gets one
+ * snapshot, as text lines "name value", then the connection is closed
+ * (`nc <board> 5001`, or go_tstamp_srv -scrape for time series). It holds:
+ * - the FreeRTOS heap (free now and minimum ever) and, per task, its run
+ *   time counter (configGENERATE_RUN_TIME_STATS, DWT cycles / 64) and the
+ *   stack it never used;
+ * - the lwIP heap and pools (used, max, allocation failures: an exhausted
+ *   PBUF_POOL shows as memp.PBUF_POOL.err), link and TCP counters, TCP
+ *   retransmissions (LWIP_STATS, MIB2_STATS);
+ * - the operations registered with metrics_op_add: count, errors and
+ *   latency (min/max/sum in us), e.g. requests, handshakes, KEM steps.
+ * Counters only grow: rates and averages are the scraper's differences.
+ * With METRICS_ENABLE defined, main.c starts StartMetricsTask and the
+ * applications count their operations.
+ */
+
+#ifndef INC_METRICS_H_
+#define INC_METRICS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define METRICS_PORT 5001 //TCP port of the snapshots
+#define METRICS_TASKS 12 //most tasks listed
+#define METRICS_CHUNK 256 //bytes formatted per netconn_write
+#define METRICS_RUNTIME_SHIFT 6 //run time counter = DWT cycles >> this (wraps in 38 min at 120 MHz)
+
+struct metrics_op
+{
+  const char *name;
+  struct metrics_op *next;
+  uint32_t count;
+  uint32_t errors;
+  uint32_t min_us;
+  uint32_t max_us;
+  uint64_t sum_us;
+};
+
+#define METRICS_OP_INIT(n) {.name = (n), .min_us = UINT32_MAX}
+
+/* output of metrics_format: write len bytes, 0 on success */
+typedef int (*metrics_sink_fn)(void *ctx, const char *buf, size_t len);
+
+void metrics_op_add(struct metrics_op *op);
+uint32_t metrics_op_start(void);
+void metrics_op_end(struct metrics_op *op, uint32_t start, int ok);
+void metrics_op_record(struct metrics_op *op, uint32_t us, int ok);
+int metrics_format(metrics_sink_fn sink, void *ctx);
+void StartMetricsTask(void const *argument);
+
+#endif /* INC_METRICS_H_ */
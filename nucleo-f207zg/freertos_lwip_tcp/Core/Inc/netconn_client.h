@@ -0,0 +1,70 @@
+/*
+ * netconn_client.h
+ *
+ * Framed request/response client on a TCP netconn, for application tasks.
+ * The connection is kept across requests and re-established on the next
+ * one after any failure (error, timeout, malformed frame), since the byte
+ * stream can't be trusted after that. Responses are reassembled to exact
+ * frame lengths straight from the netbuf fragments, whatever the segment
+ * boundaries, and each request's latency goes into nc_stats. Constant
+ * parts of a request (templates in flash) can be sent by reference, with
+ * only the changing fields copied (nc_send_ref).
+ */
+
+#ifndef INC_NETCONN_CLIENT_H_
+#define INC_NETCONN_CLIENT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lwip/api.h"
+
+#define NC_RECV_TIMEOUT_MS 2000 //needs LWIP_SO_RCVTIMEO
+#define NC_SEND_TIMEOUT_MS 2000 //needs LWIP_SO_SNDTIMEO
+#define NC_LAT_BUCKETS 22 //log2 latency histogram, the last one holds >= 2^21 us
+
+/*
+ * Frame layout callback of nc_request: called with the hdr_len bytes of a
+ * response header, sets the length of the body that follows (at most
+ * body_max), returns -1 if the header is not valid.
+ */
+typedef int (*nc_frame_fn)(const uint8_t *hdr, u16_t *body_len, u16_t body_max);
+
+struct nc_stats
+{
+  uint32_t requests; //completed
+  uint32_t errors; //failed, including timeouts
+  uint32_t timeouts;
+  uint32_t connects; //established connections
+  uint32_t lat_min_us; //request sent to response complete
+  uint32_t lat_max_us;
+  uint64_t lat_sum_us;
+  uint32_t lat_hist[NC_LAT_BUCKETS]; //bucket i: latency < 2^(i+1) us
+  uint32_t bytes_tx;
+  uint32_t bytes_rx;
+};
+
+struct nc_client
+{
+  struct netconn *conn; //NULL while disconnected
+  ip_addr_t addr;
+  u16_t port;
+  struct netbuf *rx_buf; //received, not consumed yet...
+  const uint8_t *rx_ptr; //...from here...
+  u16_t rx_left; //...to the end of its current fragment
+  struct nc_stats stats;
+};
+
+void nc_init(struct nc_client *c, const ip_addr_t *addr, u16_t port);
+err_t nc_open(struct nc_client *c);
+void nc_close(struct nc_client *c);
+void nc_reset(struct nc_client *c);
+bool nc_connected(const struct nc_client *c);
+err_t nc_send(struct nc_client *c, const void *data, u16_t len);
+err_t nc_send_ref(struct nc_client *c, const void *hdr, u16_t hdr_len, const void *ref, u16_t ref_len);
+err_t nc_recv(struct nc_client *c, void *dst, u16_t len);
+int nc_request(struct nc_client *c, const void *req, u16_t req_len, const void *req_ref, u16_t ref_len,
+               void *resp, u16_t hdr_len, u16_t resp_max, nc_frame_fn frame);
+uint32_t nc_lat_percentile(const struct nc_stats *stats, uint8_t pct);
+
+#endif /* INC_NETCONN_CLIENT_H_ */
@@ -24,9 +24,18 @@
 
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include "lwip.h"
 #include "lwip/api.h"
+#include "netconn_client.h"
+#ifdef METRICS_ENABLE
+#include "metrics.h"
+#endif
+#ifdef UDP_SYNC_ENABLE
+#include "clock_sync.h" //from lwip_bare
+#endif
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -47,10 +56,57 @@ struct time_packet
   uint8_t hour;
   uint8_t minute;
   uint8_t second;
-  uint8_t dummy[247]; //you may add more information
+  uint8_t seq[4]; //request sequence number (little-endian), echoed in the response
+  uint8_t dummy[243]; //you may add more information
   uint8_t tail; //0xEA
 };
 //256 bytes
+
+/*
+ * Protocol v2: 8-byte header + len bytes of body (see lwip_bare tcp_client.h).
+ * A sample costs 8 + 14 (18 with microseconds) bytes instead of 2 x 256.
+ */
+#define TP2_MAGIC 0xAF
+#define TP2_VERSION 2
+#define TP2_BODY_MAX 16
+
+typedef enum
+{
+  TP2_REQ = 0,
+  TP2_RESP = 1,
+  TP2_HELLO = 2,
+  TP2_SYNC = 3 //over UDP, see StartUdpSyncTask
+} tp2_type;
+
+#define TP2_F_USEC 0x01 //RESP carries the microseconds of the second
+
+struct tp2_hdr
+{
+  uint8_t magic; //0xAF
+  uint8_t ver_type; //version << 4 | type
+  uint8_t len; //body bytes that follow
+  uint8_t flags; //TP2_F_*
+  uint8_t seq[4]; //little-endian, echoed in the response
+};
+//8 bytes
+
+struct tp2_resp
+{
+  uint8_t year;
+  uint8_t month;
+  uint8_t day;
+  uint8_t hour;
+  uint8_t minute;
+  uint8_t second;
+  uint8_t usec[4]; //little-endian, only with TP2_F_USEC
+};
+
+struct tp2_sync
+{
+  uint8_t t1[8]; //little-endian, client clock, echoed
+  uint8_t t2[8]; //request received, server (us since the Unix epoch)
+  uint8_t t3[8]; //response sent, server
+};
 /* USER CODE END PTD */
 
 /* Private define ------------------------------------------------------------*/
@@ -61,6 +117,16 @@ struct time_packet
 #define SERVER_IP3  15
 #define SERVER_IP4  13
 #define SERVER_PORT	5000 //server listen port
+
+#define CLIENT_PROTO 2 //highest protocol version offered, 1 to speak v1 only
+#define CLIENT_USEC 1 //ask for microseconds in v2 responses
+#define CLIENT_PERIOD_MS 100 //request interval
+#define REQ_V1_HDR offsetof(struct time_packet, dummy) //copied part of a v1 request, the rest is sent from flash
+#define CLIENT_REPORT_EVERY 100 //print the latency statistics every this many requests (0: never)
+
+#define SYNC_PERIOD_MS 1000 //UDP clock sync poll period
+#define SYNC_TIMEOUT_MS 500 //a response later than this is counted as lost
+#define SYNC_REPORT_EVERY 10 //print the filter state every this many exchanges (0: never)
 /* USER CODE END PD */
 
 /* Private macro -------------------------------------------------------------*/
@@ -72,11 +138,33 @@ struct time_packet
 /* USER CODE BEGIN Variables */
 extern struct netif gnetif; //extern gnetif
 ip_addr_t server_addr; //server address
-struct time_packet packet; //256 bytes time_packet structure
+struct time_packet packet; //256 bytes time_packet structure, v1 response
+static const struct time_packet req_v1 = {.head = 0xAE, .type = REQ, .tail = 0xEA}; //request templates (flash)
+static const struct tp2_hdr req_v2 = {.magic = TP2_MAGIC, .ver_type = (TP2_VERSION << 4) | TP2_REQ};
+static const struct tp2_hdr req_hello =
+{
+  .magic = TP2_MAGIC,
+  .ver_type = (CLIENT_PROTO << 4) | TP2_HELLO,
+  .flags = CLIENT_USEC ? TP2_F_USEC : 0
+};
+static uint8_t frame[sizeof(struct tp2_hdr) + TP2_BODY_MAX]; //v2 request/response
+static struct nc_client client; //connection to the server, kept across requests
+static uint8_t proto = CLIENT_PROTO; //protocol version in use
+static uint8_t proto_known; //negotiated, new connections skip the HELLO
+static uint8_t features; //TP2_F_* granted by the server
+static uint32_t next_seq; //sequence number of the next request
+#ifdef METRICS_ENABLE
+static struct metrics_op op_request = METRICS_OP_INIT("client.request"); //client_get_time, reconnects excluded
+static struct metrics_op op_sync = METRICS_OP_INIT("sync.exchange"); //SYNC request to matching response
+#endif
 /* USER CODE END Variables */
 
 /* Private function prototypes -----------------------------------------------*/
 /* USER CODE BEGIN FunctionPrototypes */
+static int client_hello(struct nc_client *c);
+static int client_get_time(struct nc_client *c);
+static void client_report(const struct nc_client *c);
+void StartUdpSyncTask(void const *argument);
 
 /* USER CODE END FunctionPrototypes */
 
@@ -97,8 +185,23 @@ void vApplicationGetIdleTaskMemory( StaticTask_t **ppxIdleTaskTCBBuffer, StackTy
 /* USER CODE END GET_IDLE_TASK_MEMORY */
 
 /* Hook prototypes */
+void configureTimerForRunTimeStats(void);
+unsigned long getRunTimeCounterValue(void);
 void vApplicationStackOverflowHook(xTaskHandle xTask, signed char *pcTaskName);
 
+/* USER CODE BEGIN 1 */
+/* Functions needed when configGENERATE_RUN_TIME_STATS is on */
+__weak void configureTimerForRunTimeStats(void)
+{
+
+}
+
+__weak unsigned long getRunTimeCounterValue(void)
+{
+return 0;
+}
+/* USER CODE END 1 */
+
 void vApplicationStackOverflowHook(xTaskHandle xTask, signed char *pcTaskName)
 {
   /* Run time stack overflow checking is performed if
@@ -110,19 +213,184 @@ void vApplicationStackOverflowHook(xTaskHandle xTask, signed char *pcTaskName)
 
 /* Private application code --------------------------------------------------*/
 /* USER CODE BEGIN Application */
-void StartTcpClientTask(void const *argument)
+static inline uint32_t get_u32(const uint8_t *b)
 {
+  return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static inline void put_u32(uint8_t *b, uint32_t v)
+{
+  b[0] = (uint8_t)v;
+  b[1] = (uint8_t)(v >> 8);
+  b[2] = (uint8_t)(v >> 16);
+  b[3] = (uint8_t)(v >> 24);
+}
+
+static inline uint64_t get_u64(const uint8_t *b)
+{
+  return get_u32(b) | ((uint64_t)get_u32(b + 4) << 32);
+}
+
+static int client_frame_v1(const uint8_t *hdr, u16_t *body_len, u16_t body_max)
+{
+  LWIP_UNUSED_ARG(hdr);
+  LWIP_UNUSED_ARG(body_max);
+
+  *body_len = 0; //fixed size, checked field by field afterwards
+  return 0;
+}
+
+static int client_frame_v2(const uint8_t *hdr, u16_t *body_len, u16_t body_max)
+{
+  const struct tp2_hdr *h = (const struct tp2_hdr *)hdr;
+
+  if (h->magic != TP2_MAGIC || h->ver_type != ((TP2_VERSION << 4) | TP2_RESP) ||
+      h->len < offsetof(struct tp2_resp, usec) || h->len > body_max)
+  {
+    return -1;
+  }
+  *body_len = h->len;
+  return 0;
+}
+
+/*
+ * client_hello
+ * offer CLIENT_PROTO, the server answers with the version it picked.
+ * Returns 1 for a v1-only server: a v1 packet for an answer, or a close once
+ * the HELLO went out. -1 (timeout, reset) leaves the question open.
+ */
+static int client_hello(struct nc_client *c)
+{
+  struct tp2_hdr hello;
+  uint8_t ver;
   err_t err;
-  struct netconn *conn;
-  struct netbuf *buf;
-  void *data;
 
-  u16_t len; //buffer length
-  u16_t nRead; //read buffer index
-  u16_t nWritten; //write buffer index
+  if (nc_send(c, &req_hello, sizeof(struct tp2_hdr)) != ERR_OK)
+  {
+    return -1;
+  }
+  err = nc_recv(c, &hello, sizeof(struct tp2_hdr));
+  if (err == ERR_CLSD || (err == ERR_OK && hello.magic == 0xAE))
+  {
+    return 1;
+  }
+  if (err != ERR_OK || hello.magic != TP2_MAGIC || (hello.ver_type & 0x0F) != TP2_HELLO ||
+      (hello.ver_type >> 4) < 1)
+  {
+    return -1;
+  }
+
+  ver = hello.ver_type >> 4;
+  proto = ver < CLIENT_PROTO ? ver : CLIENT_PROTO;
+  features = hello.flags & (CLIENT_USEC ? TP2_F_USEC : 0);
+  return 0;
+}
+
+/*
+ * client_get_time
+ * send one request in the negotiated version, check and print the response
+ */
+static int client_get_time(struct nc_client *c)
+{
+  uint32_t seq = next_seq++;
+
+  if (proto >= 2)
+  {
+    struct tp2_hdr *hdr = (struct tp2_hdr *)frame;
+    const struct tp2_resp *resp = (const struct tp2_resp *)(hdr + 1);
+
+    memcpy(hdr, &req_v2, sizeof(struct tp2_hdr));
+    hdr->flags = features;
+    put_u32(hdr->seq, seq);
+
+    if (nc_request(c, hdr, sizeof(struct tp2_hdr), NULL, 0, frame, sizeof(struct tp2_hdr), sizeof(frame),
+                   client_frame_v2) < 0)
+    {
+      return -1;
+    }
+    if (get_u32(hdr->seq) != seq)
+    {
+      nc_reset(c); //a response to another request: out of sync
+      return -1;
+    }
+
+    if ((hdr->flags & TP2_F_USEC) && hdr->len >= sizeof(struct tp2_resp))
+    {
+      printf("%04d-%02d-%02d %02d:%02d:%02d.%06lu\r\n", resp->year + 2000, resp->month, resp->day,
+             resp->hour, resp->minute, resp->second, (unsigned long)get_u32(resp->usec)); //print time information
+    }
+    else
+    {
+      printf("%04d-%02d-%02d %02d:%02d:%02d\r\n", resp->year + 2000, resp->month, resp->day,
+             resp->hour, resp->minute, resp->second); //print time information
+    }
+  }
+  else
+  {
+    uint8_t req[REQ_V1_HDR]; //head to seq
+
+    memcpy(req, &req_v1, REQ_V1_HDR);
+    put_u32(req + offsetof(struct time_packet, seq), seq);
+
+    if (nc_request(c, req, REQ_V1_HDR, (const uint8_t *)&req_v1 + REQ_V1_HDR, sizeof(struct time_packet) - REQ_V1_HDR,
+                   &packet, sizeof(struct time_packet), sizeof(struct time_packet), client_frame_v1) < 0)
+    {
+      return -1;
+    }
+    if (packet.head != 0xAE || packet.tail != 0xEA || packet.type != RESP || get_u32(packet.seq) != seq)
+    {
+      nc_reset(c);
+      return -1;
+    }
+
+    printf("%04d-%02d-%02d %02d:%02d:%02d\r\n", packet.year + 2000, packet.month, packet.day,
+           packet.hour, packet.minute, packet.second); //print time information
+  }
+
+  HAL_GPIO_TogglePin(LD2_GPIO_Port, LD2_Pin); //toggle data led
+  return 0;
+}
+
+/*
+ * client_report
+ * one line of request counters and latencies
+ */
+static void client_report(const struct nc_client *c)
+{
+  const struct nc_stats *s = &c->stats;
+
+  if (s->requests == 0) //no latency yet, nothing for the histogram to bound
+  {
+    printf("[CLIENT] v%u: 0 requests, %lu errors (%lu timeouts), %lu connects, latency no samples\r\n",
+           proto, (unsigned long)s->errors, (unsigned long)s->timeouts, (unsigned long)s->connects);
+    return;
+  }
+  printf("[CLIENT] v%u: %lu requests, %lu errors (%lu timeouts), %lu connects, latency min/avg/max %lu/%lu/%lu us, p50/p99 <%lu/<%lu us\r\n",
+         proto, (unsigned long)s->requests, (unsigned long)s->errors, (unsigned long)s->timeouts,
+         (unsigned long)s->connects, (unsigned long)s->lat_min_us, (unsigned long)(s->lat_sum_us / s->requests),
+         (unsigned long)s->lat_max_us, (unsigned long)nc_lat_percentile(s, 50), (unsigned long)nc_lat_percentile(s, 99));
+}
+
+/*
+ * StartTcpClientTask
+ * one time request every CLIENT_PERIOD_MS on a persistent connection, which
+ * is re-established (and the protocol negotiated once) after any failure
+ */
+void StartTcpClientTask(void const *argument)
+{
+#ifdef METRICS_ENABLE
+  uint32_t start;
+#endif
+  int err;
 
   LWIP_UNUSED_ARG(argument);
 
+  IP4_ADDR(&server_addr, SERVER_IP1, SERVER_IP2, SERVER_IP3, SERVER_IP4); //server ip
+  nc_init(&client, &server_addr, SERVER_PORT);
+#ifdef METRICS_ENABLE
+  metrics_op_add(&op_request);
+#endif
+
   while (1)
   {
     if (gnetif.ip_addr.addr == 0 || gnetif.netmask.addr == 0 || gnetif.gw.addr == 0) //system has no valid ip address
@@ -132,77 +400,169 @@ void StartTcpClientTask(void const *argument)
     }
     else //valid ip address
     {
-      osDelay(100); //request interval
+      osDelay(CLIENT_PERIOD_MS); //request interval
     }
 
-    nRead = 0; //clear indexes
-    nWritten = 0;
-
-    conn = netconn_new(NETCONN_TCP); //new tcp netconn
-
-    if (conn != NULL)
+    if (!nc_connected(&client))
     {
-      IP4_ADDR(&server_addr, SERVER_IP1, SERVER_IP2, SERVER_IP3, SERVER_IP4); //server ip
-      err = netconn_connect(conn, &server_addr, SERVER_PORT); //connect to the server
-
-      if (err != ERR_OK)
+      if (nc_open(&client) != ERR_OK)
       {
-        netconn_delete(conn); //free memory
         continue;
       }
 
-      memset(&packet, 0, sizeof(struct time_packet));
-      packet.head = 0xAE; //head
-      packet.type = REQ; //request type
-      packet.tail = 0xEA; //tail
-
-      do {
-        if (netconn_write_partly(
-            conn, //connection
-            (const void*) (&packet + nWritten), //buffer pointer
-            (sizeof(struct time_packet) - nWritten), //buffer length
-            NETCONN_NOFLAG, //no copy
-            (size_t*) &len) != ERR_OK) //written len
+      if (proto >= 2 && !proto_known)
+      {
+        err = client_hello(&client);
+        if (err != 0)
         {
-          netconn_close(conn); //close session
-          netconn_delete(conn); //free memory
+          if (err > 0) //v1-only server
+          {
+            proto = 1;
+            proto_known = 1;
+          }
+          nc_close(&client); //otherwise the next connection sends the HELLO again
           continue;
         }
-        else {
-          nWritten += len;
-        }
-      } while (nWritten < sizeof(struct time_packet)); //send request
-
-//      while (netconn_recv(conn, &buf) == ERR_OK) //receive the response
-//      {
-//        do {
-//          netbuf_data(buf, &data, &len); //receive data pointer & length
-//          memcpy(&packet + nRead, data, len);
-//          nRead += len;
-//          printf("len = %d\r\n", len);
-//          printf("0x%02x\r\n", packet.tail);
-//        } while (netbuf_next(buf) >= 0); //check buffer empty
-//
-//        netbuf_delete(buf); //clear buffer
-//      }
-
-      if (netconn_recv(conn, &buf) == ERR_OK) {
-    	  netbuf_data(buf, &data, &len); //receive data pointer & length
-//    	  printf("len = %d\r\n", len);
-    	  memcpy(&packet + nRead, data, len);
-    	  netbuf_delete(buf); //clear buffer
+        proto_known = 1;
+      }
+    }
+
+#ifdef METRICS_ENABLE
+    start = metrics_op_start();
+#endif
+    err = client_get_time(&client);
+#ifdef METRICS_ENABLE
+    metrics_op_end(&op_request, start, err == 0);
+#endif
+    if (err != 0)
+    {
+      HAL_GPIO_WritePin(LD3_GPIO_Port, LD3_Pin, GPIO_PIN_SET); //error led
+    }
+    else if (CLIENT_REPORT_EVERY != 0 && client.stats.requests % CLIENT_REPORT_EVERY == 0)
+    {
+      client_report(&client);
+    }
+  }
+}
+#ifdef UDP_SYNC_ENABLE
+/*
+ * StartUdpSyncTask
+ * NTP-style clock sync over a UDP netconn: one TP2_SYNC exchange every
+ * SYNC_PERIOD_MS, fed to clock_sync. T4 is taken as soon as netconn_recv
+ * returns, so this task should run above the other application tasks.
+ */
+void StartUdpSyncTask(void const *argument)
+{
+  struct netconn *conn;
+  struct netbuf *buf;
+  ip_addr_t sync_addr;
+  uint8_t b[sizeof(struct tp2_hdr) + sizeof(struct tp2_sync)];
+  struct tp2_hdr *hdr = (struct tp2_hdr *)b;
+  const struct tp2_sync *body = (const struct tp2_sync *)(hdr + 1);
+  uint32_t seq = 0, received = 0, lost = 0, wake;
+#ifdef METRICS_ENABLE
+  uint32_t start;
+#endif
+  uint64_t t1, t4;
+  uint8_t *req;
+  err_t err;
+
+  LWIP_UNUSED_ARG(argument);
+
+  clock_sync_init();
+#ifdef METRICS_ENABLE
+  metrics_op_add(&op_sync);
+#endif
+  while (gnetif.ip_addr.addr == 0) //system has no valid ip address
+  {
+    osDelay(1000);
+  }
+
+  conn = netconn_new(NETCONN_UDP);
+  IP4_ADDR(&sync_addr, SERVER_IP1, SERVER_IP2, SERVER_IP3, SERVER_IP4); //server ip
+  if (conn == NULL || netconn_connect(conn, &sync_addr, SERVER_PORT) != ERR_OK)
+  {
+    HAL_GPIO_WritePin(LD3_GPIO_Port, LD3_Pin, GPIO_PIN_SET); //error led
+    osThreadTerminate(NULL);
+    return;
+  }
+#if LWIP_SO_RCVTIMEO
+  netconn_set_recvtimeout(conn, SYNC_TIMEOUT_MS);
+#endif
+
+  wake = osKernelSysTick();
+  while (1)
+  {
+    buf = netbuf_new();
+    req = buf != NULL ? netbuf_alloc(buf, sizeof(struct tp2_hdr) + sizeof(body->t1)) : NULL;
+    if (req == NULL)
+    {
+      if (buf != NULL)
+      {
+        netbuf_delete(buf);
+      }
+      osDelayUntil(&wake, SYNC_PERIOD_MS);
+      continue;
+    }
+
+    memset(req, 0, sizeof(struct tp2_hdr));
+    req[0] = TP2_MAGIC;
+    req[1] = (TP2_VERSION << 4) | TP2_SYNC;
+    req[2] = sizeof(body->t1);
+    put_u32(&req[offsetof(struct tp2_hdr, seq)], ++seq);
+#ifdef METRICS_ENABLE
+    start = metrics_op_start();
+#endif
+    t1 = clock_local_us(); //T1, as late as possible
+    put_u32(&req[sizeof(struct tp2_hdr)], (uint32_t)t1);
+    put_u32(&req[sizeof(struct tp2_hdr) + 4], (uint32_t)(t1 >> 32));
+    err = netconn_send(conn, buf);
+    netbuf_delete(buf);
+
+    t4 = 0;
+    while (err == ERR_OK && netconn_recv(conn, &buf) == ERR_OK)
+    {
+      uint16_t len;
+
+      t4 = clock_local_us(); //T4 before anything else
+      len = netbuf_copy(buf, b, sizeof(b));
+      netbuf_delete(buf);
+      if (len == sizeof(b) && hdr->magic == TP2_MAGIC && hdr->ver_type == ((TP2_VERSION << 4) | TP2_SYNC) &&
+          hdr->len >= sizeof(struct tp2_sync) && get_u32(hdr->seq) == seq && get_u64(body->t1) == t1)
+      {
+        break;
       }
+      t4 = 0; //late answer to an earlier request, keep waiting
+    }
+#ifdef METRICS_ENABLE
+    metrics_op_end(&op_sync, start, t4 != 0);
+#endif
 
-      //if (len == sizeof(struct time_packet) && packet.type == RESP) //if received length is valid
-      //{
-        printf("%04d-%02d-%02d %02d:%02d:%02d\r\n", packet.year + 2000, packet.month, packet.day, packet.hour, packet.minute, packet.second); //print time information
-        HAL_GPIO_TogglePin(LD2_GPIO_Port, LD2_Pin); //toggle data led
-      //}
+    if (t4 == 0)
+    {
+      lost++;
+    }
+    else
+    {
+      clock_sync_update(t1, get_u64(body->t2), get_u64(body->t3), t4);
+      received++;
 
-      netconn_close(conn); //close session
-      netconn_delete(conn); //free memory
+      if (SYNC_REPORT_EVERY != 0 && received % SYNC_REPORT_EVERY == 0)
+      {
+        struct sync_stats cs;
+        uint64_t now = clock_now_us();
+
+        clock_sync_get(&cs);
+        printf("[SYNC] time %lu.%06lu, %lu samples (%lu used, %lu lost), offset %ld us, delay %lu us, freq %ld ppb, jitter %lu us\r\n",
+               (unsigned long)(now / 1000000), (unsigned long)(now % 1000000),
+               (unsigned long)cs.samples, (unsigned long)cs.used, (unsigned long)lost,
+               (long)cs.offset_us, (unsigned long)cs.delay_us, (long)cs.freq_ppb, (unsigned long)cs.jitter_us);
+      }
     }
+
+    osDelayUntil(&wake, SYNC_PERIOD_MS);
   }
 }
+#endif /* UDP_SYNC_ENABLE */
 /* USER CODE END Application */
 
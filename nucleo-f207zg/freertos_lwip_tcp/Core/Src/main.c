@@ -23,7 +23,12 @@
 
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
-
+#ifdef UARTLOG_ENABLE
+#include "uartlog.h"
+#endif
+#ifdef METRICS_ENABLE
+#include "metrics.h"
+#endif
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -50,6 +55,8 @@ osThreadId defaultTaskHandle;
 /* USER CODE BEGIN PV */
 extern struct netif gnetif;
 osThreadId tcpClientTaskHandle;  //tcp client task handle
+osThreadId udpSyncTaskHandle;  //udp clock sync task handle
+osThreadId metricsTaskHandle;  //metrics server task handle
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
@@ -61,14 +68,37 @@ void StartDefaultTask(void const * argument);
 
 /* USER CODE BEGIN PFP */
 void StartTcpClientTask(void const *argument);
+void StartUdpSyncTask(void const *argument);
 /* USER CODE END PFP */
 
 /* Private user code ---------------------------------------------------------*/
 /* USER CODE BEGIN 0 */
 int __io_putchar(int ch){
+#ifdef UARTLOG_ENABLE
+  return uartlog_putc(ch);	// queued, drained by USART3 TX DMA
+#else
   HAL_UART_Transmit(&huart3, (uint8_t *)&ch, 1, 0xFFFF);
   return ch;
+#endif
+}
+
+#ifdef UARTLOG_ENABLE
+// HSO: one logger channel per task, so each ring has a single producer
+static uint8_t tcpClientLogBuf[1024];
+static uartlog_chan tcpClientLog;
+static uint8_t udpSyncLogBuf[512];
+static uartlog_chan udpSyncLog;
+
+uartlog_chan *uartlog_current(void){
+  if (__get_IPSR() != 0)
+    return &uartlog_irq;
+  if (tcpClientTaskHandle != NULL && osThreadGetId() == tcpClientTaskHandle)
+    return &tcpClientLog;
+  if (udpSyncTaskHandle != NULL && osThreadGetId() == udpSyncTaskHandle)
+    return &udpSyncLog;
+  return &uartlog_stdout;	// main() before the scheduler, then defaultTask
 }
+#endif
 
 /* USER CODE END 0 */
 
@@ -103,7 +133,15 @@ int main(void)
   MX_USART3_UART_Init();
   MX_USB_OTG_FS_PCD_Init();
   /* USER CODE BEGIN 2 */
-
+#ifdef UARTLOG_ENABLE
+  // HSO: non-blocking printf, see uartlog.h
+  if (uartlog_init(&huart3) != 0) {
+    static const char msg[] = "uartlog: USART3 TX DMA not configured\r\n";
+    HAL_UART_Transmit(&huart3, (uint8_t *)msg, sizeof(msg) - 1, 0xFFFF);
+  }
+  uartlog_chan_init(&tcpClientLog, "tcpClient", tcpClientLogBuf, sizeof(tcpClientLogBuf));
+  uartlog_chan_init(&udpSyncLog, "udpSync", udpSyncLogBuf, sizeof(udpSyncLogBuf));
+#endif
   /* USER CODE END 2 */
 
   /* USER CODE BEGIN RTOS_MUTEX */
@@ -326,6 +364,16 @@ void StartDefaultTask(void const * argument)
   /* USER CODE BEGIN 5 */
   osThreadDef(tcpClientTask, StartTcpClientTask, osPriorityNormal, 0, configMINIMAL_STACK_SIZE);
   tcpClientTaskHandle = osThreadCreate(osThread(tcpClientTask), NULL); //run tcp client task
+#ifdef UDP_SYNC_ENABLE
+  // HSO: above the other tasks, so T4 is taken as soon as the response arrives
+  osThreadDef(udpSyncTask, StartUdpSyncTask, osPriorityAboveNormal, 0, configMINIMAL_STACK_SIZE);
+  udpSyncTaskHandle = osThreadCreate(osThread(udpSyncTask), NULL); //run udp clock sync task
+#endif
+#ifdef METRICS_ENABLE
+  // HSO: below the clients, a scrape must not delay their requests
+  osThreadDef(metricsTask, StartMetricsTask, osPriorityBelowNormal, 0, 2 * configMINIMAL_STACK_SIZE);
+  metricsTaskHandle = osThreadCreate(osThread(metricsTask), NULL); //run metrics server task
+#endif
   /* Infinite loop */
   for(;;)
   {
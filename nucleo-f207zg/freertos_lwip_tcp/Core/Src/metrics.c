@@ -0,0 +1,364 @@
+/*
+ * metrics.c
+ *
+ * See metrics.h. A snapshot is formatted in METRICS_CHUNK pieces straight
+ * into the connection (netconn_write copies them), so it takes no buffer of
+ * its own. The lwIP counters are copied under the core lock so that they
+ * are consistent with each other, the pools' ones too (lwip_stats.memp[]
+ * only points to them), the operation counters under a critical section. The run time counter hooks of configGENERATE_RUN_TIME_STATS live
+ * here as well, over the weak ones CubeMX puts in freertos.c.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "cmsis_os.h"
+#include "main.h"
+#include "lwip/api.h"
+#include "lwip/memp.h"
+#include "lwip/stats.h"
+#include "lwip/tcpip.h"
+#include "cycles.h"
+#include "metrics.h"
+
+#define METRICS_SEND_TIMEOUT_MS 1000 //a stalled scraper must not hold the task
+
+struct metrics_out
+{
+  metrics_sink_fn sink;
+  void *ctx;
+  int err;
+  size_t len;
+  char buf[METRICS_CHUNK];
+};
+
+static struct metrics_op *ops; //registered operations
+#if configUSE_TRACE_FACILITY
+static TaskStatus_t tasks[METRICS_TASKS]; //metrics task only
+#endif
+#if LWIP_STATS
+static struct stats_ lwip_copy;
+#endif
+#if MEMP_STATS
+static struct stats_mem memp_copy[MEMP_MAX]; //what lwip_copy.memp[] points to
+#endif
+#if MEMP_STATS
+static const char *const memp_names[] =
+{
+#define LWIP_MEMPOOL(name, num, size, desc) #name,
+#include "lwip/priv/memp_std.h"
+};
+#endif
+
+#if configGENERATE_RUN_TIME_STATS
+void configureTimerForRunTimeStats(void)
+{
+  cycles_enable();
+}
+
+unsigned long getRunTimeCounterValue(void)
+{
+  return DWT->CYCCNT >> METRICS_RUNTIME_SHIFT;
+}
+#endif
+
+/*
+ * metrics_op_add
+ * list op in the snapshots, once, before it is used
+ */
+void metrics_op_add(struct metrics_op *op)
+{
+  cycles_enable();
+
+  taskENTER_CRITICAL();
+  op->next = ops;
+  ops = op;
+  taskEXIT_CRITICAL();
+}
+
+uint32_t metrics_op_start(void)
+{
+  return DWT->CYCCNT;
+}
+
+/*
+ * metrics_op_end
+ * count an operation started at start (metrics_op_start), with its latency
+ * if ok, as an error otherwise
+ */
+void metrics_op_end(struct metrics_op *op, uint32_t start, int ok)
+{
+  metrics_op_record(op, (DWT->CYCCNT - start) / (SystemCoreClock / 1000000), ok);
+}
+
+/*
+ * metrics_op_record
+ * count an operation timed by the caller, for those longer than the cycle
+ * counter wraps (35 s at 120 MHz)
+ */
+void metrics_op_record(struct metrics_op *op, uint32_t us, int ok)
+{
+  taskENTER_CRITICAL();
+  if (!ok)
+  {
+    op->errors++;
+  }
+  else
+  {
+    op->count++;
+    op->sum_us += us;
+    if (us < op->min_us)
+    {
+      op->min_us = us;
+    }
+    if (us > op->max_us)
+    {
+      op->max_us = us;
+    }
+  }
+  taskEXIT_CRITICAL();
+}
+
+/*
+ * metrics_printf
+ * append a line, handing the chunk to the sink first if it doesn't fit
+ */
+static void metrics_printf(struct metrics_out *o, const char *fmt, ...)
+{
+  va_list ap;
+  int n;
+
+  if (o->err)
+  {
+    return;
+  }
+
+  va_start(ap, fmt);
+  n = vsnprintf(o->buf + o->len, sizeof(o->buf) - o->len, fmt, ap);
+  va_end(ap);
+  if (n > 0 && (size_t)n >= sizeof(o->buf) - o->len && o->len > 0)
+  {
+    o->err = o->sink(o->ctx, o->buf, o->len);
+    o->len = 0;
+    if (o->err)
+    {
+      return;
+    }
+    va_start(ap, fmt);
+    n = vsnprintf(o->buf, sizeof(o->buf), fmt, ap);
+    va_end(ap);
+  }
+  if (n > 0 && (size_t)n < sizeof(o->buf) - o->len) //longer than a chunk: dropped
+  {
+    o->len += n;
+  }
+}
+
+/* uint64_t in decimal, without printf's %llu (newlib-nano) */
+static const char *metrics_u64(char *s, uint64_t v)
+{
+  char *p = s + 20;
+
+  *p = '\0';
+  do
+  {
+    *--p = '0' + v % 10;
+    v /= 10;
+  } while (v != 0);
+  return p;
+}
+
+#if configUSE_TRACE_FACILITY
+/*
+ * metrics_tasks
+ * run time and unused stack of every task; names get '_' for spaces
+ * ("Tmr Svc")
+ */
+static void metrics_tasks(struct metrics_out *o)
+{
+  char name[configMAX_TASK_NAME_LEN + 1], *c;
+  uint32_t total = 0;
+  UBaseType_t n, i;
+
+  n = uxTaskGetSystemState(tasks, METRICS_TASKS, &total);
+  metrics_printf(o, "tasks %lu\n", (unsigned long)uxTaskGetNumberOfTasks()); //none listed if more than METRICS_TASKS
+#if configGENERATE_RUN_TIME_STATS
+  metrics_printf(o, "run.total %lu\n", (unsigned long)total);
+#endif
+
+  for (i = 0; i < n; i++)
+  {
+    strncpy(name, tasks[i].pcTaskName, configMAX_TASK_NAME_LEN);
+    name[configMAX_TASK_NAME_LEN] = '\0';
+    for (c = name; *c != '\0'; c++)
+    {
+      if (*c == ' ')
+      {
+        *c = '_';
+      }
+    }
+#if configGENERATE_RUN_TIME_STATS
+    metrics_printf(o, "task.%s.run %lu\n", name, (unsigned long)tasks[i].ulRunTimeCounter);
+#endif
+    metrics_printf(o, "task.%s.stack_free %lu\n", name,
+                   (unsigned long)(tasks[i].usStackHighWaterMark * sizeof(StackType_t)));
+  }
+}
+#endif
+
+#if LWIP_STATS
+/*
+ * metrics_lwip_copy
+ * copy lwip_stats and the pool counters it points to
+ */
+static void metrics_lwip_copy(void)
+{
+#if MEMP_STATS
+  int i;
+#endif
+
+  lwip_copy = lwip_stats;
+#if MEMP_STATS
+  for (i = 0; i < MEMP_MAX; i++)
+  {
+    memp_copy[i] = *lwip_stats.memp[i];
+  }
+#endif
+}
+
+/*
+ * metrics_lwip
+ * heap, pools, link and TCP counters, from a consistent copy
+ */
+static void metrics_lwip(struct metrics_out *o)
+{
+#if MEMP_STATS
+  int i;
+#endif
+
+#if LWIP_TCPIP_CORE_LOCKING
+  LOCK_TCPIP_CORE();
+  metrics_lwip_copy();
+  UNLOCK_TCPIP_CORE();
+#else
+  metrics_lwip_copy();
+#endif
+
+#if MEM_STATS
+  metrics_printf(o, "mem.used %lu\nmem.max %lu\nmem.err %lu\n", (unsigned long)lwip_copy.mem.used,
+                 (unsigned long)lwip_copy.mem.max, (unsigned long)lwip_copy.mem.err);
+#endif
+#if MEMP_STATS
+  for (i = 0; i < MEMP_MAX; i++)
+  {
+    const struct stats_mem *m = &memp_copy[i];
+
+    metrics_printf(o, "memp.%s.used %lu\nmemp.%s.max %lu\nmemp.%s.err %lu\n", memp_names[i],
+                   (unsigned long)m->used, memp_names[i], (unsigned long)m->max, memp_names[i], (unsigned long)m->err);
+  }
+#endif
+#if LINK_STATS
+  metrics_printf(o, "link.xmit %lu\nlink.recv %lu\nlink.drop %lu\nlink.memerr %lu\n", (unsigned long)lwip_copy.link.xmit,
+                 (unsigned long)lwip_copy.link.recv, (unsigned long)lwip_copy.link.drop,
+                 (unsigned long)lwip_copy.link.memerr);
+#endif
+#if TCP_STATS
+  metrics_printf(o, "tcp.xmit %lu\ntcp.recv %lu\ntcp.drop %lu\ntcp.memerr %lu\n", (unsigned long)lwip_copy.tcp.xmit,
+                 (unsigned long)lwip_copy.tcp.recv, (unsigned long)lwip_copy.tcp.drop,
+                 (unsigned long)lwip_copy.tcp.memerr);
+#endif
+#if MIB2_STATS
+  metrics_printf(o, "tcp.retrans %lu\ntcp.active_opens %lu\ntcp.attempt_fails %lu\ntcp.estab_resets %lu\ntcp.out_rsts %lu\n",
+                 (unsigned long)lwip_copy.mib2.tcpretranssegs, (unsigned long)lwip_copy.mib2.tcpactiveopens,
+                 (unsigned long)lwip_copy.mib2.tcpattemptfails, (unsigned long)lwip_copy.mib2.tcpestabresets,
+                 (unsigned long)lwip_copy.mib2.tcpoutrsts);
+#endif
+}
+#endif
+
+/*
+ * metrics_format
+ * write one snapshot through sink; returns the sink's first error
+ */
+int metrics_format(metrics_sink_fn sink, void *ctx)
+{
+  struct metrics_out o;
+  struct metrics_op *op, c;
+  char u64[21];
+
+  o.sink = sink;
+  o.ctx = ctx;
+  o.err = 0;
+  o.len = 0;
+
+  metrics_printf(&o, "uptime_ms %lu\n", (unsigned long)(xTaskGetTickCount() * portTICK_PERIOD_MS));
+  metrics_printf(&o, "heap.free %lu\nheap.min_free %lu\n", (unsigned long)xPortGetFreeHeapSize(),
+                 (unsigned long)xPortGetMinimumEverFreeHeapSize());
+#if configUSE_TRACE_FACILITY
+  metrics_tasks(&o);
+#endif
+#if LWIP_STATS
+  metrics_lwip(&o);
+#endif
+
+  for (op = ops; op != NULL; op = c.next)
+  {
+    taskENTER_CRITICAL();
+    c = *op;
+    taskEXIT_CRITICAL();
+
+    metrics_printf(&o, "op.%s.count %lu\nop.%s.errors %lu\n", c.name, (unsigned long)c.count, c.name,
+                   (unsigned long)c.errors);
+    metrics_printf(&o, "op.%s.min_us %lu\nop.%s.max_us %lu\nop.%s.sum_us %s\n", c.name,
+                   (unsigned long)(c.count ? c.min_us : 0), c.name, (unsigned long)c.max_us, c.name,
+                   metrics_u64(u64, c.sum_us));
+  }
+
+  if (!o.err && o.len > 0)
+  {
+    o.err = sink(ctx, o.buf, o.len);
+  }
+  return o.err;
+}
+
+static int metrics_sink_netconn(void *ctx, const char *buf, size_t len)
+{
+  return netconn_write((struct netconn *)ctx, buf, len, NETCONN_COPY) != ERR_OK;
+}
+
+/*
+ * StartMetricsTask
+ * serve one snapshot per connection on METRICS_PORT
+ */
+void StartMetricsTask(void const *argument)
+{
+  struct netconn *listener, *conn;
+
+  LWIP_UNUSED_ARG(argument);
+
+  listener = netconn_new(NETCONN_TCP);
+  if (listener == NULL || netconn_bind(listener, IP_ADDR_ANY, METRICS_PORT) != ERR_OK ||
+      netconn_listen(listener) != ERR_OK)
+  {
+    HAL_GPIO_WritePin(LD3_GPIO_Port, LD3_Pin, GPIO_PIN_SET); //error led
+    osThreadTerminate(NULL);
+    return;
+  }
+
+  while (1)
+  {
+    if (netconn_accept(listener, &conn) != ERR_OK)
+    {
+      continue;
+    }
+#if LWIP_SO_SNDTIMEO
+    netconn_set_sendtimeout(conn, METRICS_SEND_TIMEOUT_MS);
+#endif
+    metrics_format(metrics_sink_netconn, conn);
+    netconn_close(conn);
+    netconn_delete(conn);
+  }
+}
@@ -0,0 +1,376 @@
+/*
+ * netconn_client.c
+ *
+ * See netconn_client.h. Receiving walks the netbuf fragment by fragment
+ * (netbuf_data/netbuf_next) with a cursor kept across calls, so a header
+ * and its body can come in one segment, a frame can span several, and no
+ * fragment is walked twice. Latencies are measured with the DWT cycle
+ * counter.
+ */
+
+#include <string.h>
+
+#include "main.h"
+#include "lwip/tcp.h"
+#include "lwip/tcpip.h"
+#include "cycles.h"
+#include "netconn_client.h"
+
+static inline uint32_t nc_cycles(void)
+{
+  return DWT->CYCCNT;
+}
+
+/*
+ * nc_init
+ * set the server address, the connection is opened by the first request
+ */
+void nc_init(struct nc_client *c, const ip_addr_t *addr, u16_t port)
+{
+  memset(c, 0, sizeof(*c));
+  ip_addr_copy(c->addr, *addr);
+  c->port = port;
+  c->stats.lat_min_us = UINT32_MAX;
+
+  cycles_enable();
+}
+
+#if !LWIP_TCPIP_CORE_LOCKING
+/*
+ * nc_nodelay
+ * run by tcpip_thread for nc_open, which can't lock the core to reach the pcb
+ */
+static void nc_nodelay(void *arg)
+{
+  struct netconn *conn = arg;
+
+  if (conn->pcb.tcp != NULL)
+  {
+    tcp_nagle_disable(conn->pcb.tcp);
+  }
+}
+#endif
+
+bool nc_connected(const struct nc_client *c)
+{
+  return c->conn != NULL;
+}
+
+/*
+ * nc_open
+ * connect unless already connected
+ */
+err_t nc_open(struct nc_client *c)
+{
+  err_t err;
+
+  if (c->conn != NULL)
+  {
+    return ERR_OK;
+  }
+
+  c->conn = netconn_new(NETCONN_TCP); //new tcp netconn
+  if (c->conn == NULL)
+  {
+    return ERR_MEM;
+  }
+#if LWIP_SO_RCVTIMEO
+  netconn_set_recvtimeout(c->conn, NC_RECV_TIMEOUT_MS); //a silent server must not block the task
+#endif
+#if LWIP_SO_SNDTIMEO
+  netconn_set_sendtimeout(c->conn, NC_SEND_TIMEOUT_MS); //nor a full window
+#endif
+
+  err = netconn_connect(c->conn, &c->addr, c->port); //connect to the server
+  if (err != ERR_OK)
+  {
+    netconn_delete(c->conn); //free memory
+    c->conn = NULL;
+    return err;
+  }
+
+#if LWIP_TCPIP_CORE_LOCKING
+  LOCK_TCPIP_CORE();
+  tcp_nagle_disable(c->conn->pcb.tcp); //a request written in two parts must not wait for an ACK
+  UNLOCK_TCPIP_CORE();
+#else
+  if (tcpip_callback(nc_nodelay, c->conn) != ERR_OK) //queued ahead of the first write, in the same mailbox
+  {
+    netconn_delete(c->conn);
+    c->conn = NULL;
+    return ERR_MEM;
+  }
+#endif
+
+  c->stats.connects++;
+  return ERR_OK;
+}
+
+/*
+ * nc_close
+ * close the session and free what is left of it
+ */
+void nc_close(struct nc_client *c)
+{
+  if (c->rx_buf != NULL)
+  {
+    netbuf_delete(c->rx_buf);
+    c->rx_buf = NULL;
+  }
+  c->rx_left = 0;
+
+  if (c->conn != NULL)
+  {
+    netconn_close(c->conn); //close session
+    netconn_delete(c->conn); //free memory
+    c->conn = NULL;
+  }
+}
+
+/*
+ * nc_reset
+ * count a failed request and drop the connection, the stream is out of sync
+ */
+void nc_reset(struct nc_client *c)
+{
+  c->stats.errors++;
+  nc_close(c);
+}
+
+/*
+ * nc_send
+ * queue len bytes, copied (the caller's buffer is free on return)
+ */
+err_t nc_send(struct nc_client *c, const void *data, u16_t len)
+{
+  err_t err;
+
+  if (c->conn == NULL)
+  {
+    return ERR_CONN;
+  }
+
+  err = netconn_write(c->conn, data, len, NETCONN_COPY);
+  if (err == ERR_OK)
+  {
+    c->stats.bytes_tx += len;
+  }
+  return err;
+}
+
+/*
+ * nc_send_ref
+ * queue hdr_len bytes copied, then ref_len bytes by reference (PBUF_ROM),
+ * which must stay unchanged until acknowledged: a const template in flash.
+ * With the core lock, both go straight to the pcb, in one segment; without
+ * it, or without room, through the netconn
+ */
+err_t nc_send_ref(struct nc_client *c, const void *hdr, u16_t hdr_len, const void *ref, u16_t ref_len)
+{
+  err_t err = ERR_WOULDBLOCK;
+
+  if (c->conn == NULL)
+  {
+    return ERR_CONN;
+  }
+
+#if LWIP_TCPIP_CORE_LOCKING
+  LOCK_TCPIP_CORE();
+  if (c->conn->pcb.tcp != NULL && tcp_sndbuf(c->conn->pcb.tcp) >= hdr_len + ref_len &&
+      tcp_sndqueuelen(c->conn->pcb.tcp) + 2 <= TCP_SND_QUEUELEN)
+  {
+    err = tcp_write(c->conn->pcb.tcp, hdr, hdr_len, TCP_WRITE_FLAG_COPY);
+    if (err == ERR_OK)
+    {
+      err = tcp_write(c->conn->pcb.tcp, ref, ref_len, 0); //on failure the header is queued alone: reset
+      tcp_output(c->conn->pcb.tcp);
+    }
+  }
+  UNLOCK_TCPIP_CORE();
+#endif
+
+  if (err == ERR_WOULDBLOCK) //no core lock, or no room: the netconn waits for it
+  {
+    err = netconn_write(c->conn, hdr, hdr_len, NETCONN_COPY | NETCONN_MORE);
+    if (err == ERR_OK)
+    {
+      err = netconn_write(c->conn, ref, ref_len, NETCONN_NOCOPY);
+    }
+  }
+  if (err == ERR_OK)
+  {
+    c->stats.bytes_tx += hdr_len + ref_len;
+  }
+  return err;
+}
+
+/*
+ * nc_rx_advance
+ * once the current fragment is used up, move the cursor to the next one
+ * with data, or drop the netbuf at the end of its chain (so that it doesn't
+ * hold pbufs between requests)
+ */
+static void nc_rx_advance(struct nc_client *c)
+{
+  void *data;
+
+  while (c->rx_left == 0 && c->rx_buf != NULL)
+  {
+    if (netbuf_next(c->rx_buf) < 0) //last fragment
+    {
+      netbuf_delete(c->rx_buf); //clear buffer
+      c->rx_buf = NULL;
+    }
+    else
+    {
+      netbuf_data(c->rx_buf, &data, &c->rx_left);
+      c->rx_ptr = data;
+    }
+  }
+}
+
+/*
+ * nc_recv
+ * read exactly len bytes, whatever the netbuf boundaries (leftovers are kept
+ * for the next call, e.g. a body received with its header)
+ */
+err_t nc_recv(struct nc_client *c, void *dst, u16_t len)
+{
+  uint8_t *out = dst;
+  void *data;
+  u16_t n;
+  err_t err;
+
+  if (c->conn == NULL)
+  {
+    return ERR_CONN;
+  }
+
+  while (len > 0)
+  {
+    if (c->rx_buf == NULL)
+    {
+      err = netconn_recv(c->conn, &c->rx_buf);
+      if (err != ERR_OK)
+      {
+        c->rx_buf = NULL;
+        return err; //closed, reset or ERR_TIMEOUT
+      }
+      netbuf_data(c->rx_buf, &data, &c->rx_left); //a new netbuf starts at its first fragment
+      c->rx_ptr = data;
+    }
+
+    n = len < c->rx_left ? len : c->rx_left;
+    memcpy(out, c->rx_ptr, n);
+    out += n;
+    len -= n;
+    c->rx_ptr += n;
+    c->rx_left -= n;
+    c->stats.bytes_rx += n;
+    nc_rx_advance(c);
+  }
+  return ERR_OK;
+}
+
+static void nc_account(struct nc_stats *s, uint32_t us)
+{
+  uint8_t b = 0;
+
+  s->requests++;
+  s->lat_sum_us += us;
+  if (us < s->lat_min_us)
+  {
+    s->lat_min_us = us;
+  }
+  if (us > s->lat_max_us)
+  {
+    s->lat_max_us = us;
+  }
+
+  while (b < NC_LAT_BUCKETS - 1 && (us >> (b + 1)) != 0)
+  {
+    b++;
+  }
+  s->lat_hist[b]++;
+}
+
+/*
+ * nc_request
+ * send req (copied) and req_ref (by reference, see nc_send_ref; NULL if
+ * none), then receive a header of hdr_len bytes and the body frame() finds
+ * in it into resp; returns the response length, or -1 with the connection
+ * reset (open it again for the next request)
+ */
+int nc_request(struct nc_client *c, const void *req, u16_t req_len, const void *req_ref, u16_t ref_len,
+               void *resp, u16_t hdr_len, u16_t resp_max, nc_frame_fn frame)
+{
+  uint32_t t0;
+  u16_t body = 0;
+  err_t err;
+
+  if (nc_open(c) != ERR_OK)
+  {
+    c->stats.errors++;
+    return -1;
+  }
+
+  t0 = nc_cycles();
+  err = req_ref != NULL ? nc_send_ref(c, req, req_len, req_ref, ref_len) : nc_send(c, req, req_len);
+  if (err == ERR_OK)
+  {
+    err = nc_recv(c, resp, hdr_len);
+  }
+  if (err == ERR_OK)
+  {
+    if (frame(resp, &body, resp_max - hdr_len) != 0 || body > resp_max - hdr_len)
+    {
+      err = ERR_VAL; //not a frame of ours
+    }
+    else if (body != 0)
+    {
+      err = nc_recv(c, (uint8_t *)resp + hdr_len, body);
+    }
+  }
+
+  if (err != ERR_OK)
+  {
+    if (err == ERR_TIMEOUT)
+    {
+      c->stats.timeouts++;
+    }
+    nc_reset(c);
+    return -1;
+  }
+
+  nc_account(&c->stats, (nc_cycles() - t0) / (SystemCoreClock / 1000000));
+  return hdr_len + body;
+}
+
+/*
+ * nc_lat_percentile
+ * upper bound of the pct-th percentile latency in us, from the histogram,
+ * 0 if it has no samples
+ */
+uint32_t nc_lat_percentile(const struct nc_stats *stats, uint8_t pct)
+{
+  uint32_t total = 0, acc = 0;
+  uint8_t b;
+
+  for (b = 0; b < NC_LAT_BUCKETS; b++)
+  {
+    total += stats->lat_hist[b];
+  }
+  if (total == 0)
+  {
+    return 0;
+  }
+  for (b = 0; b < NC_LAT_BUCKETS - 1; b++)
+  {
+    acc += stats->lat_hist[b];
+    if ((uint64_t)acc * 100 >= (uint64_t)total * pct)
+    {
+      break;
+    }
+  }
+  return b < NC_LAT_BUCKETS - 1 ? (2UL << b) : stats->lat_max_us;
+}
@@ -0,0 +1,56 @@
+/*
+ * FreeRTOSConfig.h
+ *
+ * FreeRTOS configuration of the host build (HOST_RTOS), for the POSIX port
+ * (portable/ThirdParty/GCC/Posix) and heap_4, which keeps the free and
+ * minimum ever free sizes metrics.c reports. It keeps the board's 1 kHz tick,
+ * static idle task (freertos.c provides its memory) and run time stats on the
+ * DWT counter, but every task runs on a pthread, so stacks have the pthread
+ * minimum.
+ */
+
+#ifndef FREERTOS_CONFIG_H
+#define FREERTOS_CONFIG_H
+
+#define configUSE_PREEMPTION 1
+#define configSUPPORT_STATIC_ALLOCATION 1
+#define configSUPPORT_DYNAMIC_ALLOCATION 1
+#define configUSE_IDLE_HOOK 0
+#define configUSE_TICK_HOOK 0
+#define configCPU_CLOCK_HZ ((unsigned long)120000000)
+#define configTICK_RATE_HZ ((TickType_t)1000)
+#define configMAX_PRIORITIES 7
+#define configMINIMAL_STACK_SIZE ((unsigned short)4096) //words of 8 bytes: 32 KiB, above PTHREAD_STACK_MIN
+#define configSTACK_DEPTH_TYPE uint32_t
+#define configTOTAL_HEAP_SIZE ((size_t)(1024 * 1024)) //task stacks included
+#define configMAX_TASK_NAME_LEN 16
+#define configUSE_16_BIT_TICKS 0
+#define configUSE_MUTEXES 1
+#define configUSE_RECURSIVE_MUTEXES 1
+#define configUSE_COUNTING_SEMAPHORES 1
+#define configQUEUE_REGISTRY_SIZE 8
+#define configUSE_TIMERS 0
+#define configCHECK_FOR_STACK_OVERFLOW 0 //the pthread stacks have guard pages instead
+#define configENABLE_BACKWARD_COMPATIBILITY 1 //xTaskHandle in freertos.c
+#define configUSE_TRACE_FACILITY 1
+#define configGENERATE_RUN_TIME_STATS 1
+
+/* the hooks of freertos.c, as in the CubeMX FreeRTOSConfig.h */
+void configureTimerForRunTimeStats(void);
+unsigned long getRunTimeCounterValue(void);
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS configureTimerForRunTimeStats
+#define portGET_RUN_TIME_COUNTER_VALUE getRunTimeCounterValue
+
+#define INCLUDE_vTaskPrioritySet 1
+#define INCLUDE_uxTaskPriorityGet 1
+#define INCLUDE_vTaskDelete 1
+#define INCLUDE_vTaskSuspend 1
+#define INCLUDE_vTaskDelayUntil 1
+#define INCLUDE_vTaskDelay 1
+#define INCLUDE_xTaskGetSchedulerState 1
+#define INCLUDE_xTaskGetCurrentTaskHandle 1
+
+void vAssertCalled(const char *file, unsigned long line);
+#define configASSERT(x) if ((x) == 0) vAssertCalled(__FILE__, __LINE__)
+
+#endif /* FREERTOS_CONFIG_H */
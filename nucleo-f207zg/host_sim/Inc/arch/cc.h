@@ -0,0 +1,22 @@
+/*
+ * cc.h
+ *
+ * lwIP compiler/platform abstraction for the host build (gcc, glibc).
+ */
+
+#ifndef __CC_H__
+#define __CC_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h> //struct timeval, before lwIP's sockets.h defines its own
+
+#define LWIP_TIMEVAL_PRIVATE 0
+#define LWIP_ERRNO_INCLUDE <errno.h>
+
+#define LWIP_PLATFORM_DIAG(x) do { printf x; } while (0)
+#define LWIP_PLATFORM_ASSERT(x) do { fprintf(stderr, "lwIP assert \"%s\" at %s:%d\n", x, __FILE__, __LINE__); abort(); } while (0)
+
+#define LWIP_RAND() ((u32_t)random())
+
+#endif /* __CC_H__ */
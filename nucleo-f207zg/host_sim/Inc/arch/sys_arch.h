@@ -0,0 +1,38 @@
+/*
+ * sys_arch.h
+ *
+ * lwIP OS abstraction on FreeRTOS for the host build (HOST_RTOS), the same
+ * mapping as ST's CMSIS-RTOS sys_arch: semaphores and mutexes are FreeRTOS
+ * semaphores, mailboxes are queues of pointers, threads are osThreadCreate.
+ */
+
+#ifndef __SYS_ARCH_H__
+#define __SYS_ARCH_H__
+
+#include "lwip/opt.h"
+
+#if !NO_SYS
+
+#include "cmsis_os.h"
+#include "semphr.h"
+#include "queue.h"
+
+#define SYS_MBOX_NULL NULL
+#define SYS_SEM_NULL NULL
+
+typedef SemaphoreHandle_t sys_sem_t;
+typedef SemaphoreHandle_t sys_mutex_t;
+typedef QueueHandle_t sys_mbox_t;
+typedef osThreadId sys_thread_t;
+typedef int sys_prot_t;
+
+#define sys_sem_valid(sem) (*(sem) != NULL)
+#define sys_sem_set_invalid(sem) (*(sem) = NULL)
+#define sys_mutex_valid(mutex) (*(mutex) != NULL)
+#define sys_mutex_set_invalid(mutex) (*(mutex) = NULL)
+#define sys_mbox_valid(mbox) (*(mbox) != NULL)
+#define sys_mbox_set_invalid(mbox) (*(mbox) = NULL)
+
+#endif /* !NO_SYS */
+
+#endif /* __SYS_ARCH_H__ */
@@ -0,0 +1,64 @@
+/*
+ * cmsis_os.h
+ *
+ * The part of CMSIS-RTOS v1 (as generated by CubeMX with CMSIS_V1) that the
+ * F207 applications and sys_arch.c use, on top of the FreeRTOS POSIX port.
+ * Priorities map to FreeRTOS the same way: osPriorityIdle is 0.
+ */
+
+#ifndef _CMSIS_OS_H
+#define _CMSIS_OS_H
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+typedef enum
+{
+  osPriorityIdle = -3,
+  osPriorityLow = -2,
+  osPriorityBelowNormal = -1,
+  osPriorityNormal = 0,
+  osPriorityAboveNormal = +1,
+  osPriorityHigh = +2,
+  osPriorityRealtime = +3,
+  osPriorityError = 0x84
+} osPriority;
+
+typedef enum
+{
+  osOK = 0,
+  osEventTimeout = 0x40,
+  osErrorParameter = 0x80,
+  osErrorResource = 0x81,
+  osErrorOS = 0xFF
+} osStatus;
+
+#define osWaitForever 0xFFFFFFFF
+
+typedef TaskHandle_t osThreadId;
+typedef void (*os_pthread)(void const *argument);
+
+typedef struct os_thread_def
+{
+  char *name;
+  os_pthread pthread;
+  osPriority tpriority;
+  uint32_t instances;
+  uint32_t stacksize; //in words, raised to configMINIMAL_STACK_SIZE (pthread minimum)
+} osThreadDef_t;
+
+#define osThreadDef(name, thread, priority, instances, stacksz) \
+  const osThreadDef_t os_thread_def_##name = {#name, (thread), (priority), (instances), (stacksz)}
+#define osThread(name) &os_thread_def_##name
+
+osStatus osKernelStart(void);
+uint32_t osKernelSysTick(void);
+osThreadId osThreadCreate(const osThreadDef_t *thread_def, void *argument);
+osThreadId osThreadGetId(void);
+osStatus osThreadTerminate(osThreadId thread_id);
+osStatus osDelay(uint32_t millisec);
+osStatus osDelayUntil(uint32_t *PreviousWakeTime, uint32_t millisec);
+
+#endif /* _CMSIS_OS_H */
@@ -0,0 +1,37 @@
+/*
+ * eth_mac_sim.h
+ *
+ * Host stand-in for the ETH MAC and its DMA, on the descriptor lists and
+ * registers of main.h: frames given to mac_sim_rx are written into the
+ * buffer of the next receive descriptor the DMA owns, and mac_sim_tx
+ * gathers the frames queued on the transmit descriptors, so that eth_zc.c
+ * runs unchanged on the host (see ethernetif.c and host_ethbench.c).
+ */
+
+#ifndef __ETH_MAC_SIM_H
+#define __ETH_MAC_SIM_H
+
+#include <stdint.h>
+
+#include "main.h"
+
+#define MAC_SIM_FRAME_MAX 1518
+
+typedef void (*mac_sim_tx_fn)(const uint8_t *frame, uint32_t len);
+
+struct mac_sim_stats
+{
+  uint32_t rx_frames;
+  uint32_t rx_missed; //no descriptor owned by the DMA (RBUS)
+  uint32_t tx_frames;
+  uint32_t tx_bytes;
+  uint32_t tx_errors; //a frame without FS, or a descriptor not owned before LS
+};
+
+void mac_sim_set_tx(mac_sim_tx_fn fn);
+int mac_sim_rx_ready(void);
+int mac_sim_rx(const void *frame, uint32_t len);
+uint32_t mac_sim_tx(void);
+void mac_sim_get_stats(struct mac_sim_stats *stats);
+
+#endif /* __ETH_MAC_SIM_H */
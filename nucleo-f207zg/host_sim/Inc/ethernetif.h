@@ -0,0 +1,30 @@
+/*
+ * ethernetif.h
+ *
+ * Same interface as the CubeMX ethernetif.h, backed by a Linux TAP device
+ * instead of the ETH MAC (see ethernetif.c), so LWIP/App/lwip.c links as is.
+ */
+
+#ifndef __ETHERNETIF_H__
+#define __ETHERNETIF_H__
+
+#include "lwip/err.h"
+#include "lwip/netif.h"
+
+err_t ethernetif_init(struct netif *netif);
+
+#if NO_SYS
+void ethernetif_input(struct netif *netif);
+void ethernetif_set_link(struct netif *netif);
+u32_t sys_now(void);
+#else
+void ethernetif_input(void const *argument); //receive thread, started by ethernetif_init
+#endif
+
+void ethernetif_update_config(struct netif *netif);
+void ethernetif_notify_conn_changed(struct netif *netif);
+
+/* host only: sleep until a frame is received or ms have passed */
+void ethernetif_wait(uint32_t ms);
+
+#endif /* __ETHERNETIF_H__ */
@@ -0,0 +1,31 @@
+/*
+ * lwip.h
+ *
+ * Same interface as the CubeMX LWIP/App/lwip.h: MX_LWIP_Init() brings up
+ * gnetif, MX_LWIP_Process() runs the NO_SYS stack from the main loop.
+ */
+
+#ifndef __LWIP_H__
+#define __LWIP_H__
+
+#include "lwip/opt.h"
+#include "lwip/mem.h"
+#include "lwip/memp.h"
+#include "netif/etharp.h"
+#include "lwip/dhcp.h"
+#include "lwip/netif.h"
+#include "lwip/timeouts.h"
+#include "ethernetif.h"
+#if WITH_RTOS
+#include "lwip/tcpip.h"
+#endif
+
+extern struct netif gnetif;
+
+void MX_LWIP_Init(void);
+
+#if !WITH_RTOS
+void MX_LWIP_Process(void);
+#endif
+
+#endif /* __LWIP_H__ */
@@ -0,0 +1,60 @@
+/*
+ * lwipopts.h
+ *
+ * lwIP 2.0.3 options of the host build. They follow the board projects
+ * (DHCP, DNS, link callback, mailbox sizes), except that checksums are
+ * computed in software: a TAP interface has no checksum offload. HOST_RTOS
+ * selects the FreeRTOS configuration of freertos_lwip_tcp, otherwise it is
+ * NO_SYS like lwip_bare.
+ */
+
+#ifndef __LWIPOPTS__H__
+#define __LWIPOPTS__H__
+
+#include "main.h"
+
+#ifdef HOST_RTOS
+#define WITH_RTOS 1
+#define NO_SYS 0
+#define LWIP_SO_RCVTIMEO 1 //response timeouts of the netconn clients
+#define LWIP_SO_SNDTIMEO 1
+#define TCPIP_THREAD_STACKSIZE 1024
+#define TCPIP_THREAD_PRIO osPriorityNormal
+#define TCPIP_MBOX_SIZE 6
+#define DEFAULT_THREAD_STACKSIZE 1024
+#define DEFAULT_THREAD_PRIO 3
+#define DEFAULT_UDP_RECVMBOX_SIZE 6
+#define DEFAULT_TCP_RECVMBOX_SIZE 6
+#define DEFAULT_ACCEPTMBOX_SIZE 6
+#define RECV_BUFSIZE_DEFAULT 2000000000
+#ifndef MEMP_NUM_NETCONN
+#define MEMP_NUM_NETCONN 12 //tls_mux sessions (TLS_MUX_SESSIONS), clients and metrics: raise both with the sessions
+#endif
+#ifndef MEMP_NUM_TCP_PCB
+#define MEMP_NUM_TCP_PCB 12
+#endif
+#define MEM_SIZE 10240 //records that tls_mux.c sends in place (TLS_MUX_ZEROCOPY)
+#else
+#define WITH_RTOS 0
+#define NO_SYS 1
+#define LWIP_NETCONN 0
+#define LWIP_SOCKET 0
+#endif
+
+#define LWIP_DHCP 1
+#define LWIP_DNS 1
+#define LWIP_DNS_SECURE 7
+#define MEM_ALIGNMENT 4
+#define LWIP_ETHERNET 1
+#define LWIP_NETIF_LINK_CALLBACK 1
+
+#define TCP_SND_QUEUELEN 9
+#define TCP_SNDLOWAT 1071
+#define TCP_SNDQUEUELOWAT 5
+#define TCP_WND_UPDATE_THRESHOLD 536
+
+#ifndef LWIP_STATS
+#define LWIP_STATS 0 //-DLWIP_STATS=1 for the heap and pool peaks of [BENCH] and for metrics.c
+#endif
+
+#endif /*__LWIPOPTS__H__ */
@@ -0,0 +1,183 @@
+/*
+ * main.h
+ *
+ * Host stand-in for the CubeMX main.h: the HAL and CMSIS-Core pieces the
+ * application sources use (LEDs, USART3, RNG, tick, DWT cycle counter and
+ * interrupt masking, flash), implemented in host_hal.c on top of POSIX, and
+ * the ETH DMA descriptors and registers eth_zc.c drives, run by
+ * eth_mac_sim.c.
+ */
+
+#ifndef __MAIN_H
+#define __MAIN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {HAL_OK = 0, HAL_ERROR, HAL_BUSY, HAL_TIMEOUT} HAL_StatusTypeDef;
+
+typedef enum {GPIO_PIN_RESET = 0, GPIO_PIN_SET} GPIO_PinState;
+
+typedef struct
+{
+  volatile uint32_t ODR;
+} GPIO_TypeDef;
+
+typedef struct
+{
+  const char *name; //prefix of the host_hal.c trace lines
+} UART_HandleTypeDef;
+
+typedef struct
+{
+  uint32_t state;
+} RNG_HandleTypeDef;
+
+extern GPIO_TypeDef host_gpiob;
+#define GPIOB (&host_gpiob)
+
+/* same pins as the board, so LED traces read like the schematic */
+#define LD1_Pin 0x0001 //green
+#define LD1_GPIO_Port GPIOB
+#define LD2_Pin 0x0080 //blue
+#define LD2_GPIO_Port GPIOB
+#define LD3_Pin 0x4000 //red
+#define LD3_GPIO_Port GPIOB
+
+extern UART_HandleTypeDef huart3;
+extern RNG_HandleTypeDef hrng;
+extern uint32_t SystemCoreClock; //frequency of the emulated cycle counter
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+void HAL_GPIO_TogglePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_RNG_GenerateRandomNumber(RNG_HandleTypeDef *hrng, uint32_t *random32bit);
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t Delay);
+void Error_Handler(void);
+
+/* CMSIS-Core: the cycle counter follows CLOCK_MONOTONIC at SystemCoreClock */
+typedef struct
+{
+  volatile uint32_t CTRL;
+  volatile uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct
+{
+  volatile uint32_t DEMCR;
+} CoreDebug_Type;
+
+DWT_Type *host_dwt(void);
+extern CoreDebug_Type host_coredebug;
+#define DWT (host_dwt())
+#define CoreDebug (&host_coredebug)
+#define DWT_CTRL_CYCCNTENA_Msk (1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+
+/* interrupts are the scheduler tick (FreeRTOS POSIX port), or nothing at all
+ * in the single-threaded NO_SYS build */
+uint32_t __get_PRIMASK(void);
+void __set_PRIMASK(uint32_t priMask);
+void __disable_irq(void);
+void __enable_irq(void);
+uint32_t __get_IPSR(void);
+#define __DMB() __sync_synchronize()
+#define __DSB() __sync_synchronize()
+#define __weak __attribute__((weak))
+
+/* flash: one 128 KB sector, for tls_store.c, in RAM or in the file named by
+ * HOST_FLASH so that it outlives the process; programming clears bits only,
+ * as on the chip */
+typedef struct
+{
+  uint32_t TypeErase;
+  uint32_t Banks;
+  uint32_t Sector;
+  uint32_t NbSectors;
+  uint32_t VoltageRange;
+} FLASH_EraseInitTypeDef;
+
+#define FLASH_TYPEERASE_SECTORS 0x00000000U
+#define FLASH_TYPEPROGRAM_WORD 0x00000002U
+#define FLASH_VOLTAGE_RANGE_3 0x00000002U
+#define FLASH_SECTOR_11 11U
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uintptr_t Address, uint64_t Data);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *SectorError);
+uint8_t *host_flash(void);
+#define __HAL_FLASH_DATA_CACHE_DISABLE() ((void)0)
+#define __HAL_FLASH_DATA_CACHE_RESET() ((void)0)
+#define __HAL_FLASH_DATA_CACHE_ENABLE() ((void)0)
+
+#define HOST_FLASH_SIZE (128 * 1024)
+#define TLS_STORE_SECTOR FLASH_SECTOR_11 //tls_store.h
+#define TLS_STORE_ADDR ((uintptr_t)host_flash())
+#define TLS_STORE_SIZE HOST_FLASH_SIZE
+
+/* ETH DMA: normal descriptors and the registers of their lists, with
+ * pointer-sized addresses on the host */
+typedef struct
+{
+  volatile uint32_t Status;
+  uint32_t ControlBufferSize;
+  uintptr_t Buffer1Addr;
+  uintptr_t Buffer2NextDescAddr;
+} ETH_DMADescTypeDef;
+
+typedef struct
+{
+  volatile uint32_t DMATPDR;
+  volatile uint32_t DMARPDR;
+  volatile uintptr_t DMARDLAR;
+  volatile uintptr_t DMATDLAR;
+  volatile uint32_t DMASR;
+} ETH_TypeDef;
+
+typedef struct
+{
+  uint32_t ChecksumMode;
+} ETH_InitTypeDef;
+
+typedef struct
+{
+  ETH_TypeDef *Instance;
+  ETH_InitTypeDef Init;
+} ETH_HandleTypeDef;
+
+extern ETH_TypeDef host_eth;
+#define ETH (&host_eth)
+
+#define ETH_RXBUFNB 4U //as in the CubeMX stm32f2xx_hal_conf.h
+#define ETH_TXBUFNB 4U
+#define ETH_RX_BUF_SIZE 1524U
+#define ETH_CHECKSUM_BY_HARDWARE 0x00000000U
+#define ETH_CHECKSUM_BY_SOFTWARE 0x00000001U
+#define ETH_DMARXDESC_OWN 0x80000000U
+#define ETH_DMARXDESC_FL 0x3FFF0000U
+#define ETH_DMARXDESC_FRAMELENGTHSHIFT 16U
+#define ETH_DMARXDESC_ES 0x00008000U
+#define ETH_DMARXDESC_FS 0x00000200U
+#define ETH_DMARXDESC_LS 0x00000100U
+#define ETH_DMARXDESC_RCH 0x00004000U
+#define ETH_DMARXDESC_RBS1 0x00001FFFU
+#define ETH_DMATXDESC_OWN 0x80000000U
+#define ETH_DMATXDESC_LS 0x20000000U
+#define ETH_DMATXDESC_FS 0x10000000U
+#define ETH_DMATXDESC_CIC_TCPUDPICMP_FULL 0x00C00000U
+#define ETH_DMATXDESC_TCH 0x00100000U
+#define ETH_DMATXDESC_TBS1 0x00001FFFU
+#define ETH_DMASR_TBUS 0x00000004U
+#define ETH_DMASR_RBUS 0x00000080U
+
+HAL_StatusTypeDef HAL_ETH_Start(ETH_HandleTypeDef *heth);
+HAL_StatusTypeDef HAL_ETH_Stop(ETH_HandleTypeDef *heth);
+
+/* no flash the DMA can't read: PBUF_ROM pbufs stand for it (eth_zc.h) */
+#define ETH_ZC_DMA_REACHABLE(q) ((q)->type != PBUF_ROM)
+
+#endif /* __MAIN_H */
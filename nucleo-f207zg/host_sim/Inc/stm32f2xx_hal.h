@@ -0,0 +1,12 @@
+/*
+ * stm32f2xx_hal.h
+ *
+ * Host build: the HAL stubs live in main.h (see host_hal.c).
+ */
+
+#ifndef __STM32F2xx_HAL_H
+#define __STM32F2xx_HAL_H
+
+#include "main.h"
+
+#endif /* __STM32F2xx_HAL_H */
@@ -0,0 +1,64 @@
+/*
+ * cmsis_os.c
+ *
+ * CMSIS-RTOS v1 subset of cmsis_os.h for the host build.
+ */
+
+#include "cmsis_os.h"
+
+static UBaseType_t makeFreeRtosPriority(osPriority priority)
+{
+  return priority != osPriorityError ? (UBaseType_t)(priority - osPriorityIdle) : tskIDLE_PRIORITY;
+}
+
+osStatus osKernelStart(void)
+{
+  vTaskStartScheduler();
+  return osErrorOS; //only returns without memory for the idle task
+}
+
+uint32_t osKernelSysTick(void)
+{
+  return xTaskGetTickCount();
+}
+
+osThreadId osThreadCreate(const osThreadDef_t *thread_def, void *argument)
+{
+  TaskHandle_t handle;
+  uint32_t stack = thread_def->stacksize > configMINIMAL_STACK_SIZE ? thread_def->stacksize : configMINIMAL_STACK_SIZE;
+
+  if (xTaskCreate((TaskFunction_t)thread_def->pthread, thread_def->name, (configSTACK_DEPTH_TYPE)stack, argument,
+                  makeFreeRtosPriority(thread_def->tpriority), &handle) != pdPASS)
+  {
+    return NULL;
+  }
+  return handle;
+}
+
+osThreadId osThreadGetId(void)
+{
+  return xTaskGetCurrentTaskHandle();
+}
+
+osStatus osThreadTerminate(osThreadId thread_id)
+{
+  vTaskDelete(thread_id);
+  return osOK;
+}
+
+osStatus osDelay(uint32_t millisec)
+{
+  TickType_t ticks = millisec / portTICK_PERIOD_MS;
+
+  vTaskDelay(ticks ? ticks : 1);
+  return osOK;
+}
+
+osStatus osDelayUntil(uint32_t *PreviousWakeTime, uint32_t millisec)
+{
+  TickType_t wake = (TickType_t)*PreviousWakeTime;
+
+  vTaskDelayUntil(&wake, millisec / portTICK_PERIOD_MS);
+  *PreviousWakeTime = (uint32_t)wake;
+  return osOK;
+}
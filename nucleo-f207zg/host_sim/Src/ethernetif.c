@@ -0,0 +1,272 @@
+/*
+ * ethernetif.c
+ *
+ * lwIP netif on a Linux TAP device, in place of the CubeMX ETH driver. The
+ * interface is HOST_TAP from the environment (tap0 by default) and must
+ * exist already, so the program needs no privileges:
+ *
+ *   ip tuntap add dev tap0 mode tap user $USER
+ *
+ * The MAC address is locally administered, with the low byte taken from the
+ * process id so that several instances can share a bridge. Without an RTOS,
+ * MX_LWIP_Process() polls ethernetif_input(); with one, a receive task polls
+ * the non-blocking fd, sleeping one tick when it is empty (a blocking read
+ * would stall the FreeRTOS POSIX port's scheduler).
+ *
+ * With -DETH_ZC_ENABLE (lwip_bare only), lwip.c moves the interface to
+ * eth_zc.c; ethernetif_input then feeds the TAP frames to the simulated DMA
+ * of eth_mac_sim.c and eth_zc_input hands them to lwIP. The DMA sends what
+ * eth_zc queued on every pass (ethernetif_input, ethernetif_wait).
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+
+#include "main.h"
+#include "lwip/opt.h"
+#include "lwip/pbuf.h"
+#include "lwip/sys.h"
+#include "netif/etharp.h"
+#include "ethernetif.h"
+#if !NO_SYS
+#include "cmsis_os.h"
+#endif
+#ifdef ETH_ZC_ENABLE
+#include "eth_mac_sim.h"
+#if !NO_SYS
+#error "eth_zc runs in the NO_SYS main loop (lwip_bare)"
+#endif
+#endif
+
+#define IFNAME0 's'
+#define IFNAME1 't'
+
+#define HOST_TAP_DEFAULT "tap0"
+#define ETH_FRAME_MAX 1518
+
+ETH_HandleTypeDef heth = {ETH, {ETH_CHECKSUM_BY_SOFTWARE}}; //for eth_zc_init, no checksum offload either
+
+static int tap_fd = -1;
+
+#ifdef ETH_ZC_ENABLE
+static void tap_send(const uint8_t *frame, uint32_t len)
+{
+  if (write(tap_fd, frame, len) != (ssize_t)len)
+  {
+    perror("tap write");
+  }
+}
+#endif
+
+static void low_level_init(struct netif *netif)
+{
+  const char *name = getenv("HOST_TAP");
+  struct ifreq ifr;
+
+  tap_fd = open("/dev/net/tun", O_RDWR);
+  if (tap_fd < 0)
+  {
+    perror("/dev/net/tun");
+    Error_Handler();
+  }
+
+  memset(&ifr, 0, sizeof(ifr));
+  ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+  strncpy(ifr.ifr_name, name != NULL ? name : HOST_TAP_DEFAULT, IFNAMSIZ - 1);
+  if (ioctl(tap_fd, TUNSETIFF, &ifr) < 0)
+  {
+    perror(ifr.ifr_name);
+    Error_Handler();
+  }
+  fcntl(tap_fd, F_SETFL, fcntl(tap_fd, F_GETFL) | O_NONBLOCK);
+
+  netif->hwaddr_len = ETH_HWADDR_LEN;
+  netif->hwaddr[0] = 0x02; //locally administered, ST's 00:80:E1 otherwise
+  netif->hwaddr[1] = 0x80;
+  netif->hwaddr[2] = 0xE1;
+  netif->hwaddr[3] = 0x00;
+  netif->hwaddr[4] = 0x00;
+  netif->hwaddr[5] = (u8_t)getpid();
+  netif->mtu = 1500;
+  netif->flags |= NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP;
+#ifdef ETH_ZC_ENABLE
+  mac_sim_set_tx(tap_send);
+#endif
+
+  printf("ethernetif: %s, %02x:%02x:%02x:%02x:%02x:%02x\n\r", ifr.ifr_name,
+         netif->hwaddr[0], netif->hwaddr[1], netif->hwaddr[2], netif->hwaddr[3], netif->hwaddr[4], netif->hwaddr[5]);
+
+#if !NO_SYS
+  netif_set_link_up(netif); //no PHY to wait for
+  osThreadDef(EthIf, ethernetif_input, osPriorityRealtime, 0, configMINIMAL_STACK_SIZE);
+  osThreadCreate(osThread(EthIf), netif);
+#endif
+}
+
+static err_t low_level_output(struct netif *netif, struct pbuf *p)
+{
+  uint8_t frame[ETH_FRAME_MAX];
+  u16_t len;
+
+  LWIP_UNUSED_ARG(netif);
+
+  len = pbuf_copy_partial(p, frame, sizeof(frame), 0);
+  if (write(tap_fd, frame, len) != len)
+  {
+    return ERR_IF;
+  }
+  return ERR_OK;
+}
+
+static struct pbuf *low_level_input(struct netif *netif)
+{
+  uint8_t frame[ETH_FRAME_MAX];
+  struct pbuf *p;
+  ssize_t len;
+
+  LWIP_UNUSED_ARG(netif);
+
+  len = read(tap_fd, frame, sizeof(frame));
+  if (len <= 0)
+  {
+    return NULL;
+  }
+
+  p = pbuf_alloc(PBUF_RAW, (u16_t)len, PBUF_POOL);
+  if (p != NULL)
+  {
+    pbuf_take(p, frame, (u16_t)len);
+  }
+  return p; //dropped when the pool is empty, as the MAC would
+}
+
+#if NO_SYS
+#ifdef ETH_ZC_ENABLE
+/*
+ * ethernetif_input
+ * send what eth_zc queued, then move the TAP frames to the receive
+ * descriptors while the DMA owns some (the others wait in the TAP queue)
+ */
+void ethernetif_input(struct netif *netif)
+{
+  uint8_t frame[ETH_FRAME_MAX];
+  ssize_t len;
+
+  LWIP_UNUSED_ARG(netif);
+
+  mac_sim_tx();
+  while (mac_sim_rx_ready() && (len = read(tap_fd, frame, sizeof(frame))) > 0)
+  {
+    mac_sim_rx(frame, (uint32_t)len);
+  }
+}
+#else
+/*
+ * ethernetif_input
+ * hand every frame waiting on the TAP device to the stack
+ */
+void ethernetif_input(struct netif *netif)
+{
+  struct pbuf *p;
+
+  while ((p = low_level_input(netif)) != NULL)
+  {
+    if (netif->input(p, netif) != ERR_OK)
+    {
+      pbuf_free(p);
+    }
+  }
+}
+#endif /* ETH_ZC_ENABLE */
+
+/*
+ * ethernetif_set_link
+ * the TAP link is up as soon as the device is open
+ */
+void ethernetif_set_link(struct netif *netif)
+{
+  if (tap_fd >= 0 && !netif_is_link_up(netif))
+  {
+    netif_set_link_up(netif);
+  }
+}
+
+u32_t sys_now(void)
+{
+  return HAL_GetTick();
+}
+#else
+/*
+ * ethernetif_input
+ * receive thread: tcpip_input() for every frame, a tick's sleep when idle
+ */
+void ethernetif_input(void const *argument)
+{
+  struct netif *netif = (struct netif *)argument;
+  struct pbuf *p;
+
+  for (;;)
+  {
+    p = low_level_input(netif);
+    if (p == NULL)
+    {
+      osDelay(1);
+    }
+    else if (netif->input(p, netif) != ERR_OK)
+    {
+      pbuf_free(p);
+    }
+  }
+}
+#endif /* NO_SYS */
+
+/*
+ * ethernetif_wait
+ * block until the TAP device is readable, at most ms
+ */
+void ethernetif_wait(uint32_t ms)
+{
+  struct pollfd pfd = {tap_fd, POLLIN, 0};
+
+#ifdef ETH_ZC_ENABLE
+  mac_sim_tx();
+#endif
+  if (poll(&pfd, 1, (int)ms) < 0 && errno != EINTR)
+  {
+    perror("poll");
+  }
+}
+
+err_t ethernetif_init(struct netif *netif)
+{
+  LWIP_ASSERT("netif != NULL", (netif != NULL));
+
+#if LWIP_NETIF_HOSTNAME
+  netif->hostname = "lwip";
+#endif
+  netif->name[0] = IFNAME0;
+  netif->name[1] = IFNAME1;
+  netif->output = etharp_output;
+  netif->linkoutput = low_level_output;
+
+  low_level_init(netif);
+  return ERR_OK;
+}
+
+void ethernetif_update_config(struct netif *netif)
+{
+  ethernetif_notify_conn_changed(netif);
+}
+
+void ethernetif_notify_conn_changed(struct netif *netif)
+{
+  printf("ethernetif: link %s\n\r", netif_is_link_up(netif) ? "up" : "down");
+}
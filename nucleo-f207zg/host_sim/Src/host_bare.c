@@ -0,0 +1,59 @@
+/*
+ * host_bare.c
+ *
+ * Host build of lwip_bare: tcp_client.c, udp_sync.c and LWIP/App/lwip.c as
+ * they are, on a TAP interface, with the main loop of main.c. SysTick's
+ * 10 s request flag (stm32f2xx_it.c) becomes a period taken from the
+ * command line, so the client can be driven much harder than on the board.
+ *
+ * usage: lwip_bare_host [period_ms]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "main.h"
+#include "lwip.h"
+#include "tcp_client.h"
+#include "udp_sync.h"
+
+#define HOST_PERIOD_MS 10000 //the board's SysTick flag
+
+int main(int argc, char *argv[])
+{
+  uint32_t period = argc > 1 ? strtoul(argv[1], NULL, 0) : HOST_PERIOD_MS;
+  uint32_t next;
+#ifdef TCP_CLIENT_BENCH
+  int bench_round = 0;
+#endif
+
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  if (period == 0)
+  {
+    period = 1;
+  }
+
+  MX_LWIP_Init();
+#ifdef UDP_SYNC_ENABLE
+  udp_sync_start();
+#endif
+
+  next = HAL_GetTick() + period;
+  while (1)
+  {
+    ethernetif_wait(1); //instead of spinning, lwIP timers are coarser than this
+    MX_LWIP_Process();
+
+    if ((int32_t)(HAL_GetTick() - next) >= 0)
+    {
+      next += period;
+#ifdef TCP_CLIENT_BENCH
+      // alternate connect-per-request and persistent/pipelined rounds
+      if (app_bench_time((bench_round & 1) ? CLIENT_PERSISTENT : CLIENT_ONESHOT, TCP_CLIENT_BENCH) == 0)
+        bench_round++;
+#else
+      app_start_get_time(); //get time information from the server
+#endif
+    }
+  }
+}
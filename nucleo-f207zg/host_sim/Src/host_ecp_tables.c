@@ -0,0 +1,209 @@
+/*
+ * host_ecp_tables.c
+ *
+ * Writes freertos_lwip_mbedtls7/Core/Src/ecp_tables.c: the comb tables of
+ * the base points of the short Weierstrass curves of mbedtls_config.h, as
+ * ecp_mul_comb computes them (ecp_precompute_comb) for the window it picks
+ * for G: point i of the table is
+ *
+ *   (1 + i_0 2^d + i_1 2^(2d) + ... + i_(w-2) 2^((w-1)d)) G, d = ceil(bits / w)
+ *
+ * in affine coordinates, computed here with mbedtls_ecp_mul. The limbs are
+ * written as pairs of 32-bit words, so that the file builds for the board's
+ * 32-bit limbs and the host's 64-bit ones.
+ *
+ * usage: host_ecp_tables > freertos_lwip_mbedtls7/Core/Src/ecp_tables.c
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mbedtls/ecp.h"
+
+/* window of ecp_mul_comb for G, as ecp_pick_window */
+static unsigned pick_window(size_t nbits)
+{
+  unsigned w = (nbits >= 384 ? 5 : 4) + 1;
+
+  if (MBEDTLS_ECP_WINDOW_SIZE < 6 && w > MBEDTLS_ECP_WINDOW_SIZE)
+  {
+    w = MBEDTLS_ECP_WINDOW_SIZE;
+  }
+  return w;
+}
+
+/* the curve's name in mbedTLS's macros: MBEDTLS_ECP_DP_<name>(_ENABLED) */
+static const char *macro_name(const char *name)
+{
+  static char buf[32];
+  size_t i, start = 0;
+
+  if (strncmp(name, "brainpoolP", 10) == 0) //brainpoolP256r1: BP256R1
+  {
+    memcpy(buf, "BP", 2);
+    name += 10;
+    start = 2;
+  }
+  for (i = start; *name != '\0' && i < sizeof(buf) - 1; i++, name++)
+  {
+    buf[i] = *name >= 'a' && *name <= 'z' ? *name - 'a' + 'A' : *name;
+  }
+  buf[i] = '\0';
+  return buf;
+}
+
+/* the table's scalars are public: no blinding needed */
+static int no_rng(void *p_rng, unsigned char *output, size_t len)
+{
+  (void)p_rng;
+  memset(output, 0x5a, len);
+  return 0;
+}
+
+/* X as 32-bit word pairs, least significant first, padded to 64 bits */
+static void print_mpi(const mbedtls_mpi *X, size_t nbits)
+{
+  unsigned char be[MBEDTLS_ECP_MAX_BYTES + 8];
+  size_t words = (nbits + 63) / 64, len = words * 8, i;
+  unsigned long lo, hi;
+  const unsigned char *b;
+
+  mbedtls_mpi_write_binary(X, be, len);
+  for (i = 0; i < words; i++)
+  {
+    b = be + len - 8 * (i + 1);
+    hi = (unsigned long)b[0] << 24 | (unsigned long)b[1] << 16 | (unsigned long)b[2] << 8 | b[3];
+    lo = (unsigned long)b[4] << 24 | (unsigned long)b[5] << 16 | (unsigned long)b[6] << 8 | b[7];
+    printf("%sW(0x%08lx, 0x%08lx),", i % 4 == 0 ? "\n    " : " ", lo, hi);
+  }
+}
+
+/*
+ * print_table
+ * the table of one curve: 0, or an mbedTLS error
+ */
+static int print_table(const mbedtls_ecp_curve_info *info)
+{
+  mbedtls_ecp_group grp;
+  mbedtls_ecp_point R;
+  mbedtls_mpi k, t;
+  unsigned w, d, size, i, j;
+  int ret;
+
+  mbedtls_ecp_group_init(&grp);
+  mbedtls_ecp_point_init(&R);
+  mbedtls_mpi_init(&k);
+  mbedtls_mpi_init(&t);
+  if ((ret = mbedtls_ecp_group_load(&grp, info->grp_id)) != 0)
+  {
+    goto cleanup;
+  }
+  w = pick_window(grp.nbits);
+  d = (grp.nbits + w - 1) / w;
+  size = 1U << (w - 1);
+
+  printf("\n#if defined(MBEDTLS_ECP_DP_%s_ENABLED)\n", macro_name(info->name));
+  printf("/* %s: w = %u, d = %u */\n", info->name, w, d);
+  printf("static const mbedtls_mpi_uint %s_T[] = {", info->name);
+  for (i = 0; i < size && ret == 0; i++)
+  {
+    if ((ret = mbedtls_mpi_lset(&k, 1)) != 0)
+    {
+      break;
+    }
+    for (j = 1; j < w && ret == 0; j++)
+    {
+      if (i >> (j - 1) & 1)
+      {
+        ret = mbedtls_mpi_lset(&t, 1);
+        ret = ret ? ret : mbedtls_mpi_shift_l(&t, j * d);
+        ret = ret ? ret : mbedtls_mpi_add_mpi(&k, &k, &t);
+      }
+    }
+    ret = ret ? ret : mbedtls_mpi_mod_mpi(&k, &k, &grp.N);
+    ret = ret ? ret : mbedtls_ecp_mul(&grp, &R, &k, &grp.G, no_rng, NULL);
+    if (ret == 0)
+    {
+      printf("\n    /* %u */", i);
+      print_mpi(&R.X, grp.pbits);
+      print_mpi(&R.Y, grp.pbits);
+    }
+  }
+  printf("\n};\n");
+  printf("static const mbedtls_ecp_point %s_points[] = {\n", info->name);
+  for (i = 0; i < size; i++)
+  {
+    printf("    POINT(%s_T, %u, %u),\n", info->name, i, (unsigned)grp.pbits);
+  }
+  printf("};\n#endif\n");
+
+cleanup:
+  mbedtls_mpi_free(&t);
+  mbedtls_mpi_free(&k);
+  mbedtls_ecp_point_free(&R);
+  mbedtls_ecp_group_free(&grp);
+  return ret;
+}
+
+int main(void)
+{
+  const mbedtls_ecp_curve_info *info;
+  mbedtls_ecp_group grp;
+  int montgomery, ret;
+
+  printf("/*\n"
+         " * ecp_tables.c\n"
+         " *\n"
+         " * Comb tables of the base points, for ecp_fast.c: generated by\n"
+         " * host_sim/Src/host_ecp_tables.c for MBEDTLS_ECP_WINDOW_SIZE %d, do not edit.\n"
+         " */\n\n"
+         "#include \"mbedtls/ecp.h\"\n"
+         "#include \"ecp_fast.h\"\n\n"
+         "#if MBEDTLS_ECP_WINDOW_SIZE != %d || MBEDTLS_ECP_FIXED_POINT_OPTIM != 1\n"
+         "#error \"ecp_tables.c was generated for another window, or for no fixed-point tables: run host_ecp_tables again\"\n"
+         "#endif\n\n"
+         "#if defined(MBEDTLS_HAVE_INT32)\n"
+         "#define W(lo, hi) (lo), (hi)\n"
+         "#else\n"
+         "#define W(lo, hi) ((mbedtls_mpi_uint)(hi) << 32 | (lo))\n"
+         "#endif\n"
+         "#define LIMBS(bits) (((bits) + 63) / 64 * 8 / sizeof(mbedtls_mpi_uint))\n"
+         "#define MPI(a, i, bits) {1, LIMBS(bits), (mbedtls_mpi_uint *)(a) + (i) * LIMBS(bits)}\n"
+         "#define POINT(a, i, bits) {MPI(a, 2 * (i), bits), MPI(a, 2 * (i) + 1, bits), {1, 1, (mbedtls_mpi_uint *)ecp_one}}\n\n"
+         "static const mbedtls_mpi_uint ecp_one[] = {1}; //Z of every point\n",
+         MBEDTLS_ECP_WINDOW_SIZE, MBEDTLS_ECP_WINDOW_SIZE);
+
+  for (info = mbedtls_ecp_curve_list(); info->grp_id != MBEDTLS_ECP_DP_NONE; info++)
+  {
+    mbedtls_ecp_group_init(&grp);
+    ret = mbedtls_ecp_group_load(&grp, info->grp_id);
+    montgomery = grp.G.Y.p == NULL; //x coordinates only: no comb
+    mbedtls_ecp_group_free(&grp);
+    if (ret != 0 || montgomery)
+    {
+      continue;
+    }
+    if ((ret = print_table(info)) != 0)
+    {
+      fprintf(stderr, "%s: -0x%04x\n", info->name, (unsigned)-ret);
+      return 1;
+    }
+  }
+
+  printf("\nconst struct ecp_fast_table ecp_fast_tables[] = {\n");
+  for (info = mbedtls_ecp_curve_list(); info->grp_id != MBEDTLS_ECP_DP_NONE; info++)
+  {
+    mbedtls_ecp_group_init(&grp);
+    ret = mbedtls_ecp_group_load(&grp, info->grp_id);
+    montgomery = grp.G.Y.p == NULL;
+    if (ret == 0 && !montgomery)
+    {
+      printf("#if defined(MBEDTLS_ECP_DP_%s_ENABLED)\n", macro_name(info->name));
+      printf("    {MBEDTLS_ECP_DP_%s, %u, %s_points},\n#endif\n", macro_name(info->name),
+             1U << (pick_window(grp.nbits) - 1), info->name);
+    }
+    mbedtls_ecp_group_free(&grp);
+  }
+  printf("    {MBEDTLS_ECP_DP_NONE, 0, NULL},\n};\n");
+  return 0;
+}
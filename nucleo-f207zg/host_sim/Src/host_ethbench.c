@@ -0,0 +1,369 @@
+/*
+ * host_ethbench.c
+ *
+ * Receive and transmit paths of the ETH driver, on the simulated DMA of
+ * eth_mac_sim.c, without a network: the copying driver of CubeMX's
+ * ethernetif.c (one descriptor ring with static buffers, a PBUF_POOL copy of
+ * every frame received, every frame sent copied into a DMA buffer) against
+ * eth_zc.c. For each frame size it prints frames per second and the bytes
+ * the CPU copied per frame; the simulated DMA's own copies are in the time
+ * of both, not in the bytes copied.
+ *
+ * The "stack" reads the headers of each frame received and holds the last
+ * BENCH_HOLD ones, as TCP queues them. The transmitted frames are a header
+ * pbuf and a payload by reference, then the request template of
+ * tcp_client.c: 66 bytes in RAM and 244 in flash (PBUF_ROM, which the DMA
+ * can't read on the board).
+ *
+ * usage: ethbench [frames]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "main.h"
+#include "lwip/init.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "eth_mac_sim.h"
+#include "eth_zc.h"
+
+#define BENCH_FRAMES 200000
+#define BENCH_HOLD 2 //frames the stack holds
+#define BENCH_HDR 54 //Ethernet, IPv4 and TCP headers
+#define BENCH_TMPL_RAM 66 //headers and the copied part of the v1 request
+#define BENCH_TMPL_ROM 244 //its tail, from flash
+
+ETH_HandleTypeDef heth = {ETH, {ETH_CHECKSUM_BY_SOFTWARE}};
+
+static const uint16_t sizes[] = {60, 590, 1514};
+
+static struct netif nif;
+static struct pbuf *held[BENCH_HOLD];
+static uint32_t held_n;
+static volatile uint32_t touch; //header bytes read, so that it isn't optimized away
+
+static uint8_t frame_rx[MAC_SIM_FRAME_MAX];
+static uint8_t payload[MAC_SIM_FRAME_MAX];
+static const uint8_t payload_rom[BENCH_TMPL_ROM] = {0x5a}; //"flash"
+static uint32_t tx_expect_len, tx_expect_hdr, tx_bad;
+
+/* copying driver, as ethernetif.c */
+static ETH_DMADescTypeDef cp_rx_desc[ETH_RXBUFNB], cp_tx_desc[ETH_TXBUFNB];
+static uint8_t cp_rx_buf[ETH_RXBUFNB][ETH_RX_BUF_SIZE], cp_tx_buf[ETH_TXBUFNB][ETH_RX_BUF_SIZE];
+static uint32_t cp_rx_cur, cp_tx_cur;
+static uint64_t cp_copied;
+
+u32_t sys_now(void)
+{
+  return HAL_GetTick();
+}
+
+static double bench_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * bench_input
+ * netif input: read the headers, keep the frame for a while
+ */
+static err_t bench_input(struct pbuf *p, struct netif *netif)
+{
+  const uint8_t *h = p->payload;
+  uint32_t i, sum = 0;
+
+  LWIP_UNUSED_ARG(netif);
+
+  for (i = 0; i < BENCH_HDR && i < p->len; i++)
+  {
+    sum += h[i];
+  }
+  touch += sum;
+
+  if (held_n == BENCH_HOLD)
+  {
+    pbuf_free(held[0]);
+    memmove(held, held + 1, (BENCH_HOLD - 1) * sizeof(held[0]));
+    held_n--;
+  }
+  held[held_n++] = p;
+  return ERR_OK;
+}
+
+static void bench_release(void)
+{
+  while (held_n > 0)
+  {
+    pbuf_free(held[--held_n]);
+  }
+}
+
+static err_t bench_netif_init(struct netif *netif)
+{
+  netif->name[0] = 'b';
+  netif->name[1] = 'n';
+  netif->mtu = 1500;
+  netif->hwaddr_len = ETH_HWADDR_LEN;
+  netif->flags |= NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP;
+  return ERR_OK;
+}
+
+/*
+ * bench_tx_check
+ * simulated wire: the frame must come out whole
+ */
+static void bench_tx_check(const uint8_t *frame, uint32_t len)
+{
+  if (len != tx_expect_len || frame[0] != 0xff || frame[tx_expect_hdr - 1] != 0xff || frame[tx_expect_hdr] != 0x5a)
+  {
+    tx_bad++;
+  }
+}
+
+static void cp_init(void)
+{
+  uint32_t i;
+
+  HAL_ETH_Stop(&heth);
+  for (i = 0; i < ETH_RXBUFNB; i++)
+  {
+    cp_rx_desc[i].Buffer1Addr = (uintptr_t)cp_rx_buf[i];
+    cp_rx_desc[i].ControlBufferSize = ETH_DMARXDESC_RCH | ETH_RX_BUF_SIZE;
+    cp_rx_desc[i].Buffer2NextDescAddr = (uintptr_t)&cp_rx_desc[(i + 1) % ETH_RXBUFNB];
+    cp_rx_desc[i].Status = ETH_DMARXDESC_OWN;
+  }
+  for (i = 0; i < ETH_TXBUFNB; i++)
+  {
+    cp_tx_desc[i].Buffer1Addr = (uintptr_t)cp_tx_buf[i];
+    cp_tx_desc[i].Buffer2NextDescAddr = (uintptr_t)&cp_tx_desc[(i + 1) % ETH_TXBUFNB];
+    cp_tx_desc[i].Status = ETH_DMATXDESC_TCH;
+  }
+  cp_rx_cur = 0;
+  cp_tx_cur = 0;
+  heth.Instance->DMARDLAR = (uintptr_t)cp_rx_desc;
+  heth.Instance->DMATDLAR = (uintptr_t)cp_tx_desc;
+  HAL_ETH_Start(&heth);
+}
+
+/*
+ * cp_input
+ * low_level_input of ethernetif.c: copy the frame into a PBUF_POOL chain
+ * and give the descriptor back
+ */
+static uint32_t cp_input(void)
+{
+  ETH_DMADescTypeDef *d;
+  struct pbuf *p, *q;
+  uint32_t n, len, off;
+
+  for (n = 0; n < ETH_RXBUFNB; n++)
+  {
+    d = &cp_rx_desc[cp_rx_cur];
+    if (d->Status & ETH_DMARXDESC_OWN)
+    {
+      break;
+    }
+    len = ((d->Status & ETH_DMARXDESC_FL) >> ETH_DMARXDESC_FRAMELENGTHSHIFT) - 4;
+    p = pbuf_alloc(PBUF_RAW, (u16_t)len, PBUF_POOL);
+    if (p != NULL)
+    {
+      for (q = p, off = 0; q != NULL; off += q->len, q = q->next)
+      {
+        memcpy(q->payload, (uint8_t *)d->Buffer1Addr + off, q->len);
+      }
+      cp_copied += len;
+    }
+    d->Status = ETH_DMARXDESC_OWN;
+    cp_rx_cur = (cp_rx_cur + 1) % ETH_RXBUFNB;
+
+    if (p != NULL && nif.input(p, &nif) != ERR_OK)
+    {
+      pbuf_free(p);
+    }
+  }
+  return n;
+}
+
+/*
+ * cp_output
+ * low_level_output of ethernetif.c: copy the chain into the DMA buffer
+ */
+static err_t cp_output(struct netif *netif, struct pbuf *p)
+{
+  ETH_DMADescTypeDef *d = &cp_tx_desc[cp_tx_cur];
+  struct pbuf *q;
+  uint32_t off = 0;
+
+  LWIP_UNUSED_ARG(netif);
+
+  if (d->Status & ETH_DMATXDESC_OWN)
+  {
+    return ERR_USE;
+  }
+  for (q = p; q != NULL; q = q->next)
+  {
+    memcpy((uint8_t *)d->Buffer1Addr + off, q->payload, q->len);
+    off += q->len;
+  }
+  cp_copied += off;
+  d->ControlBufferSize = off & ETH_DMATXDESC_TBS1;
+  d->Status = ETH_DMATXDESC_TCH | ETH_DMATXDESC_FS | ETH_DMATXDESC_LS | ETH_DMATXDESC_OWN;
+  cp_tx_cur = (cp_tx_cur + 1) % ETH_TXBUFNB;
+  return ERR_OK;
+}
+
+/*
+ * bench_rx
+ * receive frames of len bytes, four at a time (the ring), through input
+ */
+static double bench_rx(uint32_t frames, uint16_t len, uint32_t (*input)(void))
+{
+  double t0 = bench_now();
+  uint32_t i, k;
+
+  memset(frame_rx, 0xff, len);
+  for (i = 0; i < frames; i += k)
+  {
+    for (k = 0; k < ETH_RXBUFNB && i + k < frames; k++)
+    {
+      mac_sim_rx(frame_rx, len);
+    }
+    input();
+  }
+  bench_release();
+  return bench_now() - t0;
+}
+
+static uint32_t zc_input(void)
+{
+  return eth_zc_input(&nif);
+}
+
+/*
+ * bench_tx
+ * send frames of ram + rom bytes: a header pbuf, and the payload by
+ * reference (PBUF_REF) for ram bytes in all, or ram bytes and rom more
+ * from "flash" (PBUF_ROM)
+ */
+static double bench_tx(uint32_t frames, uint16_t ram, uint16_t rom, uint32_t *errors)
+{
+  double t0 = bench_now();
+  struct pbuf *h, *d;
+  uint32_t i;
+
+  tx_expect_len = rom ? ram + rom : ram;
+  tx_expect_hdr = rom ? ram : BENCH_HDR;
+  for (i = 0; i < frames; i++)
+  {
+    h = pbuf_alloc(PBUF_RAW, rom ? ram : BENCH_HDR, PBUF_RAM);
+    d = pbuf_alloc(PBUF_RAW, rom ? rom : ram - BENCH_HDR, rom ? PBUF_ROM : PBUF_REF);
+    if (h == NULL || d == NULL)
+    {
+      (*errors)++;
+      if (h != NULL)
+      {
+        pbuf_free(h);
+      }
+      if (d != NULL)
+      {
+        pbuf_free(d);
+      }
+      continue;
+    }
+    memset(h->payload, 0xff, h->len);
+    d->payload = rom ? (void *)payload_rom : payload;
+    pbuf_cat(h, d);
+
+    if (nif.linkoutput(&nif, h) != ERR_OK)
+    {
+      (*errors)++;
+    }
+    pbuf_free(h);
+    mac_sim_tx();
+  }
+  return bench_now() - t0;
+}
+
+static void bench_print(const char *dir, uint16_t len, const char *mode, uint32_t frames, double t,
+                        uint64_t copied, const char *extra)
+{
+  printf("[ETHBENCH] %s %4u B %-9s %9.0f frames/s, %6.1f B copied/frame%s\n",
+         dir, len, mode, frames / t, (double)copied / frames, extra);
+}
+
+int main(int argc, char *argv[])
+{
+  uint32_t frames = argc > 1 ? strtoul(argv[1], NULL, 0) : BENCH_FRAMES;
+  double t_cp_rx[3], t_cp_tx[4], t;
+  uint64_t cp_rx[3], cp_tx[4];
+  uint32_t cp_err[4] = {0}, err, i;
+  struct eth_zc_stats s0, s1;
+  struct mac_sim_stats m;
+  char extra[96];
+
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  if (frames == 0)
+  {
+    frames = 1;
+  }
+  memset(payload, 0x5a, sizeof(payload));
+
+  lwip_init();
+  netif_add(&nif, NULL, NULL, NULL, NULL, bench_netif_init, bench_input);
+  mac_sim_set_tx(bench_tx_check);
+
+  //the copying driver first: eth_zc_init takes the DMA for good
+  cp_init();
+  nif.linkoutput = cp_output;
+  for (i = 0; i < 3; i++)
+  {
+    cp_copied = 0;
+    t_cp_rx[i] = bench_rx(frames, sizes[i], cp_input);
+    cp_rx[i] = cp_copied;
+  }
+  for (i = 0; i < 4; i++)
+  {
+    cp_copied = 0;
+    t_cp_tx[i] = i < 3 ? bench_tx(frames, sizes[i], 0, &cp_err[i]) : bench_tx(frames, BENCH_TMPL_RAM, BENCH_TMPL_ROM, &cp_err[i]);
+    cp_tx[i] = cp_copied;
+  }
+
+  eth_zc_init(&heth, &nif);
+  for (i = 0; i < 3; i++)
+  {
+    bench_print("rx", sizes[i], "copy", frames, t_cp_rx[i], cp_rx[i], "");
+    eth_zc_get_stats(&s0);
+    t = bench_rx(frames, sizes[i], zc_input);
+    eth_zc_get_stats(&s1);
+    snprintf(extra, sizeof(extra), ", %lu held max, %lu no buffer", (unsigned long)s1.rx_held_max,
+             (unsigned long)(s1.rx_nobuf - s0.rx_nobuf));
+    bench_print("rx", sizes[i], "zero-copy", frames, t, s1.rx_copied - s0.rx_copied, extra);
+  }
+  for (i = 0; i < 4; i++)
+  {
+    uint16_t len = i < 3 ? sizes[i] : BENCH_TMPL_RAM + BENCH_TMPL_ROM;
+
+    snprintf(extra, sizeof(extra), ", %lu errors", (unsigned long)cp_err[i]);
+    bench_print("tx", len, "copy", frames, t_cp_tx[i], cp_tx[i], extra);
+    err = 0;
+    eth_zc_get_stats(&s0);
+    t = i < 3 ? bench_tx(frames, sizes[i], 0, &err) : bench_tx(frames, BENCH_TMPL_RAM, BENCH_TMPL_ROM, &err);
+    eth_zc_input(&nif); //reclaim the last frames
+    eth_zc_get_stats(&s1);
+    snprintf(extra, sizeof(extra), ", %.1f descriptors/frame, %lu errors",
+             (double)(s1.tx_segs - s0.tx_segs) / frames, (unsigned long)err);
+    bench_print("tx", len, "zero-copy", frames, t, s1.tx_copied - s0.tx_copied, extra);
+  }
+
+  mac_sim_get_stats(&m);
+  printf("[ETHBENCH] mac: %lu frames received, %lu missed; %lu sent, %lu bad, %lu errors\n",
+         (unsigned long)m.rx_frames, (unsigned long)m.rx_missed, (unsigned long)m.tx_frames,
+         (unsigned long)tx_bad, (unsigned long)m.tx_errors);
+  return tx_bad != 0 || m.tx_errors != 0;
+}
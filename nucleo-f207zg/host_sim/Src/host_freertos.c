@@ -0,0 +1,145 @@
+/*
+ * host_freertos.c
+ *
+ * Host build of freertos_lwip_tcp on the FreeRTOS POSIX port: the tasks of
+ * freertos.c (and metrics.c with METRICS_ENABLE), started the way
+ * StartDefaultTask in main.c starts them. With HOST_MBEDTLS, the default
+ * task first seeds the shared RNG of freertos_lwip_mbedtls7 (rng.c, on the
+ * mutexes of threading_alt.c) through hardware_rng.c (RNG stub in
+ * host_hal.c) and prints 32 bytes of it, then runs its stress test with
+ * RNG_STRESS_ENABLE and the ECC benchmark of ecp_fast.c with ECP_FAST_BENCH,
+ * and with HOST_TLS it then starts its TLS client task (tls_client.c,
+ * tls_mux.c), and with HOST_KEM its Kyber channel task (kem_client.c,
+ * kem_chan.c). With HOST_TLSBENCH, it runs the handshake benchmark of
+ * host_tlsbench.c after the seeding instead, without the network, and
+ * exits.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "main.h"
+#include "cmsis_os.h"
+#include "lwip.h"
+#ifdef METRICS_ENABLE
+#include "metrics.h"
+#endif
+#ifdef HOST_MBEDTLS
+#include "mbedtls/threading.h"
+#include "ecp_fast.h"
+#include "rng.h"
+#endif
+#ifdef HOST_TLS
+#include "tls_client.h"
+#endif
+#ifdef HOST_KEM
+#include "kem_client.h"
+#endif
+
+osThreadId defaultTaskHandle;
+osThreadId tcpClientTaskHandle;
+osThreadId udpSyncTaskHandle;
+osThreadId metricsTaskHandle;
+osThreadId tlsClientTaskHandle;
+osThreadId kemClientTaskHandle;
+
+void StartDefaultTask(void const *argument);
+void StartTcpClientTask(void const *argument);
+void StartUdpSyncTask(void const *argument);
+#ifdef HOST_TLSBENCH
+int host_tlsbench(void);
+#endif
+
+int main(void)
+{
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
+  osThreadDef(defaultTask, StartDefaultTask, osPriorityNormal, 0, 256);
+  defaultTaskHandle = osThreadCreate(osThread(defaultTask), NULL);
+
+  osKernelStart();
+  return 1; //the scheduler didn't start
+}
+
+#ifdef HOST_MBEDTLS
+/*
+ * host_drbg_check
+ * seed the shared RNG from mbedtls_hardware_poll and print 32 bytes of it
+ */
+static void host_drbg_check(void)
+{
+  unsigned char rand_bytes[32];
+  int ret;
+
+  threading_alt_init();
+  ret = rng_init();
+  if (ret == 0)
+  {
+    ret = rng_random(NULL, rand_bytes, sizeof(rand_bytes));
+  }
+  if (ret != 0)
+  {
+    printf("CTR_DRBG failed: %d\n\r", ret);
+  }
+  else
+  {
+    printf("rand_bytes = {");
+    for (size_t i = 0; i < sizeof(rand_bytes); i++)
+    {
+      printf(" 0x%02x%s", rand_bytes[i], i + 1 < sizeof(rand_bytes) ? "," : " }\n\r");
+    }
+  }
+}
+#endif
+
+void StartDefaultTask(void const *argument)
+{
+  uint32_t addr = 0;
+
+  (void)argument;
+
+#ifdef HOST_TLSBENCH
+  host_drbg_check();
+  exit(host_tlsbench()); //no network: client and server in this task
+#endif
+  MX_LWIP_Init();
+#ifdef HOST_MBEDTLS
+  host_drbg_check();
+#ifdef ECP_FAST_BENCH
+  ecp_fast_bench();
+#endif
+#ifdef RNG_STRESS_ENABLE
+  rng_stress();
+#endif
+#endif
+#ifdef HOST_TLS
+  osThreadDef(tlsClientTask, StartTlsClientTask, osPriorityNormal, 0, configMINIMAL_STACK_SIZE);
+  tlsClientTaskHandle = osThreadCreate(osThread(tlsClientTask), NULL); //run TLS client task
+#endif
+#ifdef HOST_KEM
+  osThreadDef(kemClientTask, StartKemClientTask, osPriorityBelowNormal, 0, KEM_CLIENT_STACK);
+  kemClientTaskHandle = osThreadCreate(osThread(kemClientTask), NULL); //run Kyber channel client task
+#endif
+
+  osThreadDef(tcpClientTask, StartTcpClientTask, osPriorityNormal, 0, configMINIMAL_STACK_SIZE);
+  tcpClientTaskHandle = osThreadCreate(osThread(tcpClientTask), NULL); //run tcp client task
+#ifdef UDP_SYNC_ENABLE
+  osThreadDef(udpSyncTask, StartUdpSyncTask, osPriorityAboveNormal, 0, configMINIMAL_STACK_SIZE);
+  udpSyncTaskHandle = osThreadCreate(osThread(udpSyncTask), NULL); //run udp clock sync task
+#endif
+#ifdef METRICS_ENABLE
+  osThreadDef(metricsTask, StartMetricsTask, osPriorityBelowNormal, 0, 2 * configMINIMAL_STACK_SIZE);
+  metricsTaskHandle = osThreadCreate(osThread(metricsTask), NULL); //run metrics server task
+#endif
+
+  for (;;)
+  {
+    HAL_GPIO_TogglePin(LD1_GPIO_Port, LD1_Pin);
+    if (ip4_addr_get_u32(netif_ip4_addr(&gnetif)) != addr) //only on change, unlike the board
+    {
+      addr = ip4_addr_get_u32(netif_ip4_addr(&gnetif));
+      printf(">>> IP address = %s \r\n", ip4addr_ntoa(netif_ip4_addr(&gnetif)));
+    }
+    osDelay(500);
+  }
+}
@@ -0,0 +1,278 @@
+/*
+ * host_hal.c
+ *
+ * HAL and CMSIS-Core stubs of main.h for the host build. LEDs are traced on
+ * stderr when HOST_TRACE_LEDS is set in the environment, USART3 writes to
+ * stdout, the RNG reads getrandom(), and the tick and cycle counter follow
+ * CLOCK_MONOTONIC. With HOST_RTOS, masking interrupts masks the FreeRTOS
+ * POSIX port's tick. The flash sector is mapped from the file named by
+ * HOST_FLASH, if set, so that what tls_store.c saves is there on the next
+ * run, as after a reset of the board.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+
+#include "main.h"
+#ifdef HOST_RTOS
+#include "FreeRTOS.h"
+#include "task.h"
+#endif
+
+GPIO_TypeDef host_gpiob;
+CoreDebug_Type host_coredebug;
+UART_HandleTypeDef huart3 = {"USART3"};
+RNG_HandleTypeDef hrng;
+uint32_t SystemCoreClock = 120000000; //as configured by SystemClock_Config on the board
+
+static DWT_Type dwt;
+static uint32_t primask;
+static uint8_t *flash;
+static uint8_t flash_locked = 1;
+
+static uint64_t host_mono_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void host_trace_led(uint16_t pin, uint32_t odr)
+{
+  static int trace = -1;
+
+  if (trace < 0)
+  {
+    trace = getenv("HOST_TRACE_LEDS") != NULL;
+  }
+  if (trace)
+  {
+    fprintf(stderr, "[LED] %s %s\n", pin == LD1_Pin ? "LD1" : (pin == LD2_Pin ? "LD2" : (pin == LD3_Pin ? "LD3" : "?")),
+            (odr & pin) ? "on" : "off");
+  }
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+  if (PinState == GPIO_PIN_SET)
+  {
+    GPIOx->ODR |= GPIO_Pin;
+  }
+  else
+  {
+    GPIOx->ODR &= ~(uint32_t)GPIO_Pin;
+  }
+  host_trace_led(GPIO_Pin, GPIOx->ODR);
+}
+
+void HAL_GPIO_TogglePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+  GPIOx->ODR ^= GPIO_Pin;
+  host_trace_led(GPIO_Pin, GPIOx->ODR);
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+  return (GPIOx->ODR & GPIO_Pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+  (void)huart;
+  (void)Timeout;
+
+  fflush(stdout); //keep the order with printf
+  return write(STDOUT_FILENO, pData, Size) == Size ? HAL_OK : HAL_ERROR;
+}
+
+HAL_StatusTypeDef HAL_RNG_GenerateRandomNumber(RNG_HandleTypeDef *hrng, uint32_t *random32bit)
+{
+  (void)hrng;
+
+  return getrandom(random32bit, sizeof(*random32bit), 0) == sizeof(*random32bit) ? HAL_OK : HAL_ERROR;
+}
+
+uint32_t HAL_GetTick(void)
+{
+  return (uint32_t)(host_mono_ns() / 1000000);
+}
+
+void HAL_Delay(uint32_t Delay)
+{
+  struct timespec ts = {Delay / 1000, (Delay % 1000) * 1000000L};
+
+  nanosleep(&ts, NULL);
+}
+
+void Error_Handler(void)
+{
+  fprintf(stderr, "Error_Handler\n");
+  abort();
+}
+
+/*
+ * host_flash
+ * the sector: mapped from HOST_FLASH (created erased), or erased RAM
+ */
+uint8_t *host_flash(void)
+{
+  static uint8_t ram[HOST_FLASH_SIZE];
+  const char *path;
+  struct stat st;
+  int fd;
+
+  if (flash != NULL)
+  {
+    return flash;
+  }
+  path = getenv("HOST_FLASH");
+  fd = path != NULL ? open(path, O_RDWR | O_CREAT, 0644) : -1;
+  if (fd >= 0 && fstat(fd, &st) == 0 && (st.st_size == HOST_FLASH_SIZE || ftruncate(fd, HOST_FLASH_SIZE) == 0))
+  {
+    flash = mmap(NULL, HOST_FLASH_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (flash == MAP_FAILED)
+    {
+      flash = NULL;
+    }
+    else if (st.st_size != HOST_FLASH_SIZE)
+    {
+      memset(flash, 0xFF, HOST_FLASH_SIZE); //new file
+    }
+  }
+  if (fd >= 0)
+  {
+    close(fd);
+  }
+  if (flash == NULL)
+  {
+    if (path != NULL)
+    {
+      fprintf(stderr, "HOST_FLASH %s: cannot map it, flash is in RAM\n", path);
+    }
+    memset(ram, 0xFF, sizeof(ram));
+    flash = ram;
+  }
+  return flash;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void)
+{
+  flash_locked = 0;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void)
+{
+  flash_locked = 1;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uintptr_t Address, uint64_t Data)
+{
+  uint8_t *base = host_flash();
+  uint32_t word;
+
+  if (flash_locked || TypeProgram != FLASH_TYPEPROGRAM_WORD || Address < (uintptr_t)base ||
+      Address + 4 > (uintptr_t)base + HOST_FLASH_SIZE || (Address & 3) != 0)
+  {
+    return HAL_ERROR;
+  }
+  memcpy(&word, (void *)Address, 4);
+  word &= (uint32_t)Data; //bits go from 1 to 0 only
+  memcpy((void *)Address, &word, 4);
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *SectorError)
+{
+  *SectorError = 0xFFFFFFFFU;
+  if (flash_locked || pEraseInit->TypeErase != FLASH_TYPEERASE_SECTORS || pEraseInit->Sector != FLASH_SECTOR_11 ||
+      pEraseInit->NbSectors != 1)
+  {
+    *SectorError = pEraseInit->Sector;
+    return HAL_ERROR;
+  }
+  memset(host_flash(), 0xFF, HOST_FLASH_SIZE);
+  return HAL_OK;
+}
+
+/*
+ * host_dwt
+ * the DWT block, with CYCCNT brought up to date (it only counts once
+ * DEMCR.TRCENA and CTRL.CYCCNTENA are set, as on the core)
+ */
+DWT_Type *host_dwt(void)
+{
+  if ((host_coredebug.DEMCR & CoreDebug_DEMCR_TRCENA_Msk) && (dwt.CTRL & DWT_CTRL_CYCCNTENA_Msk))
+  {
+    uint64_t ns = host_mono_ns();
+
+    dwt.CYCCNT = (uint32_t)((ns / 1000000000ULL) * SystemCoreClock +
+                            (ns % 1000000000ULL) * SystemCoreClock / 1000000000ULL);
+  }
+  return &dwt;
+}
+
+uint32_t __get_PRIMASK(void)
+{
+  return primask;
+}
+
+void __disable_irq(void)
+{
+#ifdef HOST_RTOS
+  if (!primask && xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED)
+  {
+    portDISABLE_INTERRUPTS();
+  }
+#endif
+  primask = 1;
+}
+
+void __enable_irq(void)
+{
+  primask = 0;
+#ifdef HOST_RTOS
+  if (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED)
+  {
+    portENABLE_INTERRUPTS();
+  }
+#endif
+}
+
+void __set_PRIMASK(uint32_t priMask)
+{
+  if (priMask)
+  {
+    __disable_irq();
+  }
+  else
+  {
+    __enable_irq();
+  }
+}
+
+uint32_t __get_IPSR(void)
+{
+  return 0; //thread mode, there are no handlers to be in
+}
+
+#ifdef HOST_RTOS
+/*
+ * vAssertCalled
+ * configASSERT of the host FreeRTOSConfig.h
+ */
+void vAssertCalled(const char *file, unsigned long line)
+{
+  fprintf(stderr, "FreeRTOS assert %s:%lu\n", file, line);
+  abort();
+}
+#endif
@@ -0,0 +1,1576 @@
+/*
+ * host_tlsbench.c
+ *
+ * Where the time of a handshake goes: the TLS client of
+ * freertos_lwip_mbedtls7, with its configuration (tls_client_config), against
+ * an mbedTLS server built from the same mbedtls_config.h, both in the calling
+ * task. They talk over a loopback in memory instead of TCP: each side takes
+ * its handshake steps until it waits for the other, as over a network
+ * without delay, so the latency is the CPU time of both sides.
+ *
+ * Each step is charged to the message of its side's state before the step
+ * (the message the step writes or reads), with its time and the bytes it
+ * sent and received; a step cut short by TLS_MUX_ECP_OPS is a pause. The
+ * crypto primitives inside the steps are timed by link-time wraps
+ * (-Wl,--wrap=...) of the calls of mbedTLS's TLS modules into the others:
+ * ECDH, the ECDSA signature and verification, the parsing and verification
+ * of the certificate chain, the key derivation, AES-GCM and the handshake
+ * hash. MBEDTLS_DEBUG_C is off, and its messages would not time them anyway.
+ * A primitive called from another (the hash of the key derivation) is in the
+ * trace, but only the outermost one counts in the totals. The round trips
+ * are the flights of the server, which the client waits for.
+ *
+ * The server has mbedTLS's test certificate (P-256, from a P-384 CA) and,
+ * like go_tstamp_srv, picks P-256 for ECDHE and issues session tickets,
+ * sealed with AES-256-GCM. Three handshakes:
+ * - ecdhe: full handshake, a new session each time;
+ * - resumed: the ticket of the last full handshake;
+ * - hybrid, with HOST_TLSBENCH_KYBER: the full handshake, then a Kyber768
+ *   exchange inside the channel (the client's public key, the server's
+ *   ciphertext: one more round trip), its shared secret mixed with the
+ *   master secret by HKDF. TLS 1.2 cannot carry a KEM in the handshake, so
+ *   this is the cost of a hybrid key on top of ECDHE.
+ * And, with HOST_TLSBENCH_KYBER, the Kyber channel of kem_client.c
+ * (kem_chan.c, built with KEM_CHAN_SERVER for its server side) in place of
+ * TLS, against a server key pair made at start:
+ * - kemchan: the full hello, an encapsulation to the server's key;
+ * - kemchan-resumed: the ticket of the last full one.
+ * The Kyber calls, HKDF and ChaCha20-Poly1305 are wrapped as well.
+ * With TLS_CLIENT_CA_PEM, the client verifies the chain, against the test CA.
+ *
+ * It writes every run to a trace in Chrome's trace event format (for
+ * chrome://tracing, Perfetto or speedscope: one process per handshake, one
+ * thread per side, handshake > message > primitive), and the averages per
+ * side, message and primitive to a CSV for regression checks, and prints
+ * them as [TLSBENCH] lines. Each wrapped call adds two clock readings to the
+ * time of its message; the events are written out between the runs.
+ * mbedTLS allocates through a counting calloc (MBEDTLS_PLATFORM_MEMORY),
+ * which charges each block to the side that took it: the peak of each side,
+ * and what it still holds once the handshake is over, next to the size of
+ * its context (mbedtls_ssl_context, or struct kem_chan).
+ *
+ * host_freertos.c runs it with HOST_TLSBENCH, instead of the network:
+ * HOST_TLSBENCH_RUNS handshakes of each kind (BENCH_RUNS), the trace to the
+ * file named by HOST_TLSBENCH_TRACE and the CSV to HOST_TLSBENCH_CSV
+ * (tlsbench.json, tlsbench.csv).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mbedtls/certs.h"
+#include "mbedtls/cipher.h"
+#include "mbedtls/ecdh.h"
+#include "mbedtls/pk.h"
+#include "mbedtls/platform.h"
+#include "mbedtls/sha256.h"
+#include "mbedtls/sha512.h"
+#include "mbedtls/ssl_internal.h"
+#include "mbedtls/x509_crt.h"
+#include "rng.h"
+#include "tls_client.h"
+#ifdef HOST_TLSBENCH_KYBER
+#include "mbedtls/hkdf.h"
+#include "kem_chan.h"
+#include "kyber_fused.h"
+#endif
+
+#define BENCH_RUNS 20 //handshakes of each kind
+#define BENCH_PIPE 16384 //bytes one way, a flight at most
+#define BENCH_EVENTS 8192 //trace events of one run
+#define BENCH_HOSTNAME "localhost" //name in mbedTLS's test certificate
+#define BENCH_TICKET_IV 12
+#define BENCH_TICKET_TAG 16
+#define BENCH_TICKET_LIFETIME 86400 //s
+#define BENCH_KEY_LEN 32 //hybrid key
+#define BENCH_HEAP_HDR 16 //before each block: its size and side, keeps the alignment
+#define BENCH_HEAP_NONE 0xFF //side of a block taken outside the runs
+
+#define SIDE_CLIENT 0
+#define SIDE_SERVER 1
+#define SIDES 2
+
+#define BENCH_MSG_KEM_PK (MBEDTLS_SSL_SERVER_HELLO_VERIFY_REQUEST_SENT + 1) //after the handshake states
+#define BENCH_MSG_KEM_CT (MBEDTLS_SSL_SERVER_HELLO_VERIFY_REQUEST_SENT + 2)
+#define BENCH_MSG_KEM_HELLO (MBEDTLS_SSL_SERVER_HELLO_VERIFY_REQUEST_SENT + 3) //kem_chan.c
+#define BENCH_MSG_KEM_ACCEPT (MBEDTLS_SSL_SERVER_HELLO_VERIFY_REQUEST_SENT + 4)
+#define BENCH_MSGS (MBEDTLS_SSL_SERVER_HELLO_VERIFY_REQUEST_SENT + 5)
+
+#define BENCH_CAT(a, b) BENCH_CAT2(a, b) //after the expansion of b: the names of kyber_fused.h
+#define BENCH_CAT2(a, b) a##b
+
+enum bench_mode
+{
+  MODE_ECDHE,
+  MODE_RESUMED,
+  MODE_HYBRID,
+  MODE_KEMCHAN,
+  MODE_KEMCHAN_RESUMED,
+  MODES
+};
+
+enum bench_prim
+{
+  PRIM_ECDH_MAKE_PARAMS,
+  PRIM_ECDH_READ_PARAMS,
+  PRIM_ECDH_MAKE_PUBLIC,
+  PRIM_ECDH_READ_PUBLIC,
+  PRIM_ECDH_CALC_SECRET,
+  PRIM_PK_SIGN,
+  PRIM_PK_VERIFY,
+  PRIM_X509_PARSE,
+  PRIM_X509_VERIFY,
+  PRIM_DERIVE_KEYS,
+  PRIM_AEAD_ENCRYPT,
+  PRIM_AEAD_DECRYPT,
+  PRIM_SHA256,
+  PRIM_SHA512,
+  PRIM_KEM_KEYPAIR,
+  PRIM_KEM_ENC,
+  PRIM_KEM_DEC,
+  PRIM_HKDF,
+  PRIM_CHACHAPOLY_ENCRYPT,
+  PRIM_CHACHAPOLY_DECRYPT,
+  PRIMS
+};
+
+static const char *const mode_names[MODES] = {"ecdhe", "resumed", "hybrid", "kemchan", "kemchan-resumed"};
+static const char *const side_names[SIDES] = {"client", "server"};
+
+static const char *const msg_names[BENCH_MSGS] = {
+    [MBEDTLS_SSL_HELLO_REQUEST] = "HelloRequest",
+    [MBEDTLS_SSL_CLIENT_HELLO] = "ClientHello",
+    [MBEDTLS_SSL_SERVER_HELLO] = "ServerHello",
+    [MBEDTLS_SSL_SERVER_CERTIFICATE] = "Certificate",
+    [MBEDTLS_SSL_SERVER_KEY_EXCHANGE] = "ServerKeyExchange",
+    [MBEDTLS_SSL_CERTIFICATE_REQUEST] = "CertificateRequest",
+    [MBEDTLS_SSL_SERVER_HELLO_DONE] = "ServerHelloDone",
+    [MBEDTLS_SSL_CLIENT_CERTIFICATE] = "client Certificate",
+    [MBEDTLS_SSL_CLIENT_KEY_EXCHANGE] = "ClientKeyExchange",
+    [MBEDTLS_SSL_CERTIFICATE_VERIFY] = "CertificateVerify",
+    [MBEDTLS_SSL_CLIENT_CHANGE_CIPHER_SPEC] = "client ChangeCipherSpec",
+    [MBEDTLS_SSL_CLIENT_FINISHED] = "client Finished",
+    [MBEDTLS_SSL_SERVER_CHANGE_CIPHER_SPEC] = "server ChangeCipherSpec",
+    [MBEDTLS_SSL_SERVER_FINISHED] = "server Finished",
+    [MBEDTLS_SSL_FLUSH_BUFFERS] = "flush",
+    [MBEDTLS_SSL_HANDSHAKE_WRAPUP] = "wrap-up",
+    [MBEDTLS_SSL_HANDSHAKE_OVER] = "over",
+    [MBEDTLS_SSL_SERVER_NEW_SESSION_TICKET] = "NewSessionTicket",
+    [MBEDTLS_SSL_SERVER_HELLO_VERIFY_REQUEST_SENT] = "HelloVerifyRequest",
+    [BENCH_MSG_KEM_PK] = "KEM public key",
+    [BENCH_MSG_KEM_CT] = "KEM ciphertext",
+    [BENCH_MSG_KEM_HELLO] = "kem_chan hello",
+    [BENCH_MSG_KEM_ACCEPT] = "kem_chan accept",
+};
+
+static const char *const prim_names[PRIMS] = {
+    "ecdh_make_params", "ecdh_read_params", "ecdh_make_public", "ecdh_read_public", "ecdh_calc_secret",
+    "pk_sign", "pk_verify", "x509_crt_parse_der", "x509_crt_verify", "ssl_derive_keys", "cipher_auth_encrypt",
+    "cipher_auth_decrypt", "sha256_update", "sha512_update", "kem_keypair", "kem_enc", "kem_dec", "hkdf",
+    "chachapoly_encrypt", "chachapoly_decrypt",
+};
+
+struct bench_stat //one run
+{
+  uint32_t calls;
+  uint32_t bytes;
+  uint64_t ns;
+};
+
+struct bench_agg //sum of the runs
+{
+  uint64_t calls;
+  uint64_t bytes;
+  uint64_t ns;
+  uint64_t ns_min; //of one run
+  uint64_t ns_max;
+};
+
+struct bench_side
+{
+  struct bench_stat msg[BENCH_MSGS]; //calls: steps that did some work
+  struct bench_stat prim[PRIMS]; //calls: completed ones, outermost only
+  struct bench_stat cpu; //all the steps of the side, calls: steps
+  struct bench_stat wire; //calls: flights sent, bytes: their bytes
+  struct bench_stat heap; //calls: allocations, bytes: peak in use
+  struct bench_stat kept; //bytes: in use after the handshake
+  uint32_t heap_used;
+  uint8_t order[BENCH_MSGS]; //the messages, in the order of the handshake
+  uint8_t order_n;
+};
+
+struct bench_run
+{
+  struct bench_side side[SIDES];
+  struct bench_stat latency; //first step of the client to the end
+  struct bench_stat pauses; //client steps cut short
+};
+
+struct bench_agg_side
+{
+  struct bench_agg msg[BENCH_MSGS];
+  struct bench_agg prim[PRIMS];
+  struct bench_agg cpu;
+  struct bench_agg wire;
+  struct bench_agg heap;
+  struct bench_agg kept;
+  uint8_t order[BENCH_MSGS]; //as the runs first did them
+  uint8_t order_n;
+};
+
+struct bench_sum
+{
+  uint32_t runs;
+  struct bench_agg_side side[SIDES];
+  struct bench_agg latency;
+  struct bench_agg pauses;
+};
+
+struct bench_event
+{
+  const char *name;
+  const char *cat;
+  uint8_t side;
+  uint32_t bytes;
+  uint64_t start;
+  uint64_t ns;
+};
+
+struct bench_pipe //bytes sent by one side, not yet read by the other
+{
+  uint8_t buf[BENCH_PIPE];
+  size_t off;
+  size_t len;
+};
+
+static struct
+{
+  uint8_t on; //a run is timed
+  uint8_t side; //whose step runs
+  uint8_t depth; //wrapped calls in progress
+  uint8_t resumed; //the client's handshake was abbreviated
+  uint8_t heap; //allocations are charged to side
+  int writer; //side of the flight on the wire, -1 before the first
+  uint32_t step_bytes; //sent and received by the step
+  uint64_t first[SIDES]; //first and last step of each side
+  uint64_t last[SIDES];
+  uint64_t t0; //origin of the trace
+  unsigned mode;
+  unsigned run;
+} bench;
+
+static struct bench_run cur;
+static struct bench_sum sums[MODES];
+static struct bench_pipe pipes[SIDES]; //[side]: what it sent
+static struct bench_event events[BENCH_EVENTS];
+static uint32_t events_n, events_lost;
+static FILE *trace;
+static const char *trace_sep = "";
+
+static mbedtls_ssl_config client_conf, server_conf;
+static mbedtls_x509_crt server_crt;
+static mbedtls_pk_context server_key;
+static mbedtls_cipher_context_t ticket_key;
+#ifdef TLS_CLIENT_CA_PEM
+static mbedtls_x509_crt bench_ca;
+#endif
+#ifdef HOST_TLSBENCH_KYBER
+static uint8_t kem_pk[KYBER_PUBLICKEYBYTES], kem_sk[KYBER_SECRETKEYBYTES]; //the kem_chan server's
+static uint8_t kem_ticket_key[32];
+static struct kem_chan_ticket kem_ticket; //of the last full kemchan handshake
+#endif
+
+int __real_mbedtls_ecdh_make_params(mbedtls_ecdh_context *ctx, size_t *olen, unsigned char *buf, size_t blen,
+                                    int (*f_rng)(void *, unsigned char *, size_t), void *p_rng);
+int __real_mbedtls_ecdh_read_params(mbedtls_ecdh_context *ctx, const unsigned char **buf, const unsigned char *end);
+int __real_mbedtls_ecdh_make_public(mbedtls_ecdh_context *ctx, size_t *olen, unsigned char *buf, size_t blen,
+                                    int (*f_rng)(void *, unsigned char *, size_t), void *p_rng);
+int __real_mbedtls_ecdh_read_public(mbedtls_ecdh_context *ctx, const unsigned char *buf, size_t blen);
+int __real_mbedtls_ecdh_calc_secret(mbedtls_ecdh_context *ctx, size_t *olen, unsigned char *buf, size_t blen,
+                                    int (*f_rng)(void *, unsigned char *, size_t), void *p_rng);
+int __real_mbedtls_pk_sign(mbedtls_pk_context *ctx, mbedtls_md_type_t md_alg, const unsigned char *hash,
+                           size_t hash_len, unsigned char *sig, size_t *sig_len,
+                           int (*f_rng)(void *, unsigned char *, size_t), void *p_rng);
+int __real_mbedtls_pk_verify_restartable(mbedtls_pk_context *ctx, mbedtls_md_type_t md_alg,
+                                         const unsigned char *hash, size_t hash_len, const unsigned char *sig,
+                                         size_t sig_len, mbedtls_pk_restart_ctx *rs_ctx);
+int __real_mbedtls_x509_crt_parse_der(mbedtls_x509_crt *chain, const unsigned char *buf, size_t buflen);
+int __real_mbedtls_x509_crt_verify_restartable(mbedtls_x509_crt *crt, mbedtls_x509_crt *trust_ca,
+                                               mbedtls_x509_crl *ca_crl, const mbedtls_x509_crt_profile *profile,
+                                               const char *cn, uint32_t *flags,
+                                               int (*f_vrfy)(void *, mbedtls_x509_crt *, int, uint32_t *),
+                                               void *p_vrfy, mbedtls_x509_crt_restart_ctx *rs_ctx);
+int __real_mbedtls_ssl_derive_keys(mbedtls_ssl_context *ssl);
+int __real_mbedtls_cipher_auth_encrypt(mbedtls_cipher_context_t *ctx, const unsigned char *iv, size_t iv_len,
+                                       const unsigned char *ad, size_t ad_len, const unsigned char *input,
+                                       size_t ilen, unsigned char *output, size_t *olen, unsigned char *tag,
+                                       size_t tag_len);
+int __real_mbedtls_cipher_auth_decrypt(mbedtls_cipher_context_t *ctx, const unsigned char *iv, size_t iv_len,
+                                       const unsigned char *ad, size_t ad_len, const unsigned char *input,
+                                       size_t ilen, unsigned char *output, size_t *olen, const unsigned char *tag,
+                                       size_t tag_len);
+int __real_mbedtls_sha256_update_ret(mbedtls_sha256_context *ctx, const unsigned char *input, size_t ilen);
+int __real_mbedtls_sha512_update_ret(mbedtls_sha512_context *ctx, const unsigned char *input, size_t ilen);
+#ifdef HOST_TLSBENCH_KYBER
+int BENCH_CAT(__real_, crypto_kem_keypair)(uint8_t *pk, uint8_t *sk, void (*f_rng)(uint8_t *, size_t));
+int BENCH_CAT(__real_, crypto_kem_enc)(uint8_t *ct, uint8_t *ss, const uint8_t *pk, void (*f_rng)(uint8_t *, size_t));
+int BENCH_CAT(__real_, crypto_kem_dec)(uint8_t *ss, const uint8_t *ct, const uint8_t *sk);
+int __real_mbedtls_hkdf(const mbedtls_md_info_t *md, const unsigned char *salt, size_t salt_len,
+                        const unsigned char *ikm, size_t ikm_len, const unsigned char *info, size_t info_len,
+                        unsigned char *okm, size_t okm_len);
+int __real_mbedtls_chachapoly_encrypt_and_tag(mbedtls_chachapoly_context *ctx, size_t length,
+                                              const unsigned char nonce[12], const unsigned char *aad,
+                                              size_t aad_len, const unsigned char *input, unsigned char *output,
+                                              unsigned char tag[16]);
+int __real_mbedtls_chachapoly_auth_decrypt(mbedtls_chachapoly_context *ctx, size_t length,
+                                           const unsigned char nonce[12], const unsigned char *aad, size_t aad_len,
+                                           const unsigned char tag[16], const unsigned char *input,
+                                           unsigned char *output);
+#endif
+
+static uint64_t bench_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * bench_event
+ * keep an event of the run for the trace
+ */
+static void bench_event(const char *name, const char *cat, int side, uint64_t start, uint64_t ns, uint32_t bytes)
+{
+  struct bench_event *e;
+
+  if (events_n == BENCH_EVENTS)
+  {
+    events_lost++;
+    return;
+  }
+  e = &events[events_n++];
+  e->name = name;
+  e->cat = cat;
+  e->side = side;
+  e->bytes = bytes;
+  e->start = start;
+  e->ns = ns;
+}
+
+/*
+ * bench_trace_flush
+ * write the events of the run, untimed
+ */
+static void bench_trace_flush(void)
+{
+  const struct bench_event *e;
+
+  if (trace != NULL)
+  {
+    for (e = events; e < events + events_n; e++)
+    {
+      fprintf(trace,
+              "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%u,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+              "\"args\":{\"run\":%u,\"bytes\":%lu}}",
+              trace_sep, e->name, e->cat, bench.mode + 1, e->side + 1, (e->start - bench.t0) / 1e3, e->ns / 1e3,
+              bench.run, (unsigned long)e->bytes);
+      trace_sep = ",\n";
+    }
+  }
+  events_n = 0;
+}
+
+/*
+ * bench_trace_open
+ * the trace file, with the names of its processes (handshakes) and threads
+ * (sides)
+ */
+static void bench_trace_open(const char *path)
+{
+  unsigned mode;
+  int side;
+
+  trace = fopen(path, "w");
+  if (trace == NULL)
+  {
+    perror(path);
+    return;
+  }
+  fprintf(trace, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  for (mode = 0; mode < MODES; mode++)
+  {
+    fprintf(trace, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"%s\"}}", trace_sep,
+            mode + 1, mode_names[mode]);
+    trace_sep = ",\n";
+    for (side = 0; side < SIDES; side++)
+    {
+      fprintf(trace, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+              mode + 1, side + 1, side_names[side]);
+    }
+  }
+}
+
+/*
+ * bench_prim_start
+ * a wrapped call starts: its start time
+ */
+static uint64_t bench_prim_start(void)
+{
+  bench.depth++;
+  return bench_now();
+}
+
+/*
+ * bench_prim_end
+ * a wrapped call returned ret: charge it to the side running, if it is the
+ * outermost one
+ */
+static void bench_prim_end(enum bench_prim prim, uint64_t start, int ret, size_t bytes)
+{
+  uint64_t ns = bench_now() - start;
+  struct bench_stat *st;
+
+  bench.depth--;
+  if (!bench.on)
+  {
+    return;
+  }
+  bench_event(prim_names[prim], "primitive", bench.side, start, ns, (uint32_t)bytes);
+  if (bench.depth == 0)
+  {
+    st = &cur.side[bench.side].prim[prim];
+    st->ns += ns;
+    st->bytes += (uint32_t)bytes;
+    if (ret != MBEDTLS_ERR_ECP_IN_PROGRESS) //once per operation
+    {
+      st->calls++;
+    }
+  }
+}
+
+int __wrap_mbedtls_ecdh_make_params(mbedtls_ecdh_context *ctx, size_t *olen, unsigned char *buf, size_t blen,
+                                    int (*f_rng)(void *, unsigned char *, size_t), void *p_rng)
+{
+  uint64_t start = bench_prim_start();
+  int ret = __real_mbedtls_ecdh_make_params(ctx, olen, buf, blen, f_rng, p_rng);
+
+  bench_prim_end(PRIM_ECDH_MAKE_PARAMS, start, ret, 0);
+  return ret;
+}
+
+int __wrap_mbedtls_ecdh_read_params(mbedtls_ecdh_context *ctx, const unsigned char **buf, const unsigned char *end)
+{
+  uint64_t start = bench_prim_start();
+  int ret = __real_mbedtls_ecdh_read_params(ctx, buf, end);
+
+  bench_prim_end(PRIM_ECDH_READ_PARAMS, start, ret, 0);
+  return ret;
+}
+
+int __wrap_mbedtls_ecdh_make_public(mbedtls_ecdh_context *ctx, size_t *olen, unsigned char *buf, size_t blen,
+                                    int (*f_rng)(void *, unsigned char *, size_t), void *p_rng)
+{
+  uint64_t start = bench_prim_start();
+  int ret = __real_mbedtls_ecdh_make_public(ctx, olen, buf, blen, f_rng, p_rng);
+
+  bench_prim_end(PRIM_ECDH_MAKE_PUBLIC, start, ret, 0);
+  return ret;
+}
+
+int __wrap_mbedtls_ecdh_read_public(mbedtls_ecdh_context *ctx, const unsigned char *buf, size_t blen)
+{
+  uint64_t start = bench_prim_start();
+  int ret = __real_mbedtls_ecdh_read_public(ctx, buf, blen);
+
+  bench_prim_end(PRIM_ECDH_READ_PUBLIC, start, ret, 0);
+  return ret;
+}
+
+int __wrap_mbedtls_ecdh_calc_secret(mbedtls_ecdh_context *ctx, size_t *olen, unsigned char *buf, size_t blen,
+                                    int (*f_rng)(void *, unsigned char *, size_t), void *p_rng)
+{
+  uint64_t start = bench_prim_start();
+  int ret = __real_mbedtls_ecdh_calc_secret(ctx, olen, buf, blen, f_rng, p_rng);
+
+  bench_prim_end(PRIM_ECDH_CALC_SECRET, start, ret, 0);
+  return ret;
+}
+
+int __wrap_mbedtls_pk_sign(mbedtls_pk_context *ctx, mbedtls_md_type_t md_alg, const unsigned char *hash,
+                           size_t hash_len, unsigned char *sig, size_t *sig_len,
+                           int (*f_rng)(void *, unsigned char *, size_t), void *p_rng)
+{
+  uint64_t start = bench_prim_start();
+  int ret = __real_mbedtls_pk_sign(ctx, md_alg, hash, hash_len, sig, sig_len, f_rng, p_rng);
+
+  bench_prim_end(PRIM_PK_SIGN, start, ret, 0);
+  return ret;
+}
+
+int __wrap_mbedtls_pk_verify_restartable(mbedtls_pk_context *ctx, mbedtls_md_type_t md_alg,
+                                         const unsigned char *hash, size_t hash_len, const unsigned char *sig,
+                                         size_t sig_len, mbedtls_pk_restart_ctx *rs_ctx)
+{
+  uint64_t start = bench_prim_start();
+  int ret = __real_mbedtls_pk_verify_restartable(ctx, md_alg, hash, hash_len, sig, sig_len, rs_ctx);
+
+  bench_prim_end(PRIM_PK_VERIFY, start, ret, 0);
+  return ret;
+}
+
+int __wrap_mbedtls_x509_crt_parse_der(mbedtls_x509_crt *chain, const unsigned char *buf, size_t buflen)
+{
+  uint64_t start = bench_prim_start();
+  int ret = __real_mbedtls_x509_crt_parse_der(chain, buf, buflen);
+
+  bench_prim_end(PRIM_X509_PARSE, start, ret, buflen);
+  return ret;
+}
+
+int __wrap_mbedtls_x509_crt_verify_restartable(mbedtls_x509_crt *crt, mbedtls_x509_crt *trust_ca,
+                                               mbedtls_x509_crl *ca_crl, const mbedtls_x509_crt_profile *profile,
+                                               const char *cn, uint32_t *flags,
+                                               int (*f_vrfy)(void *, mbedtls_x509_crt *, int, uint32_t *),
+                                               void *p_vrfy, mbedtls_x509_crt_restart_ctx *rs_ctx)
+{
+  uint64_t start = bench_prim_start();
+  int ret = __real_mbedtls_x509_crt_verify_restartable(crt, trust_ca, ca_crl, profile, cn, flags, f_vrfy, p_vrfy,
+                                                       rs_ctx);
+
+  bench_prim_end(PRIM_X509_VERIFY, start, ret, 0);
+  return ret;
+}
+
+int __wrap_mbedtls_ssl_derive_keys(mbedtls_ssl_context *ssl)
+{
+  uint64_t start = bench_prim_start();
+  int ret = __real_mbedtls_ssl_derive_keys(ssl);
+
+  bench_prim_end(PRIM_DERIVE_KEYS, start, ret, 0);
+  return ret;
+}
+
+int __wrap_mbedtls_cipher_auth_encrypt(mbedtls_cipher_context_t *ctx, const unsigned char *iv, size_t iv_len,
+                                       const unsigned char *ad, size_t ad_len, const unsigned char *input,
+                                       size_t ilen, unsigned char *output, size_t *olen, unsigned char *tag,
+                                       size_t tag_len)
+{
+  uint64_t start = bench_prim_start();
+  int ret = __real_mbedtls_cipher_auth_encrypt(ctx, iv, iv_len, ad, ad_len, input, ilen, output, olen, tag,
+                                               tag_len);
+
+  bench_prim_end(PRIM_AEAD_ENCRYPT, start, ret, ilen);
+  return ret;
+}
+
+int __wrap_mbedtls_cipher_auth_decrypt(mbedtls_cipher_context_t *ctx, const unsigned char *iv, size_t iv_len,
+                                       const unsigned char *ad, size_t ad_len, const unsigned char *input,
+                                       size_t ilen, unsigned char *output, size_t *olen, const unsigned char *tag,
+                                       size_t tag_len)
+{
+  uint64_t start = bench_prim_start();
+  int ret = __real_mbedtls_cipher_auth_decrypt(ctx, iv, iv_len, ad, ad_len, input, ilen, output, olen, tag,
+                                               tag_len);
+
+  bench_prim_end(PRIM_AEAD_DECRYPT, start, ret, ilen);
+  return ret;
+}
+
+int __wrap_mbedtls_sha256_update_ret(mbedtls_sha256_context *ctx, const unsigned char *input, size_t ilen)
+{
+  uint64_t start = bench_prim_start();
+  int ret = __real_mbedtls_sha256_update_ret(ctx, input, ilen);
+
+  bench_prim_end(PRIM_SHA256, start, ret, ilen);
+  return ret;
+}
+
+int __wrap_mbedtls_sha512_update_ret(mbedtls_sha512_context *ctx, const unsigned char *input, size_t ilen)
+{
+  uint64_t start = bench_prim_start();
+  int ret = __real_mbedtls_sha512_update_ret(ctx, input, ilen);
+
+  bench_prim_end(PRIM_SHA512, start, ret, ilen);
+  return ret;
+}
+
+#ifdef HOST_TLSBENCH_KYBER
+int BENCH_CAT(__wrap_, crypto_kem_keypair)(uint8_t *pk, uint8_t *sk, void (*f_rng)(uint8_t *, size_t))
+{
+  uint64_t start = bench_prim_start();
+  int ret = BENCH_CAT(__real_, crypto_kem_keypair)(pk, sk, f_rng);
+
+  bench_prim_end(PRIM_KEM_KEYPAIR, start, ret, 0);
+  return ret;
+}
+
+int BENCH_CAT(__wrap_, crypto_kem_enc)(uint8_t *ct, uint8_t *ss, const uint8_t *pk, void (*f_rng)(uint8_t *, size_t))
+{
+  uint64_t start = bench_prim_start();
+  int ret = BENCH_CAT(__real_, crypto_kem_enc)(ct, ss, pk, f_rng);
+
+  bench_prim_end(PRIM_KEM_ENC, start, ret, 0);
+  return ret;
+}
+
+int BENCH_CAT(__wrap_, crypto_kem_dec)(uint8_t *ss, const uint8_t *ct, const uint8_t *sk)
+{
+  uint64_t start = bench_prim_start();
+  int ret = BENCH_CAT(__real_, crypto_kem_dec)(ss, ct, sk);
+
+  bench_prim_end(PRIM_KEM_DEC, start, ret, 0);
+  return ret;
+}
+
+int __wrap_mbedtls_hkdf(const mbedtls_md_info_t *md, const unsigned char *salt, size_t salt_len,
+                        const unsigned char *ikm, size_t ikm_len, const unsigned char *info, size_t info_len,
+                        unsigned char *okm, size_t okm_len)
+{
+  uint64_t start = bench_prim_start();
+  int ret = __real_mbedtls_hkdf(md, salt, salt_len, ikm, ikm_len, info, info_len, okm, okm_len);
+
+  bench_prim_end(PRIM_HKDF, start, ret, okm_len);
+  return ret;
+}
+
+int __wrap_mbedtls_chachapoly_encrypt_and_tag(mbedtls_chachapoly_context *ctx, size_t length,
+                                              const unsigned char nonce[12], const unsigned char *aad,
+                                              size_t aad_len, const unsigned char *input, unsigned char *output,
+                                              unsigned char tag[16])
+{
+  uint64_t start = bench_prim_start();
+  int ret = __real_mbedtls_chachapoly_encrypt_and_tag(ctx, length, nonce, aad, aad_len, input, output, tag);
+
+  bench_prim_end(PRIM_CHACHAPOLY_ENCRYPT, start, ret, length);
+  return ret;
+}
+
+int __wrap_mbedtls_chachapoly_auth_decrypt(mbedtls_chachapoly_context *ctx, size_t length,
+                                           const unsigned char nonce[12], const unsigned char *aad, size_t aad_len,
+                                           const unsigned char tag[16], const unsigned char *input,
+                                           unsigned char *output)
+{
+  uint64_t start = bench_prim_start();
+  int ret = __real_mbedtls_chachapoly_auth_decrypt(ctx, length, nonce, aad, aad_len, tag, input, output);
+
+  bench_prim_end(PRIM_CHACHAPOLY_DECRYPT, start, ret, length);
+  return ret;
+}
+#endif
+
+/*
+ * bench_calloc
+ * mbedTLS's calloc: the block is charged to the side running, while a run
+ * is set up, timed or freed
+ */
+static void *bench_calloc(size_t n, size_t size)
+{
+  size_t len = n * size;
+  struct bench_side *s;
+  uint8_t *p;
+
+  if (size != 0 && len / size != n)
+  {
+    return NULL;
+  }
+  p = calloc(1, len + BENCH_HEAP_HDR);
+  if (p == NULL)
+  {
+    return NULL;
+  }
+  *(size_t *)p = len;
+  p[sizeof(size_t)] = bench.heap ? bench.side : BENCH_HEAP_NONE;
+  if (bench.heap)
+  {
+    s = &cur.side[bench.side];
+    s->heap.calls++;
+    s->heap_used += (uint32_t)len;
+    if (s->heap_used > s->heap.bytes)
+    {
+      s->heap.bytes = s->heap_used;
+    }
+  }
+  return p + BENCH_HEAP_HDR;
+}
+
+static void bench_free(void *ptr)
+{
+  uint8_t *p = (uint8_t *)ptr - BENCH_HEAP_HDR;
+
+  if (ptr == NULL)
+  {
+    return;
+  }
+  if (p[sizeof(size_t)] != BENCH_HEAP_NONE)
+  {
+    cur.side[p[sizeof(size_t)]].heap_used -= (uint32_t)*(size_t *)p;
+  }
+  free(p);
+}
+
+/*
+ * bench_send
+ * BIO of a side: into its pipe, which the other side reads; a flight starts
+ * when the side writing changes
+ */
+static int bench_send(void *ctx, const unsigned char *buf, size_t len)
+{
+  struct bench_pipe *p = ctx;
+  int side = p - pipes;
+
+  if (p->off > 0) //what was read makes room
+  {
+    memmove(p->buf, p->buf + p->off, p->len - p->off);
+    p->len -= p->off;
+    p->off = 0;
+  }
+  if (len > sizeof(p->buf) - p->len)
+  {
+    len = sizeof(p->buf) - p->len;
+  }
+  if (len == 0)
+  {
+    return MBEDTLS_ERR_SSL_WANT_WRITE;
+  }
+  memcpy(p->buf + p->len, buf, len);
+  p->len += len;
+
+  if (bench.writer != side)
+  {
+    bench.writer = side;
+    cur.side[side].wire.calls++;
+  }
+  cur.side[side].wire.bytes += len;
+  bench.step_bytes += len;
+  return (int)len;
+}
+
+/*
+ * bench_recv
+ * BIO of a side: from the other side's pipe
+ */
+static int bench_recv(void *ctx, unsigned char *buf, size_t len)
+{
+  struct bench_pipe *p = &pipes[SIDES - 1 - ((struct bench_pipe *)ctx - pipes)];
+
+  if (len > p->len - p->off)
+  {
+    len = p->len - p->off;
+  }
+  if (len == 0)
+  {
+    return MBEDTLS_ERR_SSL_WANT_READ;
+  }
+  memcpy(buf, p->buf + p->off, len);
+  p->off += len;
+  bench.step_bytes += len;
+  return (int)len;
+}
+
+/*
+ * bench_ticket_write
+ * session ticket of the server: the session, sealed with ticket_key
+ */
+static int bench_ticket_write(void *p_ticket, const mbedtls_ssl_session *session, unsigned char *start,
+                              const unsigned char *end, size_t *tlen, uint32_t *lifetime)
+{
+  size_t len = sizeof(*session), olen;
+  int ret;
+
+  (void)p_ticket;
+  if ((size_t)(end - start) < BENCH_TICKET_IV + len + BENCH_TICKET_TAG)
+  {
+    return MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL;
+  }
+  ret = rng_random(NULL, start, BENCH_TICKET_IV);
+  if (ret != 0)
+  {
+    return ret;
+  }
+  ret = mbedtls_cipher_auth_encrypt(&ticket_key, start, BENCH_TICKET_IV, NULL, 0, (const unsigned char *)session,
+                                    len, start + BENCH_TICKET_IV, &olen, start + BENCH_TICKET_IV + len,
+                                    BENCH_TICKET_TAG);
+  if (ret != 0)
+  {
+    return ret;
+  }
+  *tlen = BENCH_TICKET_IV + len + BENCH_TICKET_TAG;
+  *lifetime = BENCH_TICKET_LIFETIME;
+  return 0;
+}
+
+/*
+ * bench_ticket_parse
+ * the session of a ticket from bench_ticket_write, opened in place
+ */
+static int bench_ticket_parse(void *p_ticket, mbedtls_ssl_session *session, unsigned char *buf, size_t len)
+{
+  size_t olen;
+  int ret;
+
+  (void)p_ticket;
+  if (len != BENCH_TICKET_IV + sizeof(*session) + BENCH_TICKET_TAG)
+  {
+    return MBEDTLS_ERR_SSL_INVALID_MAC;
+  }
+  ret = mbedtls_cipher_auth_decrypt(&ticket_key, buf, BENCH_TICKET_IV, NULL, 0, buf + BENCH_TICKET_IV,
+                                    sizeof(*session), buf + BENCH_TICKET_IV, &olen,
+                                    buf + BENCH_TICKET_IV + sizeof(*session), BENCH_TICKET_TAG);
+  if (ret == MBEDTLS_ERR_CIPHER_AUTH_FAILED)
+  {
+    return MBEDTLS_ERR_SSL_INVALID_MAC;
+  }
+  if (ret != 0)
+  {
+    return ret;
+  }
+  memcpy(session, buf + BENCH_TICKET_IV, sizeof(*session));
+#if defined(MBEDTLS_X509_CRT_PARSE_C)
+  session->peer_cert = NULL; //the server asks for no client certificate
+#endif
+#if defined(MBEDTLS_SSL_CLI_C) //the client's ticket, none here
+  session->ticket = NULL;
+  session->ticket_len = 0;
+#endif
+  return 0;
+}
+
+/*
+ * bench_setup
+ * the client's configuration, and the server's: mbedTLS's test
+ * certificate, P-256 first, tickets
+ */
+static int bench_setup(void)
+{
+  static const mbedtls_ecp_group_id curves[] = {MBEDTLS_ECP_DP_SECP256R1, MBEDTLS_ECP_DP_SECP384R1,
+                                                MBEDTLS_ECP_DP_NONE};
+  unsigned char key[32];
+  int ret;
+
+  mbedtls_platform_set_calloc_free(bench_calloc, bench_free); //before the first block
+  ret = tls_client_config(&client_conf);
+  if (ret != 0)
+  {
+    return ret;
+  }
+#ifdef TLS_CLIENT_CA_PEM
+  mbedtls_x509_crt_init(&bench_ca);
+  ret = mbedtls_x509_crt_parse(&bench_ca, (const unsigned char *)mbedtls_test_ca_crt_ec, mbedtls_test_ca_crt_ec_len);
+  if (ret != 0)
+  {
+    return ret;
+  }
+  mbedtls_ssl_conf_ca_chain(&client_conf, &bench_ca, NULL);
+#endif
+#if defined(MBEDTLS_ECP_RESTARTABLE)
+  mbedtls_ecp_set_max_ops(TLS_MUX_ECP_OPS); //as tls_mux_init: the client's ECC only
+#endif
+
+  mbedtls_ssl_config_init(&server_conf);
+  mbedtls_x509_crt_init(&server_crt);
+  mbedtls_pk_init(&server_key);
+  mbedtls_cipher_init(&ticket_key);
+  ret = mbedtls_x509_crt_parse(&server_crt, (const unsigned char *)mbedtls_test_srv_crt_ec,
+                               mbedtls_test_srv_crt_ec_len);
+  if (ret != 0)
+  {
+    return ret;
+  }
+  ret = mbedtls_pk_parse_key(&server_key, (const unsigned char *)mbedtls_test_srv_key_ec,
+                             mbedtls_test_srv_key_ec_len, NULL, 0);
+  if (ret != 0)
+  {
+    return ret;
+  }
+  ret = mbedtls_ssl_config_defaults(&server_conf, MBEDTLS_SSL_IS_SERVER, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                    MBEDTLS_SSL_PRESET_DEFAULT);
+  if (ret != 0)
+  {
+    return ret;
+  }
+  mbedtls_ssl_conf_rng(&server_conf, rng_random, NULL);
+  mbedtls_ssl_conf_curves(&server_conf, curves); //what Go picks for this client, instead of P-384
+  ret = mbedtls_ssl_conf_own_cert(&server_conf, &server_crt, &server_key);
+  if (ret != 0)
+  {
+    return ret;
+  }
+
+  ret = mbedtls_cipher_setup(&ticket_key, mbedtls_cipher_info_from_type(MBEDTLS_CIPHER_AES_256_GCM));
+  if (ret == 0)
+  {
+    ret = rng_random(NULL, key, sizeof(key));
+  }
+  if (ret == 0)
+  {
+    ret = mbedtls_cipher_setkey(&ticket_key, key, 8 * sizeof(key), MBEDTLS_ENCRYPT);
+  }
+  if (ret != 0)
+  {
+    return ret;
+  }
+  mbedtls_ssl_conf_session_tickets_cb(&server_conf, bench_ticket_write, bench_ticket_parse, NULL);
+#ifdef HOST_TLSBENCH_KYBER
+  ret = crypto_kem_keypair(kem_pk, kem_sk, rng_randombytes);
+  if (ret == 0)
+  {
+    ret = rng_random(NULL, kem_ticket_key, sizeof(kem_ticket_key));
+  }
+#endif
+  return ret;
+}
+
+/*
+ * bench_msg_start
+ * a step of side starts: its start time
+ */
+static uint64_t bench_msg_start(int side)
+{
+  bench.side = side;
+  bench.step_bytes = 0;
+  return bench_now();
+}
+
+/*
+ * bench_msg_end
+ * charge the step to message msg of side; done: it did some work (it did
+ * not just find nothing to read)
+ */
+static void bench_msg_end(int side, int msg, uint64_t start, int done)
+{
+  uint64_t now = bench_now(), ns = now - start;
+  struct bench_side *s = &cur.side[side];
+
+  s->cpu.calls++;
+  s->cpu.ns += ns;
+  s->msg[msg].ns += ns;
+  s->msg[msg].bytes += bench.step_bytes;
+  if (done)
+  {
+    if (s->msg[msg].calls++ == 0)
+    {
+      s->order[s->order_n++] = msg;
+    }
+    bench_event(msg_names[msg], "message", side, start, ns, bench.step_bytes);
+  }
+  if (bench.first[side] == 0)
+  {
+    bench.first[side] = start;
+  }
+  bench.last[side] = now;
+}
+
+/*
+ * bench_step
+ * one handshake step of side
+ */
+static int bench_step(int side, mbedtls_ssl_context *ssl)
+{
+  int msg = ssl->state, ret;
+  uint64_t start = bench_msg_start(side);
+
+  ret = mbedtls_ssl_handshake_step(ssl);
+  bench_msg_end(side, msg, start, ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE);
+  if (side == SIDE_CLIENT && ssl->handshake != NULL && ssl->handshake->resume)
+  {
+    bench.resumed = 1;
+  }
+  if (ret == MBEDTLS_ERR_SSL_CRYPTO_IN_PROGRESS)
+  {
+    cur.pauses.calls++;
+    return 0;
+  }
+  return ret;
+}
+
+/*
+ * bench_handshake
+ * step each side until it waits for the other, until both are done
+ */
+static int bench_handshake(mbedtls_ssl_context *ssl)
+{
+  int side = SIDE_CLIENT, idle = 0, ret;
+
+  while (ssl[SIDE_CLIENT].state != MBEDTLS_SSL_HANDSHAKE_OVER || ssl[SIDE_SERVER].state != MBEDTLS_SSL_HANDSHAKE_OVER)
+  {
+    if (ssl[side].state == MBEDTLS_SSL_HANDSHAKE_OVER)
+    {
+      side = SIDES - 1 - side;
+      continue;
+    }
+    ret = bench_step(side, &ssl[side]);
+    if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE)
+    {
+      if (++idle == SIDES) //both wait
+      {
+        return MBEDTLS_ERR_SSL_INTERNAL_ERROR;
+      }
+      side = SIDES - 1 - side;
+      continue;
+    }
+    if (ret != 0)
+    {
+      return ret;
+    }
+    idle = 0;
+  }
+  return 0;
+}
+
+#ifdef HOST_TLSBENCH_KYBER
+static int bench_write(mbedtls_ssl_context *ssl, const uint8_t *buf, size_t len)
+{
+  int ret;
+
+  while (len > 0)
+  {
+    ret = mbedtls_ssl_write(ssl, buf, len);
+    if (ret < 0)
+    {
+      return ret;
+    }
+    buf += ret;
+    len -= ret;
+  }
+  return 0;
+}
+
+/* len bytes, all sent already */
+static int bench_read(mbedtls_ssl_context *ssl, uint8_t *buf, size_t len)
+{
+  int ret;
+
+  while (len > 0)
+  {
+    ret = mbedtls_ssl_read(ssl, buf, len);
+    if (ret < 0)
+    {
+      return ret;
+    }
+    if (ret == 0)
+    {
+      return MBEDTLS_ERR_SSL_CONN_EOF;
+    }
+    buf += ret;
+    len -= ret;
+  }
+  return 0;
+}
+
+/*
+ * bench_kem_key
+ * hybrid key: HKDF-SHA-256 of the KEM's shared secret, salted with the
+ * master secret of the handshake
+ */
+static int bench_kem_key(mbedtls_ssl_context *ssl, const uint8_t *ss, uint8_t *key)
+{
+  static const unsigned char info[] = "host_tlsbench hybrid";
+
+  return mbedtls_hkdf(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), ssl->session->master,
+                      sizeof(ssl->session->master), ss, KYBER_SSBYTES, info, sizeof(info) - 1, key, BENCH_KEY_LEN);
+}
+
+/*
+ * bench_kem
+ * Kyber768 over the channel: the client sends a public key, the server
+ * encapsulates to it and returns the ciphertext, both derive the key
+ */
+static int bench_kem(mbedtls_ssl_context *ssl)
+{
+  static uint8_t pk[KYBER_PUBLICKEYBYTES], sk[KYBER_SECRETKEYBYTES], ct[KYBER_CIPHERTEXTBYTES];
+  uint8_t ss[SIDES][KYBER_SSBYTES], key[SIDES][BENCH_KEY_LEN];
+  uint64_t start;
+  int ret;
+
+  start = bench_msg_start(SIDE_CLIENT);
+  ret = crypto_kem_keypair(pk, sk, rng_randombytes);
+  if (ret == 0)
+  {
+    ret = bench_write(&ssl[SIDE_CLIENT], pk, sizeof(pk));
+  }
+  bench_msg_end(SIDE_CLIENT, BENCH_MSG_KEM_PK, start, 1);
+  if (ret != 0)
+  {
+    return ret;
+  }
+
+  start = bench_msg_start(SIDE_SERVER);
+  ret = bench_read(&ssl[SIDE_SERVER], pk, sizeof(pk)); //into the client's copy: the same bytes
+  if (ret == 0)
+  {
+    ret = crypto_kem_enc(ct, ss[SIDE_SERVER], pk, rng_randombytes);
+  }
+  bench_msg_end(SIDE_SERVER, BENCH_MSG_KEM_PK, start, 1);
+  if (ret != 0)
+  {
+    return ret;
+  }
+
+  start = bench_msg_start(SIDE_SERVER);
+  ret = bench_write(&ssl[SIDE_SERVER], ct, sizeof(ct));
+  if (ret == 0)
+  {
+    ret = bench_kem_key(&ssl[SIDE_SERVER], ss[SIDE_SERVER], key[SIDE_SERVER]);
+  }
+  bench_msg_end(SIDE_SERVER, BENCH_MSG_KEM_CT, start, 1);
+  if (ret != 0)
+  {
+    return ret;
+  }
+
+  start = bench_msg_start(SIDE_CLIENT);
+  ret = bench_read(&ssl[SIDE_CLIENT], ct, sizeof(ct));
+  if (ret == 0)
+  {
+    ret = crypto_kem_dec(ss[SIDE_CLIENT], ct, sk);
+  }
+  if (ret == 0)
+  {
+    ret = bench_kem_key(&ssl[SIDE_CLIENT], ss[SIDE_CLIENT], key[SIDE_CLIENT]);
+  }
+  bench_msg_end(SIDE_CLIENT, BENCH_MSG_KEM_CT, start, 1);
+  if (ret == 0 && memcmp(key[SIDE_CLIENT], key[SIDE_SERVER], BENCH_KEY_LEN) != 0)
+  {
+    ret = MBEDTLS_ERR_SSL_INTERNAL_ERROR;
+  }
+  return ret;
+}
+#endif
+
+/*
+ * bench_done
+ * the handshake that started at start is over: its latency, and the heap
+ * each side holds for the connection
+ */
+static void bench_done(uint64_t start)
+{
+  int side;
+
+  cur.latency.ns = bench_now() - start;
+  cur.latency.calls = 1;
+  bench.on = 0;
+  for (side = 0; side < SIDES; side++)
+  {
+    cur.side[side].kept.bytes = cur.side[side].heap_used;
+  }
+}
+
+/*
+ * bench_tls
+ * a TLS handshake of mode; session: the client's, from the full
+ * handshakes, offered by the resumed ones
+ */
+static int bench_tls(enum bench_mode mode, mbedtls_ssl_session *session)
+{
+  mbedtls_ssl_context ssl[SIDES];
+  uint64_t start;
+  int side, ret;
+
+  for (side = 0; side < SIDES; side++)
+  {
+    mbedtls_ssl_init(&ssl[side]);
+  }
+
+  bench.side = SIDE_SERVER;
+  ret = mbedtls_ssl_setup(&ssl[SIDE_SERVER], &server_conf);
+  bench.side = SIDE_CLIENT;
+  if (ret == 0)
+  {
+    ret = mbedtls_ssl_setup(&ssl[SIDE_CLIENT], &client_conf);
+  }
+  if (ret == 0)
+  {
+    ret = mbedtls_ssl_set_hostname(&ssl[SIDE_CLIENT], BENCH_HOSTNAME);
+  }
+  if (ret == 0 && mode == MODE_RESUMED)
+  {
+    ret = mbedtls_ssl_set_session(&ssl[SIDE_CLIENT], session);
+  }
+  if (ret == 0)
+  {
+    for (side = 0; side < SIDES; side++)
+    {
+      mbedtls_ssl_set_bio(&ssl[side], &pipes[side], bench_send, bench_recv, NULL);
+    }
+    bench.on = 1;
+    start = bench_now();
+    ret = bench_handshake(ssl);
+#ifdef HOST_TLSBENCH_KYBER
+    if (ret == 0 && mode == MODE_HYBRID)
+    {
+      ret = bench_kem(ssl);
+    }
+#endif
+    bench_done(start);
+  }
+  bench.heap = 0; //the session outlives the run
+  if (ret == 0 && mode == MODE_ECDHE)
+  {
+    ret = mbedtls_ssl_get_session(&ssl[SIDE_CLIENT], session);
+  }
+  for (side = 0; side < SIDES; side++)
+  {
+    mbedtls_ssl_free(&ssl[side]);
+  }
+  return ret;
+}
+
+#ifdef HOST_TLSBENCH_KYBER
+/*
+ * bench_kemchan
+ * a kem_chan.c handshake of mode: the client's hello, full or with the
+ * ticket of the last full one, and the server's accept; then a record, not
+ * timed, to check that both sides have the same keys
+ */
+static int bench_kemchan(enum bench_mode mode)
+{
+  static uint8_t hello[KEM_CHAN_FULL_LEN], accept[KEM_CHAN_ACCEPT_LEN];
+  static const uint8_t text[] = "host_tlsbench";
+  uint8_t rec[KEM_CHAN_OVERHEAD + sizeof(text)], plain[sizeof(text)];
+  struct kem_chan ch[SIDES];
+  uint64_t start, t;
+  size_t len;
+  int side, ret;
+
+  for (side = 0; side < SIDES; side++)
+  {
+    kem_chan_init(&ch[side]);
+  }
+  bench.on = 1;
+  start = bench_now();
+
+  t = bench_msg_start(SIDE_CLIENT);
+  ret = kem_chan_hello(&ch[SIDE_CLIENT], kem_pk, mode == MODE_KEMCHAN_RESUMED ? &kem_ticket : NULL, hello, &len);
+  if (ret == 0 && bench_send(&pipes[SIDE_CLIENT], hello, len) != (int)len)
+  {
+    ret = MBEDTLS_ERR_SSL_INTERNAL_ERROR;
+  }
+  bench_msg_end(SIDE_CLIENT, BENCH_MSG_KEM_HELLO, t, 1);
+
+  if (ret == 0)
+  {
+    t = bench_msg_start(SIDE_SERVER);
+    ret = bench_recv(&pipes[SIDE_SERVER], hello, sizeof(hello));
+    if (ret > 0)
+    {
+      ret = kem_chan_server_hello(&ch[SIDE_SERVER], kem_sk, kem_ticket_key, (uint32_t)time(NULL), hello, ret,
+                                  accept, &len);
+    }
+    if (ret == 0 && bench_send(&pipes[SIDE_SERVER], accept, len) != (int)len)
+    {
+      ret = MBEDTLS_ERR_SSL_INTERNAL_ERROR;
+    }
+    bench_msg_end(SIDE_SERVER, BENCH_MSG_KEM_HELLO, t, 1);
+  }
+
+  if (ret == 0)
+  {
+    t = bench_msg_start(SIDE_CLIENT);
+    ret = bench_recv(&pipes[SIDE_CLIENT], accept, sizeof(accept));
+    if (ret > 0)
+    {
+      ret = kem_chan_accept(&ch[SIDE_CLIENT], accept, ret, &kem_ticket);
+    }
+    bench_msg_end(SIDE_CLIENT, BENCH_MSG_KEM_ACCEPT, t, 1);
+  }
+  bench.resumed = ch[SIDE_CLIENT].resumed;
+  bench_done(start);
+
+  if (ret == 0)
+  {
+    ret = kem_chan_seal(&ch[SIDE_CLIENT], text, sizeof(text), rec);
+  }
+  if (ret > 0)
+  {
+    ret = kem_chan_open(&ch[SIDE_SERVER], rec, ret, plain);
+  }
+  if (ret > 0)
+  {
+    ret = memcmp(plain, text, sizeof(text)) == 0 ? 0 : MBEDTLS_ERR_SSL_INTERNAL_ERROR;
+  }
+  for (side = 0; side < SIDES; side++)
+  {
+    kem_chan_free(&ch[side]);
+  }
+  return ret;
+}
+#endif
+
+static void bench_fold(struct bench_agg *a, const struct bench_stat *s, size_t n, uint32_t runs)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++)
+  {
+    a[i].calls += s[i].calls;
+    a[i].bytes += s[i].bytes;
+    a[i].ns += s[i].ns;
+    if (runs == 0 || s[i].ns < a[i].ns_min)
+    {
+      a[i].ns_min = s[i].ns;
+    }
+    if (s[i].ns > a[i].ns_max)
+    {
+      a[i].ns_max = s[i].ns;
+    }
+  }
+}
+
+/*
+ * bench_run
+ * one handshake of mode between new contexts; session: the client's, from
+ * the full handshakes, offered by the resumed ones
+ */
+static int bench_run(enum bench_mode mode, mbedtls_ssl_session *session)
+{
+  struct bench_sum *sum = &sums[mode];
+  int side, msg, i, ret;
+
+  memset(&cur, 0, sizeof(cur));
+  memset(bench.first, 0, sizeof(bench.first));
+  memset(bench.last, 0, sizeof(bench.last));
+  bench.writer = -1;
+  bench.resumed = 0;
+  for (side = 0; side < SIDES; side++)
+  {
+    pipes[side].off = 0;
+    pipes[side].len = 0;
+  }
+
+  bench.heap = 1;
+#ifdef HOST_TLSBENCH_KYBER
+  if (mode == MODE_KEMCHAN || mode == MODE_KEMCHAN_RESUMED)
+  {
+    ret = bench_kemchan(mode);
+  }
+  else
+#endif
+  {
+    ret = bench_tls(mode, session);
+  }
+  bench.heap = 0;
+  if (ret == 0 && bench.resumed != (mode == MODE_RESUMED || mode == MODE_KEMCHAN_RESUMED))
+  {
+    printf("[TLSBENCH] %s: the handshake was %s\r\n", mode_names[mode], bench.resumed ? "resumed" : "not resumed");
+    ret = MBEDTLS_ERR_SSL_INTERNAL_ERROR;
+  }
+  if (ret != 0)
+  {
+    events_n = 0;
+    return ret;
+  }
+
+  for (side = 0; side < SIDES; side++)
+  {
+    bench_event("handshake", "handshake", side, bench.first[side], bench.last[side] - bench.first[side],
+                cur.side[side].wire.bytes);
+    for (i = 0; i < cur.side[side].order_n; i++)
+    {
+      msg = cur.side[side].order[i];
+      if (sum->side[side].msg[msg].calls == 0) //new to the sum
+      {
+        sum->side[side].order[sum->side[side].order_n++] = msg;
+      }
+    }
+    bench_fold(sum->side[side].msg, cur.side[side].msg, BENCH_MSGS, sum->runs);
+    bench_fold(sum->side[side].prim, cur.side[side].prim, PRIMS, sum->runs);
+    bench_fold(&sum->side[side].cpu, &cur.side[side].cpu, 1, sum->runs);
+    bench_fold(&sum->side[side].wire, &cur.side[side].wire, 1, sum->runs);
+    bench_fold(&sum->side[side].heap, &cur.side[side].heap, 1, sum->runs);
+    bench_fold(&sum->side[side].kept, &cur.side[side].kept, 1, sum->runs);
+  }
+  bench_fold(&sum->latency, &cur.latency, 1, sum->runs);
+  bench_fold(&sum->pauses, &cur.pauses, 1, sum->runs);
+  sum->runs++;
+  bench_trace_flush();
+  return 0;
+}
+
+static void bench_csv_row(FILE *f, enum bench_mode mode, int side, const char *kind, const char *name,
+                          const struct bench_agg *a, uint32_t runs)
+{
+  fprintf(f, "%s,%s,%s,%s,%lu,%.1f,%.1f,%.1f,%.1f,%.1f\n", mode_names[mode], side_names[side], kind, name,
+          (unsigned long)runs, (double)a->calls / runs, (double)a->bytes / runs, a->ns / 1e3 / runs, a->ns_min / 1e3,
+          a->ns_max / 1e3);
+}
+
+/*
+ * bench_csv
+ * one row per handshake kind, side and item, averaged per handshake
+ */
+static void bench_csv(const char *path)
+{
+  const struct bench_agg_side *s;
+  const struct bench_sum *sum;
+  unsigned mode;
+  int side, i;
+  FILE *f;
+
+  f = fopen(path, "w");
+  if (f == NULL)
+  {
+    perror(path);
+    return;
+  }
+  fprintf(f, "mode,side,kind,name,runs,calls,bytes,us_avg,us_min,us_max\n");
+  for (mode = 0; mode < MODES; mode++)
+  {
+    sum = &sums[mode];
+    if (sum->runs == 0)
+    {
+      continue;
+    }
+    bench_csv_row(f, mode, SIDE_CLIENT, "handshake", "latency", &sum->latency, sum->runs);
+    bench_csv_row(f, mode, SIDE_CLIENT, "handshake", "ecc_pauses", &sum->pauses, sum->runs);
+    for (side = 0; side < SIDES; side++)
+    {
+      s = &sum->side[side];
+      bench_csv_row(f, mode, side, "handshake", "cpu", &s->cpu, sum->runs);
+      bench_csv_row(f, mode, side, "wire", "flights", &s->wire, sum->runs);
+      bench_csv_row(f, mode, side, "heap", "peak", &s->heap, sum->runs);
+      bench_csv_row(f, mode, side, "heap", "kept", &s->kept, sum->runs);
+      for (i = 0; i < s->order_n; i++)
+      {
+        bench_csv_row(f, mode, side, "message", msg_names[s->order[i]], &s->msg[s->order[i]], sum->runs);
+      }
+      for (i = 0; i < PRIMS; i++)
+      {
+        if (s->prim[i].calls > 0)
+        {
+          bench_csv_row(f, mode, side, "primitive", prim_names[i], &s->prim[i], sum->runs);
+        }
+      }
+    }
+  }
+  fclose(f);
+}
+
+/*
+ * bench_report
+ * [TLSBENCH] lines of a handshake kind: totals, the memory, then the
+ * messages and primitives of each side with their share of its time
+ */
+static void bench_report(enum bench_mode mode)
+{
+  const struct bench_sum *sum = &sums[mode];
+  const struct bench_agg_side *s;
+  const struct bench_agg *m;
+  uint64_t runs = sum->runs;
+  size_t ctx = sizeof(mbedtls_ssl_context);
+  int side, i;
+
+#ifdef HOST_TLSBENCH_KYBER
+  if (mode == MODE_KEMCHAN || mode == MODE_KEMCHAN_RESUMED)
+  {
+    ctx = sizeof(struct kem_chan);
+  }
+#endif
+
+  printf("[TLSBENCH] %s: %lu handshakes, %.3f ms (%.3f-%.3f), client %.3f ms, server %.3f ms, "
+         "%lu B to the server, %lu B to the client, %lu round trips, %lu ECC pauses\r\n",
+         mode_names[mode], (unsigned long)runs, sum->latency.ns / 1e6 / runs, sum->latency.ns_min / 1e6,
+         sum->latency.ns_max / 1e6, sum->side[SIDE_CLIENT].cpu.ns / 1e6 / runs,
+         sum->side[SIDE_SERVER].cpu.ns / 1e6 / runs, (unsigned long)(sum->side[SIDE_CLIENT].wire.bytes / runs),
+         (unsigned long)(sum->side[SIDE_SERVER].wire.bytes / runs),
+         (unsigned long)(sum->side[SIDE_SERVER].wire.calls / runs), (unsigned long)(sum->pauses.calls / runs));
+  printf("[TLSBENCH] %s: context %lu B, heap client %lu B peak, %lu B kept, server %lu B peak, %lu B kept\r\n",
+         mode_names[mode], (unsigned long)ctx, (unsigned long)(sum->side[SIDE_CLIENT].heap.bytes / runs),
+         (unsigned long)(sum->side[SIDE_CLIENT].kept.bytes / runs),
+         (unsigned long)(sum->side[SIDE_SERVER].heap.bytes / runs),
+         (unsigned long)(sum->side[SIDE_SERVER].kept.bytes / runs));
+  for (side = 0; side < SIDES; side++)
+  {
+    s = &sum->side[side];
+    for (i = 0; i < s->order_n; i++)
+    {
+      m = &s->msg[s->order[i]];
+      printf("[TLSBENCH] %s %s %-24s %9.3f ms %5.1f%% %6lu B\r\n", mode_names[mode], side_names[side],
+             msg_names[s->order[i]], m->ns / 1e6 / runs, 100.0 * m->ns / (s->cpu.ns ? s->cpu.ns : 1),
+             (unsigned long)(m->bytes / runs));
+    }
+    for (i = 0; i < PRIMS; i++)
+    {
+      if (s->prim[i].calls > 0)
+      {
+        printf("[TLSBENCH] %s %s   %-22s %9.3f ms %5.1f%% %6.1f calls\r\n", mode_names[mode], side_names[side],
+               prim_names[i], s->prim[i].ns / 1e6 / runs, 100.0 * s->prim[i].ns / (s->cpu.ns ? s->cpu.ns : 1),
+               (double)s->prim[i].calls / runs);
+      }
+    }
+  }
+}
+
+/*
+ * host_tlsbench
+ * the benchmark, on the shared RNG seeded already: 0, or 1 if a handshake
+ * failed
+ */
+int host_tlsbench(void)
+{
+  const char *runs_env = getenv("HOST_TLSBENCH_RUNS");
+  const char *trace_path = getenv("HOST_TLSBENCH_TRACE");
+  const char *csv_path = getenv("HOST_TLSBENCH_CSV");
+  unsigned runs = runs_env != NULL ? strtoul(runs_env, NULL, 0) : BENCH_RUNS;
+  mbedtls_ssl_session session;
+  enum bench_mode mode;
+  int ret;
+
+  if (runs == 0)
+  {
+    runs = 1;
+  }
+  ret = bench_setup();
+  if (ret != 0)
+  {
+    printf("[TLSBENCH] setup failed: -0x%04x\r\n", (unsigned int)-ret);
+    return 1;
+  }
+  mbedtls_ssl_session_init(&session);
+  bench.t0 = bench_now();
+  bench_trace_open(trace_path != NULL ? trace_path : "tlsbench.json");
+
+  for (mode = 0; mode < MODES; mode++)
+  {
+#ifndef HOST_TLSBENCH_KYBER
+    if (mode == MODE_HYBRID || mode == MODE_KEMCHAN || mode == MODE_KEMCHAN_RESUMED)
+    {
+      printf("[TLSBENCH] %s: build with -DHOST_TLSBENCH_KYBER\r\n", mode_names[mode]);
+      continue;
+    }
+#endif
+    bench.mode = mode;
+    for (bench.run = 0; bench.run < runs; bench.run++)
+    {
+      ret = bench_run(mode, &session);
+      if (ret != 0)
+      {
+        printf("[TLSBENCH] %s: handshake %u failed: -0x%04x\r\n", mode_names[mode], bench.run, (unsigned int)-ret);
+        break;
+      }
+    }
+    if (sums[mode].runs > 0)
+    {
+      bench_report(mode);
+    }
+    if (ret != 0)
+    {
+      break;
+    }
+  }
+
+  if (trace != NULL)
+  {
+    fprintf(trace, "\n]}\n");
+    fclose(trace);
+  }
+  if (events_lost > 0)
+  {
+    printf("[TLSBENCH] %lu trace events lost, raise BENCH_EVENTS\r\n", (unsigned long)events_lost);
+  }
+  bench_csv(csv_path != NULL ? csv_path : "tlsbench.csv");
+  mbedtls_ssl_session_free(&session);
+  return ret != 0;
+}
@@ -0,0 +1,43 @@
+/*
+ * lwip_rtos.c
+ *
+ * MX_LWIP_Init() of the FreeRTOS projects for the host build (HOST_RTOS),
+ * as CubeMX generates it: tcpip thread, gnetif with DHCP. The NO_SYS build
+ * links lwip_bare/LWIP/App/lwip.c instead.
+ */
+
+#include "lwip.h"
+#include "lwip/init.h"
+
+#if WITH_RTOS
+
+struct netif gnetif;
+ip4_addr_t ipaddr;
+ip4_addr_t netmask;
+ip4_addr_t gw;
+
+void MX_LWIP_Init(void)
+{
+  /* Initilialize the LwIP stack with RTOS */
+  tcpip_init(NULL, NULL);
+
+  /* IP addresses initialization with DHCP (IPv4) */
+  ipaddr.addr = 0;
+  netmask.addr = 0;
+  gw.addr = 0;
+
+  /* add the network interface (IPv4/IPv6) with RTOS */
+  netif_add(&gnetif, &ipaddr, &netmask, &gw, NULL, &ethernetif_init, &tcpip_input);
+
+  /* Registers the default network interface */
+  netif_set_default(&gnetif);
+  netif_set_up(&gnetif);
+
+  /* Set the link callback function, this function is called on change of link status*/
+  netif_set_link_callback(&gnetif, ethernetif_update_config);
+
+  /* Start DHCP negotiation for a network interface (IPv4) */
+  dhcp_start(&gnetif);
+}
+
+#endif /* WITH_RTOS */
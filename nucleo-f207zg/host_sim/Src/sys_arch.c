@@ -0,0 +1,156 @@
+/*
+ * sys_arch.c
+ *
+ * lwIP OS layer on FreeRTOS for the host build (see arch/sys_arch.h). Not
+ * needed by the NO_SYS build, where ethernetif.c provides sys_now().
+ */
+
+#include "lwip/opt.h"
+
+#if !NO_SYS
+
+#include "lwip/sys.h"
+#include "lwip/err.h"
+
+void sys_init(void)
+{
+}
+
+u32_t sys_now(void)
+{
+  return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
+/*
+ * sys_arch_ticks, sys_arch_waited
+ * common part of the semaphore and mailbox waits: FreeRTOS ticks for a
+ * timeout in ms (0 is forever), and the ms actually waited
+ */
+static TickType_t sys_arch_ticks(u32_t timeout)
+{
+  return timeout != 0 ? timeout / portTICK_PERIOD_MS + 1 : portMAX_DELAY;
+}
+
+static u32_t sys_arch_waited(TickType_t start)
+{
+  return (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+}
+
+err_t sys_sem_new(sys_sem_t *sem, u8_t count)
+{
+  *sem = xSemaphoreCreateBinary();
+  if (*sem == NULL)
+  {
+    return ERR_MEM;
+  }
+  if (count != 0)
+  {
+    xSemaphoreGive(*sem);
+  }
+  return ERR_OK;
+}
+
+void sys_sem_free(sys_sem_t *sem)
+{
+  vSemaphoreDelete(*sem);
+}
+
+void sys_sem_signal(sys_sem_t *sem)
+{
+  xSemaphoreGive(*sem);
+}
+
+u32_t sys_arch_sem_wait(sys_sem_t *sem, u32_t timeout)
+{
+  TickType_t start = xTaskGetTickCount();
+
+  if (xSemaphoreTake(*sem, sys_arch_ticks(timeout)) != pdTRUE)
+  {
+    return SYS_ARCH_TIMEOUT;
+  }
+  return sys_arch_waited(start);
+}
+
+err_t sys_mutex_new(sys_mutex_t *mutex)
+{
+  *mutex = xSemaphoreCreateMutex();
+  return *mutex != NULL ? ERR_OK : ERR_MEM;
+}
+
+void sys_mutex_free(sys_mutex_t *mutex)
+{
+  vSemaphoreDelete(*mutex);
+}
+
+void sys_mutex_lock(sys_mutex_t *mutex)
+{
+  xSemaphoreTake(*mutex, portMAX_DELAY);
+}
+
+void sys_mutex_unlock(sys_mutex_t *mutex)
+{
+  xSemaphoreGive(*mutex);
+}
+
+err_t sys_mbox_new(sys_mbox_t *mbox, int size)
+{
+  *mbox = xQueueCreate(size, sizeof(void *));
+  return *mbox != NULL ? ERR_OK : ERR_MEM;
+}
+
+void sys_mbox_free(sys_mbox_t *mbox)
+{
+  vQueueDelete(*mbox);
+}
+
+void sys_mbox_post(sys_mbox_t *mbox, void *msg)
+{
+  while (xQueueSend(*mbox, &msg, portMAX_DELAY) != pdTRUE)
+  {
+  }
+}
+
+err_t sys_mbox_trypost(sys_mbox_t *mbox, void *msg)
+{
+  return xQueueSend(*mbox, &msg, 0) == pdTRUE ? ERR_OK : ERR_MEM;
+}
+
+u32_t sys_arch_mbox_fetch(sys_mbox_t *mbox, void **msg, u32_t timeout)
+{
+  TickType_t start = xTaskGetTickCount();
+  void *dummy;
+
+  if (xQueueReceive(*mbox, msg != NULL ? msg : &dummy, sys_arch_ticks(timeout)) != pdTRUE)
+  {
+    return SYS_ARCH_TIMEOUT;
+  }
+  return sys_arch_waited(start);
+}
+
+u32_t sys_arch_mbox_tryfetch(sys_mbox_t *mbox, void **msg)
+{
+  void *dummy;
+
+  return xQueueReceive(*mbox, msg != NULL ? msg : &dummy, 0) == pdTRUE ? 0 : SYS_MBOX_EMPTY;
+}
+
+sys_thread_t sys_thread_new(const char *name, lwip_thread_fn thread, void *arg, int stacksize, int prio)
+{
+  const osThreadDef_t os_thread_def = {(char *)name, (os_pthread)thread, (osPriority)prio, 0, (uint32_t)stacksize};
+
+  return osThreadCreate(&os_thread_def, arg);
+}
+
+sys_prot_t sys_arch_protect(void)
+{
+  taskENTER_CRITICAL();
+  return 1;
+}
+
+void sys_arch_unprotect(sys_prot_t pval)
+{
+  (void)pval;
+  taskEXIT_CRITICAL();
+}
+
+#endif /* !NO_SYS */
@@ -0,0 +1,89 @@
+#!/bin/sh
+#
+# tls_sweep.sh
+# Sweep the record buffers a TLS session keeps after its handshake
+# (TLS_MUX_IN_LEN/OUT_LEN, see host_sim/README.md): build the TLS client of
+# freertos_lwip_mbedtls7 once per size, run each against the Go server's
+# -tlsecho port for RUN_S seconds, and write the table of the README to
+# host_sim/tls_sweep.md, the logs next to it.
+#
+# Run from nucleo-f207zg, with LWIP, FREERTOS and MBEDTLS pointing to the
+# checkouts of the README, the TAP device up and the server started with
+# -tls :5443 -tlsecho :5444.
+#
+
+set -e
+
+: "${LWIP:?LWIP must point to the lwIP checkout}"
+: "${FREERTOS:?FREERTOS must point to the FreeRTOS-Kernel checkout}"
+: "${MBEDTLS:?MBEDTLS must point to the mbedTLS checkout}"
+POSIX=$FREERTOS/portable/ThirdParty/GCC/Posix
+RUN_S=${RUN_S:-40} #long enough for 32 handshakes and the 256 kB echo
+ARENA_B=${ARENA_B:-65536} #RAM the board can spare for the arena
+OUT=${OUT:-host_sim/tls_sweep}
+
+mkdir -p "$OUT"
+
+build()
+{
+  gcc -O2 -pthread -DHOST_RTOS -Ihost_sim/Inc -Ifreertos_lwip_tcp/Core/Inc -Ilwip_bare/Core/Inc \
+      -I"$LWIP"/src/include -I"$FREERTOS"/include -I"$POSIX" -I"$POSIX"/utils \
+      -DHOST_MBEDTLS -DMBEDTLS_CONFIG_FILE='"mbedtls/mbedtls_config.h"' \
+      -Ifreertos_lwip_mbedtls7/mbedTLS/include -Ifreertos_lwip_mbedtls7/mbedTLS/include/mbedtls \
+      -I"$MBEDTLS"/include -I"$MBEDTLS"/include/mbedtls -Ifreertos_lwip_mbedtls7/Core/Inc \
+      -DHOST_TLS -DTLS_CLIENT_BULK_KB=256 -DTLS_MUX_ZEROCOPY=0 -DTLS_MUX_SESSIONS=32 \
+      -DMEMP_NUM_NETCONN=40 -DMEMP_NUM_TCP_PCB=40 "$@" \
+      host_sim/Src/host_freertos.c host_sim/Src/host_hal.c host_sim/Src/ethernetif.c \
+      host_sim/Src/lwip_rtos.c host_sim/Src/sys_arch.c host_sim/Src/cmsis_os.c \
+      freertos_lwip_tcp/Core/Src/freertos.c freertos_lwip_tcp/Core/Src/netconn_client.c \
+      freertos_lwip_tcp/Core/Src/metrics.c lwip_bare/Core/Src/clock_sync.c \
+      freertos_lwip_mbedtls7/Core/Src/hardware_rng.c freertos_lwip_mbedtls7/Core/Src/rng.c \
+      freertos_lwip_mbedtls7/Core/Src/threading_alt.c freertos_lwip_mbedtls7/Core/Src/ecp_fast.c \
+      freertos_lwip_mbedtls7/Core/Src/ecp_tables.c freertos_lwip_mbedtls7/Core/Src/x25519.c \
+      freertos_lwip_mbedtls7/Core/Src/tls_client.c freertos_lwip_mbedtls7/Core/Src/tls_mux.c \
+      freertos_lwip_mbedtls7/Core/Src/tls_store.c freertos_lwip_mbedtls7/Core/Src/tls_arena.c \
+      "$LWIP"/src/core/*.c "$LWIP"/src/core/ipv4/*.c "$LWIP"/src/netif/ethernet.c "$LWIP"/src/api/*.c \
+      "$FREERTOS"/tasks.c "$FREERTOS"/queue.c "$FREERTOS"/list.c "$FREERTOS"/portable/MemMang/heap_4.c \
+      "$POSIX"/port.c "$POSIX"/utils/wait_for_event.c "$MBEDTLS"/library/*.c \
+      -Wl,--wrap=mbedtls_ecp_mul_restartable,--wrap=mbedtls_ecp_muladd_restartable
+}
+
+# row <name> <log>: B per open session, handshake peak, kB/s, sessions in ARENA_B
+row()
+{
+  awk -v name="$1" -v arena="$ARENA_B" '
+    { sub(/\r$/, "") }
+    /\[TLS\] bulk .* kB\/s each way/ { for (i = 1; i < NF; i++) if ($(i + 1) == "kB/s") rate = $i }
+    /heap .* B per session/ { for (i = 1; i < NF; i++) if ($i == "heap") per = $(i + 1) }
+    /\[TLS\] arena .* session peak/ { peak = $(NF - 1) }
+    /\[TLS\] arena owners/ { for (i = 1; i < NF; i++) if ($i == "shared:") { split($(i + 1), s, "/"); shared = s[1] } }
+    END {
+      if (per == "" || peak == "") { printf("| %s | failed | | | |\n", name); exit }
+      fit = per > 0 ? int((arena - shared - peak) / per) : 0
+      printf("| %s | %s | %s | %s | %d |\n", name, per, peak, rate == "" ? "-" : rate, fit)
+    }' "$2"
+}
+
+# run <name> <tag> <cflags...>
+run()
+{
+  name=$1
+  tag=$2
+  shift 2
+  echo "$name" >&2
+  build "$@" -o "$OUT/tls_host_$tag"
+  timeout "$RUN_S" stdbuf -oL "$OUT/tls_host_$tag" > "$OUT/$tag.log" 2>&1 || true
+  row "$name" "$OUT/$tag.log" >> "$OUT.md"
+}
+
+{
+  echo "| \`TLS_MUX_IN_LEN\`/\`OUT_LEN\` | B per open session | handshake peak (B) | kB/s each way | sessions in $((ARENA_B / 1024)) kB |"
+  echo "|----------------------------|--------------------|--------------------|---------------|-------------------|"
+} > "$OUT.md"
+
+run "no shrink, 4096/2048" noshrink -DTLS_MUX_SHRINK=0
+for sizes in 4096/2048 2048/1024 1024/1024 512/512; do
+  run "$sizes" "${sizes%/*}" -DTLS_MUX_IN_LEN="${sizes%/*}" -DTLS_MUX_OUT_LEN="${sizes#*/}"
+done
+
+cat "$OUT.md"
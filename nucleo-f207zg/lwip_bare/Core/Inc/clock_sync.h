@@ -0,0 +1,52 @@
+/*
+ * clock_sync.h
+ *
+ * Four-timestamp (NTP style) clock synchronization, independent of the
+ * transport (udp_sync.c on the raw API, StartUdpSyncTask on netconn).
+ *
+ * Every exchange gives T1 (request sent, local clock), T2 (request received,
+ * server), T3 (response sent, server) and T4 (response received, local).
+ * T1 and T4 are read from the free-running local clock, so the samples stay
+ * comparable whatever corrections were applied in between:
+ *
+ *   offset = ((T2 - T1) + (T3 - T4)) / 2    server - local
+ *   delay  = (T4 - T1) - (T3 - T2)          round trip, minus server time
+ *
+ * The last SYNC_FILTER samples go through a minimum-delay filter (the sample
+ * with the shortest round trip has the least asymmetric queueing), and each
+ * new best sample disciplines the clock: offsets over SYNC_STEP_US are
+ * stepped, smaller ones are slewed over the next poll period while a
+ * frequency correction absorbs the crystal drift.
+ */
+
+#ifndef INC_CLOCK_SYNC_H_
+#define INC_CLOCK_SYNC_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SYNC_FILTER 8 //samples of the minimum-delay filter
+#define SYNC_STEP_US 128000 //larger offsets are stepped instead of slewed
+#define SYNC_SLEW_MAX_PPB 500000 //at most 500 ppm of phase slew
+#define SYNC_FREQ_MAX_PPB 500000 //frequency correction limit
+#define SYNC_JITTER_N 16 //residual offsets in the jitter window
+
+struct sync_stats
+{
+  uint32_t samples; //exchanges completed
+  uint32_t used; //samples picked by the filter and applied
+  uint32_t steps; //clock steps (the first sync included)
+  int32_t offset_us; //residual offset of the last applied sample
+  uint32_t delay_us; //its round-trip delay
+  int32_t freq_ppb; //frequency correction
+  uint32_t jitter_us; //RMS of the last SYNC_JITTER_N residual offsets
+};
+
+void clock_sync_init(void);
+uint64_t clock_local_us(void);
+uint64_t clock_now_us(void);
+bool clock_synced(void);
+int clock_sync_update(uint64_t t1, uint64_t t2, uint64_t t3, uint64_t t4);
+void clock_sync_get(struct sync_stats *stats);
+
+#endif /* INC_CLOCK_SYNC_H_ */
@@ -0,0 +1,28 @@
+/*
+ * cycles.h
+ *
+ * The DWT cycle counter, which the clients, the clock sync, the event loop,
+ * the metrics and the TLS code all time with. Each of them starts it in its
+ * init with cycles_enable(), so none depends on another one having run first.
+ * The other F207 projects import this header from lwip_bare, as clock_sync.h.
+ */
+
+#ifndef INC_CYCLES_H_
+#define INC_CYCLES_H_
+
+#include "main.h"
+
+/*
+ * cycles_enable
+ * power up the DWT and start its cycle counter, once
+ */
+static inline void cycles_enable(void)
+{
+  if (!(CoreDebug->DEMCR & CoreDebug_DEMCR_TRCENA_Msk))
+  {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  }
+}
+
+#endif /* INC_CYCLES_H_ */
@@ -0,0 +1,64 @@
+/*
+ * eth_zc.h
+ *
+ * Zero-copy driver core for the ETH MAC, next to the CubeMX ethernetif.c
+ * (which copies every received frame into PBUF_POOL pbufs and every frame
+ * sent into its Tx_Buff). It takes over the DMA with descriptor rings of its
+ * own:
+ * - receive buffers come from a pool and are handed to lwIP as custom pbufs
+ *   (pbuf_alloced_custom) over the DMA buffer; freeing the pbuf puts the
+ *   buffer back in the pool and re-arms the ring;
+ * - frames are sent straight from their pbuf chain, one TX descriptor per
+ *   pbuf, held (pbuf_ref) until the DMA is done with them. Only the pbufs
+ *   the DMA can't read (flash, see ETH_ZC_DMA_REACHABLE) are copied.
+ * Everything runs in the lwIP core context (the NO_SYS main loop): the
+ * pbufs are freed there, and eth_zc_input reclaims the sent descriptors.
+ */
+
+#ifndef INC_ETH_ZC_H_
+#define INC_ETH_ZC_H_
+
+#include <stdint.h>
+
+#include "main.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+
+//#define ETH_ZC_ENABLE	/* Uncomment this to receive and send through eth_zc instead of ethernetif.c */
+
+#define ETH_ZC_RX_DESC ETH_RXBUFNB //receive descriptors
+#define ETH_ZC_RX_BUFS (2 * ETH_RXBUFNB) //receive pool: the ring, and the frames lwIP holds (queued, out of sequence)
+#define ETH_ZC_BUF_SIZE ETH_RX_BUF_SIZE //one whole frame, with its CRC
+#define ETH_ZC_TX_DESC (2 * ETH_TXBUFNB) //transmit descriptors, one per pbuf of a chain
+#define ETH_ZC_RX_COPYBREAK 0 //frames up to this length are copied, so that TCP doesn't hold a whole DMA buffer for them
+#define ETH_ZC_REPORT_MS 10000 //print the [ETHZC] line this often (0: never)
+
+/*
+ * Addresses the ETH DMA can read: its bus matrix port reaches the SRAMs, not
+ * the flash (const data, PBUF_ROM templates).
+ */
+#ifndef ETH_ZC_DMA_REACHABLE
+#define ETH_ZC_DMA_REACHABLE(q) ((uintptr_t)(q)->payload >= SRAM1_BASE && (uintptr_t)(q)->payload < SRAM_BB_BASE)
+#endif
+
+struct eth_zc_stats
+{
+  uint32_t rx_frames; //handed to lwIP
+  uint32_t rx_bytes;
+  uint32_t rx_copied; //bytes, below ETH_ZC_RX_COPYBREAK
+  uint32_t rx_dropped; //bad frame, larger than one buffer, or no pbuf to copy it to
+  uint32_t rx_nobuf; //ring refills short of a buffer (the DMA stalls and the MAC drops)
+  uint32_t rx_held_max; //most buffers in lwIP at a time
+  uint32_t tx_frames;
+  uint32_t tx_bytes;
+  uint32_t tx_segs; //descriptors used
+  uint32_t tx_copied; //bytes the DMA couldn't read in place, or of chains longer than the ring
+  uint32_t tx_busy; //frames refused: no free descriptors
+};
+
+void eth_zc_init(ETH_HandleTypeDef *heth, struct netif *netif);
+uint32_t eth_zc_input(struct netif *netif);
+err_t eth_zc_output(struct netif *netif, struct pbuf *p);
+void eth_zc_get_stats(struct eth_zc_stats *stats);
+
+#endif /* INC_ETH_ZC_H_ */
@@ -0,0 +1,49 @@
+/*
+ * evloop.h
+ *
+ * Event-driven main loop of lwip_bare, in place of spinning on
+ * MX_LWIP_Process(). The ETH DMA receive interrupt and SysTick (which
+ * watches the deadline of the next lwIP timeout) flag events, the loop
+ * handles them, runs the queued jobs and sleeps in WFI until the next
+ * interrupt. EVLOOP_SLEEP 0 keeps the polling loop, with the same
+ * measurements, for comparison.
+ */
+
+#ifndef INC_EVLOOP_H_
+#define INC_EVLOOP_H_
+
+#include <stdint.h>
+
+//#define EVLOOP_ENABLE	/* Uncomment this to run the event loop instead of MX_LWIP_Process() */
+
+#define EVLOOP_SLEEP 1 //0: poll like MX_LWIP_Process(), to measure the difference
+#define EVLOOP_JOBS 8 //job queue size
+#define EVLOOP_LINK_MS 250 //PHY link poll period (an MDIO read, once per pass before)
+#define EVLOOP_REPORT_MS 10000 //print the [LOOP] line this often (0: never)
+
+/*
+ * A job runs in the main loop, like the lwIP callbacks, so it can use the
+ * raw API. It runs to completion: longer work (crypto) should do one step
+ * and post itself again.
+ */
+typedef void (*evloop_job_fn)(void *arg);
+
+struct evloop_stats
+{
+  uint32_t passes; //loop passes (wakeups with EVLOOP_SLEEP)
+  uint32_t rx_events; //ETH receive interrupts handled
+  uint32_t rx_frames;
+  uint32_t jobs;
+  uint32_t lat_min; //receive interrupt to ethernetif_input, in CPU cycles
+  uint32_t lat_max;
+  uint64_t lat_sum;
+  uint64_t busy; //CPU cycles awake, interrupts included
+};
+
+void evloop_init(void);
+void evloop_poll(void);
+int evloop_post(evloop_job_fn fn, void *arg);
+void evloop_tick(void);
+void evloop_get_stats(struct evloop_stats *stats);
+
+#endif /* INC_EVLOOP_H_ */
@@ -21,8 +21,24 @@
 #define SERVER_IP4  13
 #define SERVER_PORT	5000
 
+#define CLIENT_PIPELINE 4 //max outstanding requests on the persistent connection
+#define CLIENT_RESP_TIMEOUT_MS 2000 //connection is reset when a response is this late
+#define CLIENT_BACKOFF_MIN_MS 250 //first reconnect delay, doubled on every failure
+#define CLIENT_BACKOFF_MAX_MS 8000
+
+#define CLIENT_PROTO 2 //highest protocol version offered, 1 to speak v1 only
+#define CLIENT_USEC 1 //ask for microseconds in v2 responses
+
+//#define TCP_CLIENT_BENCH 100	/* Uncomment this to benchmark both modes with this many requests */
+
 typedef enum {REQ = 0, RESP = 1} packet_type;
 
+typedef enum
+{
+  CLIENT_PERSISTENT = 0, //one connection, up to CLIENT_PIPELINE requests in flight
+  CLIENT_ONESHOT //connect, send one request, close on the response
+} client_mode;
+
 struct time_packet
 {
   uint8_t head; //0xAE
@@ -33,10 +49,79 @@ struct time_packet
   uint8_t hour;
   uint8_t minute;
   uint8_t second;
-  uint8_t dummy[247]; //you may add more information
+  uint8_t seq[4]; //request sequence number (little-endian), echoed in the response
+  uint8_t dummy[243]; //you may add more information
   uint8_t tail; //0xEA
 };//256 bytes
 
+/*
+ * Protocol v2: an 8-byte header, then len bytes of body.
+ * REQ has no body, RESP carries the 6 time fields (+4 bytes of microseconds
+ * with TP2_F_USEC), so a sample costs 8 + 14 (or 18) bytes instead of 2 x 256.
+ * HELLO carries no body either: the client offers its highest version in
+ * ver_type and the features it wants in flags, the server answers with the
+ * version and features it picked. A server tells the versions apart by the
+ * first byte of the connection (0xAE or 0xAF), so HELLO is only needed once.
+ */
+#define TP2_MAGIC 0xAF
+#define TP2_VERSION 2
+#define TP2_BODY_MAX 16
+
+typedef enum {TP2_REQ = 0, TP2_RESP = 1, TP2_HELLO = 2, TP2_SYNC = 3} tp2_type;
+
+#define TP2_F_USEC 0x01 //RESP carries the microseconds of the second
+
+struct tp2_hdr
+{
+  uint8_t magic; //0xAF
+  uint8_t ver_type; //version << 4 | type
+  uint8_t len; //body bytes that follow
+  uint8_t flags; //TP2_F_*
+  uint8_t seq[4]; //request sequence number (little-endian), echoed in the response
+};//8 bytes
+
+struct tp2_resp
+{
+  uint8_t year;
+  uint8_t month;
+  uint8_t day;
+  uint8_t hour;
+  uint8_t minute;
+  uint8_t second;
+  uint8_t usec[4]; //little-endian, only with TP2_F_USEC
+};
+
+/*
+ * TP2_SYNC, over UDP (see udp_sync.h): the request body is T1, the response
+ * body T1 (echoed), T2 and T3. Server timestamps are microseconds since the
+ * Unix epoch, T1 is opaque to the server.
+ */
+struct tp2_sync
+{
+  uint8_t t1[8]; //little-endian
+  uint8_t t2[8];
+  uint8_t t3[8];
+};
+
+struct client_stats
+{
+  uint32_t requests; //requests sent
+  uint32_t responses; //valid responses
+  uint32_t errors; //malformed/out-of-sequence responses and timeouts
+  uint32_t connects; //established connections
+  uint32_t reconnects; //connections lost with work pending
+  uint32_t lat_min; //request-to-response latency, in CPU cycles
+  uint32_t lat_max;
+  uint64_t lat_sum;
+  uint32_t bytes_tx; //application bytes, both directions
+  uint32_t bytes_rx;
+  uint32_t bytes_copied; //request bytes copied by tcp_write, the rest is referenced in flash
+  uint16_t queue_max; //most pbufs queued on the pcb (TCP_SND_QUEUELEN is the limit)
+  uint8_t proto; //protocol version in use
+};
+
 void app_start_get_time(void);
+int app_bench_time(client_mode mode, uint16_t n);
+void app_get_stats(struct client_stats *stats);
 
 #endif /* INC_TCP_CLIENT_H_ */
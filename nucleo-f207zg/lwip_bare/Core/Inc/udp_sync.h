@@ -0,0 +1,31 @@
+/*
+ * udp_sync.h
+ *
+ * Clock synchronization with the time server over UDP (lwIP raw API): one
+ * TP2_SYNC exchange every SYNC_PERIOD_MS, fed to clock_sync.h. A datagram
+ * has no handshake and no Nagle delay, so the round trip is one frame each
+ * way and its variation stays small.
+ */
+
+#ifndef INC_UDP_SYNC_H_
+#define INC_UDP_SYNC_H_
+
+#include "clock_sync.h"
+
+//#define UDP_SYNC_ENABLE	/* Uncomment this to synchronize the clock with the server */
+
+#define SYNC_PERIOD_MS 1000 //poll period, also the response timeout
+#define SYNC_REPORT_EVERY 10 //print the filter state every this many exchanges (0: never)
+
+struct udp_sync_stats
+{
+  uint32_t sent;
+  uint32_t received; //valid responses
+  uint32_t lost; //no response within SYNC_PERIOD_MS
+  uint32_t errors; //malformed or stale responses
+};
+
+int udp_sync_start(void);
+void udp_sync_get_stats(struct udp_sync_stats *stats);
+
+#endif /* INC_UDP_SYNC_H_ */
@@ -0,0 +1,244 @@
+/*
+ * clock_sync.c
+ *
+ * Clock filter and discipline of clock_sync.h. The local clock is the DWT
+ * cycle counter extended to 64 bits, so clock_local_us() (or clock_now_us())
+ * must run at least once per counter wrap (2^32 cycles, ~35 s at 120 MHz);
+ * the sync exchanges take care of that.
+ *
+ * The disciplined clock is a line through an anchor point:
+ *   now = base_time + dt + dt * freq + min(dt, slew_us) * slew,  dt = local - base_local
+ * and every correction re-anchors it at the current local time, so it never
+ * jumps except on a step.
+ */
+
+#include <string.h>
+
+#include "main.h"
+#include "cycles.h"
+#include "clock_sync.h"
+
+#define PPB 1000000000LL
+
+static struct
+{
+  uint32_t last_cyc; //DWT->CYCCNT at the previous read
+  uint64_t cycles; //extended cycle count
+
+  bool synced;
+  uint64_t base_local; //anchor of the disciplined clock
+  int64_t base_time;
+  int32_t freq_ppb;
+  int32_t slew_ppb; //phase correction in progress...
+  uint32_t slew_us; //...for this long after the anchor
+
+  struct
+  {
+    uint64_t local; //midpoint of T1 and T4
+    int64_t offset;
+    int64_t delay;
+  } filt[SYNC_FILTER];
+  uint8_t n_filt;
+  uint8_t next_filt;
+  uint64_t last_used; //local time of the last applied sample
+
+  int32_t resid[SYNC_JITTER_N];
+  uint8_t n_resid;
+  uint8_t next_resid;
+
+  struct sync_stats stats;
+} cs;
+
+/*
+ * clock_sync_init
+ * start the cycle counter, forget any previous synchronization
+ */
+void clock_sync_init(void)
+{
+  cycles_enable();
+
+  memset(&cs, 0, sizeof(cs));
+  cs.last_cyc = DWT->CYCCNT;
+}
+
+/*
+ * clock_local_us
+ * free-running local clock, microseconds since clock_sync_init
+ */
+uint64_t clock_local_us(void)
+{
+  uint32_t primask = __get_PRIMASK();
+  uint32_t cyc;
+  uint64_t us;
+
+  __disable_irq(); //callable from any task or interrupt
+  cyc = DWT->CYCCNT;
+  cs.cycles += (uint32_t)(cyc - cs.last_cyc);
+  cs.last_cyc = cyc;
+  us = cs.cycles / (SystemCoreClock / 1000000);
+  __set_PRIMASK(primask);
+
+  return us;
+}
+
+static int64_t cs_model(uint64_t local)
+{
+  int64_t dt = (int64_t)(local - cs.base_local);
+  int64_t slew_dt = dt < 0 ? 0 : (dt < cs.slew_us ? dt : cs.slew_us);
+
+  return cs.base_time + dt + dt * cs.freq_ppb / PPB + slew_dt * cs.slew_ppb / PPB;
+}
+
+/*
+ * clock_now_us
+ * disciplined clock: server time (microseconds since the Unix epoch) once
+ * synchronized, the local clock before
+ */
+uint64_t clock_now_us(void)
+{
+  uint64_t local = clock_local_us();
+
+  return cs.synced ? (uint64_t)cs_model(local) : local;
+}
+
+bool clock_synced(void)
+{
+  return cs.synced;
+}
+
+static int32_t cs_clamp(int64_t v, int32_t max)
+{
+  return v > max ? max : (v < -max ? -max : (int32_t)v);
+}
+
+static uint32_t cs_isqrt(uint64_t v)
+{
+  uint64_t r = 0, bit = 1ULL << 62;
+
+  while (bit > v)
+  {
+    bit >>= 2;
+  }
+  while (bit != 0)
+  {
+    if (v >= r + bit)
+    {
+      v -= r + bit;
+      r = (r >> 1) + bit;
+    }
+    else
+    {
+      r >>= 1;
+    }
+    bit >>= 2;
+  }
+  return (uint32_t)r;
+}
+
+static void cs_step(uint64_t local, int64_t server)
+{
+  cs.base_local = local;
+  cs.base_time = server;
+  cs.slew_ppb = 0;
+  cs.slew_us = 0;
+  cs.synced = true;
+  cs.n_resid = 0;
+  cs.next_resid = 0;
+  cs.stats.steps++;
+}
+
+/*
+ * clock_sync_update
+ * feed one exchange (T1, T4 from clock_local_us, T2, T3 from the server);
+ * returns 1 if the filter held it back, 0 if the clock was disciplined
+ */
+int clock_sync_update(uint64_t t1, uint64_t t2, uint64_t t3, uint64_t t4)
+{
+  int64_t delay = (int64_t)(t4 - t1) - (int64_t)(t3 - t2);
+  int64_t offset = ((int64_t)(t2 - t1) + (int64_t)(t3 - t4)) / 2;
+  uint64_t local = t1 + (t4 - t1) / 2;
+  int64_t resid, interval, sum = 0;
+  uint8_t i, best = cs.next_filt;
+
+  cs.filt[cs.next_filt].local = local;
+  cs.filt[cs.next_filt].offset = offset;
+  cs.filt[cs.next_filt].delay = delay < 0 ? 0 : delay; //server time stepped meanwhile
+  cs.next_filt = (cs.next_filt + 1) % SYNC_FILTER;
+  if (cs.n_filt < SYNC_FILTER)
+  {
+    cs.n_filt++;
+  }
+  cs.stats.samples++;
+
+  for (i = 0; i < cs.n_filt; i++)
+  {
+    if (cs.filt[i].delay < cs.filt[best].delay)
+    {
+      best = i;
+    }
+  }
+  if (cs.filt[best].local <= cs.last_used) //already applied, this exchange was noisier
+  {
+    return 1;
+  }
+
+  local = cs.filt[best].local;
+  interval = cs.last_used != 0 ? (int64_t)(local - cs.last_used) : 0;
+  cs.last_used = local;
+  cs.stats.used++;
+  cs.stats.delay_us = (uint32_t)cs.filt[best].delay;
+
+  if (!cs.synced)
+  {
+    cs_step(local, (int64_t)local + cs.filt[best].offset);
+    cs.stats.offset_us = 0;
+    return 0;
+  }
+
+  resid = (int64_t)local + cs.filt[best].offset - cs_model(local);
+  if (resid > SYNC_STEP_US || resid < -SYNC_STEP_US)
+  {
+    cs_step(local, (int64_t)local + cs.filt[best].offset);
+    cs.n_filt = 0; //the server clock jumped, older samples are void
+    cs.next_filt = 0;
+    cs.stats.offset_us = cs_clamp(resid, INT32_MAX);
+    return 0;
+  }
+
+  /* re-anchor, then correct half the phase over the next interval and an
+   * eighth of the implied drift (a stable second-order loop) */
+  local = clock_local_us();
+  cs.base_time = cs_model(local);
+  cs.base_local = local;
+  if (interval > 0)
+  {
+    cs.freq_ppb = cs_clamp(cs.freq_ppb + resid * PPB / interval / 8, SYNC_FREQ_MAX_PPB);
+    cs.slew_ppb = cs_clamp(resid * PPB / 2 / interval, SYNC_SLEW_MAX_PPB);
+    cs.slew_us = (uint32_t)interval;
+  }
+
+  cs.stats.offset_us = (int32_t)resid;
+  cs.stats.freq_ppb = cs.freq_ppb;
+  cs.resid[cs.next_resid] = (int32_t)resid;
+  cs.next_resid = (cs.next_resid + 1) % SYNC_JITTER_N;
+  if (cs.n_resid < SYNC_JITTER_N)
+  {
+    cs.n_resid++;
+  }
+  for (i = 0; i < cs.n_resid; i++)
+  {
+    sum += (int64_t)cs.resid[i] * cs.resid[i];
+  }
+  cs.stats.jitter_us = cs_isqrt((uint64_t)sum / cs.n_resid);
+
+  return 0;
+}
+
+/*
+ * clock_sync_get
+ * copy the counters and the current filter/discipline state
+ */
+void clock_sync_get(struct sync_stats *stats)
+{
+  *stats = cs.stats;
+}
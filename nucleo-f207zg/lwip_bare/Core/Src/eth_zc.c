@@ -0,0 +1,416 @@
+/*
+ * eth_zc.c
+ *
+ * See eth_zc.h. Both rings are chained lists of normal descriptors
+ * (RCH/TCH), like the HAL's. Receive: rx_cur is the next descriptor the DMA
+ * fills and rx_fill the next one to re-arm; the descriptors from rx_fill up
+ * to rx_cur have no buffer, their frame is in lwIP. When the pool runs dry,
+ * the DMA stops on an empty descriptor (RBUS) and is resumed by the next
+ * refill. Transmit: a frame takes one descriptor per pbuf, all handed to the
+ * DMA together by setting the first one's OWN last; the frame (and the
+ * copies of its flash pbufs) is freed when its descriptors come back.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "main.h"
+#include "lwip/opt.h"
+#include "lwip/timeouts.h"
+#include "eth_zc.h"
+
+#if !LWIP_SUPPORT_CUSTOM_PBUF
+#error "eth_zc needs LWIP_SUPPORT_CUSTOM_PBUF"
+#endif
+#if ETH_PAD_SIZE
+#error "eth_zc: the DMA writes the frame at the start of the buffer, ETH_PAD_SIZE must be 0"
+#endif
+
+struct eth_zc_rxbuf
+{
+  struct pbuf_custom pc; //first: the pbuf lwIP frees is the buffer
+  struct eth_zc_rxbuf *next; //free list
+  uint8_t data[ETH_ZC_BUF_SIZE]; //word aligned, as the DMA needs
+};
+
+static ETH_HandleTypeDef *eth;
+
+static ETH_DMADescTypeDef rx_desc[ETH_ZC_RX_DESC];
+static struct eth_zc_rxbuf rx_pool[ETH_ZC_RX_BUFS];
+static struct eth_zc_rxbuf *rx_free;
+static struct eth_zc_rxbuf *rx_slot[ETH_ZC_RX_DESC]; //buffer of each descriptor, NULL once in lwIP
+static uint32_t rx_cur, rx_fill;
+static uint32_t rx_held; //buffers in lwIP
+
+static ETH_DMADescTypeDef tx_desc[ETH_ZC_TX_DESC];
+static struct pbuf *tx_frame[ETH_ZC_TX_DESC]; //on the last descriptor of a frame
+static struct pbuf *tx_bounce[ETH_ZC_TX_DESC]; //copy of a pbuf the DMA can't read
+static uint32_t tx_head, tx_tail, tx_used;
+static uint32_t tx_cic; //checksum insertion, as set up by HAL_ETH_DMATxDescListInit
+
+static struct eth_zc_stats stats;
+
+#if ETH_ZC_REPORT_MS
+static void timer_callback_report(void *arg);
+#endif
+
+/*
+ * eth_zc_rx_refill
+ * give a pool buffer to every empty descriptor, then resume the DMA if it
+ * stopped for want of one
+ */
+static void eth_zc_rx_refill(void)
+{
+  struct eth_zc_rxbuf *b;
+  ETH_DMADescTypeDef *d;
+
+  while (rx_slot[rx_fill] == NULL)
+  {
+    b = rx_free;
+    if (b == NULL)
+    {
+      stats.rx_nobuf++;
+      break;
+    }
+    rx_free = b->next;
+    rx_slot[rx_fill] = b;
+
+    d = &rx_desc[rx_fill];
+    d->Buffer1Addr = (uintptr_t)b->data;
+    d->ControlBufferSize = ETH_DMARXDESC_RCH | ETH_ZC_BUF_SIZE;
+    __DMB(); //the buffer before the ownership
+    d->Status = ETH_DMARXDESC_OWN;
+    rx_fill = (rx_fill + 1) % ETH_ZC_RX_DESC;
+  }
+
+  if (eth->Instance->DMASR & ETH_DMASR_RBUS)
+  {
+    eth->Instance->DMASR = ETH_DMASR_RBUS; //clear, and poll the descriptor again
+    eth->Instance->DMARPDR = 0;
+  }
+}
+
+static void eth_zc_rx_release(struct eth_zc_rxbuf *b)
+{
+  b->next = rx_free;
+  rx_free = b;
+}
+
+/*
+ * eth_zc_rx_free
+ * custom pbuf free function: the buffer goes back to the pool, and from
+ * there to the ring
+ */
+static void eth_zc_rx_free(struct pbuf *p)
+{
+  rx_held--;
+  eth_zc_rx_release((struct eth_zc_rxbuf *)p);
+  eth_zc_rx_refill();
+}
+
+/*
+ * eth_zc_tx_reclaim
+ * free the frames the DMA is done with
+ */
+static void eth_zc_tx_reclaim(void)
+{
+  while (tx_used > 0 && !(tx_desc[tx_tail].Status & ETH_DMATXDESC_OWN))
+  {
+    if (tx_bounce[tx_tail] != NULL)
+    {
+      pbuf_free(tx_bounce[tx_tail]);
+      tx_bounce[tx_tail] = NULL;
+    }
+    if (tx_frame[tx_tail] != NULL)
+    {
+      pbuf_free(tx_frame[tx_tail]);
+      tx_frame[tx_tail] = NULL;
+    }
+    tx_tail = (tx_tail + 1) % ETH_ZC_TX_DESC;
+    tx_used--;
+  }
+}
+
+/*
+ * eth_zc_init
+ * after MX_LWIP_Init (ethernetif_init has set up and started the MAC): move
+ * the DMA to the rings of eth_zc and the netif output to eth_zc_output. The
+ * HAL's descriptors stay owned by the DMA, which no longer reads them, so
+ * ethernetif_input finds no frame there.
+ */
+void eth_zc_init(ETH_HandleTypeDef *heth, struct netif *netif)
+{
+  uint32_t i;
+
+  eth = heth;
+  HAL_ETH_Stop(heth); //the list addresses are written with the DMA stopped
+
+  rx_free = NULL;
+  for (i = 0; i < ETH_ZC_RX_BUFS; i++)
+  {
+    rx_pool[i].pc.custom_free_function = eth_zc_rx_free;
+    eth_zc_rx_release(&rx_pool[i]);
+  }
+  for (i = 0; i < ETH_ZC_RX_DESC; i++)
+  {
+    rx_desc[i].Status = 0;
+    rx_desc[i].Buffer2NextDescAddr = (uintptr_t)&rx_desc[(i + 1) % ETH_ZC_RX_DESC];
+    rx_slot[i] = NULL;
+  }
+  rx_cur = 0;
+  rx_fill = 0;
+  rx_held = 0;
+  eth_zc_rx_refill();
+
+  tx_cic = heth->Init.ChecksumMode == ETH_CHECKSUM_BY_HARDWARE ? ETH_DMATXDESC_CIC_TCPUDPICMP_FULL : 0;
+  for (i = 0; i < ETH_ZC_TX_DESC; i++)
+  {
+    tx_desc[i].Status = 0;
+    tx_desc[i].ControlBufferSize = 0;
+    tx_desc[i].Buffer2NextDescAddr = (uintptr_t)&tx_desc[(i + 1) % ETH_ZC_TX_DESC];
+    tx_frame[i] = NULL;
+    tx_bounce[i] = NULL;
+  }
+  tx_head = 0;
+  tx_tail = 0;
+  tx_used = 0;
+
+  memset(&stats, 0, sizeof(stats));
+
+  heth->Instance->DMARDLAR = (uintptr_t)rx_desc;
+  heth->Instance->DMATDLAR = (uintptr_t)tx_desc;
+  netif->linkoutput = eth_zc_output;
+  HAL_ETH_Start(heth);
+
+#if ETH_ZC_REPORT_MS
+  sys_timeout(ETH_ZC_REPORT_MS, timer_callback_report, NULL);
+#endif
+}
+
+/*
+ * eth_zc_input
+ * hand the received frames to lwIP, at most one ring's worth; returns how
+ * many were read
+ */
+uint32_t eth_zc_input(struct netif *netif)
+{
+  struct eth_zc_rxbuf *b;
+  struct pbuf *p;
+  uint32_t status, len, n;
+
+  eth_zc_tx_reclaim();
+
+  for (n = 0; n < ETH_ZC_RX_DESC; n++)
+  {
+    b = rx_slot[rx_cur];
+    if (b == NULL || (rx_desc[rx_cur].Status & ETH_DMARXDESC_OWN))
+    {
+      break;
+    }
+    status = rx_desc[rx_cur].Status;
+    rx_slot[rx_cur] = NULL;
+    rx_cur = (rx_cur + 1) % ETH_ZC_RX_DESC;
+
+    len = (status & ETH_DMARXDESC_FL) >> ETH_DMARXDESC_FRAMELENGTHSHIFT;
+    if ((status & (ETH_DMARXDESC_ES | ETH_DMARXDESC_FS | ETH_DMARXDESC_LS)) != (ETH_DMARXDESC_FS | ETH_DMARXDESC_LS) ||
+        len <= 4)
+    {
+      p = NULL; //error, or a frame over several buffers (longer than the MTU)
+    }
+    else if ((len -= 4) <= ETH_ZC_RX_COPYBREAK) //without the CRC
+    {
+      p = pbuf_alloc(PBUF_RAW, (u16_t)len, PBUF_POOL);
+      if (p != NULL)
+      {
+        pbuf_take(p, b->data, (u16_t)len);
+        stats.rx_copied += len;
+      }
+    }
+    else
+    {
+      p = pbuf_alloced_custom(PBUF_RAW, (u16_t)len, PBUF_REF, &b->pc, b->data, ETH_ZC_BUF_SIZE);
+      b = NULL; //freed with p
+      if (++rx_held > stats.rx_held_max)
+      {
+        stats.rx_held_max = rx_held;
+      }
+    }
+
+    if (b != NULL)
+    {
+      eth_zc_rx_release(b);
+    }
+    if (p == NULL)
+    {
+      stats.rx_dropped++;
+      continue;
+    }
+
+    stats.rx_frames++;
+    stats.rx_bytes += len;
+    if (netif->input(p, netif) != ERR_OK)
+    {
+      pbuf_free(p);
+    }
+  }
+
+  eth_zc_rx_refill();
+  return n;
+}
+
+/*
+ * eth_zc_output
+ * netif linkoutput: queue the pbuf chain p on the transmit ring without
+ * copying it; ERR_USE when the ring is full, like ethernetif.c
+ */
+err_t eth_zc_output(struct netif *netif, struct pbuf *p)
+{
+  struct pbuf *bounce[ETH_ZC_TX_DESC];
+  struct pbuf *frame = p, *q;
+  ETH_DMADescTypeDef *d;
+  uint32_t n = 0, i, first, last = 0, status;
+
+  LWIP_UNUSED_ARG(netif);
+
+  eth_zc_tx_reclaim();
+
+  for (q = p; q != NULL; q = q->next)
+  {
+    n += q->len != 0;
+  }
+  if (n > ETH_ZC_TX_DESC) //longer than the ring: send a copy
+  {
+    frame = pbuf_alloc(PBUF_RAW, p->tot_len, PBUF_RAM);
+    if (frame == NULL)
+    {
+      return ERR_MEM;
+    }
+    pbuf_copy(frame, p);
+    stats.tx_copied += p->tot_len;
+    n = 1;
+  }
+  if (n == 0 || n > ETH_ZC_TX_DESC - tx_used)
+  {
+    stats.tx_busy += n != 0;
+    if (frame != p)
+    {
+      pbuf_free(frame);
+    }
+    return n == 0 ? ERR_OK : ERR_USE;
+  }
+
+  //copy what the DMA can't read, before any descriptor is written
+  for (i = 0, q = frame; q != NULL; q = q->next)
+  {
+    if (q->len == 0)
+    {
+      continue;
+    }
+    bounce[i] = NULL;
+    if (!ETH_ZC_DMA_REACHABLE(q))
+    {
+      bounce[i] = pbuf_alloc(PBUF_RAW, q->len, PBUF_RAM);
+      if (bounce[i] == NULL)
+      {
+        while (i-- > 0)
+        {
+          if (bounce[i] != NULL)
+          {
+            pbuf_free(bounce[i]);
+          }
+        }
+        if (frame != p)
+        {
+          pbuf_free(frame);
+        }
+        return ERR_MEM;
+      }
+      memcpy(bounce[i]->payload, q->payload, q->len);
+      stats.tx_copied += q->len;
+    }
+    i++;
+  }
+
+  first = tx_head;
+  for (i = 0, q = frame; q != NULL; q = q->next)
+  {
+    if (q->len == 0)
+    {
+      continue;
+    }
+    d = &tx_desc[tx_head];
+    d->Buffer1Addr = (uintptr_t)(bounce[i] != NULL ? bounce[i]->payload : q->payload);
+    d->ControlBufferSize = q->len & ETH_DMATXDESC_TBS1;
+    tx_bounce[tx_head] = bounce[i];
+
+    status = ETH_DMATXDESC_TCH | tx_cic;
+    if (i == 0)
+    {
+      status |= ETH_DMATXDESC_FS;
+    }
+    else
+    {
+      status |= ETH_DMATXDESC_OWN; //the first one is handed over last
+    }
+    if (i == n - 1)
+    {
+      status |= ETH_DMATXDESC_LS;
+      last = tx_head;
+    }
+    d->Status = status;
+
+    tx_head = (tx_head + 1) % ETH_ZC_TX_DESC;
+    i++;
+  }
+  tx_used += n;
+
+  if (frame == p)
+  {
+    pbuf_ref(p); //until the DMA has read it
+  }
+  tx_frame[last] = frame;
+
+  __DMB();
+  tx_desc[first].Status |= ETH_DMATXDESC_OWN;
+  __DSB();
+  if (eth->Instance->DMASR & ETH_DMASR_TBUS)
+  {
+    eth->Instance->DMASR = ETH_DMASR_TBUS; //clear, and resume transmission
+    eth->Instance->DMATPDR = 0;
+  }
+
+  stats.tx_frames++;
+  stats.tx_bytes += p->tot_len;
+  stats.tx_segs += n;
+  return ERR_OK;
+}
+
+/*
+ * eth_zc_get_stats
+ * copy the counters (cleared by every [ETHZC] report)
+ */
+void eth_zc_get_stats(struct eth_zc_stats *s)
+{
+  *s = stats;
+}
+
+#if ETH_ZC_REPORT_MS
+/*
+ * timer_callback_report
+ * print the traffic and the bytes copied per frame since the last report
+ */
+static void timer_callback_report(void *arg)
+{
+  LWIP_UNUSED_ARG(arg);
+
+  printf("[ETHZC] rx %lu frames, %lu B copied/frame, %lu dropped, %lu no buffer, %lu held max; tx %lu frames, %lu descriptors, %lu B copied/frame, %lu busy\n\r",
+         (unsigned long)stats.rx_frames, (unsigned long)(stats.rx_frames ? stats.rx_copied / stats.rx_frames : 0),
+         (unsigned long)stats.rx_dropped, (unsigned long)stats.rx_nobuf, (unsigned long)stats.rx_held_max,
+         (unsigned long)stats.tx_frames, (unsigned long)stats.tx_segs,
+         (unsigned long)(stats.tx_frames ? stats.tx_copied / stats.tx_frames : 0), (unsigned long)stats.tx_busy);
+
+  memset(&stats, 0, sizeof(stats));
+  stats.rx_held_max = rx_held;
+  sys_timeout(ETH_ZC_REPORT_MS, timer_callback_report, NULL);
+}
+#endif
@@ -0,0 +1,346 @@
+/*
+ * evloop.c
+ *
+ * See evloop.h. The CubeMX ethernetif.c of this project sets up the ETH in
+ * ETH_RXPOLLING_MODE, so evloop_init enables the DMA receive interrupt
+ * itself; HAL_ETH_RxCpltCallback only stamps the first frame and flags it.
+ * Each event has its own flag, written by one interrupt and cleared by the
+ * loop with PRIMASK set. The core also goes to sleep with PRIMASK set, so an
+ * interrupt between the last check and WFI still wakes it up (it is taken
+ * right after).
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "main.h"
+#include "lwip.h"
+#include "lwip/timeouts.h"
+#include "cycles.h"
+#include "ethernetif.h"
+#include "eth_zc.h"
+#include "evloop.h"
+
+extern struct netif gnetif;
+extern ETH_HandleTypeDef heth; //ethernetif.c
+
+void lwip_link_poll(void); //LWIP/App/lwip.c
+
+static volatile bool rx_pending; //set by the ETH interrupt
+static volatile bool rx_stamped; //rx_stamp holds the first frame not handled yet
+static volatile uint32_t rx_stamp; //DWT cycles
+static volatile bool timer_pending; //set by SysTick at the deadline
+static volatile bool deadline_armed;
+static volatile uint32_t deadline; //HAL tick of the next lwIP timeout
+
+static struct
+{
+  evloop_job_fn fn;
+  void *arg;
+} jobs[EVLOOP_JOBS];
+static volatile uint8_t job_head, job_count;
+
+static struct evloop_stats stats;
+static uint32_t t_awake; //DWT cycles, start of the busy time not accounted yet
+static uint32_t report_tick;
+
+#if EVLOOP_SLEEP
+static void timer_callback_link(void *arg);
+#endif
+#if EVLOOP_REPORT_MS
+static void timer_callback_report(void *arg);
+#endif
+
+static inline uint32_t ev_cycles(void)
+{
+  return DWT->CYCCNT;
+}
+
+/*
+ * evloop_init
+ * enable the ETH receive interrupt and start the loop's lwIP timers, after
+ * MX_LWIP_Init
+ */
+void evloop_init(void)
+{
+  cycles_enable();
+
+  __HAL_ETH_DMA_ENABLE_IT(&heth, ETH_DMA_IT_NIS | ETH_DMA_IT_R);
+  HAL_NVIC_SetPriority(ETH_IRQn, 5, 0);
+  HAL_NVIC_EnableIRQ(ETH_IRQn);
+
+#if EVLOOP_SLEEP
+  sys_timeout(EVLOOP_LINK_MS, timer_callback_link, NULL); //MX_LWIP_Process did it every pass
+#endif
+#if EVLOOP_REPORT_MS
+  sys_timeout(EVLOOP_REPORT_MS, timer_callback_report, NULL);
+#endif
+
+  memset(&stats, 0, sizeof(stats));
+  t_awake = ev_cycles();
+  report_tick = HAL_GetTick();
+}
+
+/*
+ * evloop_post
+ * queue a job for the main loop, from the loop itself or an interrupt;
+ * returns -1 if the queue is full
+ */
+int evloop_post(evloop_job_fn fn, void *arg)
+{
+  uint32_t primask = __get_PRIMASK();
+  int ret = -1;
+
+  __disable_irq();
+  if (job_count < EVLOOP_JOBS)
+  {
+    uint8_t slot = (job_head + job_count) % EVLOOP_JOBS;
+
+    jobs[slot].fn = fn;
+    jobs[slot].arg = arg;
+    job_count++;
+    ret = 0;
+  }
+  __set_PRIMASK(primask);
+
+  return ret;
+}
+
+/*
+ * evloop_tick
+ * from SysTick_Handler, after HAL_IncTick: flag the lwIP timeout deadline
+ */
+void evloop_tick(void)
+{
+  if (deadline_armed && (int32_t)(HAL_GetTick() - deadline) >= 0)
+  {
+    deadline_armed = false;
+    timer_pending = true;
+  }
+}
+
+/*
+ * HAL_ETH_RxCpltCallback
+ * from ETH_IRQHandler, a frame is waiting in the DMA descriptors
+ */
+void HAL_ETH_RxCpltCallback(ETH_HandleTypeDef *heth)
+{
+  LWIP_UNUSED_ARG(heth);
+
+  if (!rx_stamped)
+  {
+    rx_stamp = ev_cycles();
+    rx_stamped = true;
+  }
+  rx_pending = true;
+}
+
+/*
+ * evloop_rx_latency
+ * account the time from the receive interrupt to its handling
+ */
+static void evloop_rx_latency(void)
+{
+  uint32_t lat;
+
+  __disable_irq();
+  if (!rx_stamped)
+  {
+    __enable_irq();
+    return;
+  }
+  lat = ev_cycles() - rx_stamp;
+  rx_stamped = false;
+  __enable_irq();
+
+  if (stats.rx_events == 0 || lat < stats.lat_min)
+  {
+    stats.lat_min = lat;
+  }
+  if (lat > stats.lat_max)
+  {
+    stats.lat_max = lat;
+  }
+  stats.lat_sum += lat;
+  stats.rx_events++;
+}
+
+#if EVLOOP_SLEEP
+/*
+ * evloop_rx
+ * hand the received frames to lwIP, until the DMA owns the next descriptor
+ */
+static void evloop_rx(void)
+{
+  uint32_t n;
+
+  evloop_rx_latency();
+#ifdef ETH_ZC_ENABLE
+  n = eth_zc_input(&gnetif);
+  stats.rx_frames += n;
+  if (n == ETH_ZC_RX_DESC) //let the jobs run, continue on the next pass
+  {
+    rx_pending = true;
+  }
+#else
+  for (n = 0; !(heth.RxDesc->Status & ETH_DMARXDESC_OWN); n++)
+  {
+    if (n == ETH_RXBUFNB) //let the jobs run, continue on the next pass
+    {
+      rx_pending = true;
+      break;
+    }
+    ethernetif_input(&gnetif);
+    stats.rx_frames++;
+  }
+#endif
+}
+
+/*
+ * evloop_sleep
+ * arm the deadline of the next lwIP timeout and wait for an interrupt,
+ * unless there is work already
+ */
+static void evloop_sleep(void)
+{
+  u32_t ms;
+
+  __disable_irq();
+  if (!rx_pending && !timer_pending && job_count == 0)
+  {
+    ms = sys_timeouts_sleeptime();
+    if (ms == 0)
+    {
+      timer_pending = true; //due already
+    }
+    else
+    {
+      deadline = HAL_GetTick() + ms;
+      deadline_armed = ms != 0xffffffff; //0xffffffff: no timeout queued
+      stats.busy += ev_cycles() - t_awake;
+      __DSB();
+      __WFI(); //woken up by any interrupt, masked or not
+      t_awake = ev_cycles();
+    }
+  }
+  __enable_irq(); //the interrupt that woke the core runs here
+}
+#endif
+
+/*
+ * evloop_run_jobs
+ * run the jobs queued so far, not those they queue themselves
+ */
+static void evloop_run_jobs(void)
+{
+  uint8_t n = job_count;
+
+  while (n-- > 0)
+  {
+    evloop_job_fn fn;
+    void *arg;
+
+    __disable_irq();
+    fn = jobs[job_head].fn;
+    arg = jobs[job_head].arg;
+    job_head = (job_head + 1) % EVLOOP_JOBS;
+    job_count--;
+    __enable_irq();
+
+    fn(arg);
+    stats.jobs++;
+  }
+}
+
+/*
+ * evloop_poll
+ * one pass of the main loop: handle the events, run the jobs, then sleep
+ * until the next interrupt
+ */
+void evloop_poll(void)
+{
+  bool rx, timer;
+
+  stats.passes++;
+
+  __disable_irq();
+  rx = rx_pending;
+  rx_pending = false;
+  timer = timer_pending;
+  timer_pending = false;
+  __enable_irq();
+
+#if EVLOOP_SLEEP
+  if (rx)
+  {
+    evloop_rx();
+  }
+  if (timer)
+  {
+    sys_check_timeouts();
+  }
+  evloop_run_jobs();
+  evloop_sleep();
+#else
+  LWIP_UNUSED_ARG(rx);
+  LWIP_UNUSED_ARG(timer);
+  evloop_rx_latency();
+  MX_LWIP_Process(); //input, timers and link, every pass
+  evloop_run_jobs();
+#endif
+}
+
+/*
+ * evloop_get_stats
+ * copy the counters (cleared by every [LOOP] report)
+ */
+void evloop_get_stats(struct evloop_stats *s)
+{
+  *s = stats;
+}
+
+#if EVLOOP_SLEEP
+/*
+ * timer_callback_link
+ * poll the PHY for link changes
+ */
+static void timer_callback_link(void *arg)
+{
+  LWIP_UNUSED_ARG(arg);
+
+  lwip_link_poll();
+  sys_timeout(EVLOOP_LINK_MS, timer_callback_link, NULL);
+}
+#endif
+
+#if EVLOOP_REPORT_MS
+/*
+ * timer_callback_report
+ * print the CPU load and the receive dispatch latency since the last report
+ */
+static void timer_callback_report(void *arg)
+{
+  uint32_t now = HAL_GetTick();
+  uint32_t cyc_us = SystemCoreClock / 1000000;
+  uint64_t span = (uint64_t)(now - report_tick) * (SystemCoreClock / 1000);
+  uint32_t load;
+
+  LWIP_UNUSED_ARG(arg);
+
+  stats.busy += ev_cycles() - t_awake;
+  t_awake = ev_cycles();
+  load = span ? (uint32_t)(stats.busy * 1000 / span) : 0; //per mille
+
+  printf("[LOOP] %s: cpu %lu.%lu%%, %lu passes, %lu rx events (%lu frames), rx dispatch min/avg/max %lu/%lu/%lu us, %lu jobs\n\r",
+         EVLOOP_SLEEP ? "event" : "poll", (unsigned long)(load / 10), (unsigned long)(load % 10),
+         (unsigned long)stats.passes, (unsigned long)stats.rx_events, (unsigned long)stats.rx_frames,
+         (unsigned long)(stats.lat_min / cyc_us),
+         (unsigned long)(stats.rx_events ? stats.lat_sum / stats.rx_events / cyc_us : 0),
+         (unsigned long)(stats.lat_max / cyc_us), (unsigned long)stats.jobs);
+
+  memset(&stats, 0, sizeof(stats));
+  report_tick = now;
+  sys_timeout(EVLOOP_REPORT_MS, timer_callback_report, NULL);
+}
+#endif
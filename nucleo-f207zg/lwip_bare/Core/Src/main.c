@@ -24,6 +24,11 @@
 /* USER CODE BEGIN Includes */
 // HSO
 #include "tcp_client.h"
+#include "udp_sync.h"
+#include "evloop.h"
+#ifdef UARTLOG_ENABLE
+#include "uartlog.h"
+#endif
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -75,9 +80,26 @@ void eth_conn_check(struct netif *netif) {
   }
 }
 
+// HSO: one time request, or one benchmark round
+static void time_job(void *arg) {
+  LWIP_UNUSED_ARG(arg);
+#ifdef TCP_CLIENT_BENCH
+  static int bench_round;
+  // alternate connect-per-request and persistent/pipelined rounds
+  if (app_bench_time((bench_round & 1) ? CLIENT_PERSISTENT : CLIENT_ONESHOT, TCP_CLIENT_BENCH) == 0)
+    bench_round++;
+#else
+  app_start_get_time(); //get time information from the server
+#endif
+}
+
 int __io_putchar(int ch){
+#ifdef UARTLOG_ENABLE
+  return uartlog_putc(ch);	// queued, drained by USART3 TX DMA
+#else
   HAL_UART_Transmit(&huart3, (uint8_t *)&ch, 1, 0xFFFF);
   return ch;
+#endif
 }
 /* USER CODE END 0 */
 
@@ -114,7 +136,22 @@ int main(void)
   MX_LWIP_Init();
   /* USER CODE BEGIN 2 */
   // HSO
+#ifdef UARTLOG_ENABLE
+  // HSO: non-blocking printf, see uartlog.h
+  if (uartlog_init(&huart3) != 0) {
+    static const char msg[] = "uartlog: USART3 TX DMA not configured\r\n";
+    HAL_UART_Transmit(&huart3, (uint8_t *)msg, sizeof(msg) - 1, 0xFFFF);
+  }
+#endif
   eth_conn_check(&gnetif);
+#ifdef UDP_SYNC_ENABLE
+  // HSO: NTP-style clock sync over UDP, see udp_sync.h
+  udp_sync_start();
+#endif
+#ifdef EVLOOP_ENABLE
+  // HSO: interrupt-driven main loop, see evloop.h
+  evloop_init();
+#endif
   /* USER CODE END 2 */
 
   /* Infinite loop */
@@ -124,11 +161,19 @@ int main(void)
     /* USER CODE END WHILE */
     /* USER CODE BEGIN 3 */
 	// HSO
+#ifdef EVLOOP_ENABLE
+	evloop_poll(); // returns once woken up (at least every SysTick)
+#else
 	MX_LWIP_Process();
+#endif
 #if 1
 	if (timeFlag) {
 	  timeFlag = false;
-	  app_start_get_time(); //get time information from the server
+#ifdef EVLOOP_ENABLE
+	  evloop_post(time_job, NULL);
+#else
+	  time_job(NULL);
+#endif
 	}
 #endif
   }
@@ -24,6 +24,7 @@
 /* USER CODE BEGIN Includes */
 // HSO
 #include <stdbool.h>
+#include "evloop.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -61,7 +62,8 @@ uint32_t timeCounter = 0;
 /* External variables --------------------------------------------------------*/
 
 /* USER CODE BEGIN EV */
-
+// HSO
+extern ETH_HandleTypeDef heth; //ethernetif.c
 /* USER CODE END EV */
 
 /******************************************************************************/
@@ -198,6 +200,9 @@ void SysTick_Handler(void)
     timeFlag = true;
     timeCounter = 0;
   }
+#ifdef EVLOOP_ENABLE
+  evloop_tick(); // lwIP timeout deadline
+#endif
   /* USER CODE END SysTick_IRQn 1 */
 }
 
@@ -209,5 +214,14 @@ void SysTick_Handler(void)
 /******************************************************************************/
 
 /* USER CODE BEGIN 1 */
-
+// HSO
+#ifdef EVLOOP_ENABLE
+/**
+  * @brief This function handles Ethernet global interrupt (enabled by evloop_init).
+  */
+void ETH_IRQHandler(void)
+{
+  HAL_ETH_IRQHandler(&heth);
+}
+#endif
 /* USER CODE END 1 */
@@ -3,17 +3,91 @@
  *
  *  Created on: 27 de abr de 2023
  *      Author: henrique
+ *
+ * Time client on the lwIP raw API. In CLIENT_PERSISTENT mode one connection
+ * stays open and up to CLIENT_PIPELINE requests are in flight, each tagged
+ * with a sequence number that the server echoes. Lost connections are
+ * re-established with exponential backoff and the unanswered requests are
+ * sent again. CLIENT_ONESHOT keeps the original connect-per-request behavior
+ * for comparison (see app_bench_time).
+ *
+ * Protocol v2 (tcp_client.h) is negotiated with a HELLO on the first
+ * connection. A server that answers it with a v1 packet, or closes the
+ * connection once it has taken it, is v1-only, and the client falls back to
+ * 256-byte packets for good. A timeout, a reset or a link drop before the
+ * answer says nothing of the server: the next connection sends the HELLO
+ * again.
+ *
+ * Requests are built from const templates, which stay in flash. Only the
+ * fields that change (sequence number, v2 flags) are copied by tcp_write;
+ * the constant 244-byte tail of a v1 request and the HELLO are referenced
+ * by PBUF_ROM pbufs, so nothing in RAM can change under a segment waiting
+ * for retransmission.
  */
 
+#include <stddef.h>
+#include <stdio.h>
 
+#include "main.h"
+#include "lwip/timeouts.h"
+#include "cycles.h"
 #include "tcp_client.h"
 
 static struct tcp_pcb *pcb_client; //client pcb
 static ip_addr_t server_addr; //server ip
 
-struct time_packet packet; //256 bytes time_packet structure
-uint16_t nRead = 0; //read buffer index
-uint16_t nWritten = 0; //write buffer index
+/* request templates (flash) */
+static const struct time_packet req_v1 = {.head = 0xAE, .type = REQ, .tail = 0xEA};
+static const struct tp2_hdr req_v2 = {.magic = TP2_MAGIC, .ver_type = (TP2_VERSION << 4) | TP2_REQ};
+static const struct tp2_hdr req_hello =
+{
+  .magic = TP2_MAGIC,
+  .ver_type = (CLIENT_PROTO << 4) | TP2_HELLO,
+  .flags = CLIENT_USEC ? TP2_F_USEC : 0
+};
+
+#define REQ_V1_HDR offsetof(struct time_packet, dummy) //copied part of a v1 request, up to seq
+
+typedef enum
+{
+  CLIENT_IDLE = 0, //no connection, nothing to do
+  CLIENT_CONNECTING,
+  CLIENT_CONNECTED,
+  CLIENT_BACKOFF //waiting to reconnect
+} client_state;
+
+static struct
+{
+  client_mode mode;
+  client_state state;
+  uint32_t next_seq; //sequence number of the next request
+  uint16_t pending; //requests not sent yet
+  uint16_t n_out; //requests sent and not answered yet
+  uint16_t out_head; //oldest outstanding request
+  struct
+  {
+    uint32_t seq;
+    uint32_t t_sent; //DWT cycles
+  } out[CLIENT_PIPELINE];
+  union
+  {
+    struct time_packet v1;
+    uint8_t v2[sizeof(struct tp2_hdr) + TP2_BODY_MAX];
+  } rx; //response being reassembled
+  uint16_t nRead; //bytes of rx received so far
+  uint8_t proto; //protocol version in use
+  bool proto_known; //negotiated with the server, new connections skip the HELLO
+  bool hello_out; //HELLO sent and not answered yet
+  bool hello_acked; //the server's stack has taken the HELLO
+  uint32_t t_hello; //DWT cycles
+  uint8_t features; //TP2_F_* granted by the server
+  bool tx_broken; //a request went out truncated, nothing more is sent on this connection
+  uint32_t backoff_ms;
+  bool verbose; //print every received time
+  uint16_t bench_n; //requests of the running benchmark, 0 if none
+  uint32_t bench_start; //HAL tick
+  struct client_stats stats;
+} client;
 
 /* callback functions */
 static err_t tcp_callback_connected(void *arg, struct tcp_pcb *pcb_new, err_t err);
@@ -21,19 +95,110 @@ static err_t tcp_callback_sent(void *arg, struct tcp_pcb *tpcb, u16_t len);
 static err_t tcp_callback_received(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err);
 static err_t tcp_callback_poll(void *arg, struct tcp_pcb *tpcb);
 static void tcp_callback_error(void *arg, err_t err);
+static void timer_callback_retry(void *arg);
 
 /* functions */
+static void app_request(uint16_t n); //queue requests
 static void app_open_conn(void); //open function
-static void app_close_conn(void); //close function
+static err_t app_close_conn(void); //close function
+static void app_conn_lost(void); //schedule a reconnection
+static err_t app_send_hello(void); //offer protocol v2
 static void app_send_data(void); //send function
+static uint16_t app_rx_need(void); //size of the response being reassembled
+static int app_handle_response(void); //check a complete response
+static int app_handle_hello(const struct tp2_hdr *hdr); //negotiation result
+static void app_proto_v1(void); //v1-only server
+
+static inline uint32_t app_cycles(void)
+{
+  return DWT->CYCCNT;
+}
+
+static inline uint32_t app_get_u32(const uint8_t *b)
+{
+  return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static inline void app_put_u32(uint8_t *b, uint32_t v)
+{
+  b[0] = (uint8_t)v;
+  b[1] = (uint8_t)(v >> 8);
+  b[2] = (uint8_t)(v >> 16);
+  b[3] = (uint8_t)(v >> 24);
+}
+
+static inline uint16_t app_depth(void)
+{
+  return client.mode == CLIENT_PERSISTENT ? CLIENT_PIPELINE : 1;
+}
 
 /*
  * app_start_get_time
- * initiate process (tcp_connect => tcp_callback_connected => tcp_write => tcp_callback_received => tcp_close)
+ * request one time sample from the server and print it
  */
 void app_start_get_time(void)
 {
-  app_open_conn();
+  client.verbose = true;
+  app_request(1);
+}
+
+/*
+ * app_bench_time
+ * send n requests in the given mode and print throughput and latency when
+ * all of them are answered; returns -1 if the client is busy
+ */
+int app_bench_time(client_mode mode, uint16_t n)
+{
+  if (client.bench_n != 0 || client.pending != 0 || client.n_out != 0)
+  {
+    return -1;
+  }
+
+  memset(&client.stats, 0, sizeof(client.stats));
+#if MEM_STATS && MEMP_STATS
+  lwip_stats.mem.max = lwip_stats.mem.used; //peaks of this benchmark
+  lwip_stats.memp[MEMP_PBUF]->max = lwip_stats.memp[MEMP_PBUF]->used;
+  lwip_stats.memp[MEMP_TCP_SEG]->max = lwip_stats.memp[MEMP_TCP_SEG]->used;
+#endif
+  client.mode = mode;
+  client.verbose = false;
+  client.bench_n = n;
+  client.bench_start = HAL_GetTick();
+  app_request(n);
+  return 0;
+}
+
+/*
+ * app_get_stats
+ * copy the counters (cleared when a benchmark starts)
+ */
+void app_get_stats(struct client_stats *stats)
+{
+  *stats = client.stats;
+}
+
+/*
+ * app_request
+ * queue n requests, connecting first if needed
+ */
+static void app_request(uint16_t n)
+{
+  cycles_enable();
+  if (client.proto == 0)
+  {
+    client.proto = CLIENT_PROTO;
+  }
+
+  client.pending += n;
+
+  if (client.state == CLIENT_IDLE)
+  {
+    app_open_conn();
+  }
+  else if (client.state == CLIENT_CONNECTED)
+  {
+    app_send_data();
+  }
 }
 
 /*
@@ -44,29 +209,30 @@ static void app_open_conn(void)
 {
   err_t err;
 
-  if (pcb_client == NULL)
+  pcb_client = tcp_new();
+  if (pcb_client == NULL) //lack of memory
   {
-    pcb_client = tcp_new();
-    if (pcb_client == NULL) //lack of memory
-    {
-      memp_free(MEMP_TCP_PCB, pcb_client);
-      pcb_client = NULL;
-      HAL_GPIO_WritePin(LD3_GPIO_Port, LD3_Pin, GPIO_PIN_SET); // error led
-    }
+    HAL_GPIO_WritePin(LD3_GPIO_Port, LD3_Pin, GPIO_PIN_SET); // error led
+    app_conn_lost();
+    return;
   }
 
+  tcp_arg(pcb_client, NULL); //no argument is used
+  tcp_err(pcb_client, tcp_callback_error); //register error callback first, connect errors land there
+
   IP4_ADDR(&server_addr, SERVER_IP1, SERVER_IP2, SERVER_IP3, SERVER_IP4); //server ip
   err = tcp_connect(pcb_client, &server_addr, SERVER_PORT, tcp_callback_connected); //connect
-
-  if(err == ERR_ISCONN) //already connected
+  if (err != ERR_OK)
   {
-    app_close_conn();
+    tcp_abort(pcb_client); //calls tcp_callback_error, which schedules the retry
+    return;
   }
+  client.state = CLIENT_CONNECTING;
 }
 
 /*
  * tcp_callback_connected
- * callback when connected, client sends a request to the server
+ * callback when connected, client sends the queued requests
  */
 static err_t tcp_callback_connected(void *arg, struct tcp_pcb *pcb_new, err_t err)
 {
@@ -78,37 +244,131 @@ static err_t tcp_callback_connected(void *arg, struct tcp_pcb *pcb_new, err_t er
   }
 
   tcp_setprio(pcb_new, TCP_PRIO_NORMAL); //set priority for the client pcb
+  tcp_nagle_disable(pcb_new); //don't hold pipelined requests back until the previous one is ACKed
 
-  tcp_arg(pcb_new, 0); //no argument is used
   tcp_sent(pcb_new, tcp_callback_sent); //register send callback
   tcp_recv(pcb_new, tcp_callback_received);  //register receive callback
-  tcp_err(pcb_new, tcp_callback_error); //register error callback
-  tcp_poll(pcb_new, tcp_callback_poll, 0); //register poll callback
+  tcp_poll(pcb_new, tcp_callback_poll, 2); //register poll callback, every second
 
-  app_send_data(); //send a request
+  client.state = CLIENT_CONNECTED;
+  client.backoff_ms = CLIENT_BACKOFF_MIN_MS;
+  client.nRead = 0;
+  client.tx_broken = false;
+  client.stats.connects++;
+
+  if (client.proto >= 2 && !client.proto_known && app_send_hello() != ERR_OK)
+  {
+    tcp_abort(pcb_new); //calls tcp_callback_error
+    return ERR_ABRT;
+  }
+  app_send_data(); //send the queued requests
 
   return ERR_OK;
 }
 
+/*
+ * app_send_hello
+ * offer CLIENT_PROTO, requests wait for the answer
+ */
+static err_t app_send_hello(void)
+{
+  err_t err;
+
+  err = tcp_write(pcb_client, &req_hello, sizeof(struct tp2_hdr), 0); //constant, referenced in flash
+  if (err != ERR_OK)
+  {
+    return err;
+  }
+  client.hello_out = true;
+  client.hello_acked = false;
+  client.t_hello = app_cycles();
+  client.stats.bytes_tx += sizeof(struct tp2_hdr);
+
+  return ERR_OK; //flushed by app_send_data
+}
+
 /*
  * app_send_data
- * send the request to the server
+ * send queued requests while the pipeline and the send buffer have room
  */
 static void app_send_data(void)
 {
-  memset(&packet, 0, sizeof(struct time_packet));
-  packet.head = 0xAE; //head
-  packet.type = REQ; //request type
-  packet.tail = 0xEA; //tail
+  uint8_t hdr[REQ_V1_HDR]; //per-request fields, copied
+  uint16_t hdr_len = client.proto >= 2 ? sizeof(struct tp2_hdr) : REQ_V1_HDR;
+  uint16_t size = client.proto >= 2 ? sizeof(struct tp2_hdr) : sizeof(struct time_packet);
+  uint16_t n_pbuf = client.proto >= 2 ? 1 : 2; //pbufs queued per request
+  bool queued = client.hello_out; //a fresh HELLO still needs tcp_output
+
+  if (client.tx_broken) //the next request would follow a truncated one
+  {
+    return;
+  }
+
+  //both pbufs of a v1 request are reserved here, so its tail only fails if the pools run out
+  while (!client.hello_out && client.pending > 0 && client.n_out < app_depth() &&
+         tcp_sndbuf(pcb_client) >= size && tcp_sndqueuelen(pcb_client) + n_pbuf <= TCP_SND_QUEUELEN)
+  {
+    uint32_t seq = client.next_seq;
+    uint16_t slot = (client.out_head + client.n_out) % CLIENT_PIPELINE;
+    bool last = client.pending == 1 || client.n_out + 1 == app_depth(); //of this batch
+    bool partial = false;
+
+    if (client.proto >= 2)
+    {
+      struct tp2_hdr *h = (struct tp2_hdr *)hdr;
+
+      memcpy(h, &req_v2, sizeof(struct tp2_hdr));
+      h->flags = client.features;
+      app_put_u32(h->seq, seq);
+    }
+    else
+    {
+      memcpy(hdr, &req_v1, REQ_V1_HDR);
+      app_put_u32(hdr + offsetof(struct time_packet, seq), seq);
+    }
+
+    //no TCP_WRITE_FLAG_MORE on a copy: lwIP would allocate it a full MSS to append to
+    if (tcp_write(pcb_client, hdr, hdr_len, TCP_WRITE_FLAG_COPY) != ERR_OK)
+    {
+      break; //out of pbufs/segments, retried from tcp_callback_sent
+    }
+    if (client.proto < 2)
+    {
+      //the rest of the template, chained to the header in the same segment
+      partial = tcp_write(pcb_client, (const uint8_t *)&req_v1 + REQ_V1_HDR, size - REQ_V1_HDR,
+                          last ? 0 : TCP_WRITE_FLAG_MORE) != ERR_OK;
+    }
+
+    //a partial request stays outstanding, tcp_callback_poll resets the connection
+    client.out[slot].seq = seq;
+    client.out[slot].t_sent = app_cycles();
+    client.next_seq++;
+    client.n_out++;
+    client.pending--;
+    client.stats.requests++;
+    client.stats.bytes_tx += size;
+    client.stats.bytes_copied += hdr_len;
+    queued = true;
+    if (partial)
+    {
+      client.tx_broken = true; //counted as an error by tcp_callback_poll
+      break;
+    }
+  }
 
-  nWritten = 0; //clear index
-  //tcp_write(pcb_client, &packet,sizeof(struct time_packet), TCP_WRITE_FLAG_COPY); //use copied data
-  tcp_write(pcb_client, &packet,sizeof(struct time_packet), 0); //use pointer, should not changed until receive ACK
+  if (queued)
+  {
+    if (tcp_sndqueuelen(pcb_client) > client.stats.queue_max)
+    {
+      client.stats.queue_max = tcp_sndqueuelen(pcb_client);
+    }
+    tcp_output(pcb_client); //flush
+  }
 }
 
 /*
  * tcp_callback_sent
- * callback when data sending is finished, control leds
+ * callback when sent data is acknowledged, there may be room for more requests
  */
 static err_t tcp_callback_sent(void *arg, struct tcp_pcb *tpcb, u16_t len)
 {
@@ -116,82 +376,296 @@ static err_t tcp_callback_sent(void *arg, struct tcp_pcb *tpcb, u16_t len)
   LWIP_UNUSED_ARG(tpcb);
   LWIP_UNUSED_ARG(len);
 
-  nWritten += len;
-
-  if(nWritten < sizeof(struct time_packet)) //need to flush remain data
+  if (client.hello_out) //the requests wait: this acknowledges the HELLO
   {
-    tcp_output(pcb_client); //flush
-  }
-  else if(nWritten > sizeof(struct time_packet)) //invalid length of sent data
-  {
-    HAL_GPIO_WritePin(LD3_GPIO_Port, LD3_Pin, GPIO_PIN_SET); // error led
-    app_close_conn();
-  }
-  else
-  {
-    HAL_GPIO_TogglePin(LD1_GPIO_Port, LD1_Pin); // blink green when sent OK
+    client.hello_acked = true;
   }
+  HAL_GPIO_TogglePin(LD1_GPIO_Port, LD1_Pin); // blink green when sent OK
+  app_send_data();
 
   return ERR_OK;
 }
 
 /*
  * tcp_callback_received
- * callback when data is received, validate received data and parse it
+ * callback when data is received, reassemble responses across the pbuf chain
  */
 static err_t tcp_callback_received(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
 {
-  err_t ret_err;
+  struct pbuf *q;
+  err_t ret_err = ERR_OK;
+
+  LWIP_UNUSED_ARG(arg);
 
   if (p == NULL) //pbuf is null when session is closed
   {
-    app_close_conn();
-    ret_err = ERR_OK;
+    if (client.hello_out && client.hello_acked) //closed once it took the HELLO
+    {
+      app_proto_v1();
+    }
+    ret_err = app_close_conn();
+    if (client.pending + client.n_out > 0) //closed with work left
+    {
+      app_conn_lost();
+    }
+    return ret_err;
   }
-  else if (err != ERR_OK) //ERR_ABRT is returned when called tcp_abort
+
+  if (err != ERR_OK) //ERR_ABRT is returned when called tcp_abort
   {
     tcp_recved(tpcb, p->tot_len); //advertise window size
-
     pbuf_free(p); //free pbuf
-    ret_err = err;
+    return err;
+  }
+
+  for (q = p; q != NULL && pcb_client == tpcb; q = q->next)
+  {
+    const uint8_t *src = q->payload;
+    uint16_t len = q->len;
+
+    while (len > 0)
+    {
+      uint16_t need = app_rx_need();
+      uint16_t n = need - client.nRead;
+
+      if (n > len)
+      {
+        n = len;
+      }
+      memcpy((uint8_t *)&client.rx + client.nRead, src, n);
+      client.nRead += n;
+      src += n;
+      len -= n;
+
+      if (client.nRead == need)
+      {
+        if (app_rx_need() > need) //v2 header complete, the body follows
+        {
+          continue;
+        }
+        client.stats.bytes_rx += need;
+        client.nRead = 0;
+        if (app_handle_response() != 0) //out of sync, start over
+        {
+          client.stats.errors++;
+          HAL_GPIO_WritePin(LD3_GPIO_Port, LD3_Pin, GPIO_PIN_SET); // error led
+          ret_err = app_close_conn();
+          app_conn_lost();
+        }
+        if (pcb_client != tpcb) //connection was reset
+        {
+          break;
+        }
+      }
+    }
   }
-  else //receiving data
+
+  if (pcb_client == tpcb)
   {
-	printf(">>> Packet received\n\r");
     tcp_recved(tpcb, p->tot_len); //advertise window size
 
-    memcpy(&packet + nRead, p->payload, p->len);
-    nRead += p->len;
+    if (client.mode == CLIENT_ONESHOT && client.n_out == 0) //one request per connection
+    {
+      ret_err = app_close_conn();
+      if (client.pending > 0)
+      {
+        app_open_conn();
+      }
+    }
+  }
+  pbuf_free(p); //free pbuf
+
+  return ret_err;
+}
+
+/*
+ * app_rx_need
+ * bytes of the frame in client.rx: fixed in v1, header + body in v2
+ */
+static uint16_t app_rx_need(void)
+{
+  const struct tp2_hdr *hdr = (const struct tp2_hdr *)client.rx.v2;
+
+  if (client.proto < 2)
+  {
+    return sizeof(struct time_packet);
+  }
+  if (client.nRead < sizeof(struct tp2_hdr) || hdr->magic != TP2_MAGIC || hdr->len > TP2_BODY_MAX)
+  {
+    return sizeof(struct tp2_hdr); //a bad header is rejected by app_handle_response
+  }
+  return sizeof(struct tp2_hdr) + hdr->len;
+}
 
-    if(nRead == sizeof(struct time_packet) && packet.type == RESP) //if received length is valid
+/*
+ * app_handle_hello
+ * the server picked a version and features, release the queued requests
+ */
+static int app_handle_hello(const struct tp2_hdr *hdr)
+{
+  uint8_t ver = hdr->ver_type >> 4;
+
+  if (!client.hello_out || ver < 1)
+  {
+    return -1;
+  }
+
+  client.hello_out = false;
+  client.proto_known = true;
+  client.proto = ver < CLIENT_PROTO ? ver : CLIENT_PROTO;
+  client.features = hdr->flags & (CLIENT_USEC ? TP2_F_USEC : 0);
+  client.stats.proto = client.proto;
+
+  app_send_data();
+  return 0;
+}
+
+/*
+ * app_proto_v1
+ * the server is v1-only: 256-byte packets from the next connection on
+ */
+static void app_proto_v1(void)
+{
+  client.hello_out = false;
+  client.proto = 1;
+  client.proto_known = true;
+  client.stats.proto = 1;
+  client.backoff_ms = 0; //not a failure, don't escalate the backoff
+}
+
+/*
+ * app_handle_response
+ * validate the complete response in client.rx against the oldest request
+ */
+static int app_handle_response(void)
+{
+  const uint8_t *t; //year, month, day, hour, minute, second
+  uint32_t seq, lat, usec = 0;
+  bool has_usec = false;
+
+  if (client.proto < 2)
+  {
+    struct time_packet *packet = &client.rx.v1;
+
+    if (packet->head != 0xAE || packet->tail != 0xEA || packet->type != RESP)
     {
-      nRead = 0;
+      return -1;
+    }
+    seq = app_get_u32(packet->seq);
+    t = &packet->year;
+  }
+  else
+  {
+    const struct tp2_hdr *hdr = (const struct tp2_hdr *)client.rx.v2;
+    const struct tp2_resp *resp = (const struct tp2_resp *)(hdr + 1);
 
-      printf("%04d-%02d-%02d %02d:%02d:%02d\n",
-             packet.year + 2000,
-             packet.month, packet.day, packet.hour, packet.minute, packet.second); //print time information
+    if (hdr->magic != TP2_MAGIC)
+    {
+      if (client.hello_out && client.rx.v2[0] == 0xAE) //a v1 packet for an answer
+      {
+        app_proto_v1();
+      }
+      return -1;
+    }
+    if ((hdr->ver_type & 0x0F) == TP2_HELLO)
+    {
+      return app_handle_hello(hdr);
+    }
+    if (hdr->ver_type != ((TP2_VERSION << 4) | TP2_RESP) || hdr->len < offsetof(struct tp2_resp, usec))
+    {
+      return -1;
+    }
+    seq = app_get_u32(hdr->seq);
+    t = &resp->year;
+    if ((hdr->flags & TP2_F_USEC) && hdr->len >= sizeof(struct tp2_resp))
+    {
+      usec = app_get_u32(resp->usec);
+      has_usec = true;
+    }
+  }
+
+  if (client.n_out == 0 || seq != client.out[client.out_head].seq) //the server answers in order
+  {
+    return -1;
+  }
 
-      app_close_conn(); //close connection
+  lat = app_cycles() - client.out[client.out_head].t_sent;
+  if (client.stats.responses == 0 || lat < client.stats.lat_min)
+  {
+    client.stats.lat_min = lat;
+  }
+  if (lat > client.stats.lat_max)
+  {
+    client.stats.lat_max = lat;
+  }
+  client.stats.lat_sum += lat;
+  client.stats.responses++;
+  client.stats.proto = client.proto;
+
+  client.out_head = (client.out_head + 1) % CLIENT_PIPELINE;
+  client.n_out--;
+
+  if (client.verbose)
+  {
+    if (has_usec)
+    {
+      printf("%04d-%02d-%02d %02d:%02d:%02d.%06lu (seq %lu)\n\r",
+             t[0] + 2000, t[1], t[2], t[3], t[4], t[5],
+             (unsigned long)usec, (unsigned long)seq); //print time information
     }
-    else if(nRead > sizeof(struct time_packet))
+    else
     {
-      nRead = 0;
-      app_close_conn(); //close connection
+      printf("%04d-%02d-%02d %02d:%02d:%02d (seq %lu)\n\r",
+             t[0] + 2000, t[1], t[2], t[3], t[4], t[5],
+             (unsigned long)seq); //print time information
     }
+  }
 
-    pbuf_free(p); //free pbuf
-    ret_err = ERR_OK;
+  if (client.bench_n != 0 && client.stats.responses == client.bench_n)
+  {
+    uint32_t ms = HAL_GetTick() - client.bench_start;
+    uint32_t cyc_us = SystemCoreClock / 1000000;
+
+    printf("[BENCH] %s v%u: %lu requests in %lu ms, %lu req/s, latency min/avg/max %lu/%lu/%lu us, %lu B/sample, %lu connects, %lu errors\n\r",
+           client.mode == CLIENT_PERSISTENT ? "persistent" : "connect-per-request", client.proto,
+           (unsigned long)client.bench_n, (unsigned long)ms,
+           (unsigned long)(ms ? 1000UL * client.bench_n / ms : 0),
+           (unsigned long)(client.stats.lat_min / cyc_us),
+           (unsigned long)(client.stats.lat_sum / client.stats.responses / cyc_us),
+           (unsigned long)(client.stats.lat_max / cyc_us),
+           (unsigned long)((client.stats.bytes_tx + client.stats.bytes_rx) / client.stats.responses),
+           (unsigned long)client.stats.connects, (unsigned long)client.stats.errors);
+    printf("[BENCH] tx: %lu B copied/request, %u pbufs queued max",
+           (unsigned long)(client.stats.bytes_copied / client.stats.requests), client.stats.queue_max);
+#if MEM_STATS && MEMP_STATS
+    printf(", heap peak %lu B, PBUF_ROM/REF peak %u, segments peak %u",
+           (unsigned long)lwip_stats.mem.max, lwip_stats.memp[MEMP_PBUF]->max, lwip_stats.memp[MEMP_TCP_SEG]->max);
+#endif
+    printf("\n\r");
+    client.bench_n = 0;
   }
 
-  return ret_err;
+  if (client.mode == CLIENT_PERSISTENT)
+  {
+    app_send_data(); //refill the pipeline
+  }
+
+  return 0;
 }
 
 /*
  * app_close_conn
- * close connection & clear callbacks
+ * close connection & clear callbacks, returns ERR_ABRT if it had to abort
  */
-static void app_close_conn(void)
+static err_t app_close_conn(void)
 {
+  err_t err = ERR_OK;
+
+  if (pcb_client == NULL)
+  {
+    return ERR_OK;
+  }
+
   /* clear callback functions */
   tcp_arg(pcb_client, NULL);
   tcp_sent(pcb_client, NULL);
@@ -199,15 +673,63 @@ static void app_close_conn(void)
   tcp_err(pcb_client, NULL);
   tcp_poll(pcb_client, NULL, 0);
 
-  tcp_close(pcb_client);    //close connection
+  if (tcp_close(pcb_client) != ERR_OK) //close connection
+  {
+    tcp_abort(pcb_client); //out of memory for the FIN
+    err = ERR_ABRT;
+  }
   pcb_client = NULL;
+  client.state = CLIENT_IDLE;
+  client.nRead = 0;
+
+  return err;
+}
 
+/*
+ * app_conn_lost
+ * requeue unanswered requests and reconnect after the backoff delay
+ */
+static void app_conn_lost(void)
+{
+  client.hello_out = false; //unanswered: the next connection sends it again
+  client.pending += client.n_out;
+  client.n_out = 0;
+  client.out_head = 0;
+  client.nRead = 0;
+  client.stats.reconnects++;
+
+  if (client.backoff_ms < CLIENT_BACKOFF_MIN_MS)
+  {
+    client.backoff_ms = CLIENT_BACKOFF_MIN_MS;
+  }
+  client.state = CLIENT_BACKOFF;
+  sys_timeout(client.backoff_ms, timer_callback_retry, NULL);
 
+  client.backoff_ms *= 2;
+  if (client.backoff_ms > CLIENT_BACKOFF_MAX_MS)
+  {
+    client.backoff_ms = CLIENT_BACKOFF_MAX_MS;
+  }
+}
+
+/*
+ * timer_callback_retry
+ * backoff expired, reconnect if there is still work
+ */
+static void timer_callback_retry(void *arg)
+{
+  LWIP_UNUSED_ARG(arg);
+
+  client.state = CLIENT_IDLE;
+  if (client.pending > 0)
+  {
+    app_open_conn();
+  }
 }
 
 /*
  *  error callback
- *  call when there's an error, turn on an error led
+ *  call when there's an error (the pcb is already freed), turn on an error led
  */
 static void tcp_callback_error(void *arg, err_t err)
 {
@@ -215,13 +737,29 @@ static void tcp_callback_error(void *arg, err_t err)
   LWIP_UNUSED_ARG(err);
 
   HAL_GPIO_WritePin(LD3_GPIO_Port, LD3_Pin, GPIO_PIN_SET); // error LED
+  pcb_client = NULL;
+  app_conn_lost();
 }
 
 /*
  * poll callback
- * called when lwip is idle, do something such as watchdog reset
+ * called every second while connected, reset the connection on a late response
+ * or after a truncated request
  */
 static err_t tcp_callback_poll(void *arg, struct tcp_pcb *tpcb)
 {
+  LWIP_UNUSED_ARG(arg);
+
+  uint32_t timeout = (SystemCoreClock / 1000) * CLIENT_RESP_TIMEOUT_MS;
+
+  if (client.tx_broken ||
+      (client.n_out > 0 && app_cycles() - client.out[client.out_head].t_sent > timeout) ||
+      (client.hello_out && app_cycles() - client.t_hello > timeout))
+  {
+    client.stats.errors++;
+    tcp_abort(tpcb); //calls tcp_callback_error
+    return ERR_ABRT;
+  }
+
   return ERR_OK;
 }
@@ -0,0 +1,181 @@
+/*
+ * udp_sync.c
+ *
+ * TP2_SYNC client on the lwIP raw API. One request is in flight at a time:
+ * T1 is taken right before udp_send and T4 first thing in the receive
+ * callback, the server fills in T2 and T3. A response that doesn't match the
+ * request in flight (late, duplicated) is dropped, a missing one is counted
+ * as lost when the next period starts.
+ */
+
+#include <stdio.h>
+
+#include "main.h"
+#include "lwip/timeouts.h"
+#include "lwip/udp.h"
+#include "tcp_client.h" //server address and TP2 framing
+#include "udp_sync.h"
+
+static struct udp_pcb *pcb_sync;
+
+static struct
+{
+  uint32_t seq; //of the request in flight
+  uint64_t t1;
+  bool waiting;
+  struct udp_sync_stats stats;
+} sync;
+
+static void udp_callback_received(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port);
+static void timer_callback_sync(void *arg);
+
+static inline uint32_t sync_get_u32(const uint8_t *b)
+{
+  return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static inline uint64_t sync_get_u64(const uint8_t *b)
+{
+  return sync_get_u32(b) | ((uint64_t)sync_get_u32(b + 4) << 32);
+}
+
+static inline void sync_put_u32(uint8_t *b, uint32_t v)
+{
+  b[0] = (uint8_t)v;
+  b[1] = (uint8_t)(v >> 8);
+  b[2] = (uint8_t)(v >> 16);
+  b[3] = (uint8_t)(v >> 24);
+}
+
+/*
+ * udp_sync_start
+ * open the UDP pcb and start polling the server, returns -1 without memory
+ */
+int udp_sync_start(void)
+{
+  ip_addr_t server_addr;
+
+  if (pcb_sync != NULL)
+  {
+    return 0;
+  }
+
+  clock_sync_init();
+
+  pcb_sync = udp_new();
+  if (pcb_sync == NULL) //lack of memory
+  {
+    HAL_GPIO_WritePin(LD3_GPIO_Port, LD3_Pin, GPIO_PIN_SET); // error led
+    return -1;
+  }
+
+  IP4_ADDR(&server_addr, SERVER_IP1, SERVER_IP2, SERVER_IP3, SERVER_IP4); //server ip
+  if (udp_connect(pcb_sync, &server_addr, SERVER_PORT) != ERR_OK) //only the server's datagrams get through
+  {
+    udp_remove(pcb_sync);
+    pcb_sync = NULL;
+    return -1;
+  }
+  udp_recv(pcb_sync, udp_callback_received, NULL);
+
+  timer_callback_sync(NULL); //first exchange right away
+  return 0;
+}
+
+/*
+ * udp_sync_get_stats
+ * copy the exchange counters (clock_sync_get has the clock state)
+ */
+void udp_sync_get_stats(struct udp_sync_stats *stats)
+{
+  *stats = sync.stats;
+}
+
+/*
+ * timer_callback_sync
+ * every SYNC_PERIOD_MS: send the next request (which also keeps the local
+ * clock ahead of the cycle counter wrap)
+ */
+static void timer_callback_sync(void *arg)
+{
+  struct pbuf *p;
+  struct tp2_hdr *hdr;
+
+  LWIP_UNUSED_ARG(arg);
+
+  sys_timeout(SYNC_PERIOD_MS, timer_callback_sync, NULL);
+
+  if (sync.waiting)
+  {
+    sync.stats.lost++;
+    sync.waiting = false;
+  }
+
+  p = pbuf_alloc(PBUF_TRANSPORT, sizeof(struct tp2_hdr) + sizeof(((struct tp2_sync *)0)->t1), PBUF_RAM);
+  if (p == NULL)
+  {
+    return; //try again next period
+  }
+
+  hdr = (struct tp2_hdr *)p->payload;
+  memset(hdr, 0, p->len);
+  hdr->magic = TP2_MAGIC;
+  hdr->ver_type = (TP2_VERSION << 4) | TP2_SYNC;
+  hdr->len = sizeof(((struct tp2_sync *)0)->t1);
+  sync_put_u32(hdr->seq, ++sync.seq);
+
+  sync.t1 = clock_local_us(); //T1, as late as possible
+  sync_put_u32((uint8_t *)(hdr + 1), (uint32_t)sync.t1);
+  sync_put_u32((uint8_t *)(hdr + 1) + 4, (uint32_t)(sync.t1 >> 32));
+
+  if (udp_send(pcb_sync, p) == ERR_OK)
+  {
+    sync.waiting = true;
+    sync.stats.sent++;
+  }
+  pbuf_free(p);
+}
+
+/*
+ * udp_callback_received
+ * callback when a datagram arrives from the server: T4, check, discipline
+ */
+static void udp_callback_received(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
+{
+  uint64_t t4 = clock_local_us(); //T4 before anything else
+  uint8_t b[sizeof(struct tp2_hdr) + sizeof(struct tp2_sync)];
+  const struct tp2_hdr *hdr = (const struct tp2_hdr *)b;
+  const struct tp2_sync *body = (const struct tp2_sync *)(hdr + 1);
+  struct sync_stats cs;
+
+  LWIP_UNUSED_ARG(arg);
+  LWIP_UNUSED_ARG(pcb);
+  LWIP_UNUSED_ARG(addr);
+  LWIP_UNUSED_ARG(port);
+
+  if (pbuf_copy_partial(p, b, sizeof(b), 0) != sizeof(b) ||
+      hdr->magic != TP2_MAGIC || hdr->ver_type != ((TP2_VERSION << 4) | TP2_SYNC) ||
+      hdr->len < sizeof(struct tp2_sync) || !sync.waiting ||
+      sync_get_u32(hdr->seq) != sync.seq || sync_get_u64(body->t1) != sync.t1)
+  {
+    sync.stats.errors++;
+    pbuf_free(p); //free pbuf
+    return;
+  }
+  pbuf_free(p); //free pbuf
+
+  sync.waiting = false;
+  sync.stats.received++;
+  clock_sync_update(sync.t1, sync_get_u64(body->t2), sync_get_u64(body->t3), t4);
+
+  if (SYNC_REPORT_EVERY != 0 && sync.stats.received % SYNC_REPORT_EVERY == 0)
+  {
+    uint64_t now = clock_now_us();
+
+    clock_sync_get(&cs);
+    printf("[SYNC] time %lu.%06lu, %lu samples (%lu used, %lu lost), offset %ld us, delay %lu us, freq %ld ppb, jitter %lu us\n\r",
+           (unsigned long)(now / 1000000), (unsigned long)(now % 1000000),
+           (unsigned long)cs.samples, (unsigned long)cs.used, (unsigned long)sync.stats.lost,
+           (long)cs.offset_us, (unsigned long)cs.delay_us, (long)cs.freq_ppb, (unsigned long)cs.jitter_us);
+  }
+}
@@ -28,7 +28,10 @@
 #include "ethernetif.h"
 
 /* USER CODE BEGIN 0 */
+// HSO
+#include "eth_zc.h"
 
+extern ETH_HandleTypeDef heth; //ethernetif.c
 /* USER CODE END 0 */
 /* Private function prototypes -----------------------------------------------*/
 /* ETH Variables initialization ----------------------------------------------*/
@@ -48,7 +51,20 @@ ip4_addr_t netmask;
 ip4_addr_t gw;
 
 /* USER CODE BEGIN 2 */
-
+// HSO
+/*
+ * lwip_link_poll
+ * read the link state from the PHY, bring the interface up and restart
+ * DHCP when the cable is plugged back
+ */
+void lwip_link_poll(void)
+{
+  ethernetif_set_link(&gnetif);
+  if (netif_is_link_up(&gnetif) && !netif_is_up(&gnetif)) {
+    netif_set_up(&gnetif);
+    dhcp_start(&gnetif);
+  }
+}
 /* USER CODE END 2 */
 
 /**
@@ -90,7 +106,10 @@ void MX_LWIP_Init(void)
   dhcp_start(&gnetif);
 
 /* USER CODE BEGIN 3 */
-
+#ifdef ETH_ZC_ENABLE
+  // HSO: zero-copy receive and scatter-gather transmit, see eth_zc.h
+  eth_zc_init(&heth, &gnetif);
+#endif
 /* USER CODE END 3 */
 }
 
@@ -119,17 +138,17 @@ void MX_LWIP_Process(void)
   ethernetif_input(&gnetif);
 
 /* USER CODE BEGIN 4_2 */
+#ifdef ETH_ZC_ENABLE
+  // HSO: the frames are in the rings of eth_zc, ethernetif_input finds none
+  eth_zc_input(&gnetif);
+#endif
 /* USER CODE END 4_2 */
   /* Handle timeouts */
   sys_check_timeouts();
 
 /* USER CODE BEGIN 4_3 */
   // HSO
-  ethernetif_set_link(&gnetif);
-  if (netif_is_link_up(&gnetif) && !netif_is_up(&gnetif)) {
-    netif_set_up(&gnetif);
-    dhcp_start(&gnetif);
-  }
+  lwip_link_poll();
 /* USER CODE END 4_3 */
 }
 
@@ -6,6 +6,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include "fips202.h"
+#include "prof.h"
 
 #define NROUNDS 24
 #define ROL(a, offset) ((a << offset) ^ (a >> (64-offset)))
@@ -96,6 +97,8 @@ static void KeccakF1600_StatePermute(uint64_t state[25])
         uint64_t Ema, Eme, Emi, Emo, Emu;
         uint64_t Esa, Ese, Esi, Eso, Esu;
 
+        PROF_START(KECCAK_F1600);
+
         //copyFromState(A, state)
         Aba = state[ 0];
         Abe = state[ 1];
@@ -341,6 +344,8 @@ static void KeccakF1600_StatePermute(uint64_t state[25])
         state[22] = Asi;
         state[23] = Aso;
         state[24] = Asu;
+
+        PROF_STOP(KECCAK_F1600);
 }
 
 /*************************************************
@@ -21,6 +21,16 @@
 #include "string.h"
 
 #include "kyber_fused.h"
+#include "prof.h"
+#ifdef STACKMETER_ENABLE
+#include "stackmeter.h"
+#endif
+#ifdef UARTLOG_ENABLE
+#include "uartlog.h"
+#endif
+#ifdef TRACE_ENABLE
+#include "trace.h"
+#endif
 
 ETH_TxPacketConfig TxConfig;
 ETH_DMADescTypeDef DMARxDscrTab[ETH_RX_DESC_CNT]; /* Ethernet Rx DMA Descriptors */
@@ -56,6 +66,40 @@ int __io_putchar(int ch);
 void randombytes(uint8_t *out, size_t n_bytes);
 #define N_RAND_BYTES 8
 
+#ifdef KYBER_SELFTEST
+// DWT cycle counter, used to time the compression kernels
+static uint32_t dwt_cycles(void);
+#endif
+
+// Benchmark and buffer ids, as used in the trace records
+enum { BENCH_KEYPAIR, BENCH_ENC, BENCH_DEC };
+enum { BLOB_SK, BLOB_PK, BLOB_SS_B, BLOB_CT, BLOB_SS_A };
+
+// Print a key/ciphertext/secret, or emit it as a trace record if TRACE_ENABLE
+static void dump_bytes(const char *label, uint32_t blob, const uint8_t *buf, int len);
+// Cycles of a KEM operation since t0 (a trace record if TRACE_ENABLE)
+static void bench(uint32_t id, prof_cycles_t t0);
+
+#ifdef KYBER_STEP_BUDGET
+// Stepped KEM: at most KYBER_STEP_BUDGET units per crypto_kem_step call. The
+// longest call bounds how late work run between the steps would start
+static kyber_step_ctx step_ctx;
+static struct {
+	uint32_t steps;
+	prof_cycles_t max;
+} step_stats[3];	// by BENCH_* id
+static void kem_steps(uint32_t id);
+static void step_report(void);
+#endif
+
+#ifdef TRACE_ENABLE
+static void trace_uart(const uint8_t *frame, size_t len);
+#ifdef UARTLOG_ENABLE
+static uint8_t trace_log_buf[2048];
+static uartlog_chan trace_log;
+#endif
+#endif
+
 /**
  * @brief  The application entry point.
  * @retval int
@@ -79,6 +123,16 @@ int main(void) {
 	MX_USB_PCD_Init();
 	MX_RNG_Init();
 
+	prof_init();
+
+#ifdef UARTLOG_ENABLE
+	// Non-blocking printf: the hex dumps below are drained by USART3 TX DMA
+	if (uartlog_init(&huart3) != 0) {
+		static const char msg[] = "[FAIL] uartlog: USART3 TX DMA not configured\n\r";
+		HAL_UART_Transmit(&huart3, (uint8_t *)msg, sizeof(msg) - 1, 0xFFFF);
+	}
+#endif
+
 	uint8_t rand_bytes[N_RAND_BYTES];
 
 	printf("[TEST] Generate random bytes from TRNG:\n\r");
@@ -94,6 +148,38 @@ int main(void) {
 		HAL_Delay(1000);
 	}
 
+#ifdef KYBER_SELFTEST
+	kyber_selftest_result st_res[KYBER_SELFTEST_NROUTINES];
+	int st_fails;
+
+	printf("[TEST] Division-free compression kernels:\n\r");
+	st_fails = kyber_compress_selftest(st_res, dwt_cycles);
+	printf("%-16s %10s %12s %12s\n\r", "kernel", "mismatches", "cycles(div)", "cycles");
+	for (int i = 0; i < KYBER_SELFTEST_NROUTINES; i++) {
+		printf("%-16s %10lu %12lu %12lu\n\r", st_res[i].name,
+				(unsigned long) st_res[i].mismatches,
+				(unsigned long) st_res[i].cycles_ref,
+				(unsigned long) st_res[i].cycles);
+	}
+	if (st_fails == 0) {
+		printf("[PASS] All kernels match the reference\n\n\r");
+	} else {
+		printf("[FAIL] %d mismatches!\n\n\r", st_fails);
+	}
+#endif
+
+#ifdef STACKMETER_ENABLE
+	stackmeter_result sm_res[STACKMETER_MAX_VARIANTS];
+	size_t sm_n;
+
+	printf("[TEST] KEM stack high-water marks (bytes):\n\r");
+	sm_n = stackmeter_measure_all(sm_res, randombytes);
+	stackmeter_print_table(sm_res, sm_n);
+	printf("\n\r");
+	stackmeter_write_header(stdout, "NUCLEO-H563ZI", sm_res, sm_n);
+	printf("\n\r");
+#endif
+
 	printf("[TEST] Kyber KEM test:\n\r");
 	uint8_t sk_a[KYBER_SECRETKEYBYTES];
 	uint8_t pk_a[KYBER_PUBLICKEYBYTES];
@@ -103,50 +189,63 @@ int main(void) {
 
 	printf("KYBER_K = %d\n\n\r", KYBER_K);
 
+#ifdef TRACE_ENABLE
+	// Binary records instead of hex dumps, decode with Host/trace_decode.c
+#ifdef UARTLOG_ENABLE
+	uartlog_chan_init(&trace_log, "trace", trace_log_buf, sizeof(trace_log_buf));
+#endif
+	trace_init(trace_uart, SystemCoreClock);
+	trace_name(TRACE_KIND_BENCH, BENCH_KEYPAIR, "crypto_kem_keypair");
+	trace_name(TRACE_KIND_BENCH, BENCH_ENC, "crypto_kem_enc");
+	trace_name(TRACE_KIND_BENCH, BENCH_DEC, "crypto_kem_dec");
+	trace_name(TRACE_KIND_BLOB, BLOB_SK, "sk_a");
+	trace_name(TRACE_KIND_BLOB, BLOB_PK, "pk_a");
+	trace_name(TRACE_KIND_BLOB, BLOB_SS_B, "ss_b");
+	trace_name(TRACE_KIND_BLOB, BLOB_CT, "ct_b");
+	trace_name(TRACE_KIND_BLOB, BLOB_SS_A, "ss_a");
+	trace_probe_names();
+#endif
+
 	while (1) {
+		prof_cycles_t t0;
+
 		// Alice generates a public-private Kyber keypair
+		t0 = prof_now();
+#ifdef KYBER_STEP_BUDGET
+		crypto_kem_keypair_start(&step_ctx, pk_a, sk_a, randombytes);
+		kem_steps(BENCH_KEYPAIR);
+#else
 		crypto_kem_keypair(pk_a, sk_a, randombytes);
+#endif
+		bench(BENCH_KEYPAIR, t0);
 
-		printf("Alice's private key (%d bytes) = 0x", KYBER_SECRETKEYBYTES);
-		for (int i = KYBER_SECRETKEYBYTES - 1; i >= 0; i--) {
-			printf("%02x", sk_a[i]);
-		}
-
-		printf("\n\n\r");
-
-		printf("Alice's public key (%d bytes) = 0x", KYBER_PUBLICKEYBYTES);
-		for (int i = KYBER_PUBLICKEYBYTES - 1; i >= 0; i--) {
-			printf("%02x", pk_a[i]);
-		}
-
-		printf("\n\n\r");
+		dump_bytes("Alice's private key", BLOB_SK, sk_a, KYBER_SECRETKEYBYTES);
+		dump_bytes("Alice's public key", BLOB_PK, pk_a, KYBER_PUBLICKEYBYTES);
 
 		// Bob derives a shared secret and a ciphertext from Alice's public key
+		t0 = prof_now();
+#ifdef KYBER_STEP_BUDGET
+		crypto_kem_enc_start(&step_ctx, ct_b, ss_b, pk_a, randombytes);
+		kem_steps(BENCH_ENC);
+#else
 		crypto_kem_enc(ct_b, ss_b, pk_a, randombytes);
+#endif
+		bench(BENCH_ENC, t0);
 
-		printf("Bob's shared secret (%d bytes) = 0x", KYBER_SSBYTES);
-		for (int i = KYBER_SSBYTES - 1; i >= 0; i--) {
-			printf("%02x", ss_b[i]);
-		}
-
-		printf("\n\n\r");
-
-		printf("Bob's ciphertext (%d bytes) = 0x", KYBER_CIPHERTEXTBYTES);
-		for (int i = KYBER_CIPHERTEXTBYTES - 1; i >= 0; i--) {
-			printf("%02x", ct_b[i]);
-		}
-
-		printf("\n\n\r");
+		dump_bytes("Bob's shared secret", BLOB_SS_B, ss_b, KYBER_SSBYTES);
+		dump_bytes("Bob's ciphertext", BLOB_CT, ct_b, KYBER_CIPHERTEXTBYTES);
 
 		// Alice derives a shared secret from Bob's ciphertext
+		t0 = prof_now();
+#ifdef KYBER_STEP_BUDGET
+		crypto_kem_dec_start(&step_ctx, ss_a, ct_b, sk_a);
+		kem_steps(BENCH_DEC);
+#else
 		crypto_kem_dec(ss_a, ct_b, sk_a);
+#endif
+		bench(BENCH_DEC, t0);
 
-		printf("Alice's shared secret (%d bytes) = 0x", KYBER_SSBYTES);
-		for (int i = KYBER_SSBYTES - 1; i >= 0; i--) {
-			printf("%02x", ss_a[i]);
-		}
-
-		printf("\n\n\r");
+		dump_bytes("Alice's shared secret", BLOB_SS_A, ss_a, KYBER_SSBYTES);
 
 		// Check if shared secrets match
 		if (memcmp(ss_a, ss_b, KYBER_SSBYTES) == 0) {
@@ -154,6 +253,27 @@ int main(void) {
 		} else {
 			printf("[FAIL] Alice and Bob's shared secrets don't match!\n\n\r");
 		}
+#ifdef KYBER_STEP_BUDGET
+		step_report();
+#endif
+
+#ifdef PROF_ENABLE
+		// Publish the probe table while the user button is held
+		if (HAL_GPIO_ReadPin(USER_BUTTON_GPIO_Port, USER_BUTTON_Pin) == GPIO_PIN_SET) {
+			printf("[PROF] Kyber probes since last report:\n\r");
+			prof_report();
+			printf("\n\r");
+			prof_reset();
+		}
+#endif
+#ifdef UARTLOG_ENABLE
+		// Logger counters, to size UARTLOG_RING_BYTES against the dumps above
+		if (HAL_GPIO_ReadPin(USER_BUTTON_GPIO_Port, USER_BUTTON_Pin) == GPIO_PIN_SET) {
+			printf("[LOG] UART logger channels:\n\r");
+			uartlog_report();
+			printf("\n\r");
+		}
+#endif
 		HAL_Delay(3000);
 	}
 }
@@ -162,10 +282,94 @@ int main(void) {
  * @brief printf retarget to USART3
  */
 int __io_putchar(int ch){
+#ifdef UARTLOG_ENABLE
+	return uartlog_putc(ch);
+#else
 	HAL_UART_Transmit(&huart3, (uint8_t *)&ch, 1, 0xFFFF);
 	return ch;
+#endif
 }
 
+/**
+ * @brief Print bytes as one big-endian hex number, or emit them as trace blob
+ */
+static void dump_bytes(const char *label, uint32_t blob, const uint8_t *buf, int len) {
+#ifdef TRACE_ENABLE
+	(void) label;
+	trace_blob(blob, buf, len);	// in memory order, i.e. little-endian
+#else
+	(void) blob;
+	printf("%s (%d bytes) = 0x", label, len);
+	for (int i = len - 1; i >= 0; i--) {
+		printf("%02x", buf[i]);
+	}
+
+	printf("\n\n\r");
+#endif
+}
+
+/**
+ * @brief Record the cycles of a KEM operation started at t0
+ */
+static void bench(uint32_t id, prof_cycles_t t0) {
+	prof_cycles_t dt = prof_now() - t0;
+
+#ifdef TRACE_ENABLE
+	trace_bench(id, dt);
+#else
+	(void) id;
+	(void) dt;
+#endif
+}
+
+#ifdef KYBER_STEP_BUDGET
+/**
+ * @brief Run the operation started in step_ctx, timing every step
+ */
+static void kem_steps(uint32_t id) {
+	prof_cycles_t t0, dt;
+	int ret;
+
+	step_stats[id].steps = 0;
+	step_stats[id].max = 0;
+	do {
+		t0 = prof_now();
+		ret = crypto_kem_step(&step_ctx, KYBER_STEP_BUDGET);
+		dt = prof_now() - t0;
+		if (dt > step_stats[id].max)
+			step_stats[id].max = dt;
+		step_stats[id].steps++;
+		// Other work of the main loop would run here
+	} while (ret == KYBER_STEP_IN_PROGRESS);
+}
+
+/**
+ * @brief Print the steps of the last iteration and the longest of each
+ */
+static void step_report(void) {
+	static const char *names[3] = { "crypto_kem_keypair", "crypto_kem_enc", "crypto_kem_dec" };
+
+	for (int i = 0; i < 3; i++) {
+		printf("[STEP] %s: %lu steps of %d units at most, longest %lu cycles\n\r", names[i],
+				(unsigned long) step_stats[i].steps, KYBER_STEP_BUDGET, (unsigned long) step_stats[i].max);
+	}
+	printf("\n\r");
+}
+#endif
+
+#ifdef TRACE_ENABLE
+/**
+ * @brief Trace sink: the logger's own channel, or a blocking write
+ */
+static void trace_uart(const uint8_t *frame, size_t len) {
+#ifdef UARTLOG_ENABLE
+	uartlog_write(&trace_log, frame, len);
+#else
+	HAL_UART_Transmit(&huart3, (uint8_t *)frame, len, 0xFFFF);
+#endif
+}
+#endif
+
 /**
  * @brief Extract random bytes from TRNG
  * @param pointer to output array
@@ -181,6 +385,16 @@ void randombytes(uint8_t *out, size_t n_bytes) {
 	}
 }
 
+#ifdef KYBER_SELFTEST
+/**
+ * @brief Read the DWT cycle counter (enabled by prof_init)
+ * @retval current cycle count
+ */
+static uint32_t dwt_cycles(void) {
+	return prof_now();
+}
+#endif
+
 /**
  * @brief System Clock Configuration
  * @retval None
@@ -0,0 +1,334 @@
+/*
+ * host_main.c
+ *
+ * Host (Linux) build of the kyber-fused-bare demo. It runs the same KEM
+ * sources as the board, with the probes of prof.h mapped to the TSC (or
+ * clock_gettime), so that profiles can be compared side by side with the
+ * ones printed by the NUCLEO-H563ZI.
+ *
+ * With KYBER_STEP_BUDGET defined, every iteration also runs the stepped KEM
+ * (crypto_kem_step, at most that many units per call) from the same random
+ * bytes, checks that its outputs match the monolithic calls, and reports
+ * the longest step of each operation next to the whole operation: the
+ * median over the iterations, which a preempted step does not move, and the
+ * worst case.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/random.h>
+
+#include "kyber_fused.h"
+#include "prof.h"
+#ifdef TRACE_ENABLE
+#include "trace.h"
+#endif
+
+#define DEFAULT_ITERATIONS 1000
+
+/**
+ * @brief Random bytes from the kernel, same signature as the TRNG wrapper
+ */
+static void randombytes(uint8_t *out, size_t n_bytes)
+{
+  size_t done = 0;
+
+  while (done < n_bytes) {
+    ssize_t n = getrandom(out + done, n_bytes - done, 0);
+    if (n < 0) {
+      perror("getrandom");
+      exit(1);
+    }
+    done += n;
+  }
+}
+
+#ifdef PROF_ENABLE
+/**
+ * @brief SIGPROF handler, the host counterpart of the SysTick sampler
+ */
+static void on_sigprof(int sig)
+{
+  (void) sig;
+  prof_sample();
+}
+
+static void start_sampler(void)
+{
+  struct itimerval it = { { 0, 1000 }, { 0, 1000 } };	/* 1 kHz, like SysTick */
+
+  signal(SIGPROF, on_sigprof);
+  setitimer(ITIMER_PROF, &it, NULL);
+}
+#endif
+
+#ifdef TRACE_ENABLE
+/* Benchmark and blob ids of the trace records */
+enum { BENCH_KEYPAIR, BENCH_ENC, BENCH_DEC };
+enum { BLOB_PK, BLOB_CT };
+
+static FILE *trace_file;
+
+static void trace_to_file(const uint8_t *frame, size_t len)
+{
+  fwrite(frame, 1, len, trace_file);
+}
+#endif
+
+#ifdef KYBER_STEP_BUDGET
+/* Replays the bytes of the monolithic run to the stepped one */
+static uint8_t replay_buf[3*KYBER_SYMBYTES];
+static size_t replay_len, replay_off;
+
+static void randombytes_record(uint8_t *out, size_t n_bytes)
+{
+  randombytes(out, n_bytes);
+  memcpy(replay_buf + replay_len, out, n_bytes);
+  replay_len += n_bytes;
+}
+
+static void randombytes_replay(uint8_t *out, size_t n_bytes)
+{
+  memcpy(out, replay_buf + replay_off, n_bytes);
+  replay_off += n_bytes;
+}
+
+static const char *step_names[3] = { "crypto_kem_keypair", "crypto_kem_enc", "crypto_kem_dec" };
+static struct {
+  uint32_t steps, units;
+  prof_cycles_t step_max;	/* longest crypto_kem_step */
+  prof_cycles_t op_max;		/* longest monolithic call */
+  prof_cycles_t *step_iter;	/* longest step of each iteration */
+  prof_cycles_t *op_iter;	/* monolithic call of each iteration */
+  int n;
+} step_stats[3];
+static kyber_step_ctx step_ctx;
+
+static int cycles_cmp(const void *a, const void *b)
+{
+  prof_cycles_t x = *(const prof_cycles_t *) a, y = *(const prof_cycles_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ * @brief Median of n samples (sorts them)
+ */
+static prof_cycles_t cycles_median(prof_cycles_t *v, int n)
+{
+  if (n == 0)
+    return 0;
+  qsort(v, n, sizeof(*v), cycles_cmp);
+  return v[n / 2];
+}
+
+/**
+ * @brief Run the operation started in step_ctx, timing every step
+ */
+static void kem_steps(int id, prof_cycles_t op)
+{
+  prof_cycles_t t0, dt, iter_max = 0;
+  int ret;
+
+  do {
+    t0 = prof_now();
+    ret = crypto_kem_step(&step_ctx, KYBER_STEP_BUDGET);
+    dt = prof_now() - t0;
+    if (dt > iter_max)
+      iter_max = dt;
+    step_stats[id].steps++;
+  } while (ret == KYBER_STEP_IN_PROGRESS);
+  step_stats[id].units += step_ctx.units;
+  if (iter_max > step_stats[id].step_max)
+    step_stats[id].step_max = iter_max;
+  if (op > step_stats[id].op_max)
+    step_stats[id].op_max = op;
+  step_stats[id].step_iter[step_stats[id].n] = iter_max;
+  step_stats[id].op_iter[step_stats[id].n++] = op;
+}
+
+/**
+ * @brief Stepped keypair/enc/dec from the same random bytes; 0 if the
+ * outputs match
+ */
+static int kem_stepped(const uint8_t *pk, const uint8_t *sk, const uint8_t *ct, const uint8_t *ss_b,
+                       const uint8_t *ss_a, const prof_cycles_t op[3])
+{
+  uint8_t sk_s[KYBER_SECRETKEYBYTES];
+  uint8_t pk_s[KYBER_PUBLICKEYBYTES];
+  uint8_t ct_s[KYBER_CIPHERTEXTBYTES];
+  uint8_t ss_sa[KYBER_SSBYTES];
+  uint8_t ss_sb[KYBER_SSBYTES];
+
+  replay_off = 0;
+  crypto_kem_keypair_start(&step_ctx, pk_s, sk_s, randombytes_replay);
+  kem_steps(0, op[0]);
+  crypto_kem_enc_start(&step_ctx, ct_s, ss_sb, pk_s, randombytes_replay);
+  kem_steps(1, op[1]);
+  crypto_kem_dec_start(&step_ctx, ss_sa, ct_s, sk_s);
+  kem_steps(2, op[2]);
+
+  return memcmp(pk_s, pk, sizeof(pk_s)) != 0 || memcmp(sk_s, sk, sizeof(sk_s)) != 0 ||
+         memcmp(ct_s, ct, sizeof(ct_s)) != 0 || memcmp(ss_sb, ss_b, sizeof(ss_sb)) != 0 ||
+         memcmp(ss_sa, ss_a, sizeof(ss_sa)) != 0;
+}
+#endif
+
+#ifdef KYBER_SELFTEST
+static uint32_t host_cycles(void)
+{
+  return (uint32_t) prof_now();
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+  uint8_t sk_a[KYBER_SECRETKEYBYTES];
+  uint8_t pk_a[KYBER_PUBLICKEYBYTES];
+  uint8_t ss_a[KYBER_SSBYTES];
+  uint8_t ss_b[KYBER_SSBYTES];
+  uint8_t ct_b[KYBER_CIPHERTEXTBYTES];
+  int iterations = (argc > 1) ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+  int fails = 0;
+#ifdef KYBER_STEP_BUDGET
+  int step_fails = 0;
+#endif
+
+  prof_init();
+
+#ifdef KYBER_STEP_BUDGET
+  if (iterations < 1)
+    iterations = 1;
+  for (int i = 0; i < 3; i++) {
+    step_stats[i].step_iter = malloc(iterations * sizeof(prof_cycles_t));
+    step_stats[i].op_iter = malloc(iterations * sizeof(prof_cycles_t));
+    if (step_stats[i].step_iter == NULL || step_stats[i].op_iter == NULL) {
+      perror("malloc");
+      return 1;
+    }
+  }
+#endif
+
+#ifdef TRACE_ENABLE
+  const char *trace_path = (argc > 2) ? argv[2] : "kyber.trace";
+
+  trace_file = fopen(trace_path, "wb");
+  if (trace_file == NULL) {
+    perror(trace_path);
+    return 1;
+  }
+  trace_init(trace_to_file, 0);
+  trace_name(TRACE_KIND_BENCH, BENCH_KEYPAIR, "crypto_kem_keypair");
+  trace_name(TRACE_KIND_BENCH, BENCH_ENC, "crypto_kem_enc");
+  trace_name(TRACE_KIND_BENCH, BENCH_DEC, "crypto_kem_dec");
+  trace_name(TRACE_KIND_BLOB, BLOB_PK, "pk");
+  trace_name(TRACE_KIND_BLOB, BLOB_CT, "ct");
+  trace_probe_names();
+#endif
+
+#ifdef KYBER_SELFTEST
+  kyber_selftest_result st_res[KYBER_SELFTEST_NROUTINES];
+  int st_fails;
+
+  printf("[TEST] Division-free compression kernels:\n");
+  st_fails = kyber_compress_selftest(st_res, host_cycles);
+  printf("%-16s %10s %12s %12s\n", "kernel", "mismatches", "cycles(div)", "cycles");
+  for (int i = 0; i < KYBER_SELFTEST_NROUTINES; i++) {
+    printf("%-16s %10lu %12lu %12lu\n", st_res[i].name,
+           (unsigned long) st_res[i].mismatches,
+           (unsigned long) st_res[i].cycles_ref,
+           (unsigned long) st_res[i].cycles);
+  }
+  printf(st_fails == 0 ? "[PASS] All kernels match the reference\n\n"
+                       : "[FAIL] Kernel mismatches!\n\n");
+  fails += st_fails;
+#endif
+
+  printf("[TEST] %s, %d iterations\n", CRYPTO_ALGNAME, iterations);
+
+#ifdef PROF_ENABLE
+  start_sampler();
+#endif
+
+  for (int i = 0; i < iterations; i++) {
+#ifdef TRACE_ENABLE
+    prof_cycles_t t0 = prof_now();
+    crypto_kem_keypair(pk_a, sk_a, randombytes);
+    prof_cycles_t t1 = prof_now();
+    crypto_kem_enc(ct_b, ss_b, pk_a, randombytes);
+    prof_cycles_t t2 = prof_now();
+    crypto_kem_dec(ss_a, ct_b, sk_a);
+    prof_cycles_t t3 = prof_now();
+
+    trace_bench(BENCH_KEYPAIR, t1 - t0);
+    trace_bench(BENCH_ENC, t2 - t1);
+    trace_bench(BENCH_DEC, t3 - t2);
+    if (i == 0) {
+      trace_blob(BLOB_PK, pk_a, KYBER_PUBLICKEYBYTES);
+      trace_blob(BLOB_CT, ct_b, KYBER_CIPHERTEXTBYTES);
+    }
+#elif defined(KYBER_STEP_BUDGET)
+    prof_cycles_t op[3], t0;
+
+    replay_len = 0;
+    t0 = prof_now();
+    crypto_kem_keypair(pk_a, sk_a, randombytes_record);
+    op[0] = prof_now() - t0;
+    t0 = prof_now();
+    crypto_kem_enc(ct_b, ss_b, pk_a, randombytes_record);
+    op[1] = prof_now() - t0;
+    t0 = prof_now();
+    crypto_kem_dec(ss_a, ct_b, sk_a);
+    op[2] = prof_now() - t0;
+    if (kem_stepped(pk_a, sk_a, ct_b, ss_b, ss_a, op) != 0)
+      step_fails++;
+#else
+    crypto_kem_keypair(pk_a, sk_a, randombytes);
+    crypto_kem_enc(ct_b, ss_b, pk_a, randombytes);
+    crypto_kem_dec(ss_a, ct_b, sk_a);
+#endif
+    if (memcmp(ss_a, ss_b, KYBER_SSBYTES) != 0)
+      fails++;
+  }
+
+#ifdef TRACE_ENABLE
+  fclose(trace_file);
+#endif
+
+  if (fails == 0) {
+    printf("[PASS] Alice and Bob's shared secrets match\n\n");
+  } else {
+    printf("[FAIL] %d mismatching iterations!\n\n", fails);
+  }
+
+#ifdef KYBER_STEP_BUDGET
+  if (step_fails == 0) {
+    printf("[PASS] Stepped KEM matches, budget %d units per step\n", KYBER_STEP_BUDGET);
+  } else {
+    printf("[FAIL] Stepped KEM differs in %d iterations!\n", step_fails);
+  }
+  printf("%-20s %6s %6s %14s %14s %14s %14s\n", "operation", "steps", "units", "step p50 " PROF_UNIT,
+         "step max " PROF_UNIT, "call p50 " PROF_UNIT, "call max " PROF_UNIT);
+  for (int i = 0; i < 3; i++) {
+    printf("%-20s %6lu %6lu %14llu %14llu %14llu %14llu\n", step_names[i],
+           (unsigned long) (step_stats[i].steps / iterations), (unsigned long) (step_stats[i].units / iterations),
+           (unsigned long long) cycles_median(step_stats[i].step_iter, step_stats[i].n),
+           (unsigned long long) step_stats[i].step_max,
+           (unsigned long long) cycles_median(step_stats[i].op_iter, step_stats[i].n),
+           (unsigned long long) step_stats[i].op_max);
+    free(step_stats[i].step_iter);
+    free(step_stats[i].op_iter);
+  }
+  printf("\n");
+  fails += step_fails;
+#endif
+
+#ifdef PROF_ENABLE
+  prof_report();
+#endif
+
+  return fails != 0;
+}
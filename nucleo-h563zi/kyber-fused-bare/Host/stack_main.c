@@ -0,0 +1,50 @@
+/*
+ * stack_main.c
+ *
+ * Host (Linux) run of the stack high-water-mark harness. Prints the table
+ * and, if a path is given, writes the generated kem_stack.h there.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/random.h>
+
+#include "stackmeter.h"
+
+static void randombytes(uint8_t *out, size_t n_bytes)
+{
+  size_t done = 0;
+
+  while (done < n_bytes) {
+    ssize_t n = getrandom(out + done, n_bytes - done, 0);
+    if (n < 0) {
+      perror("getrandom");
+      exit(1);
+    }
+    done += n;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  stackmeter_result res[STACKMETER_MAX_VARIANTS];
+  size_t n;
+
+  n = stackmeter_measure_all(res, randombytes);
+  stackmeter_print_table(res, n);
+
+  if (argc > 1) {
+    FILE *f = fopen(argv[1], "w");
+    if (f == NULL) {
+      perror(argv[1]);
+      return 1;
+    }
+#if defined(__x86_64__)
+    stackmeter_write_header(f, "host x86_64", res, n);
+#else
+    stackmeter_write_header(f, "host", res, n);
+#endif
+    fclose(f);
+  }
+  return 0;
+}
@@ -0,0 +1,194 @@
+/*
+ * trace_decode.c
+ *
+ * Host decoder for the record stream of Profiler/trace.h. Reads a capture
+ * (a file, or stdin: e.g. the raw UART log) and prints one CSV row or JSON
+ * object per record. Bytes between frames, such as printf text sharing the
+ * UART, are skipped (or echoed to stderr with -t).
+ *
+ * usage: trace_decode [-j] [-t] [capture]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+#define MAX_IDS 256
+
+static char *names[4][MAX_IDS];
+static int json, echo_text;
+
+static const char *type_name(int type)
+{
+  switch (type) {
+  case TRACE_CLOCK: return "clock";
+  case TRACE_BENCH: return "bench";
+  case TRACE_PROBE: return "probe";
+  case TRACE_EVENT: return "event";
+  case TRACE_BLOB:  return "blob";
+  default:          return "unknown";
+  }
+}
+
+static const char *id_name(int type, uint64_t id)
+{
+  int kind;
+
+  switch (type) {
+  case TRACE_BENCH: kind = TRACE_KIND_BENCH; break;
+  case TRACE_PROBE: kind = TRACE_KIND_PROBE; break;
+  case TRACE_EVENT: kind = TRACE_KIND_EVENT; break;
+  case TRACE_BLOB:  kind = TRACE_KIND_BLOB; break;
+  default:          return "";
+  }
+  return (id < MAX_IDS && names[kind][id] != NULL) ? names[kind][id] : "";
+}
+
+static void emit(int type, uint64_t t, uint32_t hz, uint64_t id, const char *name,
+                 uint64_t value, const char *extra)
+{
+  double us = hz ? (double) t * 1e6 / hz : 0.0;
+
+  if (json)
+    printf("{\"cycles\":%llu,\"time_us\":%.3f,\"type\":\"%s\",\"id\":%llu,\"name\":\"%s\","
+           "\"value\":%llu,\"extra\":\"%s\"}\n",
+           (unsigned long long) t, us, type_name(type), (unsigned long long) id, name,
+           (unsigned long long) value, extra);
+  else
+    printf("%llu,%.3f,%s,%llu,%s,%llu,%s\n", (unsigned long long) t, us, type_name(type),
+           (unsigned long long) id, name, (unsigned long long) value, extra);
+}
+
+/**
+ * @brief Decode the body of one CRC-checked frame
+ * @retval 0 on success, -1 if the body is malformed
+ */
+static int decode(int type, const uint8_t *b, size_t len, uint64_t *t, uint32_t *hz)
+{
+  uint64_t delta, a, v;
+  size_t n, m;
+  char extra[2 * TRACE_BODY_MAX + 1];
+
+  if ((n = trace_get_varint(b, len, &delta)) == 0)
+    return -1;
+  *t += delta;
+  b += n;
+  len -= n;
+
+  switch (type) {
+  case TRACE_CLOCK:
+    if ((n = trace_get_varint(b, len, &a)) == 0 ||
+        (m = trace_get_varint(b + n, len - n, &v)) == 0)
+      return -1;
+    *t = a;
+    *hz = (uint32_t) v;
+    snprintf(extra, sizeof(extra), "%lu", (unsigned long) v);
+    emit(type, *t, *hz, 0, "", a, extra);
+    return 0;
+
+  case TRACE_NAME:
+    if (len < 1 || b[0] > TRACE_KIND_BLOB || (n = trace_get_varint(b + 1, len - 1, &a)) == 0)
+      return -1;
+    if (a < MAX_IDS) {
+      char **slot = &names[b[0]][a];
+      free(*slot);
+      *slot = strndup((const char *) b + 1 + n, len - 1 - n);
+    }
+    return 0;
+
+  case TRACE_BENCH:
+  case TRACE_PROBE:
+  case TRACE_EVENT:
+    if ((n = trace_get_varint(b, len, &a)) == 0 ||
+        (m = trace_get_varint(b + n, len - n, &v)) == 0)
+      return -1;
+    emit(type, *t, *hz, a, id_name(type, a), v, "");
+    return 0;
+
+  case TRACE_BLOB:
+    if ((n = trace_get_varint(b, len, &a)) == 0 ||
+        (m = trace_get_varint(b + n, len - n, &v)) == 0)
+      return -1;
+    for (size_t i = n + m; i < len; i++)
+      sprintf(&extra[2 * (i - n - m)], "%02x", b[i]);
+    extra[2 * (len - n - m)] = '\0';
+    emit(type, *t, *hz, a, id_name(type, a), v, extra);
+    return 0;
+
+  default:
+    return 0;	/* newer record type: skipped, the time base is still valid */
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  FILE *in = stdin;
+  uint8_t *buf = NULL;
+  size_t size = 0, cap = 0, i = 0;
+  unsigned long frames = 0, crc_errors = 0, skipped = 0;
+  uint64_t t = 0;
+  uint32_t hz = 0;
+  int a;
+
+  for (a = 1; a < argc && argv[a][0] == '-'; a++) {
+    if (strcmp(argv[a], "-j") == 0)
+      json = 1;
+    else if (strcmp(argv[a], "-t") == 0)
+      echo_text = 1;
+    else {
+      fprintf(stderr, "usage: %s [-j] [-t] [capture]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (a < argc && (in = fopen(argv[a], "rb")) == NULL) {
+    perror(argv[a]);
+    return 1;
+  }
+
+  for (;;) {
+    if (size == cap) {
+      cap = cap ? 2 * cap : 65536;
+      buf = realloc(buf, cap);
+      if (buf == NULL)
+        return 1;
+    }
+    size_t n = fread(buf + size, 1, cap - size, in);
+    if (n == 0)
+      break;
+    size += n;
+  }
+
+  if (!json)
+    printf("cycles,time_us,type,id,name,value,extra\n");
+
+  while (i + 5 <= size) {
+    size_t len = buf[i + 2];
+    uint16_t crc;
+
+    if (buf[i] != TRACE_SYNC || i + 5 + len > size) {
+      if (echo_text)
+        fputc(buf[i], stderr);
+      skipped++;
+      i++;
+      continue;
+    }
+    crc = trace_crc16(&buf[i + 1], 2 + len);
+    if (crc != ((buf[i + 3 + len] << 8) | buf[i + 4 + len]) ||
+        decode(buf[i + 1], &buf[i + 3], len, &t, &hz) != 0) {
+      crc_errors++;
+      skipped++;
+      i++;
+      continue;
+    }
+    frames++;
+    i += 5 + len;
+  }
+  skipped += size - i;
+
+  fprintf(stderr, "%lu records, %lu bad candidates, %lu bytes outside records\n",
+          frames, crc_errors, skipped);
+  free(buf);
+  return 0;
+}
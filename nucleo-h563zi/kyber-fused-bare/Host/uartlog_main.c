@@ -0,0 +1,161 @@
+/*
+ * uartlog_main.c
+ *
+ * Host (Linux) run of the UART logger against the simulated UART. Producer
+ * threads, each with its own channel, emit Kyber-demo-sized bursts of hex
+ * lines and then idle; the run reports how long producers spent inside the
+ * logger, what was dropped, and the throughput the simulated line achieved.
+ *
+ * usage: uartlog_host [baud] [producers] [bursts] [burst_bytes] [period_ms] [ring_bytes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "uartlog.h"
+
+#define MAX_PRODUCERS 16
+#define LINE_HEX 64	/* hex digits per line, plus a prefix and '\n' */
+
+typedef struct {
+  int id;
+  uartlog_chan chan;
+  char name[16];	/* "task%d" of any int */
+  uint8_t *ring;
+  uint64_t write_ns;	/* time spent in uartlog_write */
+  uint64_t write_max_ns;
+  uint32_t writes;
+} producer;
+
+static uint32_t baud = 115200;
+static int n_producers = 2;
+static int bursts = 3;
+static int burst_bytes = 5 * 1024;	/* ~ one Kyber768 key/ciphertext dump */
+static int period_ms = 500;
+static uint32_t ring_bytes = 4096;
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *producer_main(void *arg)
+{
+  producer *p = arg;
+  char line[LINE_HEX + 16];
+  uint32_t x = 0x9e3779b9u * (p->id + 1);
+
+  for (int b = 0; b < bursts; b++) {
+    int sent = 0;
+
+    for (int l = 0; sent < burst_bytes; l++) {
+      int n = snprintf(line, sizeof(line), "[%s] ", p->name);
+      for (int i = 0; i < LINE_HEX; i++) {
+        x = x * 1664525u + 1013904223u;
+        line[n++] = "0123456789abcdef"[x >> 28];
+      }
+      line[n++] = '\n';
+
+      uint64_t t0 = now_ns();
+      uartlog_write(&p->chan, line, n);
+      uint64_t dt = now_ns() - t0;
+
+      p->write_ns += dt;
+      if (dt > p->write_max_ns)
+        p->write_max_ns = dt;
+      p->writes++;
+      sent += n;
+    }
+    nanosleep(&(struct timespec){ period_ms / 1000, (period_ms % 1000) * 1000000L }, NULL);
+  }
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  static producer prod[MAX_PRODUCERS];
+  pthread_t th[MAX_PRODUCERS];
+  uartlog_port port;
+  uint64_t t0, t_prod, t_drain, accepted = 0, dropped = 0, busy_ns = 0, max_ns = 0, writes = 0;
+  FILE *devnull;
+
+  if (argc > 1) baud = strtoul(argv[1], NULL, 0);
+  if (argc > 2) n_producers = atoi(argv[2]);
+  if (argc > 3) bursts = atoi(argv[3]);
+  if (argc > 4) burst_bytes = atoi(argv[4]);
+  if (argc > 5) period_ms = atoi(argv[5]);
+  if (argc > 6) ring_bytes = strtoul(argv[6], NULL, 0);
+  if (n_producers < 1 || n_producers > MAX_PRODUCERS || baud == 0) {
+    fprintf(stderr, "usage: %s [baud] [producers<=%d] [bursts] [burst_bytes] [period_ms] [ring_bytes]\n",
+            argv[0], MAX_PRODUCERS);
+    return 1;
+  }
+
+  /* The transmitted bytes are not interesting here, only their timing */
+  devnull = fopen("/dev/null", "w");
+  port.baud = baud;
+  port.sink = devnull;
+  uartlog_init(&port);
+
+  for (int i = 0; i < n_producers; i++) {
+    prod[i].id = i;
+    snprintf(prod[i].name, sizeof(prod[i].name), "task%d", i);
+    prod[i].ring = malloc(ring_bytes);
+    if (prod[i].ring == NULL ||
+        uartlog_chan_init(&prod[i].chan, prod[i].name, prod[i].ring, ring_bytes) != 0) {
+      fprintf(stderr, "ring_bytes must be a power of two\n");
+      return 1;
+    }
+  }
+
+  printf("[TEST] %d producers x %d bursts of %d bytes every %d ms, %lu baud, %lu-byte rings\n",
+         n_producers, bursts, burst_bytes, period_ms, (unsigned long) baud, (unsigned long) ring_bytes);
+
+  t0 = now_ns();
+  for (int i = 0; i < n_producers; i++)
+    pthread_create(&th[i], NULL, producer_main, &prod[i]);
+  for (int i = 0; i < n_producers; i++)
+    pthread_join(th[i], NULL);
+  t_prod = now_ns() - t0;
+  uartlog_flush();
+  t_drain = now_ns() - t0;
+
+  printf("%-10s %10s %10s %8s %8s %12s %12s\n", "channel", "written", "dropped", "msgs",
+         "peak", "avg ns/wr", "max ns/wr");
+  for (int i = 0; i < n_producers; i++) {
+    producer *p = &prod[i];
+
+    printf("%-10s %10lu %10lu %8lu %8lu %12llu %12llu\n", p->name,
+           (unsigned long) p->chan.written, (unsigned long) p->chan.dropped,
+           (unsigned long) p->chan.dropped_msgs, (unsigned long) p->chan.peak,
+           (unsigned long long) (p->writes ? p->write_ns / p->writes : 0),
+           (unsigned long long) p->write_max_ns);
+    accepted += p->chan.written;
+    dropped += p->chan.dropped;
+    busy_ns += p->write_ns;
+    writes += p->writes;
+    if (p->write_max_ns > max_ns)
+      max_ns = p->write_max_ns;
+  }
+
+  printf("producers done after %.3f s, UART drained after %.3f s\n", t_prod / 1e9, t_drain / 1e9);
+  printf("throughput %.0f B/s (line rate %lu B/s), %.1f%% of offered bytes dropped\n",
+         uartlog_sent() / (t_drain / 1e9), (unsigned long) (baud / 10),
+         100.0 * dropped / (accepted + dropped ? accepted + dropped : 1));
+  printf("producers spent %.3f ms in the logger (%llu writes); a blocking putchar would spend %.3f s\n",
+         busy_ns / 1e6, (unsigned long long) writes, accepted * 10.0 / baud);
+
+  if (uartlog_sent() == accepted && max_ns < 1000000ULL * period_ms) {
+    printf("[PASS] Every accepted byte was sent, drops are accounted for\n");
+    return 0;
+  }
+  printf("[FAIL] sent %lu bytes, accepted %llu\n", (unsigned long) uartlog_sent(),
+         (unsigned long long) accepted);
+  return 1;
+}
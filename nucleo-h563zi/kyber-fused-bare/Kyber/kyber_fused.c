@@ -1,5 +1,6 @@
 #include "kyber_fused.h"
 //#include "randombytes.h"
+#include "prof.h"  // HSO: cycle probes, no-ops unless PROF_ENABLE is defined
 
 #define KYBERFUSE_STATIC static
 
@@ -87,6 +88,7 @@ KYBERFUSE_STATIC void kyber_aes256ctr_prf(uint8_t *out, size_t outlen, const uin
 // end of symmetric-aes.c
 
 //__KYBER_FUSE__: extracted from symmetric-shake.c
+#ifndef KYBER_90S  // HSO: only built for the SHAKE backend, as upstream does
 /*************************************************
 * Name:        kyber_shake128_absorb
 *
@@ -131,6 +133,7 @@ KYBERFUSE_STATIC void kyber_shake256_prf(uint8_t *out, size_t outlen, const uint
 
   shake256(out, outlen, extkey, sizeof(extkey));
 }
+#endif  /* KYBER_90S */
 // end of symmetric-shake.c
 
 //__KYBER_FUSE__: extracted from reduce.c
@@ -253,6 +256,7 @@ KYBERFUSE_STATIC void ntt(int16_t r[256]) {
   unsigned int len, start, j, k;
   int16_t t, zeta;
 
+  PROF_START(NTT);
   k = 1;
   for(len = 128; len >= 2; len >>= 1) {
     for(start = 0; start < 256; start = j + len) {
@@ -264,6 +268,7 @@ KYBERFUSE_STATIC void ntt(int16_t r[256]) {
       }
     }
   }
+  PROF_STOP(NTT);
 }
 
 /*************************************************
@@ -280,6 +285,7 @@ KYBERFUSE_STATIC void invntt(int16_t r[256]) {
   int16_t t, zeta;
   const int16_t f = 1441; // mont^2/128
 
+  PROF_START(INVNTT);
   k = 127;
   for(len = 2; len <= 128; len <<= 1) {
     for(start = 0; start < 256; start = j + len) {
@@ -295,6 +301,7 @@ KYBERFUSE_STATIC void invntt(int16_t r[256]) {
 
   for(j = 0; j < 256; j++)
     r[j] = fqmul(r[j], f);
+  PROF_STOP(INVNTT);
 }
 
 /*************************************************
@@ -426,6 +433,7 @@ static void cbd3(poly *r, const uint8_t buf[3*KYBER_N/4])
 
 KYBERFUSE_STATIC void poly_cbd_eta1(poly *r, const uint8_t buf[KYBER_ETA1*KYBER_N/4])
 {
+  PROF_START(CBD);
 #if KYBER_ETA1 == 2
   cbd2(r, buf);
 #elif KYBER_ETA1 == 3
@@ -433,18 +441,110 @@ KYBERFUSE_STATIC void poly_cbd_eta1(poly *r, const uint8_t buf[KYBER_ETA1*KYBER_
 #else
 #error "This implementation requires eta1 in {2,3}"
 #endif
+  PROF_STOP(CBD);
 }
 
 KYBERFUSE_STATIC void poly_cbd_eta2(poly *r, const uint8_t buf[KYBER_ETA2*KYBER_N/4])
 {
+  PROF_START(CBD);
 #if KYBER_ETA2 == 2
   cbd2(r, buf);
 #else
 #error "This implementation requires eta2 = 2"
 #endif
+  PROF_STOP(CBD);
 }
 // end of cbd.c
 
+//__KYBER_FUSE__: division-free compression kernels (HSO)
+/*
+ * HSO: the reference code computes round(2^d * u / q) as
+ * ((u << d) + KYBER_Q/2)/KYBER_Q, which compiles to UDIV on Cortex-M.
+ * UDIV has an operand-dependent latency (2-12 cycles on the M3/M33), so it
+ * leaks the coefficients being compressed. The kernels below replace it by
+ * 32-bit MUL and shifts only, which are single-cycle on both cores; UMULL is
+ * avoided on purpose since it terminates early on the M3.
+ *
+ * Constants were searched for, and are checked by kyber_compress_selftest(),
+ * over all inputs u in {0,...,q-1}.
+ */
+
+/*************************************************
+* Name:        compress_d1, compress_d4, compress_d5
+*
+* Description: Compute round(2^d * u / q) mod 2^d for d in {1,4,5} as
+*              (((u << d) + q/2) * m) >> s, with m = ceil(2^s / q)
+*
+* Arguments:   - uint32_t u: standard representative in {0,...,q-1}
+*
+* Returns compressed value in {0,...,2^d - 1}
+**************************************************/
+static inline uint32_t compress_d1(uint32_t u)
+{
+  return ((((u << 1) + KYBER_Q/2) * 315) >> 20) & 1;
+}
+
+static inline uint32_t compress_d4(uint32_t u)
+{
+  return ((((u << 4) + KYBER_Q/2) * 20159) >> 26) & 15;
+}
+
+static inline uint32_t compress_d5(uint32_t u)
+{
+  return ((((u << 5) + KYBER_Q/2) * 20159) >> 26) & 31;
+}
+
+/*************************************************
+* Name:        compress_d10, compress_d11
+*
+* Description: Compute round(2^d * u / q) mod 2^d for d in {10,11}.
+*              An exact 32-bit multiplier does not exist for these numerators,
+*              so the quotient is estimated from below (off by at most one)
+*              and fixed up with a branch-free conditional increment
+*
+* Arguments:   - uint32_t u: standard representative in {0,...,q-1}
+*
+* Returns compressed value in {0,...,2^d - 1}
+**************************************************/
+static inline uint32_t compress_d10(uint32_t u)
+{
+  uint32_t n, t, r;
+
+  n  = (u << 10) + KYBER_Q/2;
+  t  = (n * 1259) >> 22;
+  r  = n - t*KYBER_Q;
+  t += (uint32_t)((int32_t)(KYBER_Q - 1 - r) >> 31) & 1;
+  return t & 0x3ff;
+}
+
+static inline uint32_t compress_d11(uint32_t u)
+{
+  uint32_t n, t, r;
+
+  n  = (u << 11) + KYBER_Q/2;
+  t  = ((n >> 2) * 2519) >> 21;
+  r  = n - t*KYBER_Q;
+  t += (uint32_t)((int32_t)(KYBER_Q - 1 - r) >> 31) & 1;
+  return t & 0x7ff;
+}
+
+/*************************************************
+* Name:        decompress_d
+*
+* Description: Compute round(q * t / 2^d); already division-free in the
+*              reference code, factored out so that every d shares it
+*
+* Arguments:   - uint32_t t: compressed value in {0,...,2^d - 1}
+*              - unsigned int d: number of bits in {1,4,5,10,11}
+*
+* Returns coefficient in {0,...,q-1}
+**************************************************/
+static inline int16_t decompress_d(uint32_t t, unsigned int d)
+{
+  return (t*KYBER_Q + (1U << (d - 1))) >> d;
+}
+// end of compression kernels
+
 //__KYBER_FUSE__: extracted from poly.c
 KYBERFUSE_STATIC void poly_reduce(poly *r);  // HSO: workaround since this is called before the implementation
 
@@ -469,7 +569,7 @@ KYBERFUSE_STATIC void poly_compress(uint8_t r[KYBER_POLYCOMPRESSEDBYTES], const
       // map to positive standard representatives
       u  = a->coeffs[8*i+j];
       u += (u >> 15) & KYBER_Q;
-      t[j] = ((((uint16_t)u << 4) + KYBER_Q/2)/KYBER_Q) & 15;
+      t[j] = compress_d4(u);
     }
 
     r[0] = t[0] | (t[1] << 4);
@@ -484,7 +584,7 @@ KYBERFUSE_STATIC void poly_compress(uint8_t r[KYBER_POLYCOMPRESSEDBYTES], const
       // map to positive standard representatives
       u  = a->coeffs[8*i+j];
       u += (u >> 15) & KYBER_Q;
-      t[j] = ((((uint32_t)u << 5) + KYBER_Q/2)/KYBER_Q) & 31;
+      t[j] = compress_d5(u);
     }
 
     r[0] = (t[0] >> 0) | (t[1] << 5);
@@ -515,8 +615,8 @@ KYBERFUSE_STATIC void poly_decompress(poly *r, const uint8_t a[KYBER_POLYCOMPRES
 
 #if (KYBER_POLYCOMPRESSEDBYTES == 128)
   for(i=0;i<KYBER_N/2;i++) {
-    r->coeffs[2*i+0] = (((uint16_t)(a[0] & 15)*KYBER_Q) + 8) >> 4;
-    r->coeffs[2*i+1] = (((uint16_t)(a[0] >> 4)*KYBER_Q) + 8) >> 4;
+    r->coeffs[2*i+0] = decompress_d(a[0] & 15, 4);
+    r->coeffs[2*i+1] = decompress_d(a[0] >> 4, 4);
     a += 1;
   }
 #elif (KYBER_POLYCOMPRESSEDBYTES == 160)
@@ -534,7 +634,7 @@ KYBERFUSE_STATIC void poly_decompress(poly *r, const uint8_t a[KYBER_POLYCOMPRES
     a += 5;
 
     for(j=0;j<8;j++)
-      r->coeffs[8*i+j] = ((uint32_t)(t[j] & 31)*KYBER_Q + 16) >> 5;
+      r->coeffs[8*i+j] = decompress_d(t[j] & 31, 5);
   }
 #else
 #error "KYBER_POLYCOMPRESSEDBYTES needs to be in {128, 160}"
@@ -629,7 +729,7 @@ KYBERFUSE_STATIC void poly_tomsg(uint8_t msg[KYBER_INDCPA_MSGBYTES], const poly
     for(j=0;j<8;j++) {
       t  = a->coeffs[8*i+j];
       t += ((int16_t)t >> 15) & KYBER_Q;
-      t  = (((t << 1) + KYBER_Q/2)/KYBER_Q) & 1;
+      t  = compress_d1(t);
       msg[i] |= t << j;
     }
   }
@@ -806,7 +906,7 @@ KYBERFUSE_STATIC void polyvec_compress(uint8_t r[KYBER_POLYVECCOMPRESSEDBYTES],
       for(k=0;k<8;k++) {
         t[k]  = a->vec[i].coeffs[8*j+k];
         t[k] += ((int16_t)t[k] >> 15) & KYBER_Q;
-        t[k]  = ((((uint32_t)t[k] << 11) + KYBER_Q/2)/KYBER_Q) & 0x7ff;
+        t[k]  = compress_d11(t[k]);
       }
 
       r[ 0] = (t[0] >>  0);
@@ -830,7 +930,7 @@ KYBERFUSE_STATIC void polyvec_compress(uint8_t r[KYBER_POLYVECCOMPRESSEDBYTES],
       for(k=0;k<4;k++) {
         t[k]  = a->vec[i].coeffs[4*j+k];
         t[k] += ((int16_t)t[k] >> 15) & KYBER_Q;
-        t[k]  = ((((uint32_t)t[k] << 10) + KYBER_Q/2)/ KYBER_Q) & 0x3ff;
+        t[k]  = compress_d10(t[k]);
       }
 
       r[0] = (t[0] >> 0);
@@ -875,7 +975,7 @@ KYBERFUSE_STATIC void polyvec_decompress(polyvec *r, const uint8_t a[KYBER_POLYV
       a += 11;
 
       for(k=0;k<8;k++)
-        r->vec[i].coeffs[8*j+k] = ((uint32_t)(t[k] & 0x7FF)*KYBER_Q + 1024) >> 11;
+        r->vec[i].coeffs[8*j+k] = decompress_d(t[k] & 0x7FF, 11);
     }
   }
 #elif (KYBER_POLYVECCOMPRESSEDBYTES == (KYBER_K * 320))
@@ -889,7 +989,7 @@ KYBERFUSE_STATIC void polyvec_decompress(polyvec *r, const uint8_t a[KYBER_POLYV
       a += 5;
 
       for(k=0;k<4;k++)
-        r->vec[i].coeffs[4*j+k] = ((uint32_t)(t[k] & 0x3FF)*KYBER_Q + 512) >> 10;
+        r->vec[i].coeffs[4*j+k] = decompress_d(t[k] & 0x3FF, 10);
     }
   }
 #else
@@ -1033,9 +1133,11 @@ static void pack_pk(uint8_t r[KYBER_INDCPA_PUBLICKEYBYTES],
                     const uint8_t seed[KYBER_SYMBYTES])
 {
   size_t i;
+  PROF_START(PACK);
   polyvec_tobytes(r, pk);
   for(i=0;i<KYBER_SYMBYTES;i++)
     r[i+KYBER_POLYVECBYTES] = seed[i];
+  PROF_STOP(PACK);
 }
 
 /*************************************************
@@ -1053,9 +1155,11 @@ static void unpack_pk(polyvec *pk,
                       const uint8_t packedpk[KYBER_INDCPA_PUBLICKEYBYTES])
 {
   size_t i;
+  PROF_START(UNPACK);
   polyvec_frombytes(pk, packedpk);
   for(i=0;i<KYBER_SYMBYTES;i++)
     seed[i] = packedpk[i+KYBER_POLYVECBYTES];
+  PROF_STOP(UNPACK);
 }
 
 /*************************************************
@@ -1068,7 +1172,9 @@ static void unpack_pk(polyvec *pk,
 **************************************************/
 static void pack_sk(uint8_t r[KYBER_INDCPA_SECRETKEYBYTES], polyvec *sk)
 {
+  PROF_START(PACK);
   polyvec_tobytes(r, sk);
+  PROF_STOP(PACK);
 }
 
 /*************************************************
@@ -1081,7 +1187,9 @@ static void pack_sk(uint8_t r[KYBER_INDCPA_SECRETKEYBYTES], polyvec *sk)
 **************************************************/
 static void unpack_sk(polyvec *sk, const uint8_t packedsk[KYBER_INDCPA_SECRETKEYBYTES])
 {
+  PROF_START(UNPACK);
   polyvec_frombytes(sk, packedsk);
+  PROF_STOP(UNPACK);
 }
 
 /*************************************************
@@ -1097,8 +1205,10 @@ static void unpack_sk(polyvec *sk, const uint8_t packedsk[KYBER_INDCPA_SECRETKEY
 **************************************************/
 static void pack_ciphertext(uint8_t r[KYBER_INDCPA_BYTES], polyvec *b, poly *v)
 {
+  PROF_START(PACK);
   polyvec_compress(r, b);
   poly_compress(r+KYBER_POLYVECCOMPRESSEDBYTES, v);
+  PROF_STOP(PACK);
 }
 
 /*************************************************
@@ -1113,8 +1223,10 @@ static void pack_ciphertext(uint8_t r[KYBER_INDCPA_BYTES], polyvec *b, poly *v)
 **************************************************/
 static void unpack_ciphertext(polyvec *b, poly *v, const uint8_t c[KYBER_INDCPA_BYTES])
 {
+  PROF_START(UNPACK);
   polyvec_decompress(b, c);
   poly_decompress(v, c+KYBER_POLYVECCOMPRESSEDBYTES);
+  PROF_STOP(UNPACK);
 }
 
 /*************************************************
@@ -1169,35 +1281,45 @@ static unsigned int rej_uniform(int16_t *r,
 *              - int transposed: boolean deciding whether A or A^T is generated
 **************************************************/
 #define GEN_MATRIX_NBLOCKS ((12*KYBER_N/8*(1 << 12)/KYBER_Q + XOF_BLOCKBYTES)/XOF_BLOCKBYTES)
-// Not static for benchmarking
-KYBERFUSE_STATIC void gen_matrix(polyvec *a, const uint8_t seed[KYBER_SYMBYTES], int transposed)
+// HSO: one entry per call, so that the stepped KEM can generate them one by one
+static void gen_matrix_entry(poly *r, const uint8_t seed[KYBER_SYMBYTES], uint8_t x, uint8_t y)
 {
-  unsigned int ctr, i, j, k;
+  unsigned int ctr, k;
   unsigned int buflen, off;
   uint8_t buf[GEN_MATRIX_NBLOCKS*XOF_BLOCKBYTES+2];
   xof_state state;
 
+  xof_absorb(&state, seed, x, y);
+
+  xof_squeezeblocks(buf, GEN_MATRIX_NBLOCKS, &state);
+  buflen = GEN_MATRIX_NBLOCKS*XOF_BLOCKBYTES;
+  ctr = rej_uniform(r->coeffs, KYBER_N, buf, buflen);
+
+  while(ctr < KYBER_N) {
+    off = buflen % 3;
+    for(k = 0; k < off; k++)
+      buf[k] = buf[buflen - off + k];
+    xof_squeezeblocks(buf + off, 1, &state);
+    buflen = off + XOF_BLOCKBYTES;
+    ctr += rej_uniform(r->coeffs + ctr, KYBER_N - ctr, buf, buflen);
+  }
+}
+
+// Not static for benchmarking
+KYBERFUSE_STATIC void gen_matrix(polyvec *a, const uint8_t seed[KYBER_SYMBYTES], int transposed)
+{
+  unsigned int i, j;
+
+  PROF_START(GEN_MATRIX);
   for(i=0;i<KYBER_K;i++) {
     for(j=0;j<KYBER_K;j++) {
       if(transposed)
-        xof_absorb(&state, seed, i, j);
+        gen_matrix_entry(&a[i].vec[j], seed, i, j);
       else
-        xof_absorb(&state, seed, j, i);
-
-      xof_squeezeblocks(buf, GEN_MATRIX_NBLOCKS, &state);
-      buflen = GEN_MATRIX_NBLOCKS*XOF_BLOCKBYTES;
-      ctr = rej_uniform(a[i].vec[j].coeffs, KYBER_N, buf, buflen);
-
-      while(ctr < KYBER_N) {
-        off = buflen % 3;
-        for(k = 0; k < off; k++)
-          buf[k] = buf[buflen - off + k];
-        xof_squeezeblocks(buf + off, 1, &state);
-        buflen = off + XOF_BLOCKBYTES;
-        ctr += rej_uniform(a[i].vec[j].coeffs + ctr, KYBER_N - ctr, buf, buflen);
-      }
+        gen_matrix_entry(&a[i].vec[j], seed, j, i);
     }
   }
+  PROF_STOP(GEN_MATRIX);
 }
 
 /*************************************************
@@ -1403,6 +1525,7 @@ KYBERFUSE_STATIC void cmov(uint8_t *r, const uint8_t *x, size_t len, uint8_t b)
 int crypto_kem_keypair(uint8_t *pk, uint8_t *sk, void (*f_rng)(uint8_t *, size_t))
 {
   size_t i;
+  PROF_START(KEM_KEYPAIR);
   indcpa_keypair(pk, sk, f_rng);
   for(i=0;i<KYBER_INDCPA_PUBLICKEYBYTES;i++)
     sk[i+KYBER_INDCPA_SECRETKEYBYTES] = pk[i];
@@ -1411,6 +1534,7 @@ int crypto_kem_keypair(uint8_t *pk, uint8_t *sk, void (*f_rng)(uint8_t *, size_t
   // HSO: replaced by a pointer function to provide external RNG providers
   //  randombytes(sk+KYBER_SECRETKEYBYTES-KYBER_SYMBYTES, KYBER_SYMBYTES);
   f_rng(sk+KYBER_SECRETKEYBYTES-KYBER_SYMBYTES, KYBER_SYMBYTES);
+  PROF_STOP(KEM_KEYPAIR);
   return 0;
 }
 
@@ -1436,6 +1560,7 @@ int crypto_kem_enc(uint8_t *ct, uint8_t *ss, const uint8_t *pk, void (*f_rng)(ui
   /* Will contain key, coins */
   uint8_t kr[2*KYBER_SYMBYTES];
 
+  PROF_START(KEM_ENC);
   // HSO: replaced by a pointer function to provide external RNG providers
   // randombytes(buf, KYBER_SYMBYTES);
   f_rng(buf, KYBER_SYMBYTES);
@@ -1453,6 +1578,7 @@ int crypto_kem_enc(uint8_t *ct, uint8_t *ss, const uint8_t *pk, void (*f_rng)(ui
   hash_h(kr+KYBER_SYMBYTES, ct, KYBER_CIPHERTEXTBYTES);
   /* hash concatenation of pre-k and H(c) to k */
   kdf(ss, kr, 2*KYBER_SYMBYTES);
+  PROF_STOP(KEM_ENC);
   return 0;
 }
 
@@ -1485,6 +1611,7 @@ int crypto_kem_dec(uint8_t *ss,
   uint8_t cmp[KYBER_CIPHERTEXTBYTES];
   const uint8_t *pk = sk+KYBER_INDCPA_SECRETKEYBYTES;
 
+  PROF_START(KEM_DEC);
   indcpa_dec(buf, ct, sk);
 
   /* Multitarget countermeasure for coins + contributory KEM */
@@ -1505,6 +1632,411 @@ int crypto_kem_dec(uint8_t *ss,
 
   /* hash concatenation of pre-k and H(c) to k */
   kdf(ss, kr, 2*KYBER_SYMBYTES);
+  PROF_STOP(KEM_DEC);
   return 0;
 }
 // end of kem.c
+
+//__KYBER_FUSE__: stepped KEM (HSO)
+/*
+ * Each unit below is one statement group of indcpa_keypair/enc/dec or of
+ * crypto_kem_keypair/enc/dec, in the same order and on the same data, so
+ * that the outputs match bit for bit. A polynomial of the context is an
+ * int16_t[KYBER_N] row, with the layout of poly (and a row of rows, that of
+ * polyvec).
+ */
+enum {
+  STEP_DONE,
+  STEP_KP_SEED, STEP_KP_GEN, STEP_KP_NOISE, STEP_KP_NTT, STEP_KP_MUL, STEP_KP_PACK, STEP_KP_HASH,
+  STEP_ENC_SEED, STEP_ENC_HASH,
+  STEP_DEC_UNPACK, STEP_DEC_NTT, STEP_DEC_MUL, STEP_DEC_MSG,
+  STEP_CPA_UNPACK, STEP_CPA_GEN, STEP_CPA_NOISE, STEP_CPA_NTT, STEP_CPA_MUL, STEP_CPA_INVNTT, STEP_CPA_PACK,
+  STEP_ENC_KDF, STEP_DEC_KDF
+};
+
+#define STEP_P(x)  ((poly *)(x))
+#define STEP_PV(x) ((polyvec *)(x))
+
+/*************************************************
+* Name:        step_unit
+*
+* Description: Run the next unit of the operation in ctx
+*
+* Arguments:   - kyber_step_ctx *ctx: pointer to the operation
+**************************************************/
+static void step_unit(kyber_step_ctx *ctx)
+{
+  unsigned int i = ctx->i;
+  unsigned int next = ctx->phase;
+  int fail;
+
+  switch(ctx->phase) {
+    case STEP_KP_SEED:
+      ctx->f_rng(ctx->buf, KYBER_SYMBYTES);
+      hash_g(ctx->buf, ctx->buf, KYBER_SYMBYTES);
+      next = STEP_KP_GEN;
+      break;
+    case STEP_KP_GEN:
+      gen_matrix_entry(&STEP_PV(ctx->a[i/KYBER_K])->vec[i%KYBER_K], ctx->buf, i%KYBER_K, i/KYBER_K);
+      if(++i == KYBER_K*KYBER_K)
+        next = STEP_KP_NOISE;
+      break;
+    case STEP_KP_NOISE:
+      poly_getnoise_eta1(i < KYBER_K ? STEP_P(ctx->s[i]) : STEP_P(ctx->e[i-KYBER_K]), ctx->buf+KYBER_SYMBYTES, i);
+      if(++i == 2*KYBER_K)
+        next = STEP_KP_NTT;
+      break;
+    case STEP_KP_NTT:
+      poly_ntt(i < KYBER_K ? STEP_P(ctx->s[i]) : STEP_P(ctx->e[i-KYBER_K]));
+      if(++i == 2*KYBER_K)
+        next = STEP_KP_MUL;
+      break;
+    case STEP_KP_MUL:
+      polyvec_basemul_acc_montgomery(STEP_P(ctx->t[i]), STEP_PV(ctx->a[i]), STEP_PV(ctx->s));
+      poly_tomont(STEP_P(ctx->t[i]));
+      if(++i == KYBER_K)
+        next = STEP_KP_PACK;
+      break;
+    case STEP_KP_PACK:
+      polyvec_add(STEP_PV(ctx->t), STEP_PV(ctx->t), STEP_PV(ctx->e));
+      polyvec_reduce(STEP_PV(ctx->t));
+      pack_sk(ctx->sk_out, STEP_PV(ctx->s));
+      pack_pk(ctx->pk_out, STEP_PV(ctx->t), ctx->buf);
+      next = STEP_KP_HASH;
+      break;
+    case STEP_KP_HASH:
+      for(i=0;i<KYBER_INDCPA_PUBLICKEYBYTES;i++)
+        ctx->sk_out[i+KYBER_INDCPA_SECRETKEYBYTES] = ctx->pk_out[i];
+      hash_h(ctx->sk_out+KYBER_SECRETKEYBYTES-2*KYBER_SYMBYTES, ctx->pk_out, KYBER_PUBLICKEYBYTES);
+      ctx->f_rng(ctx->sk_out+KYBER_SECRETKEYBYTES-KYBER_SYMBYTES, KYBER_SYMBYTES);
+      next = STEP_DONE;
+      break;
+
+    case STEP_ENC_SEED:
+      ctx->f_rng(ctx->buf, KYBER_SYMBYTES);
+      hash_h(ctx->buf, ctx->buf, KYBER_SYMBYTES);
+      next = STEP_ENC_HASH;
+      break;
+    case STEP_ENC_HASH:
+      hash_h(ctx->buf+KYBER_SYMBYTES, ctx->pk, KYBER_PUBLICKEYBYTES);
+      hash_g(ctx->kr, ctx->buf, 2*KYBER_SYMBYTES);
+      next = STEP_CPA_UNPACK;
+      break;
+
+    case STEP_DEC_UNPACK:
+      unpack_ciphertext(STEP_PV(ctx->u), STEP_P(ctx->v), ctx->ct);
+      unpack_sk(STEP_PV(ctx->s), ctx->sk);
+      next = STEP_DEC_NTT;
+      break;
+    case STEP_DEC_NTT:
+      poly_ntt(STEP_P(ctx->u[i]));
+      if(++i == KYBER_K)
+        next = STEP_DEC_MUL;
+      break;
+    case STEP_DEC_MUL:
+      polyvec_basemul_acc_montgomery(STEP_P(ctx->k), STEP_PV(ctx->s), STEP_PV(ctx->u));
+      poly_invntt_tomont(STEP_P(ctx->k));
+      next = STEP_DEC_MSG;
+      break;
+    case STEP_DEC_MSG:
+      poly_sub(STEP_P(ctx->k), STEP_P(ctx->v), STEP_P(ctx->k));
+      poly_reduce(STEP_P(ctx->k));
+      poly_tomsg(ctx->buf, STEP_P(ctx->k));
+      for(i=0;i<KYBER_SYMBYTES;i++)
+        ctx->buf[KYBER_SYMBYTES+i] = ctx->sk[KYBER_SECRETKEYBYTES-2*KYBER_SYMBYTES+i];
+      hash_g(ctx->kr, ctx->buf, 2*KYBER_SYMBYTES);
+      next = STEP_CPA_UNPACK;
+      break;
+
+    /* indcpa_enc of buf with the coins in kr+KYBER_SYMBYTES, for enc and dec */
+    case STEP_CPA_UNPACK:
+      unpack_pk(STEP_PV(ctx->t), ctx->seed, ctx->pk);
+      poly_frommsg(STEP_P(ctx->k), ctx->buf);
+      next = STEP_CPA_GEN;
+      break;
+    case STEP_CPA_GEN:
+      gen_matrix_entry(&STEP_PV(ctx->a[i/KYBER_K])->vec[i%KYBER_K], ctx->seed, i/KYBER_K, i%KYBER_K);
+      if(++i == KYBER_K*KYBER_K)
+        next = STEP_CPA_NOISE;
+      break;
+    case STEP_CPA_NOISE:
+      if(i < KYBER_K)
+        poly_getnoise_eta1(STEP_P(ctx->s[i]), ctx->kr+KYBER_SYMBYTES, i);
+      else if(i < 2*KYBER_K)
+        poly_getnoise_eta2(STEP_P(ctx->e[i-KYBER_K]), ctx->kr+KYBER_SYMBYTES, i);
+      else
+        poly_getnoise_eta2(STEP_P(ctx->epp), ctx->kr+KYBER_SYMBYTES, i);
+      if(++i == 2*KYBER_K+1)
+        next = STEP_CPA_NTT;
+      break;
+    case STEP_CPA_NTT:
+      poly_ntt(STEP_P(ctx->s[i]));
+      if(++i == KYBER_K)
+        next = STEP_CPA_MUL;
+      break;
+    case STEP_CPA_MUL:
+      if(i < KYBER_K)
+        polyvec_basemul_acc_montgomery(STEP_P(ctx->u[i]), STEP_PV(ctx->a[i]), STEP_PV(ctx->s));
+      else
+        polyvec_basemul_acc_montgomery(STEP_P(ctx->v), STEP_PV(ctx->t), STEP_PV(ctx->s));
+      if(++i == KYBER_K+1)
+        next = STEP_CPA_INVNTT;
+      break;
+    case STEP_CPA_INVNTT:
+      poly_invntt_tomont(i < KYBER_K ? STEP_P(ctx->u[i]) : STEP_P(ctx->v));
+      if(++i == KYBER_K+1)
+        next = STEP_CPA_PACK;
+      break;
+    case STEP_CPA_PACK:
+      polyvec_add(STEP_PV(ctx->u), STEP_PV(ctx->u), STEP_PV(ctx->e));
+      poly_add(STEP_P(ctx->v), STEP_P(ctx->v), STEP_P(ctx->epp));
+      poly_add(STEP_P(ctx->v), STEP_P(ctx->v), STEP_P(ctx->k));
+      polyvec_reduce(STEP_PV(ctx->u));
+      poly_reduce(STEP_P(ctx->v));
+      if(ctx->op == STEP_DEC_UNPACK) {
+        pack_ciphertext(ctx->cmp, STEP_PV(ctx->u), STEP_P(ctx->v));
+        next = STEP_DEC_KDF;
+      } else {
+        pack_ciphertext(ctx->ct_out, STEP_PV(ctx->u), STEP_P(ctx->v));
+        next = STEP_ENC_KDF;
+      }
+      break;
+
+    case STEP_ENC_KDF:
+      hash_h(ctx->kr+KYBER_SYMBYTES, ctx->ct_out, KYBER_CIPHERTEXTBYTES);
+      kdf(ctx->ss_out, ctx->kr, 2*KYBER_SYMBYTES);
+      next = STEP_DONE;
+      break;
+    case STEP_DEC_KDF:
+      fail = verify(ctx->ct, ctx->cmp, KYBER_CIPHERTEXTBYTES);
+      hash_h(ctx->kr+KYBER_SYMBYTES, ctx->ct, KYBER_CIPHERTEXTBYTES);
+      cmov(ctx->kr, ctx->sk+KYBER_SECRETKEYBYTES-KYBER_SYMBYTES, KYBER_SYMBYTES, fail);
+      kdf(ctx->ss_out, ctx->kr, 2*KYBER_SYMBYTES);
+      next = STEP_DONE;
+      break;
+    default:
+      next = STEP_DONE;
+      break;
+  }
+
+  ctx->i = next == ctx->phase ? i : 0;
+  ctx->phase = next;
+}
+
+/*************************************************
+* Name:        crypto_kem_keypair_start
+*
+* Description: Start crypto_kem_keypair in ctx
+*
+* Arguments:   - kyber_step_ctx *ctx: pointer to the operation
+*              - uint8_t *pk, uint8_t *sk, f_rng: as crypto_kem_keypair,
+*                the buffers must stay valid until crypto_kem_step returns 0
+**************************************************/
+void crypto_kem_keypair_start(kyber_step_ctx *ctx, uint8_t *pk, uint8_t *sk, void (*f_rng)(uint8_t *, size_t))
+{
+  ctx->op = ctx->phase = STEP_KP_SEED;
+  ctx->i = 0;
+  ctx->units = 0;
+  ctx->pk_out = pk;
+  ctx->sk_out = sk;
+  ctx->f_rng = f_rng;
+}
+
+/*************************************************
+* Name:        crypto_kem_enc_start
+*
+* Description: Start crypto_kem_enc in ctx
+*
+* Arguments:   - kyber_step_ctx *ctx: pointer to the operation
+*              - uint8_t *ct, uint8_t *ss, const uint8_t *pk, f_rng: as
+*                crypto_kem_enc, the buffers must stay valid until
+*                crypto_kem_step returns 0
+**************************************************/
+void crypto_kem_enc_start(kyber_step_ctx *ctx, uint8_t *ct, uint8_t *ss, const uint8_t *pk, void (*f_rng)(uint8_t *, size_t))
+{
+  ctx->op = ctx->phase = STEP_ENC_SEED;
+  ctx->i = 0;
+  ctx->units = 0;
+  ctx->ct_out = ct;
+  ctx->ss_out = ss;
+  ctx->pk = pk;
+  ctx->f_rng = f_rng;
+}
+
+/*************************************************
+* Name:        crypto_kem_dec_start
+*
+* Description: Start crypto_kem_dec in ctx
+*
+* Arguments:   - kyber_step_ctx *ctx: pointer to the operation
+*              - uint8_t *ss, const uint8_t *ct, const uint8_t *sk: as
+*                crypto_kem_dec, the buffers must stay valid until
+*                crypto_kem_step returns 0
+**************************************************/
+void crypto_kem_dec_start(kyber_step_ctx *ctx, uint8_t *ss, const uint8_t *ct, const uint8_t *sk)
+{
+  ctx->op = ctx->phase = STEP_DEC_UNPACK;
+  ctx->i = 0;
+  ctx->units = 0;
+  ctx->ss_out = ss;
+  ctx->ct = ct;
+  ctx->sk = sk;
+  ctx->pk = sk+KYBER_INDCPA_SECRETKEYBYTES;
+}
+
+/*************************************************
+* Name:        crypto_kem_step
+*
+* Description: Advance the operation started in ctx
+*
+* Arguments:   - kyber_step_ctx *ctx: pointer to the operation
+*              - unsigned int budget: most units to run, 0 for all
+*
+* Returns 0 once the operation is done, KYBER_STEP_IN_PROGRESS otherwise
+**************************************************/
+int crypto_kem_step(kyber_step_ctx *ctx, unsigned int budget)
+{
+  unsigned int n;
+
+  PROF_START(KEM_STEP);
+  for(n=0;ctx->phase != STEP_DONE && (budget == 0 || n < budget);n++)
+    step_unit(ctx);
+  ctx->units += n;
+  PROF_STOP(KEM_STEP);
+  return ctx->phase == STEP_DONE ? 0 : KYBER_STEP_IN_PROGRESS;
+}
+// end of stepped KEM
+
+//__KYBER_FUSE__: variant descriptor (HSO)
+const kyber_variant crypto_kem_variant = {
+  CRYPTO_ALGNAME,
+  KYBER_PUBLICKEYBYTES,
+  KYBER_SECRETKEYBYTES,
+  KYBER_CIPHERTEXTBYTES,
+  KYBER_SSBYTES,
+  crypto_kem_keypair,
+  crypto_kem_enc,
+  crypto_kem_dec
+};
+// end of variant descriptor
+
+//__KYBER_FUSE__: compression self-test (HSO)
+#ifdef KYBER_SELFTEST
+/*************************************************
+* Name:        compress_ref, decompress_ref
+*
+* Description: Reference (division-based) compression and decompression.
+*              The divisor is read through a volatile so that the compiler
+*              really emits UDIV, which keeps the cycle counts honest
+**************************************************/
+static volatile uint32_t selftest_q = KYBER_Q;
+static volatile uint32_t selftest_sink;
+
+static uint32_t compress_ref(uint32_t u, unsigned int d)
+{
+  return (((u << d) + KYBER_Q/2)/selftest_q) & ((1U << d) - 1);
+}
+
+static uint32_t decompress_ref(uint32_t t, unsigned int d)
+{
+  volatile uint32_t div = 1U << d;
+  return (t*KYBER_Q + div/2)/div;
+}
+
+static uint32_t compress_d(uint32_t u, unsigned int d)
+{
+  switch(d) {
+    case 1:  return compress_d1(u);
+    case 4:  return compress_d4(u);
+    case 5:  return compress_d5(u);
+    case 10: return compress_d10(u);
+    default: return compress_d11(u);
+  }
+}
+
+/*************************************************
+* Name:        kyber_compress_selftest
+*
+* Description: Exhaustively compare the division-free kernels against the
+*              reference ones: compression over all 3329 coefficients and
+*              decompression over all 2^d codes, for every d in {1,4,5,10,11}.
+*              Also checks that decompress(compress(u)) stays within the
+*              round(q/2^(d+1)) error bound.
+*
+* Arguments:   - kyber_selftest_result *res: output array of
+*                KYBER_SELFTEST_NROUTINES entries
+*              - uint32_t (*cycles)(void): cycle counter used to time both
+*                implementations over their whole input range; may be NULL
+*
+* Returns total number of mismatches (0 on success)
+**************************************************/
+int kyber_compress_selftest(kyber_selftest_result res[KYBER_SELFTEST_NROUTINES], uint32_t (*cycles)(void))
+{
+  static const unsigned int ds[5] = {1, 4, 5, 10, 11};
+  static const char *names[KYBER_SELFTEST_NROUTINES] = {
+    "compress_d1", "compress_d4", "compress_d5", "compress_d10", "compress_d11",
+    "decompress_d1", "decompress_d4", "decompress_d5", "decompress_d10", "decompress_d11"
+  };
+  unsigned int i, d;
+  uint32_t u, t, c0, acc;
+  int32_t err, bound;
+  int fails = 0;
+
+  for(i=0;i<5;i++) {
+    d = ds[i];
+    bound = (KYBER_Q + (1 << d)) >> (d + 1);
+
+    /* compression over all standard representatives */
+    res[i].name = names[i];
+    res[i].mismatches = 0;
+    for(u=0;u<KYBER_Q;u++) {
+      t = compress_d(u, d);
+      if(t != compress_ref(u, d))
+        res[i].mismatches++;
+      err = (int32_t)decompress_d(t, d) - (int32_t)u;
+      err += (err < -KYBER_Q/2) ? KYBER_Q : 0;
+      err -= (err >  KYBER_Q/2) ? KYBER_Q : 0;
+      if(err > bound || err < -bound)
+        res[i].mismatches++;
+    }
+
+    /* decompression over all codes */
+    res[5+i].name = names[5+i];
+    res[5+i].mismatches = 0;
+    for(t=0;t<(1U << d);t++)
+      if((uint32_t)decompress_d(t, d) != decompress_ref(t, d))
+        res[5+i].mismatches++;
+
+    fails += res[i].mismatches + res[5+i].mismatches;
+
+    res[i].cycles_ref = res[i].cycles = 0;
+    res[5+i].cycles_ref = res[5+i].cycles = 0;
+    if(cycles == NULL)
+      continue;
+
+    acc = 0;
+    c0 = cycles();
+    for(u=0;u<KYBER_Q;u++)
+      acc += compress_ref(u, d);
+    res[i].cycles_ref = cycles() - c0;
+    c0 = cycles();
+    for(u=0;u<KYBER_Q;u++)
+      acc += compress_d(u, d);
+    res[i].cycles = cycles() - c0;
+
+    c0 = cycles();
+    for(t=0;t<(1U << d);t++)
+      acc += decompress_ref(t, d);
+    res[5+i].cycles_ref = cycles() - c0;
+    c0 = cycles();
+    for(t=0;t<(1U << d);t++)
+      acc += decompress_d(t, d);
+    res[5+i].cycles = cycles() - c0;
+
+    selftest_sink = acc;
+  }
+
+  return fails;
+}
+#endif /* KYBER_SELFTEST */
+// end of compression self-test
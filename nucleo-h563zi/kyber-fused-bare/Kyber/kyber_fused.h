@@ -12,6 +12,8 @@
 
 //#define KYBER_90S	/* Uncomment this if you want the 90S variant */
 
+//#define KYBER_SELFTEST	/* Uncomment this to build the compression self-test */
+
 /* Don't change parameters below this line */
 #if   (KYBER_K == 2)
 #ifdef KYBER_90S
@@ -101,4 +103,77 @@ int crypto_kem_enc(uint8_t *ct, uint8_t *ss, const uint8_t *pk, void (*f_rng)(ui
 int crypto_kem_dec(uint8_t *ss, const uint8_t *ct, const uint8_t *sk);
 // end of kem.h
 
+//__KYBER_FUSE__: stepped KEM (HSO)
+/* The same operations cut into units of about one polynomial each (a matrix
+ * entry, a noise sample, an NTT, a row of the matrix product, a hash of a
+ * key or ciphertext), so that a main loop or task can serve other work
+ * in between: start one, then call crypto_kem_step until it returns 0,
+ * running at most budget units per call (0: all). The outputs are those of
+ * crypto_kem_keypair/enc/dec; the intermediate polynomials live in the
+ * context instead of the stack */
+#define KYBER_STEP_IN_PROGRESS 1	/* crypto_kem_step: call again */
+
+typedef struct {
+  uint8_t op;		/* first phase of the operation started */
+  uint8_t phase;	/* next unit: its phase, 0 when done... */
+  uint8_t i;		/* ...and its index in that phase */
+  uint32_t units;	/* units run so far */
+  uint8_t *pk_out, *sk_out, *ct_out, *ss_out;
+  const uint8_t *pk, *sk, *ct;
+  void (*f_rng)(uint8_t *, size_t);
+  uint8_t buf[2*KYBER_SYMBYTES];	/* message, H(pk) */
+  uint8_t kr[2*KYBER_SYMBYTES];		/* pre-key, coins */
+  uint8_t seed[KYBER_SYMBYTES];		/* public seed */
+  uint8_t cmp[KYBER_CIPHERTEXTBYTES];	/* re-encryption of dec */
+  int16_t a[KYBER_K][KYBER_K][KYBER_N];	/* A, or its transpose */
+  int16_t s[KYBER_K][KYBER_N], e[KYBER_K][KYBER_N], t[KYBER_K][KYBER_N], u[KYBER_K][KYBER_N];
+  int16_t v[KYBER_N], k[KYBER_N], epp[KYBER_N];
+} kyber_step_ctx;
+
+#define crypto_kem_keypair_start KYBER_NAMESPACE(keypair_start)
+void crypto_kem_keypair_start(kyber_step_ctx *ctx, uint8_t *pk, uint8_t *sk, void (*f_rng)(uint8_t *, size_t));
+
+#define crypto_kem_enc_start KYBER_NAMESPACE(enc_start)
+void crypto_kem_enc_start(kyber_step_ctx *ctx, uint8_t *ct, uint8_t *ss, const uint8_t *pk, void (*f_rng)(uint8_t *, size_t));
+
+#define crypto_kem_dec_start KYBER_NAMESPACE(dec_start)
+void crypto_kem_dec_start(kyber_step_ctx *ctx, uint8_t *ss, const uint8_t *ct, const uint8_t *sk);
+
+#define crypto_kem_step KYBER_NAMESPACE(step)
+int crypto_kem_step(kyber_step_ctx *ctx, unsigned int budget);
+// end of stepped KEM
+
+//__KYBER_FUSE__: variant descriptor (HSO)
+/* Sizes and entry points of one compiled parameter set. Every build of
+ * kyber_fused.c exports one, under its own namespace, so harnesses can link
+ * several parameter sets at once (see Kyber/variants/) */
+typedef struct {
+  const char *name;
+  size_t publickeybytes;
+  size_t secretkeybytes;
+  size_t ciphertextbytes;
+  size_t ssbytes;
+  int (*keypair)(uint8_t *pk, uint8_t *sk, void (*f_rng)(uint8_t *, size_t));
+  int (*enc)(uint8_t *ct, uint8_t *ss, const uint8_t *pk, void (*f_rng)(uint8_t *, size_t));
+  int (*dec)(uint8_t *ss, const uint8_t *ct, const uint8_t *sk);
+} kyber_variant;
+
+#define crypto_kem_variant KYBER_NAMESPACE(variant)
+extern const kyber_variant crypto_kem_variant;
+
+//__KYBER_FUSE__: compression self-test (HSO)
+#ifdef KYBER_SELFTEST
+#define KYBER_SELFTEST_NROUTINES 10
+
+typedef struct {
+  const char *name;     /* kernel under test */
+  uint32_t mismatches;  /* inputs where kernel and reference disagree */
+  uint32_t cycles_ref;  /* cycles for the whole input range, division-based */
+  uint32_t cycles;      /* cycles for the whole input range, division-free */
+} kyber_selftest_result;
+
+#define kyber_compress_selftest KYBER_NAMESPACE(compress_selftest)
+int kyber_compress_selftest(kyber_selftest_result res[KYBER_SELFTEST_NROUTINES], uint32_t (*cycles)(void));
+#endif /* KYBER_SELFTEST */
+
 #endif  /* KYBER_FUSED_H */
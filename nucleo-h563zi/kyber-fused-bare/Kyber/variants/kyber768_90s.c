@@ -0,0 +1,13 @@
+/*
+ * kyber768_90s.c
+ *
+ * Kyber768-90s build of kyber_fused.c. Only compiled when KYBER_ALL_VARIANTS is
+ * defined, for harnesses that link every parameter set and backend into one
+ * image; the regular build uses kyber_fused.c (Kyber768) alone.
+ */
+
+#ifdef KYBER_ALL_VARIANTS
+#define KYBER_K 3
+#define KYBER_90S
+#include "../kyber_fused.c"
+#endif
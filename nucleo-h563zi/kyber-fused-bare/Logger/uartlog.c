@@ -0,0 +1,420 @@
+/*
+ * uartlog.c
+ *
+ * Channel rings, DMA drainer and UART backends for uartlog.h.
+ *
+ * Each ring has exactly one producer and one consumer (the drainer), so the
+ * only synchronization needed is release/acquire ordering on head and tail.
+ * The drainer itself is serialized by the 'busy' flag: whoever sets it owns
+ * the UART until the transfer completes, and the transfer-complete path
+ * clears it and looks for more work. A producer that finds the drainer busy
+ * simply returns; its bytes go out with a later transfer.
+ */
+
+#include <stdarg.h>
+#include <string.h>
+
+#include "uartlog.h"
+
+#if !defined(__arm__)
+#include <pthread.h>
+#include <time.h>
+#endif
+
+static uint8_t ul_stdout_buf[UARTLOG_RING_BYTES];
+static uint8_t ul_irq_buf[UARTLOG_IRQ_RING_BYTES];
+
+uartlog_chan uartlog_stdout = { .name = "stdout", .buf = ul_stdout_buf, .size = UARTLOG_RING_BYTES };
+uartlog_chan uartlog_irq = { .name = "irq", .buf = ul_irq_buf, .size = UARTLOG_IRQ_RING_BYTES };
+
+static struct {
+  uartlog_port *port;
+  uartlog_chan *chans;		/* registered channels */
+  uartlog_chan *cur;		/* channel of the transfer in flight (or the last one) */
+  uint32_t inflight;		/* bytes of the transfer in flight */
+  uint32_t sent;		/* bytes handed to the UART and completed */
+  uint32_t errors;		/* transfers the backend refused */
+  int midline;			/* the last run did not end with '\n' */
+  volatile uint32_t busy;	/* drainer owner flag */
+} ul;
+
+static int ul_port_open(void);
+static int ul_port_start(const uint8_t *data, uint32_t len);
+
+/* Drainer ---------------------------------------------------------------*/
+static uint32_t ul_pending(const uartlog_chan *c)
+{
+  return __atomic_load_n(&c->head, __ATOMIC_ACQUIRE) -
+         __atomic_load_n(&c->tail, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Pick the next channel round-robin, except that a channel whose last run
+ * stopped mid-line keeps the UART, so lines of different producers are not
+ * interleaved. Called with 'busy' held.
+ * Returns 1 if a transfer was started, 0 if there is nothing to send and -1
+ * if the backend refused the transfer.
+ */
+static int ul_start_next(void)
+{
+  uartlog_chan *c, *first;
+
+  if (ul.port == NULL || ul.chans == NULL)
+    return 0;
+
+  c = ul.cur;
+  if (c == NULL || !ul.midline || ul_pending(c) == 0) {
+    first = (c != NULL && c->next != NULL) ? c->next : ul.chans;
+    c = first;
+    while (ul_pending(c) == 0) {
+      c = (c->next != NULL) ? c->next : ul.chans;
+      if (c == first)
+        return 0;
+    }
+  }
+
+  uint32_t off = c->tail & (c->size - 1);
+  uint32_t n = ul_pending(c);
+  if (n > c->size - off)
+    n = c->size - off;	/* contiguous run up to the end of the ring */
+  if (n > UARTLOG_DMA_MAX)
+    n = UARTLOG_DMA_MAX;
+
+  ul.cur = c;
+  ul.inflight = n;
+  ul.midline = (c->buf[off + n - 1] != '\n');
+  if (ul_port_start(&c->buf[off], n) != 0) {
+    ul.errors++;
+    ul.inflight = 0;
+    return -1;
+  }
+  return 1;
+}
+
+static void ul_kick(void)
+{
+  uartlog_chan *c;
+  int r;
+
+  for (;;) {
+    if (__atomic_exchange_n(&ul.busy, 1, __ATOMIC_ACQUIRE))
+      return;	/* the owner picks our bytes up when its transfer completes */
+    r = ul_start_next();
+    if (r > 0)
+      return;
+    __atomic_store_n(&ul.busy, 0, __ATOMIC_RELEASE);
+
+    /* A producer may have written while we held the flag: look again */
+    if (r < 0 || ul.port == NULL)
+      return;
+    for (c = ul.chans; c != NULL && ul_pending(c) == 0; c = c->next)
+      ;
+    if (c == NULL)
+      return;
+  }
+}
+
+/**
+ * @brief Retire the transfer in flight and start the next one
+ * @note  Called by the backend when the UART is done with the last run
+ *        (DMA transfer-complete interrupt on target, simulator thread on host)
+ */
+void uartlog_tx_done(void)
+{
+  uartlog_chan *c = ul.cur;
+
+  __atomic_store_n(&c->tail, c->tail + ul.inflight, __ATOMIC_RELEASE);
+  ul.sent += ul.inflight;
+  ul.inflight = 0;
+  __atomic_store_n(&ul.busy, 0, __ATOMIC_RELEASE);
+  ul_kick();
+}
+
+/* Producers -------------------------------------------------------------*/
+static void ul_register(uartlog_chan *c)
+{
+  c->next = __atomic_load_n(&ul.chans, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&ul.chans, &c->next, c, 0,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+}
+
+/**
+ * @brief Register a channel with the drainer
+ * @param buf: ring storage, size bytes, size a power of two
+ * @retval 0 on success, -1 if size is not a power of two
+ * @note  Channels can be added at any time, but never removed.
+ */
+int uartlog_chan_init(uartlog_chan *c, const char *name, uint8_t *buf, uint32_t size)
+{
+  if (size == 0 || (size & (size - 1)) != 0)
+    return -1;
+
+  memset(c, 0, sizeof(*c));
+  c->name = name;
+  c->buf = buf;
+  c->size = size;
+  ul_register(c);
+  return 0;
+}
+
+/**
+ * @brief Queue len bytes on channel c, all or nothing
+ * @retval len, or -1 if the ring had no room (the write is counted as dropped)
+ * @note  Only one context may write to a given channel.
+ */
+int uartlog_write(uartlog_chan *c, const void *data, size_t len)
+{
+  uint32_t head = c->head;
+  uint32_t used = head - __atomic_load_n(&c->tail, __ATOMIC_ACQUIRE);
+  uint32_t off = head & (c->size - 1);
+  uint32_t first;
+
+  if (len > c->size - used) {
+    c->dropped += len;
+    c->dropped_msgs++;
+    return -1;
+  }
+
+  first = c->size - off;
+  if (first > len)
+    first = len;
+  memcpy(&c->buf[off], data, first);
+  memcpy(c->buf, (const uint8_t *)data + first, len - first);
+  __atomic_store_n(&c->head, head + len, __ATOMIC_RELEASE);
+
+  c->written += len;
+  if (used + len > c->peak)
+    c->peak = used + len;
+
+  ul_kick();
+  return (int) len;
+}
+
+/**
+ * @brief printf into channel c, formatted on the caller's stack
+ * @retval bytes queued, or -1 if dropped
+ */
+int uartlog_printf(uartlog_chan *c, const char *fmt, ...)
+{
+  char line[UARTLOG_LINE_MAX];
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(line, sizeof(line), fmt, ap);
+  va_end(ap);
+  if (n < 0)
+    return -1;
+  if (n >= (int) sizeof(line))
+    n = sizeof(line) - 1;	/* truncated */
+  return uartlog_write(c, line, n);
+}
+
+/**
+ * @brief One character on the current channel, for __io_putchar
+ */
+int uartlog_putc(int ch)
+{
+  uint8_t b = (uint8_t) ch;
+
+  uartlog_write(uartlog_current(), &b, 1);
+  return ch;
+}
+
+/**
+ * @brief Channel of the calling context
+ * @note  Weak: an RTOS application overrides this to give each task its own
+ *        channel (see README). The default separates thread and handler mode.
+ */
+__attribute__((weak)) uartlog_chan *uartlog_current(void)
+{
+#if defined(__arm__)
+  if (__get_IPSR() != 0)
+    return &uartlog_irq;
+#endif
+  return &uartlog_stdout;
+}
+
+#if defined(__arm__) && defined(UARTLOG_ENABLE)
+/*
+ * Whole-buffer retarget of newlib's stdout, overriding the weak _write of the
+ * STM32CubeIDE syscalls.c (which would call __io_putchar once per byte).
+ */
+int _write(int file, char *ptr, int len)
+{
+  (void) file;
+  uartlog_write(uartlog_current(), ptr, len);
+  return len;	/* dropped output is accounted for, not reported to stdio */
+}
+#endif
+
+/* Control ---------------------------------------------------------------*/
+/**
+ * @brief Attach the UART and start draining
+ * @retval 0 on success, -1 if the UART has no TX DMA (or the simulator failed)
+ * @note  Bytes written before this call are kept and sent first.
+ */
+int uartlog_init(uartlog_port *port)
+{
+  static int registered;
+
+  if (!registered) {
+    ul_register(&uartlog_irq);
+    ul_register(&uartlog_stdout);
+    registered = 1;
+  }
+  ul.port = port;
+  if (ul_port_open() != 0) {
+    ul.port = NULL;
+    return -1;
+  }
+  ul_kick();
+  return 0;
+}
+
+/**
+ * @brief Wait until every channel is drained
+ * @note  Blocking: call from thread mode with interrupts enabled, e.g. before
+ *        a reset or at the end of a host run.
+ */
+void uartlog_flush(void)
+{
+  uartlog_chan *c;
+
+  for (;;) {
+    ul_kick();
+    for (c = ul.chans; c != NULL && ul_pending(c) == 0; c = c->next)
+      ;
+    if (c == NULL && !__atomic_load_n(&ul.busy, __ATOMIC_ACQUIRE))
+      return;
+    if (ul.port == NULL)
+      return;
+#if defined(__arm__)
+    __NOP();
+#else
+    nanosleep(&(struct timespec){ 0, 100000 }, NULL);
+#endif
+  }
+}
+
+/**
+ * @brief Bytes that went out on the UART so far
+ */
+uint32_t uartlog_sent(void)
+{
+  return __atomic_load_n(&ul.sent, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Print the per-channel counters (through printf, i.e. the logger)
+ */
+void uartlog_report(void)
+{
+  uartlog_chan *c;
+
+  printf("%-12s %10s %10s %8s %8s %8s\n\r", "channel", "written", "dropped", "msgs", "peak", "size");
+  for (c = ul.chans; c != NULL; c = c->next)
+    printf("%-12s %10lu %10lu %8lu %8lu %8lu\n\r", c->name,
+           (unsigned long) c->written, (unsigned long) c->dropped,
+           (unsigned long) c->dropped_msgs, (unsigned long) c->peak,
+           (unsigned long) c->size);
+  printf("sent %lu bytes, %lu backend errors\n\r", (unsigned long) ul.sent, (unsigned long) ul.errors);
+}
+
+/* Backends --------------------------------------------------------------*/
+#if defined(__arm__)
+static int ul_port_open(void)
+{
+  return ul.port->hdmatx != NULL ? 0 : -1;	/* USART TX DMA request configured in CubeMX */
+}
+
+static int ul_port_start(const uint8_t *data, uint32_t len)
+{
+  return HAL_UART_Transmit_DMA(ul.port, (uint8_t *) data, (uint16_t) len) == HAL_OK ? 0 : -1;
+}
+
+/**
+ * @brief DMA transfer complete (HAL callback, interrupt context)
+ */
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+  if (huart == ul.port)
+    uartlog_tx_done();
+}
+#else
+/*
+ * Simulated UART: a thread takes one run at a time, holds it for the time
+ * the bytes would need on the wire, and reports completion like the DMA
+ * interrupt would.
+ */
+static pthread_t ul_sim_thread;
+static pthread_mutex_t ul_sim_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ul_sim_cond = PTHREAD_COND_INITIALIZER;
+static const uint8_t *ul_sim_data;
+static uint32_t ul_sim_len;
+static int ul_sim_running;
+
+static void ul_sim_wait_until(struct timespec *t, uint64_t ns)
+{
+  t->tv_nsec += ns % 1000000000ULL;
+  t->tv_sec += ns / 1000000000ULL + t->tv_nsec / 1000000000L;
+  t->tv_nsec %= 1000000000L;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, t, NULL) != 0)
+    ;
+}
+
+static void *ul_sim_main(void *arg)
+{
+  struct timespec wire;
+  (void) arg;
+
+  clock_gettime(CLOCK_MONOTONIC, &wire);
+  for (;;) {
+    const uint8_t *data;
+    uint32_t len;
+    struct timespec now;
+
+    pthread_mutex_lock(&ul_sim_lock);
+    while (ul_sim_len == 0)
+      pthread_cond_wait(&ul_sim_cond, &ul_sim_lock);
+    data = ul_sim_data;
+    len = ul_sim_len;
+    ul_sim_len = 0;
+    pthread_mutex_unlock(&ul_sim_lock);
+
+    /* The line idles between transfers: don't bank that time */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec > wire.tv_sec || (now.tv_sec == wire.tv_sec && now.tv_nsec > wire.tv_nsec))
+      wire = now;
+    ul_sim_wait_until(&wire, (uint64_t) len * 10 * 1000000000ULL / ul.port->baud);
+
+    if (ul.port->sink != NULL)
+      fwrite(data, 1, len, ul.port->sink);
+    uartlog_tx_done();
+  }
+  return NULL;
+}
+
+static int ul_port_open(void)
+{
+  if (ul.port->baud == 0)
+    return -1;
+  if (!ul_sim_running) {
+    if (pthread_create(&ul_sim_thread, NULL, ul_sim_main, NULL) != 0)
+      return -1;
+    ul_sim_running = 1;
+  }
+  return 0;
+}
+
+static int ul_port_start(const uint8_t *data, uint32_t len)
+{
+  pthread_mutex_lock(&ul_sim_lock);
+  ul_sim_data = data;
+  ul_sim_len = len;
+  pthread_cond_signal(&ul_sim_cond);
+  pthread_mutex_unlock(&ul_sim_lock);
+  return 0;
+}
+#endif
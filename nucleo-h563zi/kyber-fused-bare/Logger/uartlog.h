@@ -0,0 +1,80 @@
+/*
+ * uartlog.h
+ *
+ * Non-blocking, DMA-drained UART logger.
+ *
+ * Output is written into channels: lock-free single-producer/single-consumer
+ * rings, one per producer (a task, the main loop, or interrupt handlers).
+ * A write either fits entirely or is dropped and counted, so producers never
+ * wait for the UART. A single drainer, run from the DMA transfer-complete
+ * interrupt, sends contiguous runs of each ring straight from the ring with
+ * HAL_UART_Transmit_DMA. On a host build the UART is simulated by a thread
+ * that consumes bytes at the configured baud rate.
+ */
+
+#ifndef UARTLOG_H
+#define UARTLOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(__arm__)
+#include "main.h"
+#endif
+
+//#define UARTLOG_ENABLE	/* Uncomment this (or pass -DUARTLOG_ENABLE) to retarget printf to the logger */
+
+#ifndef UARTLOG_RING_BYTES
+#define UARTLOG_RING_BYTES 4096	/* stdout channel, power of two */
+#endif
+
+#ifndef UARTLOG_IRQ_RING_BYTES
+#define UARTLOG_IRQ_RING_BYTES 512	/* channel of interrupt handlers, power of two */
+#endif
+
+#define UARTLOG_LINE_MAX 128	/* longest uartlog_printf() message */
+#define UARTLOG_DMA_MAX 0xFFFF	/* HAL transfer size is 16 bits */
+
+/* UART backend */
+#if defined(__arm__)
+typedef UART_HandleTypeDef uartlog_port;
+#else
+typedef struct {
+  uint32_t baud;	/* simulated line rate, 10 bits per byte */
+  FILE *sink;		/* where transmitted bytes go, NULL to discard */
+} uartlog_port;
+#endif
+
+typedef struct uartlog_chan {
+  const char *name;
+  uint8_t *buf;
+  uint32_t size;		/* power of two */
+  volatile uint32_t head;	/* written by the producer only */
+  volatile uint32_t tail;	/* written by the drainer only */
+  /* producer-side statistics */
+  uint32_t written;		/* bytes accepted */
+  uint32_t dropped;		/* bytes dropped */
+  uint32_t dropped_msgs;	/* writes dropped */
+  uint32_t peak;		/* highest fill level seen, in bytes */
+  struct uartlog_chan *next;
+} uartlog_chan;
+
+extern uartlog_chan uartlog_stdout;	/* printf from thread mode */
+extern uartlog_chan uartlog_irq;	/* printf from handler mode */
+
+int uartlog_init(uartlog_port *port);
+int uartlog_chan_init(uartlog_chan *c, const char *name, uint8_t *buf, uint32_t size);
+
+int uartlog_write(uartlog_chan *c, const void *data, size_t len);
+int uartlog_printf(uartlog_chan *c, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+int uartlog_putc(int ch);
+
+uartlog_chan *uartlog_current(void);
+void uartlog_tx_done(void);
+void uartlog_flush(void);
+
+uint32_t uartlog_sent(void);
+void uartlog_report(void);
+
+#endif /* UARTLOG_H */
@@ -0,0 +1,90 @@
+/*
+ * prof.c
+ *
+ * Probe bookkeeping and report for prof.h.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "prof.h"
+
+#ifdef PROF_ENABLE	/* otherwise prof.h has it all, inline */
+
+#if defined(__arm__)
+#include "main.h"
+#endif
+
+prof_state prof;
+
+#define PROF_NAME(id, name) name,
+static const char *prof_names[PROF_NPROBES] = {
+  PROF_PROBES(PROF_NAME)
+};
+#undef PROF_NAME
+
+/**
+ * @brief Enable the cycle counter and clear all probes
+ */
+void prof_init(void)
+{
+#if defined(__arm__)
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;	/* power up DWT */
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+  prof_reset();
+}
+
+/**
+ * @brief Clear all statistics (active probes are dropped as well)
+ */
+void prof_reset(void)
+{
+  memset(&prof, 0, sizeof(prof));
+}
+
+/**
+ * @brief Attribute one sample to the innermost active probe
+ * @note  Call this from a periodic interrupt (SysTick on target, SIGPROF on
+ *        host) to get a statistical self-time breakdown, which complements
+ *        the inclusive cycle counts of the probes.
+ */
+void prof_sample(void)
+{
+  uint32_t d = prof.depth;
+
+  if (d == 0)
+    prof.samples_idle++;
+  else
+    prof.stat[prof.stack[d - 1].probe].samples++;
+}
+
+/**
+ * @brief Print the probe table through printf
+ */
+void prof_report(void)
+{
+  uint32_t total_samples = prof.samples_idle;
+  int i;
+
+  for (i = 0; i < PROF_NPROBES; i++)
+    total_samples += prof.stat[i].samples;
+
+  printf("%-26s %8s %12s %12s %12s %14s %7s\n\r", "probe (" PROF_UNIT ")",
+         "count", "min", "avg", "max", "total", "self%");
+  for (i = 0; i < PROF_NPROBES; i++) {
+    const prof_stat *s = &prof.stat[i];
+    unsigned long long avg = s->count ? s->total / s->count : 0;
+    unsigned long self = total_samples ? (1000UL * s->samples) / total_samples : 0;
+
+    printf("%-26s %8lu %12llu %12llu %12llu %14llu %5lu.%lu\n\r", prof_names[i],
+           (unsigned long) s->count, (unsigned long long) s->min, avg,
+           (unsigned long long) s->max, (unsigned long long) s->total,
+           self / 10, self % 10);
+  }
+  if (prof.overflows)
+    printf("(%lu probes dropped, raise PROF_MAX_DEPTH)\n\r", (unsigned long) prof.overflows);
+}
+
+#endif /* PROF_ENABLE */
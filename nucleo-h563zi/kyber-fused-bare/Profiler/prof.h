@@ -0,0 +1,161 @@
+/*
+ * prof.h
+ *
+ * Cycle-accurate probes for the Kyber KEM and its hot internals.
+ *
+ * On target (Cortex-M3/M33) the probes read the DWT cycle counter; on a host
+ * build they read the TSC (x86) or CLOCK_MONOTONIC, so that the same table
+ * can be compared across platforms. Probes compile to nothing unless
+ * PROF_ENABLE is defined: prof_init then only starts the cycle counter, the
+ * other calls are empty, and prof.c need not be built.
+ */
+
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdint.h>
+
+//#define PROF_ENABLE	/* Uncomment this (or pass -DPROF_ENABLE) to build the probes in */
+//#define PROF_TRACE	/* Uncomment this to also emit every closed probe as a trace.h record */
+
+/* Probe list: X(id, name) */
+#define PROF_PROBES(X)                        \
+  X(KEM_KEYPAIR,   "crypto_kem_keypair")      \
+  X(KEM_ENC,       "crypto_kem_enc")          \
+  X(KEM_DEC,       "crypto_kem_dec")          \
+  X(KEM_STEP,      "crypto_kem_step")         \
+  X(GEN_MATRIX,    "gen_matrix")              \
+  X(NTT,           "ntt")                     \
+  X(INVNTT,        "invntt")                  \
+  X(KECCAK_F1600,  "KeccakF1600_StatePermute")\
+  X(CBD,           "poly_cbd")                \
+  X(PACK,          "pack")                    \
+  X(UNPACK,        "unpack")
+
+#define PROF_ENUM(id, name) PROF_##id,
+typedef enum {
+  PROF_PROBES(PROF_ENUM)
+  PROF_NPROBES
+} prof_probe;
+#undef PROF_ENUM
+
+/* Maximum nesting of active probes (e.g. KEM_DEC > GEN_MATRIX > KECCAK_F1600) */
+#define PROF_MAX_DEPTH 8
+
+/* Cycle source ------------------------------------------------------------*/
+#if defined(__arm__)
+typedef uint32_t prof_cycles_t;	/* wraps, deltas are taken modulo 2^32 */
+#define PROF_UNIT "cycles"
+#define PROF_DWT_CTRL (*(volatile uint32_t *)0xE0001000UL)	/* same on ARMv7-M and ARMv8-M */
+#define PROF_DWT_CYCCNT (*(volatile uint32_t *)0xE0001004UL)
+#define PROF_DEMCR (*(volatile uint32_t *)0xE000EDFCUL)
+#define PROF_DEMCR_TRCENA (1UL << 24)
+#define PROF_DWT_CYCCNTENA (1UL << 0)
+static inline prof_cycles_t prof_now(void) { return PROF_DWT_CYCCNT; }
+#elif (defined(__x86_64__) || defined(__i386__)) && !defined(PROF_HOST_CLOCK_GETTIME)
+#include <x86intrin.h>
+typedef uint64_t prof_cycles_t;
+#define PROF_UNIT "tsc"
+static inline prof_cycles_t prof_now(void) { return __rdtsc(); }
+#else
+#include <time.h>
+typedef uint64_t prof_cycles_t;
+#define PROF_UNIT "ns"
+static inline prof_cycles_t prof_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+#ifdef PROF_ENABLE
+/* Per-probe statistics ----------------------------------------------------*/
+typedef struct {
+  uint32_t count;
+  prof_cycles_t min;
+  prof_cycles_t max;
+  uint64_t total;
+  uint32_t samples;	/* periodic samples landing while this probe was innermost */
+} prof_stat;
+
+typedef struct {
+  prof_stat stat[PROF_NPROBES];
+  uint32_t samples_idle;	/* samples landing outside any probe */
+  struct {
+    prof_probe probe;
+    prof_cycles_t t0;
+  } stack[PROF_MAX_DEPTH];
+  volatile uint32_t depth;
+  uint32_t overflows;	/* probes dropped because PROF_MAX_DEPTH was exceeded */
+} prof_state;
+
+extern prof_state prof;
+
+#ifdef PROF_TRACE
+#include "trace.h"
+#endif
+
+void prof_init(void);
+void prof_reset(void);
+void prof_sample(void);
+void prof_report(void);
+
+static inline void prof_start(prof_probe p)
+{
+  uint32_t d = prof.depth;
+
+  if (d >= PROF_MAX_DEPTH) {
+    prof.overflows++;
+    return;
+  }
+  prof.stack[d].probe = p;
+  prof.stack[d].t0 = prof_now();
+  prof.depth = d + 1;
+}
+
+static inline void prof_stop(prof_probe p)
+{
+  prof_cycles_t dt;
+  prof_stat *s;
+  uint32_t d = prof.depth;
+
+  if (d == 0 || prof.stack[d - 1].probe != p)	/* unmatched, or dropped by prof_start */
+    return;
+  dt = prof_now() - prof.stack[d - 1].t0;
+  prof.depth = d - 1;
+
+  s = &prof.stat[p];
+  if (s->count == 0 || dt < s->min)
+    s->min = dt;
+  if (dt > s->max)
+    s->max = dt;
+  s->total += dt;
+  s->count++;
+#ifdef PROF_TRACE
+  trace_probe(p, (uint32_t) dt);
+#endif
+}
+
+#define PROF_START(p) prof_start(PROF_##p)
+#define PROF_STOP(p)  prof_stop(PROF_##p)
+
+#else /* !PROF_ENABLE */
+
+/* The cycle counter only: main.c times the KEM with prof_now() */
+static inline void prof_init(void)
+{
+#if defined(__arm__)
+  PROF_DEMCR |= PROF_DEMCR_TRCENA;	/* power up DWT */
+  PROF_DWT_CYCCNT = 0;
+  PROF_DWT_CTRL |= PROF_DWT_CYCCNTENA;
+#endif
+}
+static inline void prof_reset(void) {}
+static inline void prof_sample(void) {}
+static inline void prof_report(void) {}
+
+#define PROF_START(p) ((void)0)
+#define PROF_STOP(p)  ((void)0)
+#endif /* PROF_ENABLE */
+
+#endif /* PROF_H */
@@ -0,0 +1,290 @@
+/*
+ * stackmeter.c
+ *
+ * Painted-stack measurement of crypto_kem_keypair/enc/dec, see stackmeter.h.
+ */
+
+#include <string.h>
+
+#include "stackmeter.h"
+
+#if !defined(__arm__)
+#include <ucontext.h>
+#endif
+
+/* Largest sizes over all parameter sets (Kyber1024) */
+#define SM_PK_BYTES 1568
+#define SM_SK_BYTES 3168
+#define SM_CT_BYTES 1568
+#define SM_SS_BYTES 32
+
+static uint32_t sm_stack[STACKMETER_STACK_BYTES / 4] __attribute__((aligned(8)));
+
+/* Operands live in static RAM so they are not part of the measured stack */
+static uint8_t sm_pk[SM_PK_BYTES];
+static uint8_t sm_sk[SM_SK_BYTES];
+static uint8_t sm_ct[SM_CT_BYTES];
+static uint8_t sm_ss_a[SM_SS_BYTES];
+static uint8_t sm_ss_b[SM_SS_BYTES];
+
+typedef struct {
+  const kyber_variant *v;
+  void (*f_rng)(uint8_t *, size_t);
+} sm_job;
+
+#ifdef KYBER_ALL_VARIANTS
+extern const kyber_variant pqcrystals_kyber512_ref_variant;
+extern const kyber_variant pqcrystals_kyber768_ref_variant;
+extern const kyber_variant pqcrystals_kyber1024_ref_variant;
+extern const kyber_variant pqcrystals_kyber512_90s_ref_variant;
+extern const kyber_variant pqcrystals_kyber768_90s_ref_variant;
+extern const kyber_variant pqcrystals_kyber1024_90s_ref_variant;
+
+static const kyber_variant *const sm_variants[] = {
+  &pqcrystals_kyber512_ref_variant,
+  &pqcrystals_kyber768_ref_variant,
+  &pqcrystals_kyber1024_ref_variant,
+  &pqcrystals_kyber512_90s_ref_variant,
+  &pqcrystals_kyber768_90s_ref_variant,
+  &pqcrystals_kyber1024_90s_ref_variant,
+};
+#else
+static const kyber_variant *const sm_variants[] = {
+  &crypto_kem_variant,
+};
+#endif
+
+static const char *sm_op_names[STACKMETER_NOPS] = { "keypair", "enc", "dec" };
+
+/* Switching stacks ------------------------------------------------------*/
+#if defined(__arm__)
+/*
+ * Call fn(arg) with SP = top, through PSP. MSP keeps serving interrupts, and
+ * the caller's PSP (an RTOS task stack) is restored on return. r4-r6 are
+ * callee-saved, so fn preserves them for us. On ARMv8-M the PSP stack limit
+ * is lifted for the duration of the call.
+ */
+__attribute__((naked, noinline))
+static void sm_call_on_stack(void (*fn)(void *), void *arg, uint32_t *top)
+{
+  __asm volatile(
+    "push  {r4, r5, r6, lr}  \n"
+    "mrs   r4, control       \n"
+    "mrs   r5, psp           \n"
+#if defined(__ARM_ARCH_8M_MAIN__)
+    "mrs   r6, psplim        \n"
+    "movs  r3, #0            \n"
+    "msr   psplim, r3        \n"
+#endif
+    "msr   psp, r2           \n"
+    "orr   r3, r4, #2        \n"	/* SPSEL = 1: thread mode uses PSP */
+    "msr   control, r3       \n"
+    "isb                     \n"
+    "mov   r3, r0            \n"
+    "mov   r0, r1            \n"
+    "blx   r3                \n"
+    "msr   control, r4       \n"
+    "isb                     \n"
+    "msr   psp, r5           \n"
+#if defined(__ARM_ARCH_8M_MAIN__)
+    "msr   psplim, r6        \n"
+#endif
+    "pop   {r4, r5, r6, pc}  \n"
+  );
+}
+#else
+static ucontext_t sm_caller, sm_callee;
+static void (*sm_fn)(void *);
+static void *sm_arg;
+
+static void sm_entry(void)
+{
+  sm_fn(sm_arg);
+}
+
+static void sm_call_on_stack(void (*fn)(void *), void *arg, uint32_t *top)
+{
+  (void) top;
+  sm_fn = fn;
+  sm_arg = arg;
+  getcontext(&sm_callee);
+  sm_callee.uc_stack.ss_sp = sm_stack;
+  sm_callee.uc_stack.ss_size = sizeof(sm_stack);
+  sm_callee.uc_link = &sm_caller;
+  makecontext(&sm_callee, sm_entry, 0);
+  swapcontext(&sm_caller, &sm_callee);
+}
+#endif
+
+/**
+ * @brief Run fn(arg) on the painted stack
+ * @retval peak stack usage in bytes (STACKMETER_STACK_BYTES if it overflowed)
+ */
+size_t stackmeter_run(void (*fn)(void *), void *arg)
+{
+  const size_t n = sizeof(sm_stack) / sizeof(sm_stack[0]);
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    sm_stack[i] = STACKMETER_PAINT;
+
+  sm_call_on_stack(fn, arg, &sm_stack[n]);
+
+  for (i = 0; i < n && sm_stack[i] == STACKMETER_PAINT; i++)
+    ;
+  return (n - i) * sizeof(sm_stack[0]);
+}
+
+/* Operation thunks ------------------------------------------------------*/
+static void sm_keypair(void *arg)
+{
+  const sm_job *job = arg;
+  job->v->keypair(sm_pk, sm_sk, job->f_rng);
+}
+
+static void sm_enc(void *arg)
+{
+  const sm_job *job = arg;
+  job->v->enc(sm_ct, sm_ss_b, sm_pk, job->f_rng);
+}
+
+static void sm_dec(void *arg)
+{
+  const sm_job *job = arg;
+  job->v->dec(sm_ss_a, sm_ct, sm_sk);
+}
+
+/**
+ * @brief Measure keypair, enc and dec of one variant
+ * @retval 0 on success, -1 if buffers are too small, the stack overflowed or
+ *         the shared secrets don't match
+ */
+int stackmeter_kem(stackmeter_result *res, const kyber_variant *v, void (*f_rng)(uint8_t *, size_t))
+{
+  sm_job job = { v, f_rng };
+  int i, ret = 0;
+
+  memset(res, 0, sizeof(*res));
+  res->variant = v;
+  if (v->publickeybytes > SM_PK_BYTES || v->secretkeybytes > SM_SK_BYTES ||
+      v->ciphertextbytes > SM_CT_BYTES || v->ssbytes > SM_SS_BYTES)
+    return -1;
+
+  res->stack[STACKMETER_KEYPAIR] = stackmeter_run(sm_keypair, &job);
+  res->stack[STACKMETER_ENC] = stackmeter_run(sm_enc, &job);
+  res->stack[STACKMETER_DEC] = stackmeter_run(sm_dec, &job);
+
+  res->buffers[STACKMETER_KEYPAIR] = v->publickeybytes + v->secretkeybytes;
+  res->buffers[STACKMETER_ENC] = v->ciphertextbytes + v->ssbytes + v->publickeybytes;
+  res->buffers[STACKMETER_DEC] = v->ssbytes + v->ciphertextbytes + v->secretkeybytes;
+
+  for (i = 0; i < STACKMETER_NOPS; i++)
+    if (res->stack[i] >= STACKMETER_STACK_BYTES)
+      ret = -1;
+  if (memcmp(sm_ss_a, sm_ss_b, v->ssbytes) != 0)
+    ret = -1;
+  return ret;
+}
+
+/**
+ * @brief Static RAM of the whole image, from the linker symbols
+ */
+void stackmeter_static_ram(stackmeter_static *st)
+{
+#if defined(__arm__)
+  extern uint32_t _sdata, _edata, _sbss, _ebss;	/* STM32CubeIDE linker script */
+  st->data = (size_t)((uint8_t *)&_edata - (uint8_t *)&_sdata);
+  st->bss = (size_t)((uint8_t *)&_ebss - (uint8_t *)&_sbss);
+#else
+  extern char __data_start, edata, end;	/* provided by the GNU linker */
+  st->data = (size_t)(&edata - &__data_start);
+  st->bss = (size_t)(&end - &edata);
+#endif
+}
+
+/**
+ * @brief Measure every linked variant
+ * @retval number of entries written to res
+ */
+size_t stackmeter_measure_all(stackmeter_result res[STACKMETER_MAX_VARIANTS], void (*f_rng)(uint8_t *, size_t))
+{
+  size_t i, n = sizeof(sm_variants) / sizeof(sm_variants[0]);
+
+  for (i = 0; i < n; i++)
+    if (stackmeter_kem(&res[i], sm_variants[i], f_rng) != 0)
+      printf("[FAIL] %s: overflow or shared secret mismatch\n\r", sm_variants[i]->name);
+  return n;
+}
+
+/**
+ * @brief Print the per-operation table and the static RAM of the image
+ */
+void stackmeter_print_table(const stackmeter_result *res, size_t n)
+{
+  stackmeter_static st;
+  size_t i;
+  int op;
+
+  printf("%-16s %-8s %12s %12s\n\r", "variant", "op", "stack", "buffers");
+  for (i = 0; i < n; i++)
+    for (op = 0; op < STACKMETER_NOPS; op++)
+      printf("%-16s %-8s %12lu %12lu\n\r", res[i].variant->name, sm_op_names[op],
+             (unsigned long) res[i].stack[op], (unsigned long) res[i].buffers[op]);
+
+  stackmeter_static_ram(&st);
+  printf("static RAM (image): .data %lu, .bss %lu (includes %lu bytes of stackmeter buffers)\n\r",
+         (unsigned long) st.data, (unsigned long) st.bss,
+         (unsigned long) (sizeof(sm_stack) + SM_PK_BYTES + SM_SK_BYTES + SM_CT_BYTES + 2 * SM_SS_BYTES));
+}
+
+static void sm_macro_name(char *out, size_t outlen, const char *name)
+{
+  size_t i;
+
+  for (i = 0; name[i] != '\0' && i + 1 < outlen; i++) {
+    char c = name[i];
+    if (c >= 'a' && c <= 'z')
+      c -= 'a' - 'A';
+    else if (!((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')))
+      c = '_';
+    out[i] = c;
+  }
+  out[i] = '\0';
+}
+
+/**
+ * @brief Emit the measurements as a C header (kem_stack.h)
+ * @param f: output stream (stdout on target, a file on host)
+ * @param platform: free-form tag recorded in the header
+ */
+void stackmeter_write_header(FILE *f, const char *platform, const stackmeter_result *res, size_t n)
+{
+  static const char *op_macro[STACKMETER_NOPS] = { "KEYPAIR", "ENC", "DEC" };
+  size_t i, worst = 0;
+  int op;
+  char name[24];
+
+  fprintf(f, "/* kem_stack.h: generated by stackmeter on %s, do not edit */\n", platform);
+  fprintf(f, "#ifndef KEM_STACK_H\n#define KEM_STACK_H\n\n");
+  fprintf(f, "/* Peak stack of each operation, in bytes */\n");
+  for (i = 0; i < n; i++) {
+    size_t vmax = 0;
+
+    sm_macro_name(name, sizeof(name), res[i].variant->name);
+    for (op = 0; op < STACKMETER_NOPS; op++) {
+      fprintf(f, "#define KEM_STACK_%s_%s %lu\n", name, op_macro[op], (unsigned long) res[i].stack[op]);
+      if (res[i].stack[op] > vmax)
+        vmax = res[i].stack[op];
+    }
+    fprintf(f, "#define KEM_STACK_%s %lu\n\n", name, (unsigned long) vmax);
+    if (vmax > worst)
+      worst = vmax;
+  }
+  fprintf(f, "/* Deepest operation over all variants */\n");
+  fprintf(f, "#define KEM_STACK_MAX %lu\n\n", (unsigned long) worst);
+  fprintf(f, "/* Task stack for KEM work plus 'margin' bytes of the task's own frames,\n"
+             " * in words (FreeRTOS osThreadDef) or bytes (ThreadX tx_thread_create) */\n");
+  fprintf(f, "#define KEM_TASK_STACK_WORDS(kem, margin) (((kem) + (margin) + 3) / 4)\n");
+  fprintf(f, "#define KEM_TASK_STACK_BYTES(kem, margin) ((((kem) + (margin)) + 7) & ~7UL)\n\n");
+  fprintf(f, "#endif /* KEM_STACK_H */\n");
+}
@@ -0,0 +1,56 @@
+/*
+ * stackmeter.h
+ *
+ * Stack high-water-mark measurement for the Kyber KEM operations.
+ *
+ * Each operation runs on a dedicated stack that is painted beforehand; the
+ * peak usage is the distance from the top of that stack to the deepest word
+ * that no longer holds the paint pattern. On Cortex-M the dedicated stack is
+ * entered through PSP, so interrupts (which always use MSP) do not show up in
+ * the result. On a host build the stack is entered with swapcontext().
+ */
+
+#ifndef STACKMETER_H
+#define STACKMETER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "kyber_fused.h"
+
+#ifndef STACKMETER_STACK_BYTES
+#define STACKMETER_STACK_BYTES (32 * 1024)	/* must exceed the deepest operation */
+#endif
+
+#define STACKMETER_PAINT 0xA5C35A3CUL
+
+typedef enum {
+  STACKMETER_KEYPAIR = 0,
+  STACKMETER_ENC,
+  STACKMETER_DEC,
+  STACKMETER_NOPS
+} stackmeter_op;
+
+#define STACKMETER_MAX_VARIANTS 6	/* {512,768,1024} x {SHAKE,90s} */
+
+typedef struct {
+  const kyber_variant *variant;
+  size_t stack[STACKMETER_NOPS];	/* peak stack, in bytes */
+  size_t buffers[STACKMETER_NOPS];	/* caller-owned pk/sk/ct/ss bytes */
+} stackmeter_result;
+
+typedef struct {
+  size_t data;	/* .data of the whole image, in bytes */
+  size_t bss;	/* .bss of the whole image, in bytes */
+} stackmeter_static;
+
+size_t stackmeter_run(void (*fn)(void *), void *arg);
+int stackmeter_kem(stackmeter_result *res, const kyber_variant *v, void (*f_rng)(uint8_t *, size_t));
+void stackmeter_static_ram(stackmeter_static *st);
+
+size_t stackmeter_measure_all(stackmeter_result res[STACKMETER_MAX_VARIANTS], void (*f_rng)(uint8_t *, size_t));
+void stackmeter_print_table(const stackmeter_result *res, size_t n);
+void stackmeter_write_header(FILE *f, const char *platform, const stackmeter_result *res, size_t n);
+
+#endif /* STACKMETER_H */
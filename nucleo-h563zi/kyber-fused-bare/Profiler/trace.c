@@ -0,0 +1,224 @@
+/*
+ * trace.c
+ *
+ * Record encoder for trace.h. A record costs one prof_now(), a few varint
+ * stores, a nibble-wise CRC over ~10 bytes and one call to the sink.
+ * Records are emitted from a single context (the time base is shared).
+ */
+
+#include <string.h>
+
+#include "trace.h"
+#include "prof.h"
+
+static struct {
+  trace_sink sink;
+  uint32_t hz;
+  prof_cycles_t last;
+  uint32_t since_clock;	/* records since the last TRACE_CLOCK */
+} tr;
+
+static const uint16_t tr_crc_nibble[16] = {
+  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+  0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef
+};
+
+/**
+ * @brief CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF), 4 bits per step
+ */
+uint16_t trace_crc16(const uint8_t *data, size_t len)
+{
+  uint16_t crc = 0xFFFF;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    crc = (crc << 4) ^ tr_crc_nibble[(crc >> 12) ^ (data[i] >> 4)];
+    crc = (crc << 4) ^ tr_crc_nibble[(crc >> 12) ^ (data[i] & 0x0F)];
+  }
+  return crc;
+}
+
+/**
+ * @brief Unsigned LEB128
+ * @retval bytes written (at most 10)
+ */
+size_t trace_put_varint(uint8_t *out, uint64_t v)
+{
+  size_t n = 0;
+
+  while (v >= 0x80) {
+    out[n++] = (uint8_t) v | 0x80;
+    v >>= 7;
+  }
+  out[n++] = (uint8_t) v;
+  return n;
+}
+
+/**
+ * @retval bytes consumed, or 0 if the varint is truncated or too long
+ */
+size_t trace_get_varint(const uint8_t *in, size_t len, uint64_t *v)
+{
+  uint64_t r = 0;
+  size_t i;
+
+  for (i = 0; i < len && i < 10; i++) {
+    r |= (uint64_t)(in[i] & 0x7F) << (7 * i);
+    if ((in[i] & 0x80) == 0) {
+      *v = r;
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * frame[3..] already holds 'fields' bytes of type-specific fields, shifted
+ * up by TR_DELTA_MAX; the delta goes in front of them here.
+ */
+#define TR_DELTA_MAX 10
+
+static void tr_emit(trace_type type, uint8_t *frame, size_t fields)
+{
+  prof_cycles_t now = prof_now();
+  size_t n, len;
+  uint16_t crc;
+
+  if (tr.sink == NULL)
+    return;
+
+  n = trace_put_varint(&frame[3], (uint64_t)(prof_cycles_t)(now - tr.last));
+  memmove(&frame[3 + n], &frame[3 + TR_DELTA_MAX], fields);
+  tr.last = now;
+  len = n + fields;
+
+  frame[0] = TRACE_SYNC;
+  frame[1] = (uint8_t) type;
+  frame[2] = (uint8_t) len;
+  crc = trace_crc16(&frame[1], 2 + len);
+  frame[3 + len] = (uint8_t)(crc >> 8);
+  frame[4 + len] = (uint8_t) crc;
+  tr.sink(frame, 5 + len);
+
+  if (type != TRACE_CLOCK && ++tr.since_clock >= TRACE_CLOCK_EVERY)
+    trace_clock();
+}
+
+#define TR_FIELDS(frame) (&(frame)[3 + TR_DELTA_MAX])
+
+/**
+ * @brief Start a stream
+ * @param sink: frame consumer (UART channel, TCP socket, file...)
+ * @param hz: cycle counter frequency, recorded for the decoder (0 if unknown)
+ */
+void trace_init(trace_sink sink, uint32_t hz)
+{
+  tr.sink = sink;
+  tr.hz = hz;
+  tr.last = prof_now();
+  trace_clock();
+}
+
+/**
+ * @brief Anchor the time base (absolute cycle count)
+ */
+void trace_clock(void)
+{
+  uint8_t frame[3 + TR_DELTA_MAX + 20 + 2];
+  uint8_t *f = TR_FIELDS(frame);
+  size_t n;
+
+  n = trace_put_varint(f, (uint64_t) prof_now());
+  n += trace_put_varint(&f[n], tr.hz);
+  tr.since_clock = 0;
+  tr_emit(TRACE_CLOCK, frame, n);
+}
+
+/**
+ * @brief Name an id of the given kind, so the decoder can label it
+ */
+void trace_name(trace_kind kind, uint32_t id, const char *name)
+{
+  uint8_t frame[3 + TR_DELTA_MAX + 6 + 32 + 2];
+  uint8_t *f = TR_FIELDS(frame);
+  size_t n, l = strlen(name);
+
+  f[0] = (uint8_t) kind;
+  n = 1 + trace_put_varint(&f[1], id);
+  if (l > 32)
+    l = 32;
+  memcpy(&f[n], name, l);
+  tr_emit(TRACE_NAME, frame, n + l);
+}
+
+/**
+ * @brief One benchmark result (cycles of an operation, a byte count...)
+ */
+void trace_bench(uint32_t id, uint64_t value)
+{
+  uint8_t frame[3 + TR_DELTA_MAX + 15 + 2];
+  uint8_t *f = TR_FIELDS(frame);
+  size_t n;
+
+  n = trace_put_varint(f, id);
+  n += trace_put_varint(&f[n], value);
+  tr_emit(TRACE_BENCH, frame, n);
+}
+
+/**
+ * @brief One closed probe of prof.h and its inclusive cycles
+ */
+void trace_probe(uint32_t probe, uint32_t cycles)
+{
+  uint8_t frame[3 + TR_DELTA_MAX + 10 + 2];
+  uint8_t *f = TR_FIELDS(frame);
+  size_t n;
+
+  n = trace_put_varint(f, probe);
+  n += trace_put_varint(&f[n], cycles);
+  tr_emit(TRACE_PROBE, frame, n);
+}
+
+/**
+ * @brief A point event with one argument
+ */
+void trace_event(uint32_t id, uint32_t arg)
+{
+  uint8_t frame[3 + TR_DELTA_MAX + 10 + 2];
+  uint8_t *f = TR_FIELDS(frame);
+  size_t n;
+
+  n = trace_put_varint(f, id);
+  n += trace_put_varint(&f[n], arg);
+  tr_emit(TRACE_EVENT, frame, n);
+}
+
+/**
+ * @brief Raw bytes (keys, ciphertexts), split into TRACE_BLOB_CHUNK records
+ */
+void trace_blob(uint32_t id, const uint8_t *data, size_t len)
+{
+  uint8_t frame[3 + TR_DELTA_MAX + 10 + TRACE_BLOB_CHUNK + 2];
+  uint8_t *f = TR_FIELDS(frame);
+  size_t off, n, l;
+
+  for (off = 0; off < len; off += l) {
+    l = len - off;
+    if (l > TRACE_BLOB_CHUNK)
+      l = TRACE_BLOB_CHUNK;
+    n = trace_put_varint(f, id);
+    n += trace_put_varint(&f[n], off);
+    memcpy(&f[n], &data[off], l);
+    tr_emit(TRACE_BLOB, frame, n + l);
+  }
+}
+
+/**
+ * @brief Name every probe of prof.h
+ */
+void trace_probe_names(void)
+{
+#define TR_NAME(id, name) trace_name(TRACE_KIND_PROBE, PROF_##id, name);
+  PROF_PROBES(TR_NAME)
+#undef TR_NAME
+}
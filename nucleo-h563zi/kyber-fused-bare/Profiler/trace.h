@@ -0,0 +1,67 @@
+/*
+ * trace.h
+ *
+ * Compact binary record stream for benchmark results, probe samples and
+ * events, decoded on the host by Host/trace_decode.c.
+ *
+ * Frame layout (all multi-byte integers are unsigned LEB128 varints):
+ *
+ *   0xA5 | type | len | body[len] | crc16 (big-endian)
+ *
+ * body starts with the cycle delta since the previous record, followed by the
+ * fields of the record type. The CRC (CRC-16/CCITT-FALSE) covers type, len
+ * and body. Frames carry no escaping: the decoder resynchronizes by scanning
+ * for 0xA5 and checking the CRC, so records can share a UART with text.
+ * TRACE_CLOCK records carry the absolute cycle count, so the time base is
+ * recovered after a lost frame.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+//#define TRACE_ENABLE	/* Uncomment this (or pass -DTRACE_ENABLE) to emit records from the demo */
+
+#define TRACE_SYNC 0xA5
+#define TRACE_BODY_MAX 255
+#define TRACE_FRAME_MAX (3 + TRACE_BODY_MAX + 2)
+#define TRACE_BLOB_CHUNK 128	/* blob bytes per record */
+#define TRACE_CLOCK_EVERY 256	/* records between automatic TRACE_CLOCK */
+
+typedef enum {
+  TRACE_CLOCK = 1,	/* delta, absolute cycles, clock in Hz (0 if unknown) */
+  TRACE_NAME,		/* delta, kind, id, name bytes */
+  TRACE_BENCH,		/* delta, id, value */
+  TRACE_PROBE,		/* delta, probe id, cycles */
+  TRACE_EVENT,		/* delta, id, arg */
+  TRACE_BLOB		/* delta, id, offset, bytes */
+} trace_type;
+
+/* Namespaces of TRACE_NAME */
+typedef enum {
+  TRACE_KIND_BENCH = 0,
+  TRACE_KIND_PROBE,
+  TRACE_KIND_EVENT,
+  TRACE_KIND_BLOB
+} trace_kind;
+
+/* Receives one whole frame per call */
+typedef void (*trace_sink)(const uint8_t *frame, size_t len);
+
+void trace_init(trace_sink sink, uint32_t hz);
+void trace_clock(void);
+void trace_name(trace_kind kind, uint32_t id, const char *name);
+void trace_bench(uint32_t id, uint64_t value);
+void trace_probe(uint32_t probe, uint32_t cycles);
+void trace_event(uint32_t id, uint32_t arg);
+void trace_blob(uint32_t id, const uint8_t *data, size_t len);
+void trace_probe_names(void);
+
+/* Shared with the decoder */
+uint16_t trace_crc16(const uint8_t *data, size_t len);
+size_t trace_put_varint(uint8_t *out, uint64_t v);
+size_t trace_get_varint(const uint8_t *in, size_t len, uint64_t *v);
+
+#endif /* TRACE_H */
@@ -1,30 +1,228 @@
 package main
 
 // Author: William Suzuki (william.suzuki@alumni.usp.br)
-// This is a first try.
-// The drawback with this implementation is that it does not support multiple
-// connections.
-
-// Clock1 is a TCP server that periodically writes the time.
-// package main
-// =>
-// <=
-// !=
+//
+// Timestamp server for the NUCLEO-F207ZG time clients (lwip_bare and
+// freertos_lwip_tcp). Every 256-byte REQ time_packet is answered right away
+// with a RESP carrying the current time; the rest of the request (notably the
+// sequence number in bytes 8..11) is echoed back, so clients can pipeline.
+// Protocol v2 frames (8-byte header, optional body, see tcp_client.h) are
+// told apart by their first byte and served on the same port, with HELLO
+// negotiation and optional microseconds.
+// TP2_SYNC datagrams (NTP-style four timestamps) are answered on the same
+// port over UDP, see udpsync.go.
+// Each connection is served by its own goroutine and keeps its own counters,
+// which are logged periodically, with the process CPU time, and served as
+// JSON on -http.
+//
+// With -tls the protocol is served over TLS as well, and -tlsecho echoes
+// TLS connections for throughput tests, see tls.go. With -kem it is also
+// served over a Kyber768 + ChaCha20-Poly1305 channel, see kemchan.go.
+// With -load N the same binary becomes a load generator instead, see
+// loadgen.go, and with -scrape a scraper of the boards' metrics, see
+// scrape.go.
 
 import (
+	"bufio"
+	"encoding/json"
+	"errors"
+	"flag"
 	"fmt"
+	"io"
 	"log"
 	"net"
+	"net/http"
+	"os"
+	"sort"
+	"sync"
+	"sync/atomic"
+	"syscall"
 	"time"
 )
 
+// time_packet layout (see tcp_client.h)
+const (
+	packetSize = 256
+	packetHead = 0xae
+	packetTail = 0xea
+	typeReq    = 0
+	typeResp   = 1
+	offYear    = 2
+	offSeq     = 8
+)
+
+// protocol v2 frame layout (see tcp_client.h)
+const (
+	v2Magic   = 0xaf
+	v2Version = 2
+	v2Header  = 8
+	v2BodyMax = 16
+	v2Req     = 0
+	v2Resp    = 1
+	v2Hello   = 2
+	v2FUsec   = 0x01
+	v2Len     = 2 // offsets in the header
+	v2Flags   = 3
+	v2Seq     = 4
+)
+
+var (
+	flagListen   = flag.String("listen", "0.0.0.0:5000", "server address")
+	flagHTTP     = flag.String("http", "", "serve per-connection counters as JSON on this address (e.g. :8080)")
+	flagReport   = flag.Duration("report", 10*time.Second, "log a summary this often (0 to disable)")
+	flagIdle     = flag.Duration("idle", 5*time.Minute, "close connections idle for this long")
+	flagUTC      = flag.Bool("utc", false, "answer with UTC instead of local time")
+	flagLoad     = flag.Int("load", 0, "load generator: number of simulated devices (0 runs the server)")
+	flagAddr     = flag.String("addr", "127.0.0.1:5000", "load generator: server address")
+	flagDuration = flag.Duration("duration", 10*time.Second, "load generator: test duration")
+	flagPipeline = flag.Int("pipeline", 4, "load generator: outstanding requests per device (CLIENT_PIPELINE)")
+	flagInterval = flag.Duration("interval", 0, "load generator: delay between requests of a device (0: back to back)")
+	flagOneshot  = flag.Bool("oneshot", false, "load generator: connect per request (CLIENT_ONESHOT)")
+	flagProto    = flag.Int("proto", 2, "load generator: highest protocol version offered (CLIENT_PROTO)")
+	flagUsec     = flag.Bool("usec", true, "load generator: ask for microseconds in v2 responses (CLIENT_USEC)")
+	flagStats    = flag.String("stats", "", "load generator: server /stats URL, to report its CPU time per request")
+	flagSync     = flag.Bool("sync", false, "load generator: run UDP time-sync clients instead (period -interval)")
+	flagScrape   = flag.String("scrape", "", "scraper: metrics addresses of the boards, host:port[,host:port...] (empty runs the server)")
+	flagEvery    = flag.Duration("every", 5*time.Second, "scraper: poll period")
+	flagOut      = flag.String("out", "", "scraper: append the CSV rows to this file (default stdout)")
+	flagTLS      = flag.String("tls", "", "also serve over TLS on this address (e.g. :5443)")
+	flagCert     = flag.String("cert", "", "TLS certificate, PEM (default: self-signed ECDSA P-256, generated at start)")
+	flagKey      = flag.String("key", "", "TLS private key of -cert, PEM")
+	flagTLSEcho  = flag.String("tlsecho", "", "echo whatever is received over TLS on this address (e.g. :5444)")
+	flagResume   = flag.String("tlsresume", "ticket", "TLS session resumption: ticket (encrypted tickets), cache (server-side cache, the ticket is its key) or off")
+	flagKEM      = flag.String("kem", "", "also serve over the Kyber channel on this address (e.g. :5446)")
+	flagKEMKey   = flag.String("kemkey", "", "Kyber key pair seed, 64 bytes, created if missing (default: random at start)")
+	flagKEMPub   = flag.String("kempub", "", "write the Kyber public key to this C header, to pin it in kem_client.h")
+)
+
+// connStats are the counters of one connection, updated by its goroutine
+type connStats struct {
+	id       uint64
+	remote   string
+	since    time.Time
+	requests atomic.Uint64
+	errors   atomic.Uint64
+	bytesIn  atomic.Uint64
+	bytesOut atomic.Uint64
+	lastSeq  atomic.Uint32
+	lastSeen atomic.Int64  // unix ns
+	proto    atomic.Uint32 // version of the last request
+}
+
+// connInfo is a point-in-time copy of connStats, as served on /stats
+type connInfo struct {
+	ID       uint64    `json:"id"`
+	Remote   string    `json:"remote"`
+	Since    time.Time `json:"since"`
+	Requests uint64    `json:"requests"`
+	Errors   uint64    `json:"errors"`
+	BytesIn  uint64    `json:"bytes_in"`
+	BytesOut uint64    `json:"bytes_out"`
+	LastSeq  uint32    `json:"last_seq"`
+	LastSeen time.Time `json:"last_seen"`
+	Proto    uint32    `json:"proto"`
+}
+
+func (s *connStats) snapshot() connInfo {
+	return connInfo{
+		ID:       s.id,
+		Remote:   s.remote,
+		Since:    s.since,
+		Requests: s.requests.Load(),
+		Errors:   s.errors.Load(),
+		BytesIn:  s.bytesIn.Load(),
+		BytesOut: s.bytesOut.Load(),
+		LastSeq:  s.lastSeq.Load(),
+		LastSeen: time.Unix(0, s.lastSeen.Load()),
+		Proto:    s.proto.Load(),
+	}
+}
+
+// registry tracks live connections and the totals of closed ones
+type registry struct {
+	mu       sync.Mutex
+	nextID   uint64
+	live     map[uint64]*connStats
+	accepted uint64
+	closed   connInfo // totals of closed connections
+}
+
+var reg = registry{live: make(map[uint64]*connStats)}
+
+func (r *registry) add(c net.Conn) *connStats {
+	r.mu.Lock()
+	defer r.mu.Unlock()
+	r.nextID++
+	r.accepted++
+	s := &connStats{id: r.nextID, remote: c.RemoteAddr().String(), since: time.Now()}
+	s.lastSeen.Store(s.since.UnixNano())
+	r.live[s.id] = s
+	return s
+}
+
+func (r *registry) remove(s *connStats) {
+	snap := s.snapshot()
+	r.mu.Lock()
+	defer r.mu.Unlock()
+	delete(r.live, s.id)
+	r.closed.Requests += snap.Requests
+	r.closed.Errors += snap.Errors
+	r.closed.BytesIn += snap.BytesIn
+	r.closed.BytesOut += snap.BytesOut
+}
+
+// totals sums closed and live connections
+func (r *registry) totals() (live int, accepted uint64, t connInfo, conns []connInfo) {
+	r.mu.Lock()
+	defer r.mu.Unlock()
+	t = r.closed
+	conns = make([]connInfo, 0, len(r.live))
+	for _, s := range r.live {
+		snap := s.snapshot()
+		t.Requests += snap.Requests
+		t.Errors += snap.Errors
+		t.BytesIn += snap.BytesIn
+		t.BytesOut += snap.BytesOut
+		conns = append(conns, snap)
+	}
+	return len(r.live), r.accepted, t, conns
+}
+
 func main() {
-	strUrl := "0.0.0.0:5000"
-	fmt.Printf("Running on %v\n", strUrl)
-	listener, err := net.Listen("tcp", strUrl)
+	flag.Parse()
+
+	if *flagLoad > 0 && *flagSync {
+		os.Exit(runSyncLoad())
+	}
+	if *flagLoad > 0 {
+		os.Exit(runLoad())
+	}
+	if *flagScrape != "" {
+		os.Exit(runScrape())
+	}
+
+	listener, err := net.Listen("tcp", *flagListen)
 	if err != nil {
 		log.Fatal(err)
 	}
+	fmt.Printf("Running on %v\n", *flagListen)
+	go serveSync(*flagListen)
+	if *flagTLS != "" {
+		go serveTLS(*flagTLS)
+	}
+	if *flagTLSEcho != "" {
+		go serveTLSEcho(*flagTLSEcho)
+	}
+	if *flagKEM != "" {
+		go serveKEM(*flagKEM)
+	}
+
+	if *flagHTTP != "" {
+		go serveStats(*flagHTTP)
+	}
+	if *flagReport > 0 {
+		go report(*flagReport)
+	}
 
 	for {
 		conn, err := listener.Accept()
@@ -32,38 +230,213 @@ func main() {
 			log.Print(err) // e.g., connection aborted
 			continue
 		}
-		handleConn(conn) // handle one connection at a time
+		go handleConn(conn) // one goroutine per connection
 	}
-
 }
 
+// handleConn answers requests until the client closes or misbehaves.
+// Responses to pipelined requests are batched: the writer is flushed only
+// when no further request is already buffered.
 func handleConn(c net.Conn) {
-	defer c.Close()
-
-	data := []byte{
-		0xae, 0xff, 0x06, 0x02, 0x01, 0x0f, 0x04, 0x05, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xea}
+	s := reg.add(c)
+	defer func() {
+		c.Close()
+		reg.remove(s)
+	}()
+
+	r := bufio.NewReaderSize(c, 16*packetSize)
+	w := bufio.NewWriterSize(c, 16*packetSize)
+	in := make([]byte, packetSize)
+	out := make([]byte, packetSize)
 
 	for {
-		// _, err := io.WriteString(c, time.Now().Format("2006-02-01 15:04:05\n"))
-		_, err := c.Write(data)
+		if *flagIdle > 0 {
+			c.SetReadDeadline(time.Now().Add(*flagIdle))
+		}
+		req, err := readFrame(r, in)
 		if err != nil {
-			return // e.g., client disconnected
+			if !errors.Is(err, io.EOF) {
+				s.errors.Add(1) // a bad frame means the stream is out of sync
+			}
+			return
+		}
+		s.bytesIn.Add(uint64(len(req)))
+
+		resp, seq, proto := answer(req, out, time.Now())
+		if resp == nil {
+			s.errors.Add(1)
+			return
 		}
-		time.Sleep(100 * time.Millisecond)
+		if _, err := w.Write(resp); err != nil {
+			s.errors.Add(1)
+			return
+		}
+		s.bytesOut.Add(uint64(len(resp)))
+		s.proto.Store(proto)
+		if seq >= 0 {
+			s.requests.Add(1)
+			s.lastSeq.Store(uint32(seq))
+		}
+		s.lastSeen.Store(time.Now().UnixNano())
+
+		if !frameBuffered(r) {
+			if err := w.Flush(); err != nil {
+				s.errors.Add(1)
+				return
+			}
+		}
+	}
+}
+
+// readFrame reads one v1 packet or v2 frame into buf
+func readFrame(r *bufio.Reader, buf []byte) ([]byte, error) {
+	b, err := r.Peek(1)
+	if err != nil {
+		return nil, err
+	}
+	switch b[0] {
+	case packetHead:
+		_, err = io.ReadFull(r, buf[:packetSize])
+		return buf[:packetSize], err
+	case v2Magic:
+		if _, err = io.ReadFull(r, buf[:v2Header]); err != nil {
+			return nil, err
+		}
+		n := v2Header + int(buf[v2Len])
+		if n > v2Header+v2BodyMax {
+			return nil, fmt.Errorf("v2 body of %d bytes", buf[v2Len])
+		}
+		_, err = io.ReadFull(r, buf[v2Header:n])
+		return buf[:n], err
+	default:
+		return nil, fmt.Errorf("bad frame start 0x%02x", b[0])
+	}
+}
+
+// frameBuffered tells if a whole frame is already waiting in r
+func frameBuffered(r *bufio.Reader) bool {
+	b, _ := r.Peek(r.Buffered())
+	switch {
+	case len(b) == 0:
+		return false
+	case b[0] == packetHead:
+		return len(b) >= packetSize
+	case b[0] == v2Magic:
+		return len(b) >= v2Header && len(b) >= v2Header+int(b[v2Len])
+	default:
+		return true // the next read fails right away
+	}
+}
+
+// answer builds the response to req in out. seq is -1 for a HELLO, resp
+// is nil for an invalid request.
+func answer(req, out []byte, now time.Time) (resp []byte, seq int64, proto uint32) {
+	if *flagUTC {
+		now = now.UTC()
+	}
+
+	if req[0] == packetHead {
+		if req[packetSize-1] != packetTail || req[1] != typeReq {
+			return nil, 0, 1
+		}
+		copy(out, req)
+		fillResponse(out[offYear:], now)
+		out[1] = typeResp
+		return out[:packetSize], int64(getU32(req[offSeq:])), 1
 	}
+
+	ver, typ := req[1]>>4, req[1]&0x0f
+	copy(out[:v2Header], req[:v2Header])
+	switch {
+	case typ == v2Hello:
+		if ver > v2Version {
+			ver = v2Version
+		}
+		out[1] = ver<<4 | v2Hello
+		out[v2Len] = 0
+		out[v2Flags] = req[v2Flags] & v2FUsec
+		return out[:v2Header], -1, uint32(ver)
+	case typ == v2Req && ver == v2Version:
+		n := 6
+		fillResponse(out[v2Header:], now)
+		out[v2Flags] = req[v2Flags] & v2FUsec
+		if out[v2Flags]&v2FUsec != 0 {
+			putU32(out[v2Header+6:], uint32(now.Nanosecond()/1000))
+			n += 4
+		}
+		out[1] = v2Version<<4 | v2Resp
+		out[v2Len] = byte(n)
+		return out[:v2Header+n], int64(getU32(req[v2Seq:])), v2Version
+	default:
+		return nil, 0, uint32(ver)
+	}
+}
+
+// fillResponse writes year (since 2000), month, day, hour, minute and second
+func fillResponse(b []byte, now time.Time) {
+	b[0] = byte(now.Year() - 2000)
+	b[1] = byte(now.Month())
+	b[2] = byte(now.Day())
+	b[3] = byte(now.Hour())
+	b[4] = byte(now.Minute())
+	b[5] = byte(now.Second())
+}
+
+func getU32(b []byte) uint32 {
+	return uint32(b[0]) | uint32(b[1])<<8 | uint32(b[2])<<16 | uint32(b[3])<<24
+}
+
+func putU32(b []byte, v uint32) {
+	b[0], b[1], b[2], b[3] = byte(v), byte(v>>8), byte(v>>16), byte(v>>24)
+}
+
+// cpuTime is the user + system time of the server process
+func cpuTime() time.Duration {
+	var ru syscall.Rusage
+	if syscall.Getrusage(syscall.RUSAGE_SELF, &ru) != nil {
+		return 0
+	}
+	return time.Duration(ru.Utime.Nano() + ru.Stime.Nano())
+}
+
+// report logs the connection count, request rate and CPU cost per request
+func report(every time.Duration) {
+	var last uint64
+	lastCPU := cpuTime()
+	for range time.Tick(every) {
+		live, accepted, t, _ := reg.totals()
+		cpu := cpuTime()
+		n, perReq := t.Requests-last, 0.0
+		if n > 0 {
+			perReq = float64((cpu - lastCPU).Microseconds()) / float64(n)
+		}
+		log.Printf("%d connections (%d accepted), %d requests (%.0f/s), %d errors, %d sync (%d bad), cpu %.1f%% (%.2f us/request)",
+			live, accepted, t.Requests, float64(n)/every.Seconds(), t.Errors,
+			syncRequests.Load(), syncErrors.Load(),
+			100*(cpu-lastCPU).Seconds()/every.Seconds(), perReq)
+		last, lastCPU = t.Requests, cpu
+	}
+}
+
+// serveStats exposes the counters: /stats for totals and every live connection
+func serveStats(addr string) {
+	http.HandleFunc("/stats", func(w http.ResponseWriter, req *http.Request) {
+		live, accepted, t, conns := reg.totals()
+		sort.Slice(conns, func(i, j int) bool { return conns[i].ID < conns[j].ID })
+		w.Header().Set("Content-Type", "application/json")
+		json.NewEncoder(w).Encode(struct {
+			Live        int        `json:"live"`
+			Accepted    uint64     `json:"accepted"`
+			Requests    uint64     `json:"requests"`
+			Errors      uint64     `json:"errors"`
+			BytesIn     uint64     `json:"bytes_in"`
+			BytesOut    uint64     `json:"bytes_out"`
+			Sync        uint64     `json:"sync_requests"`
+			SyncErrors  uint64     `json:"sync_errors"`
+			CPUSeconds  float64    `json:"cpu_seconds"`
+			Connections []connInfo `json:"connections"`
+		}{live, accepted, t.Requests, t.Errors, t.BytesIn, t.BytesOut,
+			syncRequests.Load(), syncErrors.Load(), cpuTime().Seconds(), conns})
+	})
+	log.Fatal(http.ListenAndServe(addr, nil))
 }
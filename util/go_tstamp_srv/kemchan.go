@@ -0,0 +1,455 @@
+package main
+
+// Kyber channel listener: with -kem addr, the same protocol is also served
+// over freertos_lwip_mbedtls7's kem_chan.c (see kem_chan.h for the
+// messages), for kem_client.c. One round trip opens a channel: the client
+// encapsulates a secret to the server's static Kyber768 public key, and
+// both derive ChaCha20-Poly1305 keys from it with HKDF-SHA-256. The
+// server's ACCEPT carries a ticket (the next secret and an expiry, sealed
+// with a key made at start), which the next connection may offer to skip
+// the KEM: a server restart makes the tickets fail, and the client falls
+// back to a full handshake.
+// The key pair comes from the 64-byte seed in -kemkey, created when the
+// file does not exist, or from a random seed at start. Its SHA-256 is
+// logged, to compare with what the board prints. The board asks for the
+// key on its first connection (KEY_REQ, trust on first use), or has it
+// built in: -kempub writes it as a C header for kem_client.h.
+// Go 1.21 has neither Kyber, SHA-3 nor ChaCha20-Poly1305 in its standard
+// library: kyber.go has the first two, and ChaCha20-Poly1305 (RFC 8439) is
+// here. Connections are counted with the TCP ones, and every handshake is
+// logged, full or resumed.
+
+import (
+	"bufio"
+	"crypto/hmac"
+	"crypto/rand"
+	"crypto/sha256"
+	"crypto/subtle"
+	"encoding/binary"
+	"encoding/hex"
+	"errors"
+	"fmt"
+	"io"
+	"log"
+	"math/bits"
+	"net"
+	"os"
+	"strings"
+	"sync/atomic"
+	"time"
+)
+
+// kem_chan.h
+const (
+	kemFull       = 1
+	kemResume     = 2
+	kemKeyReq     = 3
+	kemAccept     = 4
+	kemRetry      = 5
+	kemKey        = 6
+	kemNonce      = 16
+	kemSecret     = 32
+	kemTag        = 16
+	kemHdr        = 2
+	kemTicket     = 64
+	kemTicketLife = 86400 // s
+	kemRecordMax  = 256
+	kemHSTimeout  = 30 * time.Second
+)
+
+var (
+	kemPK, kemSK []byte
+	kemTicketKey [32]byte
+	kemInfo      = []byte("kem_chan v1")
+	kemFullN     atomic.Uint64
+	kemResumedN  atomic.Uint64
+	kemDeclined  atomic.Uint64
+)
+
+// chachaBlock is the ChaCha20 block of key, counter and nonce
+func chachaBlock(out *[64]byte, key []byte, counter uint32, nonce []byte) {
+	var s, x [16]uint32
+	s[0], s[1], s[2], s[3] = 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574
+	for i := 0; i < 8; i++ {
+		s[4+i] = binary.LittleEndian.Uint32(key[4*i:])
+	}
+	s[12] = counter
+	for i := 0; i < 3; i++ {
+		s[13+i] = binary.LittleEndian.Uint32(nonce[4*i:])
+	}
+	x = s
+	qr := func(a, b, c, d int) {
+		x[a] += x[b]
+		x[d] = bits.RotateLeft32(x[d]^x[a], 16)
+		x[c] += x[d]
+		x[b] = bits.RotateLeft32(x[b]^x[c], 12)
+		x[a] += x[b]
+		x[d] = bits.RotateLeft32(x[d]^x[a], 8)
+		x[c] += x[d]
+		x[b] = bits.RotateLeft32(x[b]^x[c], 7)
+	}
+	for i := 0; i < 10; i++ {
+		qr(0, 4, 8, 12)
+		qr(1, 5, 9, 13)
+		qr(2, 6, 10, 14)
+		qr(3, 7, 11, 15)
+		qr(0, 5, 10, 15)
+		qr(1, 6, 11, 12)
+		qr(2, 7, 8, 13)
+		qr(3, 4, 9, 14)
+	}
+	for i := range x {
+		binary.LittleEndian.PutUint32(out[4*i:], x[i]+s[i])
+	}
+}
+
+// chachaXOR encrypts or decrypts src into dst from block counter 1
+func chachaXOR(dst, src, key, nonce []byte) {
+	var ks [64]byte
+	for i, ctr := 0, uint32(1); i < len(src); i, ctr = i+64, ctr+1 {
+		chachaBlock(&ks, key, ctr, nonce)
+		for j := 0; j < 64 && i+j < len(src); j++ {
+			dst[i+j] = src[i+j] ^ ks[j]
+		}
+	}
+}
+
+// poly1305 is the MAC of msg under a one-time key, on 26-bit limbs
+func poly1305(key []byte, msg []byte) [16]byte {
+	const mask = 0x3ffffff
+	le := binary.LittleEndian.Uint32
+	r0 := uint64(le(key[0:]) & 0x3ffffff)
+	r1 := uint64(le(key[3:]) >> 2 & 0x3ffff03)
+	r2 := uint64(le(key[6:]) >> 4 & 0x3ffc0ff)
+	r3 := uint64(le(key[9:]) >> 6 & 0x3f03fff)
+	r4 := uint64(le(key[12:]) >> 8 & 0x00fffff)
+	s1, s2, s3, s4 := r1*5, r2*5, r3*5, r4*5
+	var h0, h1, h2, h3, h4 uint64
+
+	for len(msg) > 0 {
+		var b [17]byte
+		n := copy(b[:16], msg)
+		b[n] = 1 // 2^(8n): for a whole block, bit 128
+		msg = msg[n:]
+		h0 += uint64(le(b[0:]) & mask)
+		h1 += uint64(le(b[3:]) >> 2 & mask)
+		h2 += uint64(le(b[6:]) >> 4 & mask)
+		h3 += uint64(le(b[9:]) >> 6 & mask)
+		h4 += uint64(le(b[12:])>>8) | uint64(b[16])<<24
+
+		d0 := h0*r0 + h1*s4 + h2*s3 + h3*s2 + h4*s1
+		d1 := h0*r1 + h1*r0 + h2*s4 + h3*s3 + h4*s2
+		d2 := h0*r2 + h1*r1 + h2*r0 + h3*s4 + h4*s3
+		d3 := h0*r3 + h1*r2 + h2*r1 + h3*r0 + h4*s4
+		d4 := h0*r4 + h1*r3 + h2*r2 + h3*r1 + h4*r0
+		d1 += d0 >> 26
+		d2 += d1 >> 26
+		d3 += d2 >> 26
+		d4 += d3 >> 26
+		h0, h1, h2, h3, h4 = d0&mask, d1&mask, d2&mask, d3&mask, d4&mask
+		h0 += (d4 >> 26) * 5
+		h1 += h0 >> 26
+		h0 &= mask
+	}
+
+	h2 += h1 >> 26
+	h1 &= mask
+	h3 += h2 >> 26
+	h2 &= mask
+	h4 += h3 >> 26
+	h3 &= mask
+	h0 += (h4 >> 26) * 5
+	h4 &= mask
+	h1 += h0 >> 26
+	h0 &= mask
+
+	// h - p, kept if it does not borrow
+	g0 := h0 + 5
+	g1 := h1 + g0>>26
+	g2 := h2 + g1>>26
+	g3 := h3 + g2>>26
+	g4 := h4 + g3>>26 - 1<<26
+	sel := (g4 >> 63) - 1 // all ones when h >= p
+	h0 = h0&^sel | g0&mask&sel
+	h1 = h1&^sel | g1&mask&sel
+	h2 = h2&^sel | g2&mask&sel
+	h3 = h3&^sel | g3&mask&sel
+	h4 = h4&^sel | g4&mask&sel
+
+	var tag [16]byte
+	f := (h0 | h1<<26) & 0xffffffff
+	f += uint64(le(key[16:]))
+	binary.LittleEndian.PutUint32(tag[0:], uint32(f))
+	f = (h1>>6|h2<<20)&0xffffffff + uint64(le(key[20:])) + f>>32
+	binary.LittleEndian.PutUint32(tag[4:], uint32(f))
+	f = (h2>>12|h3<<14)&0xffffffff + uint64(le(key[24:])) + f>>32
+	binary.LittleEndian.PutUint32(tag[8:], uint32(f))
+	f = (h3>>18|h4<<8)&0xffffffff + uint64(le(key[28:])) + f>>32
+	binary.LittleEndian.PutUint32(tag[12:], uint32(f))
+	return tag
+}
+
+// aeadTag is the RFC 8439 tag of aad and ct
+func aeadTag(key, nonce, aad, ct []byte) [16]byte {
+	var otk [64]byte
+	chachaBlock(&otk, key, 0, nonce)
+	pad := func(n int) []byte { return make([]byte, (16-n%16)%16) }
+	m := make([]byte, 0, len(aad)+len(ct)+48)
+	m = append(append(m, aad...), pad(len(aad))...)
+	m = append(append(m, ct...), pad(len(ct))...)
+	m = binary.LittleEndian.AppendUint64(m, uint64(len(aad)))
+	m = binary.LittleEndian.AppendUint64(m, uint64(len(ct)))
+	return poly1305(otk[:32], m)
+}
+
+// aeadSeal appends the ciphertext of pt and its tag to dst
+func aeadSeal(dst, key, nonce, aad, pt []byte) []byte {
+	n := len(dst)
+	dst = append(dst, pt...)
+	chachaXOR(dst[n:], pt, key, nonce)
+	tag := aeadTag(key, nonce, aad, dst[n:])
+	return append(dst, tag[:]...)
+}
+
+// aeadOpen authenticates ct (tag last) and decrypts it
+func aeadOpen(key, nonce, aad, ct []byte) ([]byte, error) {
+	if len(ct) < kemTag {
+		return nil, errors.New("short ciphertext")
+	}
+	body := ct[:len(ct)-kemTag]
+	tag := aeadTag(key, nonce, aad, body)
+	if subtle.ConstantTimeCompare(tag[:], ct[len(body):]) != 1 {
+		return nil, errors.New("message authentication failed")
+	}
+	pt := make([]byte, len(body))
+	chachaXOR(pt, body, key, nonce)
+	return pt, nil
+}
+
+// hkdfSHA256 is RFC 5869 with SHA-256
+func hkdfSHA256(salt, ikm, info []byte, n int) []byte {
+	ext := hmac.New(sha256.New, salt)
+	ext.Write(ikm)
+	prk := ext.Sum(nil)
+	var out, t []byte
+	for i := byte(1); len(out) < n; i++ {
+		exp := hmac.New(sha256.New, prk)
+		exp.Write(t)
+		exp.Write(info)
+		exp.Write([]byte{i})
+		t = exp.Sum(nil)
+		out = append(out, t...)
+	}
+	return out[:n]
+}
+
+// kemSeq is the nonce of record seq
+func kemSeq(seq uint64) []byte {
+	n := make([]byte, 12)
+	binary.BigEndian.PutUint64(n[4:], seq)
+	return n
+}
+
+// kemConn carries the protocol in records: handleConn reads and writes it
+// like a TCP connection
+type kemConn struct {
+	net.Conn
+	r            *bufio.Reader
+	txKey, rxKey []byte
+	txSeq, rxSeq uint64
+	pending      []byte // opened, not read yet
+	hdr          [kemHdr]byte
+}
+
+func (k *kemConn) Read(p []byte) (int, error) {
+	if len(k.pending) == 0 {
+		if _, err := io.ReadFull(k.r, k.hdr[:]); err != nil {
+			return 0, err
+		}
+		n := int(binary.BigEndian.Uint16(k.hdr[:]))
+		if n > kemRecordMax {
+			return 0, fmt.Errorf("KEM record of %d bytes", n)
+		}
+		rec := make([]byte, n+kemTag)
+		if _, err := io.ReadFull(k.r, rec); err != nil {
+			return 0, err
+		}
+		pt, err := aeadOpen(k.rxKey, kemSeq(k.rxSeq), k.hdr[:], rec)
+		if err != nil {
+			return 0, err
+		}
+		k.rxSeq++
+		k.pending = pt
+	}
+	n := copy(p, k.pending)
+	k.pending = k.pending[n:]
+	return n, nil
+}
+
+func (k *kemConn) Write(p []byte) (int, error) {
+	var out []byte
+	for off := 0; off < len(p); off += kemRecordMax {
+		out = k.seal(out, p[off:min(off+kemRecordMax, len(p))])
+	}
+	if _, err := k.Conn.Write(out); err != nil {
+		return 0, err
+	}
+	return len(p), nil
+}
+
+// seal appends the record of pt to dst
+func (k *kemConn) seal(dst, pt []byte) []byte {
+	n := len(dst)
+	dst = binary.BigEndian.AppendUint16(dst, uint16(len(pt)))
+	dst = aeadSeal(dst, k.txKey, kemSeq(k.txSeq), dst[n:n+kemHdr], pt)
+	k.txSeq++
+	return dst
+}
+
+// kemTicketSeal seals the next secret and its expiry with the ticket key
+func kemTicketSeal(secret []byte, expiry uint32) []byte {
+	t := make([]byte, 12, kemTicket)
+	rand.Read(t)
+	body := binary.LittleEndian.AppendUint32(append([]byte{}, secret...), expiry)
+	return aeadSeal(t, kemTicketKey[:], t[:12], nil, body)
+}
+
+// kemTicketOpen returns the secret of a ticket, nil if it does not open or
+// has expired
+func kemTicketOpen(t []byte, now uint32) []byte {
+	body, err := aeadOpen(kemTicketKey[:], t[:12], nil, t[12:])
+	if err != nil || int32(binary.LittleEndian.Uint32(body[kemSecret:])-now) <= 0 {
+		return nil
+	}
+	return body[:kemSecret]
+}
+
+// kemHandshake answers the client's hellos until one opens the channel
+func kemHandshake(c net.Conn) (*kemConn, error) {
+	r := bufio.NewReader(c)
+	start := time.Now()
+	c.SetDeadline(start.Add(kemHSTimeout))
+	msg := make([]byte, 1+kemNonce+kyberCTBytes)
+	var secret []byte
+	for secret == nil {
+		if _, err := io.ReadFull(r, msg[:1]); err != nil {
+			return nil, err
+		}
+		switch msg[0] {
+		case kemKeyReq:
+			if _, err := c.Write(append([]byte{kemKey}, kemPK...)); err != nil {
+				return nil, err
+			}
+		case kemFull:
+			m := msg[:1+kemNonce+kyberCTBytes]
+			if _, err := io.ReadFull(r, m[1:]); err != nil {
+				return nil, err
+			}
+			secret = kyberDec(m[1+kemNonce:], kemSK)
+		case kemResume:
+			m := msg[:1+kemNonce+kemTicket]
+			if _, err := io.ReadFull(r, m[1:]); err != nil {
+				return nil, err
+			}
+			secret = kemTicketOpen(m[1+kemNonce:], uint32(time.Now().Unix()))
+			if secret == nil {
+				kemDeclined.Add(1)
+				if _, err := c.Write([]byte{kemRetry}); err != nil {
+					return nil, err
+				}
+			}
+		default:
+			return nil, fmt.Errorf("KEM message type %d", msg[0])
+		}
+	}
+
+	nonces := make([]byte, 2*kemNonce)
+	copy(nonces, msg[1:1+kemNonce])
+	rand.Read(nonces[kemNonce:])
+	okm := hkdfSHA256(nonces, secret, kemInfo, 3*kemSecret)
+	k := &kemConn{Conn: c, r: r, rxKey: okm[:kemSecret], txKey: okm[kemSecret : 2*kemSecret]}
+	ticket := kemTicketSeal(okm[2*kemSecret:], uint32(time.Now().Unix())+kemTicketLife)
+	out := append([]byte{kemAccept}, nonces[kemNonce:]...)
+	if _, err := c.Write(k.seal(out, ticket)); err != nil {
+		return nil, err
+	}
+	c.SetDeadline(time.Time{})
+
+	kind, count := "full", &kemFullN
+	if msg[0] == kemResume {
+		kind, count = "resumed", &kemResumedN
+	}
+	n := count.Add(1)
+	log.Printf("%v: KEM %s handshake in %v (%d %s so far, %d tickets declined)", c.RemoteAddr(), kind,
+		time.Since(start).Round(time.Millisecond), n, kind, kemDeclined.Load())
+	return k, nil
+}
+
+// kemKeys loads or makes the key pair, and writes -kempub
+func kemKeys() {
+	seed := make([]byte, kyberSeedBytes)
+	b, err := os.ReadFile(*flagKEMKey)
+	switch {
+	case *flagKEMKey == "":
+		rand.Read(seed)
+	case err == nil && len(b) == kyberSeedBytes:
+		copy(seed, b)
+	case errors.Is(err, os.ErrNotExist):
+		rand.Read(seed)
+		if err := os.WriteFile(*flagKEMKey, seed, 0600); err != nil {
+			log.Fatal(err)
+		}
+	case err == nil:
+		log.Fatalf("-kemkey %s: %d bytes, not a %d-byte seed", *flagKEMKey, len(b), kyberSeedBytes)
+	default:
+		log.Fatal(err)
+	}
+	kemPK, kemSK = kyberKeypair(seed)
+	rand.Read(kemTicketKey[:])
+	sum := sha256.Sum256(kemPK)
+	log.Printf("KEM public key SHA-256 %s", hex.EncodeToString(sum[:]))
+
+	if *flagKEMPub != "" {
+		var h strings.Builder
+		fmt.Fprintf(&h, "/* written by go_tstamp_srv -kempub: the Kyber768 public key of its -kemkey, SHA-256 %s */\n",
+			hex.EncodeToString(sum[:]))
+		h.WriteString("#define KEM_CLIENT_SERVER_PK {")
+		for i, v := range kemPK {
+			if i%16 == 0 {
+				h.WriteString(" \\\n  ")
+			}
+			fmt.Fprintf(&h, "0x%02x,", v)
+		}
+		h.WriteString(" \\\n}\n")
+		if err := os.WriteFile(*flagKEMPub, []byte(h.String()), 0644); err != nil {
+			log.Fatal(err)
+		}
+	}
+}
+
+// serveKEM accepts connections on addr, opens their channel and serves them
+// like TCP ones
+func serveKEM(addr string) {
+	kemKeys()
+	listener, err := net.Listen("tcp", addr)
+	if err != nil {
+		log.Fatal(err)
+	}
+	log.Printf("KEM channel on %v", addr)
+	for {
+		conn, err := listener.Accept()
+		if err != nil {
+			log.Print(err)
+			continue
+		}
+		go func(c net.Conn) {
+			k, err := kemHandshake(c)
+			if err != nil {
+				log.Printf("%v: KEM handshake: %v", c.RemoteAddr(), err)
+				c.Close()
+				return
+			}
+			handleConn(k)
+		}(conn)
+	}
+}
@@ -0,0 +1,552 @@
+package main
+
+// Kyber768 for the -kem listener (kemchan.go): the round 3 KEM of the
+// pqcrystals reference code (v3.02, SHAKE variant), which the board runs as
+// nucleo-h563zi/kyber-fused-bare's kyber_fused.c. Ported line by line,
+// int16 arithmetic included, so that keys, ciphertexts and shared secrets are
+// byte for byte those of the C code; it is not FIPS 203 ML-KEM, whose hashes
+// differ. The standard library of this Go has neither, nor SHA-3, so the
+// Keccak permutation is here too. Not constant time beyond what the
+// reference is: the server only decapsulates with its own key.
+
+import (
+	"encoding/binary"
+	"math/bits"
+)
+
+const (
+	kyberK            = 3
+	kyberN            = 256
+	kyberQ            = 3329
+	kyberSymBytes     = 32
+	kyberPolyBytes    = 384
+	kyberPolyVecBytes = kyberK * kyberPolyBytes
+	kyberPolyCompr    = 128          // d = 4
+	kyberPolyVecCompr = kyberK * 320 // d = 10
+	kyberIndcpaSK     = kyberPolyVecBytes
+	kyberPKBytes      = kyberPolyVecBytes + kyberSymBytes
+	kyberSKBytes      = kyberIndcpaSK + kyberPKBytes + 2*kyberSymBytes
+	kyberCTBytes      = kyberPolyVecCompr + kyberPolyCompr
+	kyberSSBytes      = 32
+	kyberSeedBytes    = 2 * kyberSymBytes // randomness of a key pair: d, then z
+
+	kyberMont = -1044 // 2^16 mod q
+	kyberQInv = -3327 // q^-1 mod 2^16
+
+	shake128Rate = 168
+	shake256Rate = 136
+	sha3_512Rate = 72
+)
+
+var keccakRC = [24]uint64{
+	0x0000000000000001, 0x0000000000008082, 0x800000000000808a, 0x8000000080008000,
+	0x000000000000808b, 0x0000000080000001, 0x8000000080008081, 0x8000000000008009,
+	0x000000000000008a, 0x0000000000000088, 0x0000000080008009, 0x000000008000000a,
+	0x000000008000808b, 0x800000000000008b, 0x8000000000008089, 0x8000000000008003,
+	0x8000000000008002, 0x8000000000000080, 0x000000000000800a, 0x800000008000000a,
+	0x8000000080008081, 0x8000000000008080, 0x0000000080000001, 0x8000000080008008,
+}
+
+var (
+	keccakRotc = [24]int{1, 3, 6, 10, 15, 21, 28, 36, 45, 55, 2, 14, 27, 41, 56, 8, 25, 43, 62, 18, 39, 61, 20, 44}
+	keccakPiln = [24]int{10, 7, 11, 17, 18, 3, 5, 16, 8, 21, 24, 4, 15, 23, 19, 13, 12, 2, 20, 14, 22, 9, 6, 1}
+)
+
+func keccakF1600(st *[25]uint64) {
+	var bc [5]uint64
+	for round := 0; round < 24; round++ {
+		for i := 0; i < 5; i++ { // theta
+			bc[i] = st[i] ^ st[i+5] ^ st[i+10] ^ st[i+15] ^ st[i+20]
+		}
+		for i := 0; i < 5; i++ {
+			t := bc[(i+4)%5] ^ bits.RotateLeft64(bc[(i+1)%5], 1)
+			for j := 0; j < 25; j += 5 {
+				st[j+i] ^= t
+			}
+		}
+		t := st[1] // rho and pi
+		for i := 0; i < 24; i++ {
+			j := keccakPiln[i]
+			bc[0] = st[j]
+			st[j] = bits.RotateLeft64(t, keccakRotc[i])
+			t = bc[0]
+		}
+		for j := 0; j < 25; j += 5 { // chi
+			copy(bc[:], st[j:j+5])
+			for i := 0; i < 5; i++ {
+				st[j+i] ^= ^bc[(i+1)%5] & bc[(i+2)%5]
+			}
+		}
+		st[0] ^= keccakRC[round] // iota
+	}
+}
+
+// sponge is a Keccak sponge that absorbed all its input at once
+type sponge struct {
+	st   [25]uint64
+	rate int
+	out  [200]byte
+	pos  int // next byte of out; rate: squeeze another block
+}
+
+func newSponge(rate int, dsByte byte, in ...[]byte) *sponge {
+	s := &sponge{rate: rate, pos: rate}
+	var block [200]byte
+	n := 0
+	for _, b := range in {
+		for len(b) > 0 {
+			c := copy(block[n:rate], b)
+			n += c
+			b = b[c:]
+			if n == rate {
+				s.xorBlock(block[:rate])
+				n = 0
+			}
+		}
+	}
+	for i := n; i < rate; i++ {
+		block[i] = 0
+	}
+	block[n] ^= dsByte
+	block[rate-1] ^= 0x80
+	s.xorBlock(block[:rate])
+	return s
+}
+
+func (s *sponge) xorBlock(b []byte) {
+	for i := 0; i < len(b)/8; i++ {
+		s.st[i] ^= binary.LittleEndian.Uint64(b[8*i:])
+	}
+	keccakF1600(&s.st)
+}
+
+// squeeze fills p with the next output bytes
+func (s *sponge) squeeze(p []byte) {
+	for i := range p {
+		if s.pos == s.rate {
+			for j := 0; j < s.rate/8; j++ {
+				binary.LittleEndian.PutUint64(s.out[8*j:], s.st[j])
+			}
+			keccakF1600(&s.st) // for the block after
+			s.pos = 0
+		}
+		p[i] = s.out[s.pos]
+		s.pos++
+	}
+}
+
+func sha3_256(in ...[]byte) []byte {
+	out := make([]byte, 32)
+	newSponge(shake256Rate, 0x06, in...).squeeze(out)
+	return out
+}
+
+func sha3_512(in ...[]byte) []byte {
+	out := make([]byte, 64)
+	newSponge(sha3_512Rate, 0x06, in...).squeeze(out)
+	return out
+}
+
+func shake256(out []byte, in ...[]byte) {
+	newSponge(shake256Rate, 0x1f, in...).squeeze(out)
+}
+
+type poly [kyberN]int16
+type polyvec [kyberK]poly
+
+var zetas = [128]int16{
+	-1044, -758, -359, -1517, 1493, 1422, 287, 202,
+	-171, 622, 1577, 182, 962, -1202, -1474, 1468,
+	573, -1325, 264, 383, -829, 1458, -1602, -130,
+	-681, 1017, 732, 608, -1542, 411, -205, -1571,
+	1223, 652, -552, 1015, -1293, 1491, -282, -1544,
+	516, -8, -320, -666, -1618, -1162, 126, 1469,
+	-853, -90, -271, 830, 107, -1421, -247, -951,
+	-398, 961, -1508, -725, 448, -1065, 677, -1275,
+	-1103, 430, 555, 843, -1251, 871, 1550, 105,
+	422, 587, 177, -235, -291, -460, 1574, 1653,
+	-246, 778, 1159, -147, -777, 1483, -602, 1119,
+	-1590, 644, -872, 349, 418, 329, -156, -75,
+	817, 1097, 603, 610, 1322, -1285, -1465, 384,
+	-1215, -136, 1218, -1335, -874, 220, -1187, -1659,
+	-1185, -1530, -1278, 794, -1510, -854, -870, 478,
+	-108, -308, 996, 991, 958, -1460, 1522, 1628,
+}
+
+func montgomeryReduce(a int32) int16 {
+	t := int16(a) * kyberQInv
+	return int16((a - int32(t)*kyberQ) >> 16)
+}
+
+func barrettReduce(a int16) int16 {
+	const v = ((1 << 26) + kyberQ/2) / kyberQ
+	t := int16((int32(v)*int32(a) + (1 << 25)) >> 26)
+	return a - t*kyberQ
+}
+
+func fqmul(a, b int16) int16 {
+	return montgomeryReduce(int32(a) * int32(b))
+}
+
+// ntt: standard order in, bit-reversed order out
+func (r *poly) ntt() {
+	k := 1
+	for l := 128; l >= 2; l >>= 1 {
+		for start := 0; start < kyberN; start += 2 * l {
+			zeta := zetas[k]
+			k++
+			for j := start; j < start+l; j++ {
+				t := fqmul(zeta, r[j+l])
+				r[j+l] = r[j] - t
+				r[j] = r[j] + t
+			}
+		}
+	}
+	r.reduce()
+}
+
+// invnttTomont: inverse NTT, times the Montgomery factor 2^16
+func (r *poly) invnttTomont() {
+	const f = 1441 // mont^2/128
+	k := 127
+	for l := 2; l <= 128; l <<= 1 {
+		for start := 0; start < kyberN; start += 2 * l {
+			zeta := zetas[k]
+			k--
+			for j := start; j < start+l; j++ {
+				t := r[j]
+				r[j] = barrettReduce(t + r[j+l])
+				r[j+l] = r[j+l] - t
+				r[j+l] = fqmul(zeta, r[j+l])
+			}
+		}
+	}
+	for j := range r {
+		r[j] = fqmul(r[j], f)
+	}
+}
+
+func basemul(r, a, b []int16, zeta int16) {
+	r[0] = fqmul(a[1], b[1])
+	r[0] = fqmul(r[0], zeta)
+	r[0] += fqmul(a[0], b[0])
+	r[1] = fqmul(a[0], b[1])
+	r[1] += fqmul(a[1], b[0])
+}
+
+func (r *poly) basemulMontgomery(a, b *poly) {
+	for i := 0; i < kyberN/4; i++ {
+		basemul(r[4*i:], a[4*i:], b[4*i:], zetas[64+i])
+		basemul(r[4*i+2:], a[4*i+2:], b[4*i+2:], -zetas[64+i])
+	}
+}
+
+func (r *poly) tomont() {
+	const f = (1 << 32) % kyberQ
+	for i := range r {
+		r[i] = montgomeryReduce(int32(r[i]) * f)
+	}
+}
+
+func (r *poly) reduce() {
+	for i := range r {
+		r[i] = barrettReduce(r[i])
+	}
+}
+
+func (r *poly) add(a, b *poly) {
+	for i := range r {
+		r[i] = a[i] + b[i]
+	}
+}
+
+func (r *poly) sub(a, b *poly) {
+	for i := range r {
+		r[i] = a[i] - b[i]
+	}
+}
+
+// canonical maps a coefficient to {0..q-1}
+func canonical(a int16) uint32 {
+	return uint32(uint16(a + (a>>15)&kyberQ))
+}
+
+func (r *poly) compress(b []byte) {
+	var t [8]uint32
+	for i := 0; i < kyberN/8; i++ {
+		for j := range t {
+			t[j] = ((canonical(r[8*i+j])<<4 + kyberQ/2) / kyberQ) & 15
+		}
+		for j := 0; j < 4; j++ {
+			b[4*i+j] = byte(t[2*j] | t[2*j+1]<<4)
+		}
+	}
+}
+
+func (r *poly) decompress(b []byte) {
+	for i := 0; i < kyberN/2; i++ {
+		r[2*i] = int16((uint32(b[i]&15)*kyberQ + 8) >> 4)
+		r[2*i+1] = int16((uint32(b[i]>>4)*kyberQ + 8) >> 4)
+	}
+}
+
+func (r *poly) tobytes(b []byte) {
+	for i := 0; i < kyberN/2; i++ {
+		t0, t1 := canonical(r[2*i]), canonical(r[2*i+1])
+		b[3*i] = byte(t0)
+		b[3*i+1] = byte(t0>>8 | t1<<4)
+		b[3*i+2] = byte(t1 >> 4)
+	}
+}
+
+func (r *poly) frombytes(b []byte) {
+	for i := 0; i < kyberN/2; i++ {
+		r[2*i] = int16((uint16(b[3*i]) | uint16(b[3*i+1])<<8) & 0xfff)
+		r[2*i+1] = int16((uint16(b[3*i+1])>>4 | uint16(b[3*i+2])<<4) & 0xfff)
+	}
+}
+
+func (r *poly) frommsg(msg []byte) {
+	for i := 0; i < kyberN/8; i++ {
+		for j := 0; j < 8; j++ {
+			mask := -int16((msg[i] >> j) & 1)
+			r[8*i+j] = mask & ((kyberQ + 1) / 2)
+		}
+	}
+}
+
+func (r *poly) tomsg(msg []byte) {
+	for i := 0; i < kyberN/8; i++ {
+		msg[i] = 0
+		for j := 0; j < 8; j++ {
+			t := ((canonical(r[8*i+j])<<1 + kyberQ/2) / kyberQ) & 1
+			msg[i] |= byte(t << j)
+		}
+	}
+}
+
+// getnoise samples the centered binomial distribution, eta 2 (eta1 and
+// eta2 of Kyber768)
+func (r *poly) getnoise(seed []byte, nonce byte) {
+	var buf [2 * kyberN / 4]byte
+	shake256(buf[:], seed, []byte{nonce})
+	for i := 0; i < kyberN/8; i++ {
+		t := binary.LittleEndian.Uint32(buf[4*i:])
+		d := t&0x55555555 + (t>>1)&0x55555555
+		for j := 0; j < 8; j++ {
+			a := int16((d >> (4 * j)) & 3)
+			b := int16((d >> (4*j + 2)) & 3)
+			r[8*i+j] = a - b
+		}
+	}
+}
+
+// uniform samples a matrix entry from SHAKE128(seed, x, y), in the NTT domain
+func (r *poly) uniform(seed []byte, x, y byte) {
+	s := newSponge(shake128Rate, 0x1f, seed, []byte{x, y})
+	var buf [3 * shake128Rate]byte
+	ctr := 0
+	for ctr < kyberN {
+		s.squeeze(buf[:]) // the same stream as the C code's blocks: 168 is a multiple of 3
+		for pos := 0; ctr < kyberN && pos+3 <= len(buf); pos += 3 {
+			v0 := (uint16(buf[pos]) | uint16(buf[pos+1])<<8) & 0xfff
+			v1 := (uint16(buf[pos+1])>>4 | uint16(buf[pos+2])<<4) & 0xfff
+			if v0 < kyberQ {
+				r[ctr] = int16(v0)
+				ctr++
+			}
+			if ctr < kyberN && v1 < kyberQ {
+				r[ctr] = int16(v1)
+				ctr++
+			}
+		}
+	}
+}
+
+func (r *poly) basemulAcc(a, b *polyvec) {
+	var t poly
+	r.basemulMontgomery(&a[0], &b[0])
+	for i := 1; i < kyberK; i++ {
+		t.basemulMontgomery(&a[i], &b[i])
+		r.add(r, &t)
+	}
+	r.reduce()
+}
+
+// genMatrix: A, or its transpose
+func genMatrix(a *[kyberK]polyvec, seed []byte, transposed bool) {
+	for i := 0; i < kyberK; i++ {
+		for j := 0; j < kyberK; j++ {
+			if transposed {
+				a[i][j].uniform(seed, byte(i), byte(j))
+			} else {
+				a[i][j].uniform(seed, byte(j), byte(i))
+			}
+		}
+	}
+}
+
+func indcpaKeypair(pk, sk, d []byte) {
+	var a [kyberK]polyvec
+	var e, pkpv, skpv polyvec
+
+	buf := sha3_512(d)
+	publicSeed, noiseSeed := buf[:kyberSymBytes], buf[kyberSymBytes:]
+	genMatrix(&a, publicSeed, false)
+	nonce := byte(0)
+	for i := range skpv {
+		skpv[i].getnoise(noiseSeed, nonce)
+		nonce++
+	}
+	for i := range e {
+		e[i].getnoise(noiseSeed, nonce)
+		nonce++
+	}
+	for i := 0; i < kyberK; i++ {
+		skpv[i].ntt()
+		e[i].ntt()
+	}
+	for i := 0; i < kyberK; i++ {
+		pkpv[i].basemulAcc(&a[i], &skpv)
+		pkpv[i].tomont()
+	}
+	for i := 0; i < kyberK; i++ {
+		pkpv[i].add(&pkpv[i], &e[i])
+		pkpv[i].reduce()
+		skpv[i].tobytes(sk[i*kyberPolyBytes:])
+		pkpv[i].tobytes(pk[i*kyberPolyBytes:])
+	}
+	copy(pk[kyberPolyVecBytes:], publicSeed)
+}
+
+func indcpaEnc(c, m, pk, coins []byte) {
+	var at [kyberK]polyvec
+	var sp, pkpv, ep, b polyvec
+	var v, k, epp poly
+
+	for i := range pkpv {
+		pkpv[i].frombytes(pk[i*kyberPolyBytes:])
+	}
+	k.frommsg(m)
+	genMatrix(&at, pk[kyberPolyVecBytes:], true)
+	nonce := byte(0)
+	for i := range sp {
+		sp[i].getnoise(coins, nonce)
+		nonce++
+	}
+	for i := range ep {
+		ep[i].getnoise(coins, nonce)
+		nonce++
+	}
+	epp.getnoise(coins, nonce)
+
+	for i := range sp {
+		sp[i].ntt()
+	}
+	for i := 0; i < kyberK; i++ {
+		b[i].basemulAcc(&at[i], &sp)
+	}
+	v.basemulAcc(&pkpv, &sp)
+	for i := range b {
+		b[i].invnttTomont()
+	}
+	v.invnttTomont()
+	for i := range b {
+		b[i].add(&b[i], &ep[i])
+		b[i].reduce()
+	}
+	v.add(&v, &epp)
+	v.add(&v, &k)
+	v.reduce()
+
+	for i := range b { // polyvec_compress, d = 10
+		var t [4]uint32
+		for j := 0; j < kyberN/4; j++ {
+			for x := range t {
+				t[x] = ((canonical(b[i][4*j+x])<<10 + kyberQ/2) / kyberQ) & 0x3ff
+			}
+			o := c[i*320+5*j:]
+			o[0] = byte(t[0])
+			o[1] = byte(t[0]>>8 | t[1]<<2)
+			o[2] = byte(t[1]>>6 | t[2]<<4)
+			o[3] = byte(t[2]>>4 | t[3]<<6)
+			o[4] = byte(t[3] >> 2)
+		}
+	}
+	v.compress(c[kyberPolyVecCompr:])
+}
+
+func indcpaDec(m, c, sk []byte) {
+	var b, skpv polyvec
+	var v, mp poly
+
+	for i := range b { // polyvec_decompress, d = 10
+		for j := 0; j < kyberN/4; j++ {
+			a := c[i*320+5*j:]
+			t := [4]uint32{
+				uint32(a[0]) | uint32(a[1])<<8,
+				uint32(a[1])>>2 | uint32(a[2])<<6,
+				uint32(a[2])>>4 | uint32(a[3])<<4,
+				uint32(a[3])>>6 | uint32(a[4])<<2,
+			}
+			for x := range t {
+				b[i][4*j+x] = int16(((t[x]&0x3ff)*kyberQ + 512) >> 10)
+			}
+		}
+	}
+	v.decompress(c[kyberPolyVecCompr:])
+	for i := range skpv {
+		skpv[i].frombytes(sk[i*kyberPolyBytes:])
+		b[i].ntt()
+	}
+	mp.basemulAcc(&skpv, &b)
+	mp.invnttTomont()
+	mp.sub(&v, &mp)
+	mp.reduce()
+	mp.tomsg(m)
+}
+
+// kyberKeypair makes the key pair of seed (kyberSeedBytes), which holds the
+// random bytes crypto_kem_keypair draws, in its order
+func kyberKeypair(seed []byte) (pk, sk []byte) {
+	pk = make([]byte, kyberPKBytes)
+	sk = make([]byte, kyberSKBytes)
+	indcpaKeypair(pk, sk, seed[:kyberSymBytes])
+	copy(sk[kyberIndcpaSK:], pk)
+	copy(sk[kyberSKBytes-2*kyberSymBytes:], sha3_256(pk))
+	copy(sk[kyberSKBytes-kyberSymBytes:], seed[kyberSymBytes:kyberSeedBytes])
+	return pk, sk
+}
+
+// kyberEnc encapsulates to pk with the random bytes coin (kyberSymBytes)
+func kyberEnc(pk, coin []byte) (ct, ss []byte) {
+	m := sha3_256(coin)
+	kr := sha3_512(m, sha3_256(pk))
+	ct = make([]byte, kyberCTBytes)
+	indcpaEnc(ct, m, pk, kr[kyberSymBytes:])
+	ss = make([]byte, kyberSSBytes)
+	shake256(ss, kr[:kyberSymBytes], sha3_256(ct))
+	return ct, ss
+}
+
+// kyberDec decapsulates ct: a wrong ciphertext gets a pseudo-random secret
+func kyberDec(ct, sk []byte) []byte {
+	m := make([]byte, kyberSymBytes)
+	pk := sk[kyberIndcpaSK : kyberIndcpaSK+kyberPKBytes]
+	indcpaDec(m, ct, sk)
+	kr := sha3_512(m, sk[kyberSKBytes-2*kyberSymBytes:kyberSKBytes-kyberSymBytes])
+	cmp := make([]byte, kyberCTBytes)
+	indcpaEnc(cmp, m, pk, kr[kyberSymBytes:])
+	var diff byte
+	for i := range ct {
+		diff |= ct[i] ^ cmp[i]
+	}
+	mask := byte((uint32(diff) - 1) >> 31) // 1 if equal
+	mask--                                 // 0 if equal, 0xff if not
+	for i := 0; i < kyberSymBytes; i++ {
+		kr[i] ^= mask & (kr[i] ^ sk[kyberSKBytes-kyberSymBytes+i])
+	}
+	ss := make([]byte, kyberSSBytes)
+	shake256(ss, kr[:kyberSymBytes], sha3_256(ct))
+	return ss
+}
@@ -0,0 +1,381 @@
+package main
+
+// Load generator: -load N simulates N devices speaking the tcp_client.c
+// protocol against -addr. By default each device keeps one connection with up
+// to -pipeline requests in flight (CLIENT_PERSISTENT); -oneshot connects per
+// request (CLIENT_ONESHOT). Like the firmware, a device offers -proto with a
+// HELLO on its first connection and falls back to v1 if the server answers
+// with a v1 packet or closes the connection; a timeout sends it again on the
+// next connection. Responses are checked like the firmware does (framing, type and
+// echoed sequence number) and every request latency is kept for the
+// percentiles of the final report.
+
+import (
+	"bufio"
+	"encoding/json"
+	"errors"
+	"fmt"
+	"io"
+	"log"
+	"net"
+	"net/http"
+	"sort"
+	"sync"
+	"time"
+)
+
+// device is one simulated board
+type device struct {
+	seq        uint32
+	proto      int  // protocol version in use
+	negotiated bool // no HELLO needed on new connections
+	flags      byte // v2 features granted by the server
+	requests   uint64
+	responses  uint64
+	errors     uint64
+	connects   uint64
+	reconnects uint64
+	bytes      uint64 // application bytes, both directions
+	lat        []time.Duration
+}
+
+// request builds the next request frame in buf
+func (d *device) request(buf []byte, seq uint32) []byte {
+	if d.proto >= 2 {
+		buf = buf[:v2Header]
+		for i := range buf {
+			buf[i] = 0
+		}
+		buf[0] = v2Magic
+		buf[1] = v2Version<<4 | v2Req
+		buf[v2Flags] = d.flags
+		putU32(buf[v2Seq:], seq)
+		return buf
+	}
+	buf = buf[:packetSize]
+	for i := range buf {
+		buf[i] = 0
+	}
+	buf[0] = packetHead
+	buf[1] = typeReq
+	putU32(buf[offSeq:], seq)
+	buf[packetSize-1] = packetTail
+	return buf
+}
+
+// response reads and checks the answer to request seq, returns its size
+func (d *device) response(r io.Reader, buf []byte, seq uint32) (int, error) {
+	if d.proto < 2 {
+		if _, err := io.ReadFull(r, buf[:packetSize]); err != nil {
+			return 0, err
+		}
+		if buf[0] != packetHead || buf[packetSize-1] != packetTail || buf[1] != typeResp ||
+			getU32(buf[offSeq:]) != seq {
+			return 0, fmt.Errorf("bad response to request %d", seq)
+		}
+		return packetSize, nil
+	}
+
+	if _, err := io.ReadFull(r, buf[:v2Header]); err != nil {
+		return 0, err
+	}
+	n := int(buf[v2Len])
+	if buf[0] != v2Magic || buf[1] != v2Version<<4|v2Resp || n < 6 || n > v2BodyMax ||
+		getU32(buf[v2Seq:]) != seq {
+		return 0, fmt.Errorf("bad response to request %d", seq)
+	}
+	if _, err := io.ReadFull(r, buf[v2Header:v2Header+n]); err != nil {
+		return 0, err
+	}
+	return v2Header + n, nil
+}
+
+// errV1Only: the server answered the HELLO with a v1 packet, or closed the
+// connection on it. The device sticks to v1 and reconnects.
+var errV1Only = errors.New("v1-only server, falling back to v1")
+
+// hello negotiates the version on a fresh connection. A v1 answer or a close
+// right after the HELLO give errV1Only; any other failure (write error,
+// timeout, short or malformed answer) leaves the device on -proto, and the
+// next connection sends the HELLO again.
+func (d *device) hello(c net.Conn, r io.Reader) error {
+	buf := make([]byte, v2Header)
+	buf[0] = v2Magic
+	buf[1] = byte(*flagProto)<<4 | v2Hello
+	if *flagUsec {
+		buf[v2Flags] = v2FUsec
+	}
+
+	c.SetDeadline(time.Now().Add(2 * time.Second)) // CLIENT_RESP_TIMEOUT_MS
+	_, err := c.Write(buf)
+	if err == nil {
+		_, err = io.ReadFull(r, buf)
+	}
+	c.SetDeadline(time.Time{})
+
+	if err == io.EOF || (err == nil && buf[0] == packetHead) {
+		d.negotiated = true
+		d.proto = 1
+		return errV1Only
+	}
+	if err != nil {
+		return err
+	}
+	if buf[0] != v2Magic || buf[1]&0x0f != v2Hello || buf[1]>>4 < 1 {
+		return fmt.Errorf("bad HELLO answer")
+	}
+	d.negotiated = true
+	d.proto = int(buf[1] >> 4)
+	if d.proto > *flagProto {
+		d.proto = *flagProto
+	}
+	d.flags = buf[v2Flags] & v2FUsec
+	d.bytes += 2 * v2Header
+	return nil
+}
+
+// runOneshot: connect, one request, close on the response
+func (d *device) runOneshot(deadline time.Time) {
+	pkt := make([]byte, packetSize)
+
+	for time.Now().Before(deadline) {
+		t0 := time.Now()
+		c, err := net.DialTimeout("tcp", *flagAddr, 2*time.Second)
+		if err != nil {
+			d.errors++
+			time.Sleep(250 * time.Millisecond) // CLIENT_BACKOFF_MIN_MS
+			continue
+		}
+		d.connects++
+		if d.proto >= 2 && !d.negotiated {
+			if err = d.hello(c, c); err != nil {
+				c.Close()
+				if err != errV1Only {
+					d.errors++
+				}
+				continue
+			}
+		}
+		c.SetDeadline(time.Now().Add(2 * time.Second)) // CLIENT_RESP_TIMEOUT_MS
+
+		d.seq++
+		req := d.request(pkt, d.seq)
+		d.requests++
+		n := 0
+		if _, err = c.Write(req); err == nil {
+			n, err = d.response(c, pkt, d.seq)
+		}
+		c.Close()
+		if err != nil {
+			d.errors++
+			continue
+		}
+		d.responses++
+		d.bytes += uint64(len(req) + n)
+		d.lat = append(d.lat, time.Since(t0))
+
+		if *flagInterval > 0 {
+			time.Sleep(*flagInterval)
+		}
+	}
+}
+
+// runPersistent: one connection, up to -pipeline outstanding requests,
+// reconnect on error. Latency is measured from the write of each request.
+func (d *device) runPersistent(deadline time.Time) {
+	for time.Now().Before(deadline) {
+		c, err := net.DialTimeout("tcp", *flagAddr, 2*time.Second)
+		if err != nil {
+			d.errors++
+			time.Sleep(250 * time.Millisecond)
+			continue
+		}
+		d.connects++
+		if d.session(c, deadline) != nil && time.Now().Before(deadline) {
+			d.errors++
+			d.reconnects++
+		}
+		c.Close()
+	}
+}
+
+func (d *device) session(c net.Conn, deadline time.Time) error {
+	type inflight struct {
+		seq uint32
+		t0  time.Time
+	}
+	window := make(chan inflight, *flagPipeline) // outstanding requests, oldest first
+	done := make(chan error, 1)
+	r := bufio.NewReaderSize(c, 16*packetSize)
+
+	if d.proto >= 2 && !d.negotiated {
+		if err := d.hello(c, r); err != nil {
+			if err == errV1Only {
+				return nil // not an error: reconnect speaking v1
+			}
+			return err
+		}
+	}
+
+	// reader: responses come back in request order. It keeps its own
+	// counters, added to the device's once it is done (see below).
+	var responses, rxBytes uint64
+	go func() {
+		pkt := make([]byte, packetSize)
+		for req := range window {
+			c.SetReadDeadline(time.Now().Add(2 * time.Second))
+			n, err := d.response(r, pkt, req.seq)
+			if err != nil {
+				done <- err
+				return
+			}
+			d.lat = append(d.lat, time.Since(req.t0))
+			responses++
+			rxBytes += uint64(n)
+		}
+		done <- nil
+	}()
+
+	pkt := make([]byte, packetSize)
+	var requests, txBytes uint64
+	var err error
+	for time.Now().Before(deadline) {
+		d.seq++
+		buf := d.request(pkt, d.seq)
+		req := inflight{d.seq, time.Now()}
+		select {
+		case window <- req: // blocks while the pipeline is full
+		case err = <-done:
+			close(window)
+			d.count(requests, txBytes, responses, rxBytes)
+			return err
+		}
+		if _, err = c.Write(buf); err != nil {
+			break
+		}
+		requests++
+		txBytes += uint64(len(buf))
+		if *flagInterval > 0 {
+			time.Sleep(*flagInterval)
+		}
+	}
+	close(window)
+	if err != nil {
+		c.Close() // unblocks the reader
+		<-done
+	} else {
+		err = <-done
+	}
+	d.count(requests, txBytes, responses, rxBytes) // the reader has returned
+	return err
+}
+
+// count adds the totals of a session's writer and reader to the device
+func (d *device) count(requests, txBytes, responses, rxBytes uint64) {
+	d.requests += requests
+	d.responses += responses
+	d.bytes += txBytes + rxBytes
+}
+
+func percentile(sorted []time.Duration, p float64) time.Duration {
+	if len(sorted) == 0 {
+		return 0
+	}
+	i := int(p * float64(len(sorted)-1))
+	return sorted[i]
+}
+
+// serverStats reads the request count and CPU time from the -stats URL
+func serverStats() (requests uint64, cpu float64, err error) {
+	resp, err := http.Get(*flagStats)
+	if err != nil {
+		return 0, 0, err
+	}
+	defer resp.Body.Close()
+	var st struct {
+		Requests   uint64  `json:"requests"`
+		CPUSeconds float64 `json:"cpu_seconds"`
+	}
+	err = json.NewDecoder(resp.Body).Decode(&st)
+	return st.Requests, st.CPUSeconds, err
+}
+
+// runLoad drives -load devices for -duration and prints the report
+func runLoad() int {
+	devs := make([]device, *flagLoad)
+	mode := "persistent"
+	if *flagOneshot {
+		mode = "oneshot"
+	} else if *flagPipeline < 1 {
+		log.Fatal("-pipeline must be at least 1")
+	}
+	for i := range devs {
+		devs[i].proto = *flagProto
+	}
+	fmt.Printf("%d devices, %s, v%d, pipeline %d, interval %v, against %s for %v\n",
+		*flagLoad, mode, *flagProto, *flagPipeline, *flagInterval, *flagAddr, *flagDuration)
+
+	var srvReq0 uint64
+	var srvCPU0 float64
+	if *flagStats != "" {
+		var err error
+		if srvReq0, srvCPU0, err = serverStats(); err != nil {
+			log.Fatal(err)
+		}
+	}
+
+	var wg sync.WaitGroup
+	start := time.Now()
+	deadline := start.Add(*flagDuration)
+	for i := range devs {
+		wg.Add(1)
+		go func(d *device) {
+			defer wg.Done()
+			if *flagOneshot {
+				d.runOneshot(deadline)
+			} else {
+				d.runPersistent(deadline)
+			}
+		}(&devs[i])
+	}
+	wg.Wait()
+	elapsed := time.Since(start)
+
+	var total device
+	protos := map[int]int{}
+	for i := range devs {
+		d := &devs[i]
+		total.requests += d.requests
+		total.responses += d.responses
+		total.errors += d.errors
+		total.connects += d.connects
+		total.reconnects += d.reconnects
+		total.bytes += d.bytes
+		total.lat = append(total.lat, d.lat...)
+		protos[d.proto]++
+	}
+	sort.Slice(total.lat, func(i, j int) bool { return total.lat[i] < total.lat[j] })
+
+	fmt.Printf("requests %d, responses %d, errors %d, connects %d, reconnects %d, devices per version %v\n",
+		total.requests, total.responses, total.errors, total.connects, total.reconnects, protos)
+	if total.responses > 0 {
+		fmt.Printf("throughput %.0f responses/s, %d bytes/sample (%.2f MB/s)\n",
+			float64(total.responses)/elapsed.Seconds(), total.bytes/total.responses,
+			float64(total.bytes)/elapsed.Seconds()/1e6)
+	}
+	if len(total.lat) > 0 {
+		fmt.Printf("latency p50 %v, p99 %v, p999 %v, max %v\n",
+			percentile(total.lat, 0.50), percentile(total.lat, 0.99),
+			percentile(total.lat, 0.999), total.lat[len(total.lat)-1])
+	}
+	if *flagStats != "" {
+		if req, cpu, err := serverStats(); err == nil && req > srvReq0 {
+			fmt.Printf("server cpu %.3f s, %.2f us/request\n",
+				cpu-srvCPU0, (cpu-srvCPU0)*1e6/float64(req-srvReq0))
+		}
+	}
+	if total.errors > 0 {
+		return 1
+	}
+	return 0
+}
@@ -0,0 +1,163 @@
+package main
+
+// Metrics scraper: -scrape host:port[,host:port...] connects to the metrics
+// task of each board (metrics.c, port 5001) every -every and appends what it
+// reads to -out as CSV rows "time,device,name,value", one per counter, until
+// interrupted. The boards only send counters, which wrap at 32 bits; the
+// scraper adds, from two consecutive snapshots of a device:
+//   - task.<name>.cpu_pct, the share of the run time counter the task used;
+//   - op.<name>.avg_us, the mean latency of the operations in between;
+//   - op.<name>.per_s, their rate (device time, from uptime_ms).
+// A smaller uptime_ms means the board restarted: nothing is derived then.
+
+import (
+	"bufio"
+	"encoding/csv"
+	"fmt"
+	"io"
+	"log"
+	"net"
+	"os"
+	"sort"
+	"strconv"
+	"strings"
+	"sync"
+	"time"
+)
+
+const scrapeMax = 64 << 10 // bytes read per snapshot at most
+
+// snapshot is one metrics page, name -> value
+type snapshot map[string]uint64
+
+// scrapeOne reads one snapshot from addr
+func scrapeOne(addr string, timeout time.Duration) (snapshot, error) {
+	c, err := net.DialTimeout("tcp", addr, timeout)
+	if err != nil {
+		return nil, err
+	}
+	defer c.Close()
+	c.SetDeadline(time.Now().Add(timeout))
+
+	s := snapshot{}
+	sc := bufio.NewScanner(io.LimitReader(c, scrapeMax))
+	for sc.Scan() {
+		f := strings.Fields(sc.Text())
+		if len(f) != 2 {
+			continue
+		}
+		v, err := strconv.ParseUint(f[1], 10, 64)
+		if err != nil {
+			continue
+		}
+		s[f[0]] = v
+	}
+	if err := sc.Err(); err != nil {
+		return nil, err
+	}
+	if _, ok := s["uptime_ms"]; !ok {
+		return nil, fmt.Errorf("%s: no uptime_ms, not a metrics page", addr)
+	}
+	return s, nil
+}
+
+// delta32 is cur - prev for a counter that wraps at 32 bits
+func delta32(cur, prev uint64) uint64 {
+	return uint64(uint32(cur) - uint32(prev))
+}
+
+// derive computes the rates and averages between prev and cur
+func derive(prev, cur snapshot) map[string]float64 {
+	out := map[string]float64{}
+	if prev == nil || cur["uptime_ms"] < prev["uptime_ms"] {
+		return out
+	}
+
+	total := delta32(cur["run.total"], prev["run.total"])
+	elapsed := float64(delta32(cur["uptime_ms"], prev["uptime_ms"])) / 1000
+	for name, v := range cur {
+		p, ok := prev[name]
+		if !ok {
+			continue
+		}
+		switch {
+		case strings.HasPrefix(name, "task.") && strings.HasSuffix(name, ".run") && total > 0:
+			out[strings.TrimSuffix(name, ".run")+".cpu_pct"] = 100 * float64(delta32(v, p)) / float64(total)
+		case strings.HasPrefix(name, "op.") && strings.HasSuffix(name, ".count"):
+			op := strings.TrimSuffix(name, ".count")
+			n := delta32(v, p)
+			if n > 0 {
+				out[op+".avg_us"] = float64(cur[op+".sum_us"]-prev[op+".sum_us"]) / float64(n)
+			}
+			if elapsed > 0 {
+				out[op+".per_s"] = float64(n) / elapsed
+			}
+		}
+	}
+	return out
+}
+
+// runScrape polls the devices until interrupted, returns the exit status
+func runScrape() int {
+	devices := strings.Split(*flagScrape, ",")
+
+	w := os.Stdout
+	if *flagOut != "" {
+		f, err := os.OpenFile(*flagOut, os.O_CREATE|os.O_WRONLY|os.O_APPEND, 0644)
+		if err != nil {
+			log.Print(err)
+			return 1
+		}
+		defer f.Close()
+		w = f
+	}
+	out := csv.NewWriter(w)
+	if fi, err := w.Stat(); err != nil || fi.Size() == 0 {
+		out.Write([]string{"time", "device", "name", "value"})
+	}
+
+	prev := make([]snapshot, len(devices))
+	cur := make([]snapshot, len(devices))
+	tick := time.NewTicker(*flagEvery)
+	defer tick.Stop()
+	for {
+		now := time.Now()
+		var wg sync.WaitGroup
+		for i, d := range devices {
+			wg.Add(1)
+			go func(i int, d string) {
+				defer wg.Done()
+				s, err := scrapeOne(d, *flagEvery)
+				if err != nil {
+					log.Print(err)
+				}
+				cur[i] = s
+			}(i, d)
+		}
+		wg.Wait()
+
+		ts := now.UTC().Format(time.RFC3339Nano)
+		for i, d := range devices {
+			if cur[i] == nil {
+				continue // keep the last snapshot: rates span the gap
+			}
+			rows := make([][]string, 0, len(cur[i]))
+			for name, v := range cur[i] {
+				rows = append(rows, []string{ts, d, name, strconv.FormatUint(v, 10)})
+			}
+			for name, v := range derive(prev[i], cur[i]) {
+				rows = append(rows, []string{ts, d, name, strconv.FormatFloat(v, 'f', 2, 64)})
+			}
+			sort.Slice(rows, func(a, b int) bool { return rows[a][2] < rows[b][2] })
+			out.WriteAll(rows)
+			prev[i] = cur[i]
+		}
+		out.Flush()
+		if err := out.Error(); err != nil {
+			log.Print(err)
+			return 1
+		}
+
+		<-tick.C
+	}
+}
@@ -0,0 +1,224 @@
+package main
+
+// TLS listener: with -tls addr, the same protocol (v1 packets and v2 frames)
+// is also served over TLS, for freertos_lwip_mbedtls7's tls_client.c. The
+// certificate comes from -cert/-key (PEM), or is generated at start: a
+// self-signed ECDSA P-256 one, the curve and signature of the board's
+// ECDHE-ECDSA cipher suites. Its SHA-256 fingerprint is logged, to compare
+// with what the board prints. Connections are counted with the TCP ones.
+// With -tlsecho addr, TLS connections there get back whatever they send,
+// for tls_client.c's bulk test (TLS_CLIENT_BULK_KB); each one logs its
+// byte count and rate when it ends.
+// Both listeners share one configuration, hence one certificate and one
+// set of session tickets: a session from one resumes on the other.
+// -tlsresume picks how the TLS 1.2 sessions the board keeps in flash
+// (tls_store.c) are resumed: "ticket" leaves it to crypto/tls's encrypted
+// tickets (RFC 5077, the whole session state in the ticket), "cache" keeps
+// the state here and hands out a 16-byte random key as the ticket (smaller
+// ClientHello and flash record, and sessions die with the server), "off"
+// makes every handshake a full one. crypto/tls does not resume by session
+// ID, so tickets carry both. Every handshake is logged, full or resumed.
+
+import (
+	"crypto/ecdsa"
+	"crypto/elliptic"
+	"crypto/rand"
+	"crypto/sha256"
+	"crypto/tls"
+	"crypto/x509"
+	"crypto/x509/pkix"
+	"encoding/hex"
+	"io"
+	"log"
+	"math/big"
+	"net"
+	"sync"
+	"sync/atomic"
+	"time"
+)
+
+const (
+	tlsCacheMax  = 4096           // sessions kept by -tlsresume cache...
+	tlsCacheTTL  = 24 * time.Hour // ...for this long at most
+	tlsHSTimeout = 30 * time.Second
+)
+
+var (
+	tlsConf     *tls.Config
+	tlsConfOnce sync.Once
+	tlsFull     atomic.Uint64 // handshakes of both listeners
+	tlsResumed  atomic.Uint64
+)
+
+// sessionCache is the server-side session store of -tlsresume cache
+type sessionCache struct {
+	mu sync.Mutex
+	m  map[string]cacheEntry
+}
+
+type cacheEntry struct {
+	state   *tls.SessionState
+	created time.Time
+}
+
+// wrap stores the session and returns its key as the ticket
+func (c *sessionCache) wrap(_ tls.ConnectionState, ss *tls.SessionState) ([]byte, error) {
+	key := make([]byte, 16)
+	if _, err := rand.Read(key); err != nil {
+		return nil, err
+	}
+	now := time.Now()
+	c.mu.Lock()
+	defer c.mu.Unlock()
+	if len(c.m) >= tlsCacheMax {
+		for k, e := range c.m {
+			if now.Sub(e.created) > tlsCacheTTL || len(c.m) >= tlsCacheMax {
+				delete(c.m, k) // expired, or any one when all are fresh
+			}
+		}
+	}
+	c.m[string(key)] = cacheEntry{ss, now}
+	return key, nil
+}
+
+// unwrap finds the session of a ticket; nil makes the handshake a full one
+func (c *sessionCache) unwrap(key []byte, _ tls.ConnectionState) (*tls.SessionState, error) {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+	e, ok := c.m[string(key)]
+	if !ok || time.Since(e.created) > tlsCacheTTL {
+		return nil, nil
+	}
+	return e.state, nil
+}
+
+// tlsCertificate loads -cert/-key, or makes an ephemeral certificate
+func tlsCertificate() (tls.Certificate, error) {
+	if *flagCert != "" {
+		return tls.LoadX509KeyPair(*flagCert, *flagKey)
+	}
+
+	key, err := ecdsa.GenerateKey(elliptic.P256(), rand.Reader)
+	if err != nil {
+		return tls.Certificate{}, err
+	}
+	serial, err := rand.Int(rand.Reader, new(big.Int).Lsh(big.NewInt(1), 64))
+	if err != nil {
+		return tls.Certificate{}, err
+	}
+	tmpl := x509.Certificate{
+		SerialNumber: serial,
+		Subject:      pkix.Name{CommonName: "go_tstamp_srv"},
+		DNSNames:     []string{"go_tstamp_srv"},
+		NotBefore:    time.Now().Add(-time.Hour),
+		NotAfter:     time.Now().Add(365 * 24 * time.Hour),
+		KeyUsage:     x509.KeyUsageDigitalSignature,
+		ExtKeyUsage:  []x509.ExtKeyUsage{x509.ExtKeyUsageServerAuth},
+	}
+	der, err := x509.CreateCertificate(rand.Reader, &tmpl, &tmpl, &key.PublicKey, key)
+	if err != nil {
+		return tls.Certificate{}, err
+	}
+	return tls.Certificate{Certificate: [][]byte{der}, PrivateKey: key}, nil
+}
+
+// tlsConfig makes the configuration of both listeners, once
+func tlsConfig() *tls.Config {
+	tlsConfOnce.Do(func() {
+		cert, err := tlsCertificate()
+		if err != nil {
+			log.Fatal(err)
+		}
+		sum := sha256.Sum256(cert.Certificate[0])
+		log.Printf("TLS certificate SHA-256 %s, resumption %s", hex.EncodeToString(sum[:]), *flagResume)
+
+		tlsConf = &tls.Config{
+			Certificates: []tls.Certificate{cert},
+			MinVersion:   tls.VersionTLS12,
+		}
+		switch *flagResume {
+		case "ticket":
+		case "cache":
+			cache := &sessionCache{m: make(map[string]cacheEntry)}
+			tlsConf.WrapSession = cache.wrap
+			tlsConf.UnwrapSession = cache.unwrap
+		case "off":
+			tlsConf.SessionTicketsDisabled = true
+		default:
+			log.Fatalf("-tlsresume %q: ticket, cache or off", *flagResume)
+		}
+	})
+	return tlsConf
+}
+
+// tlsListen listens on addr with the shared configuration
+func tlsListen(addr string) net.Listener {
+	listener, err := tls.Listen("tcp", addr, tlsConfig())
+	if err != nil {
+		log.Fatal(err)
+	}
+	log.Printf("TLS on %v", addr)
+	return listener
+}
+
+// tlsHandshake runs the handshake of c and logs it, full or resumed
+func tlsHandshake(c net.Conn) error {
+	tc := c.(*tls.Conn)
+	start := time.Now()
+	tc.SetDeadline(start.Add(tlsHSTimeout))
+	if err := tc.Handshake(); err != nil {
+		log.Printf("%v: TLS handshake: %v", c.RemoteAddr(), err)
+		return err
+	}
+	tc.SetDeadline(time.Time{})
+
+	kind, n := "full", tlsFull.Add(1)
+	if tc.ConnectionState().DidResume {
+		kind, n = "resumed", tlsResumed.Add(1)
+	}
+	log.Printf("%v: TLS %s handshake in %v (%d %s so far)", c.RemoteAddr(), kind,
+		time.Since(start).Round(time.Millisecond), n, kind)
+	return nil
+}
+
+// serveTLS accepts TLS connections on addr and serves them like TCP ones
+func serveTLS(addr string) {
+	listener := tlsListen(addr)
+	for {
+		conn, err := listener.Accept()
+		if err != nil {
+			log.Print(err)
+			continue
+		}
+		go func(c net.Conn) {
+			if tlsHandshake(c) != nil {
+				c.Close()
+				return
+			}
+			handleConn(c)
+		}(conn)
+	}
+}
+
+// serveTLSEcho accepts TLS connections on addr and echoes them
+func serveTLSEcho(addr string) {
+	listener := tlsListen(addr)
+	for {
+		conn, err := listener.Accept()
+		if err != nil {
+			log.Print(err)
+			continue
+		}
+		go func(c net.Conn) {
+			defer c.Close()
+			if tlsHandshake(c) != nil {
+				return
+			}
+			start := time.Now()
+			n, err := io.Copy(c, c)
+			d := time.Since(start)
+			log.Printf("%v: echoed %d bytes in %v (%.1f kB/s each way), %v", c.RemoteAddr(), n, d.Round(time.Millisecond),
+				float64(n)/1024/d.Seconds(), err)
+		}(conn)
+	}
+}
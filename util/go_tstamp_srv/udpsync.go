@@ -0,0 +1,197 @@
+package main
+
+// NTP-style time sync over UDP (TP2_SYNC, see tcp_client.h and udp_sync.h).
+// The request carries T1 (opaque to the server), the response echoes it and
+// adds T2 (request received) and T3 (response sent), microseconds since the
+// Unix epoch. The server listens on the same port number as the TCP service.
+//
+// With -load N -sync the load generator runs N sync clients instead, each
+// polling every -interval (1s if unset), and reports offset and delay
+// percentiles and the offset jitter. Client and server share the host clock
+// there, so the offsets measure the server's timestamping noise.
+
+import (
+	"fmt"
+	"log"
+	"math"
+	"net"
+	"sort"
+	"sync"
+	"sync/atomic"
+	"time"
+)
+
+const (
+	v2Sync     = 3
+	syncReqLen = v2Header + 8
+	syncLen    = v2Header + 24
+)
+
+var (
+	syncRequests atomic.Uint64
+	syncErrors   atomic.Uint64
+)
+
+func unixMicro(t time.Time) uint64 {
+	return uint64(t.UnixMicro())
+}
+
+func putU64(b []byte, v uint64) {
+	putU32(b, uint32(v))
+	putU32(b[4:], uint32(v>>32))
+}
+
+func getU64(b []byte) uint64 {
+	return uint64(getU32(b)) | uint64(getU32(b[4:]))<<32
+}
+
+// serveSync answers TP2_SYNC datagrams. T2 is taken as soon as the read
+// returns and T3 right before the write, so the client's delay estimate only
+// leaves out the time between the two.
+func serveSync(addr string) {
+	pc, err := net.ListenPacket("udp", addr)
+	if err != nil {
+		log.Fatal(err)
+	}
+	in := make([]byte, 512)
+	out := make([]byte, syncLen)
+	for {
+		n, from, err := pc.ReadFrom(in)
+		t2 := time.Now()
+		if err != nil {
+			log.Print(err)
+			continue
+		}
+		if n < syncReqLen || in[0] != v2Magic || in[1] != v2Version<<4|v2Sync || in[v2Len] < 8 {
+			syncErrors.Add(1)
+			continue
+		}
+
+		copy(out, in[:v2Header])
+		out[v2Len] = syncLen - v2Header
+		copy(out[v2Header:], in[v2Header:v2Header+8]) // T1
+		putU64(out[v2Header+8:], unixMicro(t2))
+		putU64(out[v2Header+16:], unixMicro(time.Now())) // T3
+		if _, err := pc.WriteTo(out, from); err != nil {
+			syncErrors.Add(1)
+			continue
+		}
+		syncRequests.Add(1)
+	}
+}
+
+// syncClient is one simulated board polling the sync service
+type syncClient struct {
+	sent, lost, stale, errors uint64
+	offsets, delays           []time.Duration
+}
+
+func (s *syncClient) run(deadline time.Time, period time.Duration) {
+	c, err := net.Dial("udp", *flagAddr)
+	if err != nil {
+		s.errors++
+		return
+	}
+	defer c.Close()
+
+	req := make([]byte, syncReqLen)
+	resp := make([]byte, 512)
+	var seq uint32
+	for time.Now().Before(deadline) {
+		next := time.Now().Add(period)
+		seq++
+		for i := range req {
+			req[i] = 0
+		}
+		req[0] = v2Magic
+		req[1] = v2Version<<4 | v2Sync
+		req[v2Len] = 8
+		putU32(req[v2Seq:], seq)
+		t1 := time.Now()
+		putU64(req[v2Header:], unixMicro(t1))
+		if _, err := c.Write(req); err != nil {
+			s.errors++
+			time.Sleep(time.Until(next))
+			continue
+		}
+		s.sent++
+
+		c.SetReadDeadline(next)
+		for {
+			n, err := c.Read(resp)
+			t4 := time.Now()
+			if err != nil {
+				s.lost++
+				break
+			}
+			if n < syncLen || resp[0] != v2Magic || resp[1] != v2Version<<4|v2Sync ||
+				getU32(resp[v2Seq:]) != seq || getU64(resp[v2Header:]) != unixMicro(t1) {
+				s.stale++ // late answer to an earlier request
+				continue
+			}
+			T1, T2 := int64(unixMicro(t1)), int64(getU64(resp[v2Header+8:]))
+			T3, T4 := int64(getU64(resp[v2Header+16:])), int64(unixMicro(t4))
+			s.offsets = append(s.offsets, time.Duration((T2-T1)+(T3-T4))*time.Microsecond/2)
+			s.delays = append(s.delays, time.Duration((T4-T1)-(T3-T2))*time.Microsecond)
+			break
+		}
+		time.Sleep(time.Until(next))
+	}
+}
+
+// runSyncLoad drives -load sync clients for -duration and prints the report
+func runSyncLoad() int {
+	period := *flagInterval
+	if period <= 0 {
+		period = time.Second
+	}
+	fmt.Printf("%d sync clients, period %v, against %s for %v\n", *flagLoad, period, *flagAddr, *flagDuration)
+
+	clients := make([]syncClient, *flagLoad)
+	deadline := time.Now().Add(*flagDuration)
+	var wg sync.WaitGroup
+	for i := range clients {
+		wg.Add(1)
+		go func(s *syncClient) {
+			defer wg.Done()
+			s.run(deadline, period)
+		}(&clients[i])
+	}
+	wg.Wait()
+
+	var total syncClient
+	for i := range clients {
+		s := &clients[i]
+		total.sent += s.sent
+		total.lost += s.lost
+		total.stale += s.stale
+		total.errors += s.errors
+		total.offsets = append(total.offsets, s.offsets...)
+		total.delays = append(total.delays, s.delays...)
+	}
+	fmt.Printf("sent %d, answered %d, lost %d, stale %d, errors %d\n",
+		total.sent, len(total.offsets), total.lost, total.stale, total.errors)
+	if len(total.offsets) == 0 {
+		return 1
+	}
+
+	var sum, sq float64
+	for _, o := range total.offsets {
+		sum += float64(o)
+		sq += float64(o) * float64(o)
+	}
+	mean := sum / float64(len(total.offsets))
+	jitter := time.Duration(math.Sqrt(sq/float64(len(total.offsets)) - mean*mean))
+
+	sort.Slice(total.offsets, func(i, j int) bool { return total.offsets[i] < total.offsets[j] })
+	sort.Slice(total.delays, func(i, j int) bool { return total.delays[i] < total.delays[j] })
+	fmt.Printf("offset p1 %v, p50 %v, p99 %v, jitter (stddev) %v\n",
+		percentile(total.offsets, 0.01), percentile(total.offsets, 0.50),
+		percentile(total.offsets, 0.99), jitter)
+	fmt.Printf("delay p50 %v, p99 %v, p999 %v\n",
+		percentile(total.delays, 0.50), percentile(total.delays, 0.99), percentile(total.delays, 0.999))
+	if total.errors > 0 {
+		return 1
+	}
+	return 0
+}